@@ -4,45 +4,757 @@
 
 #include "cmdEx/command_history.h"
 
+#include <algorithm>
+
 #include "common/util.h"
 
-CommandHistory::CommandHistory() : position_(-1) {}
+namespace {
+
+// Don't bother compacting tiny histories.
+const int kMinCompactSize = 1024;
+
+// The longest a command waits to be saved, so that others entered with it can
+// be saved together.
+const int kMaxWriteDelayMs = 50;
+
+}  // namespace
+
+CommandHistory::CommandHistory()
+    : commands_(kFirstPosition),
+      archived_before_seq_(0),
+      position_(-1),
+      deduplicate_(false),
+      live_(kFirstPosition),
+      oldest_(-1),
+      newest_(-1),
+      live_count_(0),
+      last_directory_id_(-1),
+      current_directory_(-1),
+      indexed_(false),
+      command_running_(false) {}
+
+CommandHistory::~CommandHistory() {
+  StopIndexing();
+}
+
+void CommandHistory::set_deduplicate(bool deduplicate) {
+  CHECK(commands_.empty());
+  deduplicate_ = deduplicate;
+  prefix_index_.set_newest_only(deduplicate);
+}
+
+void CommandHistory::set_directory(const wstring& directory) {
+  directory_ = directory;
+  auto found = directory_ids_.find(directory_);
+  current_directory_ = found == directory_ids_.end() ? -1 : found->second;
+  position_ = End();
+}
 
 void CommandHistory::Populate(const vector<wstring>& commands) {
-  commands_ = commands;
-  position_ = static_cast<int>(commands_.size());
+  Clear();
+  for (const auto& command : commands)
+    AddOwned(command);
+  if (!CompactIfNecessary())
+    StartIndexing();
+  position_ = End();
+}
+
+void CommandHistory::Populate(unique_ptr<HistoryFile> file) {
+  Clear();
+  file_ = move(file);
+  for (const auto& line : file_->lines())
+    AppendLine(line);
+  if (!CompactIfNecessary())
+    StartIndexing();
+  position_ = End();
+}
+
+bool CommandHistory::Populate(unique_ptr<HistoryJournal> journal) {
+  Clear();
+  vector<wstring> commands;
+  if (!journal->Load(&commands))
+    return false;
+  for (const auto& command : commands)
+    AddOwned(command);
+  archived_before_seq_ = journal->loaded_first_seq();
+  writer_.reset(new HistoryWriter(move(journal), kMaxWriteDelayMs));
+  if (!CompactIfNecessary())
+    StartIndexing();
+  position_ = End();
+  return true;
 }
 
 vector<wstring> CommandHistory::GetListForSaving() {
-  return commands_;
+  return GetListForSaving(commands_.size());
+}
+
+vector<wstring> CommandHistory::GetListForSaving(size_t max_lines) {
+  vector<wstring> result;
+  vector<int> live = GetLiveEntries(max_lines);
+  result.reserve(live.size());
+  for (const auto& i : live)
+    result.push_back(GetLineForSaving(i));
+  return result;
 }
 
 void CommandHistory::AddCommand(const wstring& command) {
-  // TODO: Maybe remove from old location so there's only one copy of it
-  // closest to the end?
-  commands_.push_back(command);
-  position_ = static_cast<int>(commands_.size());
+  wstring line = MakeHistoryLine(command, directory_);
+  if (writer_)
+    writer_->Write(line);
+  AddOwned(line);
+  CompactIfNecessary();
+  position_ = End();
+}
+
+void CommandHistory::CommandStarted(const wstring& command, int64_t time) {
+  running_command_ = CommandRecord();
+  running_command_.command = command;
+  running_command_.directory = directory_;
+  running_command_.start_time = time;
+  command_running_ = true;
+}
+
+void CommandHistory::CommandFinished(int64_t time, int exit_code) {
+  if (!command_running_)
+    return;
+  running_command_.duration_ms = time - running_command_.start_time;
+  running_command_.exit_code = exit_code;
+  records_.Add(running_command_);
+  command_running_ = false;
+}
+
+void CommandHistory::StartingEdit() {
+  if (!writer_)
+    return;
+  vector<wstring> others;
+  writer_->ReadNew(&others);
+  if (others.empty())
+    return;
+  for (const auto& other : others)
+    AddOwned(other);
+  CompactIfNecessary();
+  position_ = End();
+}
+
+bool CommandHistory::Flush() {
+  return !writer_ || writer_->Flush();
 }
 
 bool CommandHistory::MoveInHistory(int direction, const wstring& prefix, wstring* result) {
   if (commands_.empty())
     return false;
   CHECK(direction == -1 || direction == 1);
-  int original_position = position_ % commands_.size();
-  position_ += direction;
+  bool loaded = false;
   for (;;) {
-    if (position_ < 0)
-      position_ = static_cast<int>(commands_.size()) - 1;
-    if (position_ >= static_cast<int>(commands_.size()))
-      position_ = 0;
-    if (prefix.empty())
-      break;
-    if (commands_[position_].substr(0, prefix.size()) == prefix)
-      break;
-    if (position_ == original_position)
+    int end = End();
+    // Entries are visited starting one step from position_, wrapping at
+    // either end, and finishing on original_position itself.
+    int original_position = position_ == end ? First() : position_;
+    int start = Step(position_, direction);
+
+    int found = start;
+    if (!prefix.empty()) {
+      UpdateIndexes();
+      int first = commands_.first();
+      if (direction == -1) {
+        if (start >= original_position) {
+          found = FindLastPosition(prefix, original_position, start);
+        } else {
+          found = FindLastPosition(prefix, first, start);
+          if (found == -1)
+            found = FindLastPosition(prefix, original_position, end - 1);
+        }
+      } else {
+        if (start <= original_position) {
+          found = FindFirstPosition(prefix, start, original_position);
+        } else {
+          found = FindFirstPosition(prefix, start, end - 1);
+          if (found == -1)
+            found = FindFirstPosition(prefix, first, original_position);
+        }
+      }
+    }
+
+    // Going back past the oldest entry would wrap around, so look in the
+    // archive first, though only once, so that a key press doesn't page in
+    // any more than it has to.
+    bool wrapped = found == -1 || (position_ != end && found >= position_);
+    if (direction == -1 && wrapped && !loaded) {
+      loaded = LoadOlder([&prefix](const HistorySegment& segment) {
+        return prefix.empty() || segment.HasPrefix(prefix);
+      });
+      if (loaded)
+        continue;
+    }
+
+    if (found == -1) {
+      position_ = original_position;
       return false;
-    position_ += direction;
+    }
+    position_ = found;
+    *result = commands_[ToCommand(position_)].as_string();
+    return true;
   }
-  *result = commands_[position_];
+}
+
+int CommandHistory::FindSuggestion(const wstring& prefix, int before) {
+  if (prefix.empty())
+    return -1;
+  UpdateIndexes();
+  int hi = min(before, commands_.end()) - 1;
+  for (;;) {
+    int found = FindLast(prefix, commands_.first(), hi);
+    if (found == -1 || commands_[found].size() > prefix.size())
+      return found;
+    hi = found - 1;
+  }
+}
+
+void CommandHistory::FuzzySearch(const wstring& query,
+                                 size_t max_results,
+                                 vector<wstring>* results) {
+  vector<FuzzyMatch> matches;
+  WaitForIndexing();
+  searcher_.Search(commands_, query, max_results, &matches);
+  // Only the one load, as a query that hardly matches anything would
+  // otherwise page in the whole archive on a single key press. Typing on
+  // searches further back.
+  if (matches.size() < max_results &&
+      LoadOlder([&query](const HistorySegment& segment) {
+        return segment.HasFuzzyMatch(query);
+      })) {
+    WaitForIndexing();
+    searcher_.Search(commands_, query, max_results, &matches);
+  }
+  results->clear();
+  for (const auto& match : matches)
+    results->push_back(commands_[match.position].as_string());
+}
+
+void CommandHistory::WaitForIndexing() {
+  if (indexer_.joinable())
+    indexer_.join();
+  UpdateIndexes();
+}
+
+void CommandHistory::Clear() {
+  StopIndexing();
+  archived_before_seq_ = 0;
+  commands_.clear();
+  added_.Clear();
+  file_.reset();
+  writer_.reset();
+  prefix_index_.Clear();
+  searcher_.Reset();
+  links_.clear();
+  slots_.clear();
+  live_.Clear();
+  oldest_ = -1;
+  newest_ = -1;
+  live_count_ = 0;
+  directories_.clear();
+  directory_ids_.clear();
+  entry_directories_.clear();
+  last_directory_ = WStringPiece();
+  last_directory_id_ = -1;
+  current_directory_ = -1;
+}
+
+void CommandHistory::AddOwned(const wstring& line) {
+  AppendLine(added_.Add(line));
+}
+
+vector<int> CommandHistory::GetLiveEntries(size_t max_entries) {
+  vector<int> live;
+  if (deduplicate_) {
+    live.reserve(min(max_entries, static_cast<size_t>(live_count_)));
+    for (int i = newest_; i != -1 && live.size() < max_entries;
+         i = LinkAt(i).older) {
+      live.push_back(i);
+    }
+    reverse(live.begin(), live.end());
+  } else {
+    int end = commands_.end();
+    int first = end - static_cast<int>(min(max_entries, commands_.size()));
+    live.reserve(end - first);
+    for (int i = first; i < end; ++i)
+      live.push_back(i);
+  }
+  return live;
+}
+
+wstring CommandHistory::GetLineForSaving(int i) {
+  int directory = DirectoryOf(i);
+  if (directory == -1)
+    return commands_[i].as_string();
+  return MakeHistoryLine(commands_[i].as_string(),
+                         directories_[directory].name.as_string());
+}
+
+void CommandHistory::AppendLine(const WStringPiece& line) {
+  WStringPiece command;
+  WStringPiece directory;
+  SplitHistoryLine(line, &command, &directory);
+  Append(command, InternDirectory(directory));
+}
+
+int CommandHistory::InternDirectory(const WStringPiece& name) {
+  if (name.empty())
+    return -1;
+  if (last_directory_id_ != -1 && name == last_directory_)
+    return last_directory_id_;
+  auto inserted = directory_ids_.insert(
+      make_pair(name, static_cast<int>(directories_.size())));
+  if (inserted.second) {
+    directories_.push_back(Directory());
+    directories_.back().name = name;
+    directories_.back().prefix_index.set_newest_only(deduplicate_);
+    if (name == directory_)
+      current_directory_ = inserted.first->second;
+  }
+  last_directory_ = name;
+  last_directory_id_ = inserted.first->second;
+  return last_directory_id_;
+}
+
+void CommandHistory::Append(const WStringPiece& command, int directory) {
+  int position = commands_.end();
+  commands_.push_back(command);
+  entry_directories_.push_back(directory);
+  if (directory != -1) {
+    directories_[directory].positions.push_back(position);
+    directories_[directory].commands.push_back(command);
+  }
+  if (!deduplicate_)
+    return;
+
+  live_.Add();
+  if (directory != -1)
+    directories_[directory].live.Add();
+  auto inserted = slots_.insert(make_pair(command, position));
+  if (!inserted.second) {
+    // Unlink the older copy, and leave it dead.
+    int old_position = inserted.first->second;
+    if (indexes_)
+      indexes_->exclusions.push_back(old_position);
+    else
+      searcher_.Exclude(old_position);
+    live_.Kill(old_position);
+    int old_directory = DirectoryOf(old_position);
+    if (old_directory != -1) {
+      Directory& entries = directories_[old_directory];
+      entries.live.Kill(
+          entries.commands.first() +
+          static_cast<int>(lower_bound(entries.positions.begin(),
+                                       entries.positions.end(),
+                                       old_position) -
+                           entries.positions.begin()));
+    }
+    Link& old = LinkAt(old_position);
+    if (old.older != -1)
+      LinkAt(old.older).newer = old.newer;
+    else
+      oldest_ = old.newer;
+    if (old.newer != -1)
+      LinkAt(old.newer).older = old.older;
+    else
+      newest_ = old.older;
+    old.older = old.newer = kDead;
+    --live_count_;
+    inserted.first->second = position;
+  }
+
+  Link link = {newest_, -1};
+  links_.push_back(link);
+  if (newest_ != -1)
+    LinkAt(newest_).newer = position;
+  else
+    oldest_ = position;
+  newest_ = position;
+  ++live_count_;
+}
+
+bool CommandHistory::CompactIfNecessary() {
+  int size = static_cast<int>(commands_.size());
+  if (!deduplicate_ || size < kMinCompactSize || size < 2 * live_count_)
+    return false;
+  vector<pair<WStringPiece, int>> live;
+  live.reserve(live_count_);
+  for (int i = oldest_; i != -1; i = LinkAt(i).newer)
+    live.push_back(make_pair(commands_[i], DirectoryOf(i)));
+  commands_.clear();
+  searcher_.Reset();
+  links_.clear();
+  slots_.clear();
+  live_.Clear();
+  oldest_ = -1;
+  newest_ = -1;
+  live_count_ = 0;
+  // Directories keep their ids, just not their entries.
+  for (auto& directory : directories_) {
+    directory.positions.clear();
+    directory.commands.clear();
+    directory.live.Clear();
+  }
+  entry_directories_.clear();
+  for (const auto& entry : live)
+    Append(entry.first, entry.second);
+  StartIndexing();
+  return true;
+}
+
+bool CommandHistory::LoadOlder(
+    const function<bool(const HistorySegment&)>& matches) {
+  if (!archive_ || !writer_)
+    return false;
+  vector<wstring> lines;
+  int64_t first_seq;
+  if (!archive_->ReadOlder(archived_before_seq_, matches, &lines, &first_seq))
+    return false;
+  archived_before_seq_ = first_seq;
+  PrependLines(lines);
   return true;
 }
+
+void CommandHistory::PrependLines(const vector<wstring>& lines) {
+  // commands_.end() stays where it is, so of MoveInHistory() positions, only
+  // the current directory's entries past it move along, as End() does.
+  int old_end = End();
+  bool move = position_ >= commands_.end();
+  for (size_t i = lines.size(); i-- > 0;) {
+    WStringPiece command;
+    WStringPiece directory;
+    SplitHistoryLine(added_.Add(lines[i]), &command, &directory);
+    Prepend(command, InternDirectory(directory));
+  }
+  if (move)
+    position_ += End() - old_end;
+}
+
+void CommandHistory::Prepend(const WStringPiece& command, int directory) {
+  commands_.push_front(command);
+  int position = commands_.first();
+  entry_directories_.push_front(directory);
+  if (directory != -1) {
+    directories_[directory].positions.push_front(position);
+    directories_[directory].commands.push_front(command);
+  }
+  if (!deduplicate_)
+    return;
+
+  live_.AddOlder();
+  if (directory != -1)
+    directories_[directory].live.AddOlder();
+  if (!slots_.insert(make_pair(command, position)).second) {
+    // There's a newer copy, so this one's dead from the start.
+    if (indexes_)
+      indexes_->exclusions.push_back(position);
+    else
+      searcher_.Exclude(position);
+    live_.Kill(position);
+    if (directory != -1) {
+      Directory& entries = directories_[directory];
+      entries.live.Kill(entries.commands.first());
+    }
+    Link dead = {kDead, kDead};
+    links_.push_front(dead);
+    return;
+  }
+
+  Link link = {-1, oldest_};
+  links_.push_front(link);
+  if (oldest_ != -1)
+    LinkAt(oldest_).older = position;
+  else
+    newest_ = position;
+  oldest_ = position;
+  ++live_count_;
+}
+
+void CommandHistory::StartIndexing() {
+  StopIndexing();
+  prefix_index_.Clear();
+  for (auto& directory : directories_)
+    directory.prefix_index.Clear();
+  searcher_.Reset();
+  indexes_.reset(new Indexes);
+  indexes_->commands = commands_;
+  if (deduplicate_) {
+    for (int i = commands_.first(); i < commands_.end(); ++i) {
+      if (!IsLive(i))
+        indexes_->dead.push_back(i);
+    }
+  }
+  indexes_->prefix_index.set_newest_only(deduplicate_);
+  indexes_->directory_commands.reserve(directories_.size());
+  for (const auto& directory : directories_)
+    indexes_->directory_commands.push_back(directory.commands);
+  indexes_->directory_indexes.resize(directories_.size());
+  for (auto& index : indexes_->directory_indexes)
+    index.set_newest_only(deduplicate_);
+  indexed_ = false;
+  indexer_ = thread(&CommandHistory::BuildIndexes, this);
+}
+
+void CommandHistory::BuildIndexes() {
+  Indexes* indexes = indexes_.get();
+  indexes->prefix_index.Update(indexes->commands);
+  for (size_t i = 0; i < indexes->directory_commands.size(); ++i)
+    indexes->directory_indexes[i].Update(indexes->directory_commands[i]);
+  for (const auto& position : indexes->dead)
+    indexes->searcher.Exclude(position);
+  indexes->searcher.Update(indexes->commands);
+  indexed_ = true;
+}
+
+void CommandHistory::StopIndexing() {
+  if (indexer_.joinable())
+    indexer_.join();
+  indexes_.reset();
+}
+
+void CommandHistory::UpdateIndexes() {
+  if (indexes_) {
+    if (!indexed_)
+      return;
+    if (indexer_.joinable())
+      indexer_.join();
+    // Only ever added to since, at either end, as anything else restarts
+    // indexing.
+    prefix_index_ = move(indexes_->prefix_index);
+    for (size_t i = 0; i < indexes_->directory_indexes.size(); ++i)
+      directories_[i].prefix_index = move(indexes_->directory_indexes[i]);
+    searcher_ = move(indexes_->searcher);
+    for (const auto& position : indexes_->exclusions)
+      searcher_.Exclude(position);
+    indexes_.reset();
+  }
+  prefix_index_.Update(commands_);
+  if (current_directory_ != -1) {
+    Directory& current = directories_[current_directory_];
+    current.prefix_index.Update(current.commands);
+  }
+}
+
+CommandHistory::LiveFinder::LiveFinder(int origin)
+    : origin_(origin), first_(origin) {}
+
+void CommandHistory::LiveFinder::Clear() {
+  older_.clear();
+  newer_.clear();
+  first_ = origin_;
+}
+
+void CommandHistory::LiveFinder::Add() {
+  int i = first_ + static_cast<int>(older_.size());
+  older_.push_back(i);
+  newer_.push_back(i);
+}
+
+void CommandHistory::LiveFinder::AddOlder() {
+  --first_;
+  older_.push_front(first_);
+  newer_.push_front(first_);
+}
+
+void CommandHistory::LiveFinder::Kill(int i) {
+  older_[i - first_] = i - 1;
+  newer_[i - first_] = i + 1;
+}
+
+int CommandHistory::LiveFinder::Find(int i, int direction) const {
+  deque<int>& next = direction == -1 ? older_ : newer_;
+  int end = first_ + static_cast<int>(next.size());
+  int live = i;
+  while (live >= first_ && live < end && next[live - first_] != live)
+    live = next[live - first_];
+  // Point everything on the way straight at where it led.
+  while (i >= first_ && i < end && next[i - first_] != i) {
+    int following = next[i - first_];
+    next[i - first_] = live;
+    i = following;
+  }
+  return live >= first_ && live < end ? live : -1;
+}
+
+int CommandHistory::End() const {
+  if (current_directory_ == -1)
+    return commands_.end();
+  return commands_.end() +
+         static_cast<int>(directories_[current_directory_].positions.size());
+}
+
+int CommandHistory::ToCommand(int position) const {
+  if (position < commands_.end())
+    return position;
+  return directories_[current_directory_]
+      .positions[position - commands_.end()];
+}
+
+bool CommandHistory::InCurrentDirectory(int position) const {
+  return current_directory_ != -1 &&
+         DirectoryOf(position) == current_directory_;
+}
+
+int CommandHistory::SkipCurrentDirectory(int position, int direction) const {
+  const deque<int>& positions = directories_[current_directory_].positions;
+  int index = static_cast<int>(
+      lower_bound(positions.begin(), positions.end(), position) -
+      positions.begin());
+  // Positions are increasing, so position - index never decreases, and stays
+  // the same across exactly those entries that are next to each other.
+  int key = position - index;
+  int lo = direction == -1 ? 0 : index;
+  int hi = direction == -1 ? index : static_cast<int>(positions.size());
+  // Finds the first index in [lo, hi) where position - index passes |key|
+  // (going forward) or reaches it (going back).
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    int mid_key = positions[mid] - mid;
+    if (direction == -1 ? mid_key >= key : mid_key > key)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return direction == -1 ? key + lo - 1 : key + lo;
+}
+
+int CommandHistory::FindLiveElsewhere(int position, int direction) const {
+  while (position >= commands_.first() && position < commands_.end()) {
+    if (deduplicate_) {
+      position = live_.Find(position, direction);
+      if (position == -1)
+        return -1;
+    }
+    if (!InCurrentDirectory(position))
+      return position;
+    position = SkipCurrentDirectory(position, direction);
+  }
+  return -1;
+}
+
+int CommandHistory::FindLiveInDirectory(int position, int direction) const {
+  int end = commands_.end();
+  if (position < end || position >= End())
+    return -1;
+  if (!deduplicate_)
+    return position;
+  const Directory& current = directories_[current_directory_];
+  int first = current.commands.first();
+  int found = current.live.Find(first + position - end, direction);
+  return found == -1 ? -1 : end + found - first;
+}
+
+int CommandHistory::First() const {
+  int first = FindLiveElsewhere(Oldest(), 1);
+  if (first == -1)
+    first = FindLiveInDirectory(commands_.end(), 1);
+  return first;
+}
+
+int CommandHistory::Last() const {
+  int last = FindLiveInDirectory(End() - 1, -1);
+  if (last == -1)
+    last = FindLiveElsewhere(Newest(), -1);
+  return last;
+}
+
+int CommandHistory::Step(int position, int direction) const {
+  int next;
+  if (position == End()) {
+    return direction == -1 ? Last() : First();
+  } else if (position >= commands_.end()) {
+    next = FindLiveInDirectory(position + direction, direction);
+    if (next != -1)
+      return next;
+    // Going back from the oldest of the current directory's entries leads on
+    // to the rest of history.
+    if (direction == -1)
+      next = FindLiveElsewhere(Newest(), -1);
+  } else {
+    if (deduplicate_)
+      next = direction == -1 ? LinkAt(position).older : LinkAt(position).newer;
+    else
+      next = position + direction;
+    next = FindLiveElsewhere(next, direction);
+    if (next == -1 && direction == 1)
+      next = FindLiveInDirectory(commands_.end(), 1);
+  }
+  if (next != -1)
+    return next;
+  return direction == -1 ? Last() : First();
+}
+
+int CommandHistory::FindLast(const wstring& prefix, int lo, int hi) {
+  while (lo <= hi) {
+    int found = prefix_index_.FindLast(commands_, prefix, lo, hi);
+    if (found == -1 || IsLive(found))
+      return found;
+    hi = found - 1;
+  }
+  return -1;
+}
+
+int CommandHistory::FindLastPosition(const wstring& prefix, int lo, int hi) {
+  int end = commands_.end();
+  if (hi >= end) {
+    const Directory& current = directories_[current_directory_];
+    int first = current.commands.first();
+    int local_lo = first + max(lo, end) - end;
+    int local_hi = first + hi - end;
+    while (local_lo <= local_hi) {
+      int found = current.prefix_index.FindLast(
+          current.commands, prefix, local_lo, local_hi);
+      if (found == -1)
+        break;
+      if (IsLive(current.positions[found - first]))
+        return end + found - first;
+      local_hi = found - 1;
+    }
+    hi = end - 1;
+  }
+  while (lo <= hi) {
+    int found = prefix_index_.FindLast(commands_, prefix, lo, hi);
+    if (found == -1)
+      return -1;
+    if (InCurrentDirectory(found))
+      hi = SkipCurrentDirectory(found, -1);
+    else if (!IsLive(found))
+      hi = found - 1;
+    else
+      return found;
+  }
+  return -1;
+}
+
+int CommandHistory::FindFirstPosition(const wstring& prefix, int lo, int hi) {
+  int end = commands_.end();
+  int global_hi = min(hi, end - 1);
+  while (lo <= global_hi) {
+    int found = prefix_index_.FindFirst(commands_, prefix, lo, global_hi);
+    if (found == -1)
+      break;
+    if (InCurrentDirectory(found))
+      lo = SkipCurrentDirectory(found, 1);
+    else if (!IsLive(found))
+      lo = found + 1;
+    else
+      return found;
+  }
+  if (hi < end)
+    return -1;
+  const Directory& current = directories_[current_directory_];
+  int first = current.commands.first();
+  int local_lo = first + max(lo, end) - end;
+  int local_hi = first + hi - end;
+  while (local_lo <= local_hi) {
+    int found = current.prefix_index.FindFirst(
+        current.commands, prefix, local_lo, local_hi);
+    if (found == -1)
+      break;
+    if (IsLive(current.positions[found - first]))
+      return end + found - first;
+    local_lo = found + 1;
+  }
+  return -1;
+}
@@ -5,25 +5,330 @@
 #ifndef CMDEX_COMMAND_HISTORY_H_
 #define CMDEX_COMMAND_HISTORY_H_
 
+#include <atomic>
+#include <deque>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
+#include "cmdEx/entry_list.h"
+#include "cmdEx/fuzzy_match.h"
+#include "cmdEx/history_archive.h"
+#include "cmdEx/history_arena.h"
+#include "cmdEx/history_file.h"
+#include "cmdEx/history_journal.h"
+#include "cmdEx/history_records.h"
+#include "cmdEx/history_writer.h"
+#include "cmdEx/prefix_index.h"
+#include "cmdEx/string_util.h"
+
 class CommandHistory {
  public:
   CommandHistory();
+  // Waits for the indexes being built in the background, if they still are.
+  ~CommandHistory();
+
+  // In deduplicating mode, history only holds the most recent copy of each
+  // command: re-running one moves it to the newest position. Has to be set
+  // before anything is added.
+  void set_deduplicate(bool deduplicate);
+
+  // The directory commands are being entered in, which is recorded with each
+  // one that's added. MoveInHistory() goes through the ones entered here
+  // before the rest of history. Empty if it isn't known.
+  void set_directory(const wstring& directory);
 
+  // Each of |commands| is a line of history as from GetListForSaving().
   void Populate(const vector<wstring>& commands);
+  // Takes ownership of |file|. Its lines aren't copied; an entry is only
+  // copied out when it's recalled by MoveInHistory().
+  void Populate(unique_ptr<HistoryFile> file);
+  // Loads everything in |journal| and keeps it, so that commands added here
+  // are saved to it in the background (see HistoryWriter) and shared with
+  // other instances, and theirs are picked up by StartingEdit(). Returns
+  // false if it couldn't be read.
+  bool Populate(unique_ptr<HistoryJournal> journal);
+  // Where history older than |journal| has is kept (see HistoryJournal).
+  // Searches that run out of loaded history go on into it, and whatever they
+  // find is loaded, along with everything newer. Only used with a journal.
+  void set_archive(unique_ptr<HistoryArchive> archive) {
+    archive_ = move(archive);
+  }
+  // Lines as written by MakeHistoryLine(), oldest first.
   vector<wstring> GetListForSaving();
+  // The same, but only the newest |max_lines|, so that saving the end of a
+  // long history doesn't copy all of it.
+  vector<wstring> GetListForSaving(size_t max_lines);
 
   void AddCommand(const wstring& command);
 
+  // Drops all of history, but not records(), and with it the file from
+  // Populate(), which on Windows can't be replaced (by WriteHistoryFile())
+  // while it's mapped.
+  void Clear();
+
+  // Called as |command| is handed to cmd to run, and when it's done, to add
+  // its run to records(). Times are milliseconds since the Unix epoch.
+  // |exit_code| is HistoryRecords::kNoExitCode if there wasn't one.
+  // CommandFinished() does nothing if there's no command running.
+  void CommandStarted(const wstring& command, int64_t time);
+  void CommandFinished(int64_t time, int exit_code);
+  HistoryRecords* records() { return &records_; }
+
+  // Called when we resume editing again. Adds any commands other instances
+  // have entered since. Commands entered here are always in the order they
+  // were entered, so other instances' can end up after ones entered here
+  // that they were before in the journal.
+  void StartingEdit();
+
+  // Whether history is saved as it's added, via a HistoryJournal.
+  bool is_shared() const { return writer_ != NULL; }
+
+  // Blocks until all commands added so far are saved, when shared. Returns
+  // false if any couldn't be.
+  bool Flush();
+
+  // Moves to the next entry in |direction| (-1 older, 1 newer) that starts
+  // with |prefix|, wrapping around at either end. Returns false, leaving
+  // |result| alone, if no entry matches. Going back, the current directory's
+  // entries come first, and then the rest of history, newest first. Before
+  // wrapping, loads from the archive, but only once a call.
   bool MoveInHistory(int direction, const wstring& prefix, wstring* result);
 
+  // Returns the position of the newest entry before |before| that starts
+  // with, and is longer than, |prefix|, or -1 if there isn't one. Positions
+  // stay valid until history is next changed, other than by MoveInHistory()
+  // and FuzzySearch() loading from the archive, which only adds in front.
+  // Only looks at what's loaded, so as to be cheap enough to call on every
+  // key.
+  int FindSuggestion(const wstring& prefix, int before);
+  wstring GetEntry(int position) const {
+    return commands_[position].as_string();
+  }
+
+  // Fills |results| with up to |max_results| distinct entries that fuzzily
+  // match |query| (see FuzzyScore()), best first, with ties going to newer
+  // ones. Nothing carries over from the previous query: each call searches
+  // FuzzySearcher's tree of what's loaded, best first, and stops once it
+  // has the best. If what's loaded doesn't have enough, loads from the
+  // archive, but only once a call, so it may take a few calls to find
+  // everything.
+  void FuzzySearch(const wstring& query,
+                   size_t max_results,
+                   vector<wstring>* results);
+
+  // Blocks until the indexes for what was last loaded are built. Prefix
+  // searches don't need them to be, they're just slower until then, but
+  // FuzzySearch() waits.
+  void WaitForIndexing();
+
  private:
-  // Most recent are at the end.
-  vector<wstring> commands_;
+  // |line| is as from MakeHistoryLine().
+  void AddOwned(const wstring& line);
+  // Positions in commands_ of the newest |max_entries|, oldest first.
+  vector<int> GetLiveEntries(size_t max_entries);
+  wstring GetLineForSaving(int i);
+  void AppendLine(const WStringPiece& line);
+  void Append(const WStringPiece& command, int directory);
+  // As Append(), but before everything else, so it's dead if there's a copy
+  // already.
+  void Prepend(const WStringPiece& command, int directory);
+  // The index in directories_ for |name|, adding it if it's new, or -1 if
+  // it's empty. |name| has to outlive this object.
+  int InternDirectory(const WStringPiece& name);
+  // Drops the dead entries, once they outnumber the live ones. Returns
+  // whether it did, in which case the indexes are being rebuilt.
+  bool CompactIfNecessary();
+  // Loads from the archive the newest segment of what's not loaded yet for
+  // which |matches| is true, and everything after it. Returns false if
+  // there's nothing that matches.
+  bool LoadOlder(const function<bool(const HistorySegment&)>& matches);
+  // Adds |lines|, oldest first, before everything else, keeping position_ on
+  // the same entry. Nothing already loaded is renumbered, and the indexes
+  // only have to take in what's new, so this is only as slow as |lines| is
+  // long.
+  void PrependLines(const vector<wstring>& lines);
+
+  // Starts building prefix_index_, the directories' indexes and searcher_
+  // for everything in commands_ on indexer_, replacing whatever they had.
+  void StartIndexing();
+  // Runs on indexer_.
+  void BuildIndexes();
+  // Waits for indexer_, discarding what it's built.
+  void StopIndexing();
+  // Takes up what indexer_ has built, if it's finished, and brings
+  // prefix_index_ and the current directory's up to date. Until it has,
+  // they're left empty, and so searches scan. searcher_ is brought up to
+  // date by searching.
+  void UpdateIndexes();
+
+  bool IsLive(int position) const {
+    return !deduplicate_ || LinkAt(position).older != kDead;
+  }
+  int Oldest() const { return deduplicate_ ? oldest_ : commands_.first(); }
+  int Newest() const { return deduplicate_ ? newest_ : commands_.end() - 1; }
+  int DirectoryOf(int position) const {
+    return entry_directories_[position - commands_.first()];
+  }
+
+  // MoveInHistory() works in positions that run through commands_, less the
+  // current directory's entries, and then through those, so that they're
+  // what's reached first going back from End(), the position past the
+  // newest. Positions below commands_.end() are the same as in commands_.
+  int End() const;
+  int ToCommand(int position) const;
+  bool InCurrentDirectory(int position) const;
+  // The position in |direction| just past the consecutive run of the
+  // current directory's entries in commands_ that |position| is in.
+  int SkipCurrentDirectory(int position, int direction) const;
+  // The first live position in commands_ from |position| in |direction| that
+  // isn't one of the current directory's, or -1.
+  int FindLiveElsewhere(int position, int direction) const;
+  // As FindLiveElsewhere(), but for those that are, after commands_.
+  int FindLiveInDirectory(int position, int direction) const;
+  // The oldest and newest positions.
+  int First() const;
+  int Last() const;
+  // The next live position in |direction| from |position|, wrapping around.
+  int Step(int position, int direction) const;
+  // As PrefixIndex's, but skipping dead entries.
+  int FindLast(const wstring& prefix, int lo, int hi);
+  // As PrefixIndex's, but over MoveInHistory() positions.
+  int FindLastPosition(const wstring& prefix, int lo, int hi);
+  int FindFirstPosition(const wstring& prefix, int lo, int hi);
+
+  // Positions start here, and go down as older entries are loaded, so they
+  // stay clear of -1.
+  static const int kFirstPosition = 1 << 30;
+
+  // Most recent are at the end. Each points into either file_ or added_.
+  // When deduplicating, entries that have since been re-run stay here, dead,
+  // so that positions (and so prefix_index_) are only ever added to.
+  EntryList commands_;
+  // Only from Populate(unique_ptr<HistoryFile>). A journal's snapshot is
+  // copied, as it's replaced while this is running.
+  unique_ptr<HistoryFile> file_;
+  // Entries that didn't come from file_.
+  HistoryArena added_;
+  unique_ptr<HistoryWriter> writer_;
+  unique_ptr<HistoryArchive> archive_;
+  // The sequence number (see HistoryJournal) of the oldest entry loaded, so
+  // anything before it is in archive_. Only meaningful with a journal.
+  int64_t archived_before_seq_;
+  // Built on indexer_ whenever history is loaded or rearranged, so that the
+  // first prefix search doesn't wait for what can take a second or so with a
+  // lot of history, and then brought up to date by each search.
+  PrefixIndex prefix_index_;
+  // Likewise, as adding a lot of history to it takes a while.
+  FuzzySearcher searcher_;
+  // In MoveInHistory() terms.
   int position_;
+
+  // Finds the nearest live entry, past any number of dead ones, in nearly
+  // constant time: each dead entry points on towards a live one, and the
+  // pointers are shortened as they're followed, as in union-find.
+  class LiveFinder {
+   public:
+    // Entries are numbered from |origin|, as in an EntryList.
+    explicit LiveFinder(int origin);
+
+    void Clear();
+    // Adds a live entry after the others, or before them.
+    void Add();
+    void AddOlder();
+    void Kill(int i);
+    // The first live entry from |i| in |direction|, or -1 if there isn't
+    // one.
+    int Find(int i, int direction) const;
+
+   private:
+    // For each entry from first_ on, itself if it's live, or else the next
+    // to look at going older (first_ - 1 past the oldest) or newer.
+    mutable deque<int> older_;
+    mutable deque<int> newer_;
+    int origin_;
+    int first_;
+  };
+
+  bool deduplicate_;
+  // Only maintained when deduplicating. Live entries are linked oldest to
+  // newest, so stepping through history skips the dead ones in O(1), and
+  // slots_ finds the live copy of a command. live_ skips dead entries from
+  // positions that aren't live themselves, and the prefix indexes only hold
+  // the newest copy of a command in each level, so that searches don't
+  // have to step over every dead copy either.
+  static const int kDead = -2;
+  struct Link {
+    int older;  // -1 for the oldest, kDead if this entry is dead.
+    int newer;  // -1 for the newest.
+  };
+  // From commands_.first(), as are entry_directories_.
+  deque<Link> links_;
+  Link& LinkAt(int position) { return links_[position - commands_.first()]; }
+  const Link& LinkAt(int position) const {
+    return links_[position - commands_.first()];
+  }
+  unordered_map<WStringPiece, int, WStringPieceHash> slots_;
+  LiveFinder live_;
+  int oldest_;
+  int newest_;
+  int live_count_;
+
+  // Entries by the directory they were entered in.
+  struct Directory {
+    Directory() : commands(kFirstPosition), live(kFirstPosition) {}
+
+    // Points into file_ or added_.
+    WStringPiece name;
+    // Where they are in commands_, from commands.first(), and copies of them
+    // there, oldest first.
+    deque<int> positions;
+    EntryList commands;
+    // Over |commands|, so prefix searches within a directory don't have to
+    // look at anything else.
+    PrefixIndex prefix_index;
+    // Over |commands|, when deduplicating.
+    LiveFinder live;
+  };
+  vector<Directory> directories_;
+  unordered_map<WStringPiece, int, WStringPieceHash> directory_ids_;
+  // An index into directories_ for each entry in commands_, or -1.
+  deque<int> entry_directories_;
+  // The last directory interned, as lines from the same one tend to be
+  // together.
+  WStringPiece last_directory_;
+  int last_directory_id_;
+  wstring directory_;
+  // Index in directories_ of directory_, or -1 if there aren't any entries
+  // from it.
+  int current_directory_;
+
+  // What indexer_ builds, from a copy of the entries, as commands_ can be
+  // reallocated while it runs. It's only touched by indexer_ until indexed_
+  // is set.
+  struct Indexes {
+    EntryList commands;
+    PrefixIndex prefix_index;
+    vector<EntryList> directory_commands;
+    vector<PrefixIndex> directory_indexes;
+    FuzzySearcher searcher;
+    // Positions in |commands| that were dead when it was copied.
+    vector<int> dead;
+    // Entries that have died since, for |searcher| once it's taken up.
+    // indexer_ doesn't touch these.
+    vector<int> exclusions;
+  };
+  unique_ptr<Indexes> indexes_;
+  thread indexer_;
+  atomic<bool> indexed_;
+
+  HistoryRecords records_;
+  // What CommandFinished() will add, if command_running_.
+  CommandRecord running_command_;
+  bool command_running_;
 };
 
 #endif  // CMDEX_COMMAND_HISTORY_H_
@@ -3,6 +3,14 @@
 // found in the LICENSE file.
 
 #include "cmdEx/command_history.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "cmdEx/perf_timer.h"
 #include "gtest/gtest.h"
 
 TEST(CommandHistoryTest, NotFound) {
@@ -51,3 +59,488 @@ TEST(CommandHistoryTest, FoundSimpleFirst) {
   EXPECT_TRUE(ch.MoveInHistory(-1, L"a", &result));
   EXPECT_EQ(L"abc", result);
 }
+
+TEST(CommandHistoryTest, PrefixWrapsAround) {
+  CommandHistory ch;
+  vector<wstring> entries;
+  entries.push_back(L"abc");
+  entries.push_back(L"def");
+  entries.push_back(L"abd");
+  ch.Populate(entries);
+  wstring result;
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"ab", &result));
+  EXPECT_EQ(L"abd", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"ab", &result));
+  EXPECT_EQ(L"abc", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"ab", &result));
+  EXPECT_EQ(L"abd", result);
+  EXPECT_TRUE(ch.MoveInHistory(1, L"ab", &result));
+  EXPECT_EQ(L"abc", result);
+}
+
+TEST(CommandHistoryTest, OnlyMatchIsCurrent) {
+  CommandHistory ch;
+  vector<wstring> entries;
+  entries.push_back(L"abc");
+  entries.push_back(L"def");
+  ch.Populate(entries);
+  wstring result;
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"d", &result));
+  EXPECT_EQ(L"def", result);
+  // Going all the way around finds the same one again.
+  result.clear();
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"d", &result));
+  EXPECT_EQ(L"def", result);
+}
+
+namespace {
+
+// The original linear scan, to check the indexed version against. When
+// deduplicating, repeats are erased from the vector.
+class ReferenceHistory {
+ public:
+  explicit ReferenceHistory(const vector<wstring>& commands,
+                            bool deduplicate = false)
+      : deduplicate_(deduplicate) {
+    for (const auto& command : commands)
+      AddCommand(command);
+  }
+
+  void set_directory(const wstring& directory) {
+    directory_ = directory;
+    position_ = static_cast<int>(commands_.size());
+  }
+
+  void AddCommand(const wstring& command) {
+    if (deduplicate_) {
+      for (size_t i = commands_.size(); i-- > 0;) {
+        if (commands_[i] == command) {
+          commands_.erase(commands_.begin() + i);
+          directories_.erase(directories_.begin() + i);
+        }
+      }
+    }
+    commands_.push_back(command);
+    directories_.push_back(directory_);
+    position_ = static_cast<int>(commands_.size());
+  }
+
+  const vector<wstring>& commands() const { return commands_; }
+
+  bool MoveInHistory(int direction, const wstring& prefix, wstring* result) {
+    // Everything else, then the current directory's, so that those come
+    // first going back.
+    vector<wstring> ordered;
+    for (size_t i = 0; i < commands_.size(); ++i) {
+      if (directory_.empty() || directories_[i] != directory_)
+        ordered.push_back(commands_[i]);
+    }
+    for (size_t i = 0; i < commands_.size(); ++i) {
+      if (!directory_.empty() && directories_[i] == directory_)
+        ordered.push_back(commands_[i]);
+    }
+    int size = static_cast<int>(ordered.size());
+    int original_position = position_ % size;
+    position_ += direction;
+    for (;;) {
+      if (position_ < 0)
+        position_ = size - 1;
+      if (position_ >= size)
+        position_ = 0;
+      if (prefix.empty())
+        break;
+      if (ordered[position_].substr(0, prefix.size()) == prefix)
+        break;
+      if (position_ == original_position)
+        return false;
+      position_ += direction;
+    }
+    *result = ordered[position_];
+    return true;
+  }
+
+ private:
+  bool deduplicate_;
+  vector<wstring> commands_;
+  vector<wstring> directories_;
+  wstring directory_;
+  int position_;
+};
+
+// Random commands of up to |max_length| of x, y and z.
+wstring RandomCommand(int max_length) {
+  wstring command;
+  for (int j = rand() % max_length; j >= 0; --j)
+    command.push_back(L"xyz"[rand() % 3]);
+  return command;
+}
+
+}  // namespace
+
+TEST(CommandHistoryTest, MatchesLinearScan) {
+  srand(4321);
+  vector<wstring> entries;
+  for (int i = 0; i < 500; ++i)
+    entries.push_back(RandomCommand(4));
+  CommandHistory ch;
+  ch.Populate(entries);
+  ReferenceHistory reference(entries);
+  for (int i = 0; i < 5000; ++i) {
+    if (rand() % 50 == 0) {
+      wstring command(1, L"xyz"[rand() % 3]);
+      ch.AddCommand(command);
+      reference.AddCommand(command);
+      continue;
+    }
+    int direction = rand() % 2 ? 1 : -1;
+    wstring prefix;
+    for (int j = rand() % 4; j > 0; --j)
+      prefix.push_back(L"xyz"[rand() % 3]);
+    wstring expected, actual;
+    EXPECT_EQ(reference.MoveInHistory(direction, prefix, &expected),
+              ch.MoveInHistory(direction, prefix, &actual));
+    EXPECT_EQ(expected, actual);
+  }
+}
+
+TEST(CommandHistoryTest, GetNewestForSaving) {
+  vector<wstring> entries;
+  entries.push_back(L"abc");
+  entries.push_back(L"def");
+  entries.push_back(L"abc");
+  entries.push_back(L"ghi");
+  CommandHistory ch;
+  ch.Populate(entries);
+  vector<wstring> expected;
+  expected.push_back(L"abc");
+  expected.push_back(L"ghi");
+  EXPECT_EQ(expected, ch.GetListForSaving(2));
+  EXPECT_EQ(entries, ch.GetListForSaving(10));
+  EXPECT_TRUE(ch.GetListForSaving(0).empty());
+
+  CommandHistory deduplicated;
+  deduplicated.set_deduplicate(true);
+  deduplicated.Populate(entries);
+  deduplicated.AddCommand(L"def");
+  expected.clear();
+  expected.push_back(L"ghi");
+  expected.push_back(L"def");
+  EXPECT_EQ(expected, deduplicated.GetListForSaving(2));
+  expected.insert(expected.begin(), L"abc");
+  EXPECT_EQ(expected, deduplicated.GetListForSaving(10));
+}
+
+TEST(CommandHistoryTest, Deduplicate) {
+  CommandHistory ch;
+  ch.set_deduplicate(true);
+  vector<wstring> entries;
+  entries.push_back(L"abc");
+  entries.push_back(L"def");
+  entries.push_back(L"abc");
+  entries.push_back(L"ghi");
+  ch.Populate(entries);
+  ch.AddCommand(L"def");
+  vector<wstring> expected;
+  expected.push_back(L"abc");
+  expected.push_back(L"ghi");
+  expected.push_back(L"def");
+  EXPECT_EQ(expected, ch.GetListForSaving());
+
+  wstring result;
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"def", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"ghi", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"abc", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"def", result);
+  EXPECT_TRUE(ch.MoveInHistory(1, L"", &result));
+  EXPECT_EQ(L"abc", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"d", &result));
+  EXPECT_EQ(L"def", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"d", &result));
+  EXPECT_EQ(L"def", result);
+}
+
+TEST(CommandHistoryTest, DeduplicatedMatchesLinearScan) {
+  srand(5678);
+  vector<wstring> entries;
+  for (int i = 0; i < 3000; ++i)
+    entries.push_back(RandomCommand(6));
+  CommandHistory ch;
+  ch.set_deduplicate(true);
+  ch.Populate(entries);
+  ReferenceHistory reference(entries, true);
+  EXPECT_EQ(reference.commands(), ch.GetListForSaving());
+  for (int i = 0; i < 20000; ++i) {
+    // Lots of re-running, so that it compacts a few times.
+    if (rand() % 3 == 0) {
+      wstring command = RandomCommand(6);
+      ch.AddCommand(command);
+      reference.AddCommand(command);
+      continue;
+    }
+    int direction = rand() % 2 ? 1 : -1;
+    wstring prefix;
+    for (int j = rand() % 4; j > 0; --j)
+      prefix.push_back(L"xyz"[rand() % 3]);
+    wstring expected, actual;
+    ASSERT_EQ(reference.MoveInHistory(direction, prefix, &expected),
+              ch.MoveInHistory(direction, prefix, &actual));
+    ASSERT_EQ(expected, actual);
+  }
+  EXPECT_EQ(reference.commands(), ch.GetListForSaving());
+}
+
+TEST(CommandHistoryTest, PrefersCurrentDirectory) {
+  CommandHistory ch;
+  ch.set_directory(L"c:\\src");
+  ch.AddCommand(L"ninja");
+  ch.set_directory(L"c:\\");
+  ch.AddCommand(L"dir");
+  ch.set_directory(L"c:\\src");
+  ch.AddCommand(L"git status");
+  ch.set_directory(L"c:\\");
+  ch.AddCommand(L"cd src");
+
+  // Back to c:\src, which was where "git status" and "ninja" were run.
+  ch.set_directory(L"c:\\src");
+  wstring result;
+  const wchar_t* kExpected[] = {
+    L"git status", L"ninja", L"cd src", L"dir", L"git status",
+  };
+  for (const auto& expected : kExpected) {
+    EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+    EXPECT_EQ(expected, result);
+  }
+  EXPECT_TRUE(ch.MoveInHistory(1, L"", &result));
+  EXPECT_EQ(L"dir", result);
+  EXPECT_TRUE(ch.MoveInHistory(1, L"", &result));
+  EXPECT_EQ(L"cd src", result);
+
+  // Prefixes too.
+  ch.AddCommand(L"git diff");
+  ch.set_directory(L"c:\\");
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"git", &result));
+  EXPECT_EQ(L"git diff", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"git", &result));
+  EXPECT_EQ(L"git status", result);
+
+  // Directories are kept in what's saved.
+  vector<wstring> saved = ch.GetListForSaving();
+  CommandHistory loaded;
+  loaded.Populate(saved);
+  loaded.set_directory(L"c:\\");
+  EXPECT_TRUE(loaded.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"cd src", result);
+  EXPECT_EQ(saved, loaded.GetListForSaving());
+}
+
+TEST(CommandHistoryTest, DirectoriesMatchLinearScan) {
+  const wchar_t* kDirectories[] = {L"", L"c:\\a", L"c:\\b", L"c:\\c"};
+  for (int deduplicate = 0; deduplicate < 2; ++deduplicate) {
+    srand(2468);
+    CommandHistory ch;
+    ch.set_deduplicate(deduplicate != 0);
+    ReferenceHistory reference(vector<wstring>(), deduplicate != 0);
+    for (int i = 0; i < 8000; ++i) {
+      int action = rand() % 10;
+      if (action == 0) {
+        wstring directory = kDirectories[rand() % 4];
+        ch.set_directory(directory);
+        reference.set_directory(directory);
+      } else if (action < 4 || reference.commands().empty()) {
+        wstring command = RandomCommand(6);
+        ch.AddCommand(command);
+        reference.AddCommand(command);
+      } else {
+        int direction = rand() % 2 ? 1 : -1;
+        wstring prefix;
+        for (int j = rand() % 3; j > 0; --j)
+          prefix.push_back(L"xyz"[rand() % 3]);
+        wstring expected, actual;
+        ASSERT_EQ(reference.MoveInHistory(direction, prefix, &expected),
+                  ch.MoveInHistory(direction, prefix, &actual));
+        ASSERT_EQ(expected, actual);
+      }
+    }
+    EXPECT_EQ(reference.commands().size(), ch.GetListForSaving().size());
+  }
+}
+
+TEST(CommandHistoryTest, FindSuggestion) {
+  CommandHistory ch;
+  ch.set_deduplicate(true);
+  EXPECT_EQ(-1, ch.FindSuggestion(L"git", INT_MAX));
+  vector<wstring> entries;
+  entries.push_back(L"git status");
+  entries.push_back(L"git");
+  entries.push_back(L"git diff");
+  entries.push_back(L"ninja");
+  entries.push_back(L"git");
+  ch.Populate(entries);
+
+  int found = ch.FindSuggestion(L"git", INT_MAX);
+  ASSERT_NE(-1, found);
+  EXPECT_EQ(L"git diff", ch.GetEntry(found));
+  found = ch.FindSuggestion(L"git", found);
+  ASSERT_NE(-1, found);
+  EXPECT_EQ(L"git status", ch.GetEntry(found));
+  EXPECT_EQ(-1, ch.FindSuggestion(L"git", found));
+  EXPECT_EQ(-1, ch.FindSuggestion(L"", INT_MAX));
+  EXPECT_EQ(-1, ch.FindSuggestion(L"ninja", INT_MAX));
+
+  // Not the dead copy.
+  ch.AddCommand(L"git diff");
+  ch.AddCommand(L"dir");
+  found = ch.FindSuggestion(L"git d", INT_MAX);
+  EXPECT_EQ(L"git diff", ch.GetEntry(found));
+  EXPECT_EQ(-1, ch.FindSuggestion(L"git d", found));
+}
+
+TEST(CommandHistoryTest, DISABLED_PerfDeduplicate1M) {
+  const int kEntries = 1000000;
+  CommandHistory ch;
+  ch.set_deduplicate(true);
+  wstring result;
+  // Re-running an old command should cost the same however big history is.
+  const int kBatch = 100000;
+  PerfTimer timer;
+  for (int i = 0; i < kEntries; ++i) {
+    ch.AddCommand(L"cd c:\\src\\project" + to_wstring(i));
+    if ((i + 1) % kBatch == 0) {
+      double add_ms = timer.ElapsedMs();
+      timer.Restart();
+      for (int j = 0; j < kBatch; ++j)
+        ch.AddCommand(L"cd c:\\src\\project" + to_wstring(j * 7919LL % i));
+      printf("%7d entries: add %.3fus/command, re-run %.3fus/command\n",
+             i + 1,
+             add_ms * 1000 / kBatch,
+             timer.ElapsedMs() * 1000 / kBatch);
+      timer.Restart();
+    }
+  }
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(static_cast<size_t>(kEntries), ch.GetListForSaving().size());
+
+  // Searching back past a command re-run over and over shouldn't cost more
+  // for each time it was. Short of compacting, history's left with 100000
+  // dead copies of "git status", all of which the second search looks past
+  // for an older match.
+  for (int i = 0; i < 100000; ++i) {
+    ch.AddCommand(L"git status");
+    ch.AddCommand(L"cd c:\\src\\project" + to_wstring(i));
+  }
+  ch.WaitForIndexing();
+  const int kSearches = 1000;
+  timer.Restart();
+  for (int i = 0; i < kSearches; ++i) {
+    EXPECT_TRUE(ch.MoveInHistory(-1, L"git", &result));
+    EXPECT_EQ(L"git status", result);
+  }
+  double search_us = timer.ElapsedMs() * 1000 / kSearches;
+  printf("past repeats: %.3fus/search\n", search_us);
+  if (kCheckPerfBudgets) {
+    EXPECT_GT(50.0, search_us);
+  }
+}
+
+TEST(CommandHistoryTest, DISABLED_PerfPrefixSearch1M) {
+  const wchar_t* kCommands[] = {
+    L"git checkout ", L"ninja -C out\\Release ", L"cd c:\\src\\chrome\\",
+    L"python build\\run.py ", L"git rebase -i origin/",
+  };
+  const int kEntries = 1000000;
+  vector<wstring> entries;
+  entries.reserve(kEntries);
+  for (int i = 0; i < kEntries; ++i) {
+    entries.push_back(kCommands[i % (sizeof(kCommands) / sizeof(kCommands[0]))] +
+                      to_wstring(i * 7919LL % kEntries));
+  }
+  CommandHistory ch;
+  PerfTimer timer;
+  ch.Populate(entries);
+  printf("populate: %.1fms\n", timer.ElapsedMs());
+  wstring result;
+
+  // The index is still being built, so these scan, a miss all of history.
+  timer.Restart();
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"git checkout 1", &result));
+  EXPECT_FALSE(ch.MoveInHistory(-1, L"not there", &result));
+  double first_ms = timer.ElapsedMs();
+  printf("first searches, while indexing: %.2fms\n", first_ms);
+  // A scan is tens of milliseconds, and nothing waits for the index.
+  if (kCheckPerfBudgets) {
+    EXPECT_GT(100.0, first_ms);
+  }
+  timer.Restart();
+  ch.WaitForIndexing();
+  printf("rest of indexing: %.1fms\n", timer.ElapsedMs());
+
+  const int kQueries = 10000;
+  timer.Restart();
+  for (int i = 0; i < kQueries; ++i)
+    ch.MoveInHistory(i % 3 ? -1 : 1, L"ninja -C out\\Release 12", &result);
+  double hit_us = timer.ElapsedMs() * 1000 / kQueries;
+  printf("hit: %.2fus/search\n", hit_us);
+
+  timer.Restart();
+  for (int i = 0; i < kQueries; ++i)
+    EXPECT_FALSE(ch.MoveInHistory(-1, L"not there", &result));
+  double miss_us = timer.ElapsedMs() * 1000 / kQueries;
+  printf("miss: %.2fus/search\n", miss_us);
+  if (kCheckPerfBudgets) {
+    EXPECT_GT(20.0, hit_us);
+    EXPECT_GT(20.0, miss_us);
+  }
+
+  timer.Restart();
+  for (int i = 0; i < kQueries; ++i) {
+    ch.AddCommand(L"git status");
+    ch.MoveInHistory(-1, L"git checkout 9", &result);
+  }
+  printf("add+search: %.2fus/iteration\n", timer.ElapsedMs() * 1000 / kQueries);
+}
+
+TEST(CommandHistoryTest, DISABLED_PerfDirectories2M) {
+  const int kEntries = 2000000;
+  const int kDirectories = 1000;
+  vector<wstring> lines;
+  lines.reserve(kEntries);
+  for (int i = 0; i < kEntries; ++i) {
+    // Runs of a few commands in each directory, as when working somewhere
+    // for a while.
+    int directory = (i / 8) * 7919 % kDirectories;
+    lines.push_back(MakeHistoryLine(
+        L"ninja -C out\\Release target" + to_wstring(i % 5000),
+        L"c:\\src\\project" + to_wstring(directory)));
+  }
+  CommandHistory ch;
+  PerfTimer timer;
+  ch.Populate(lines);
+  printf("populate: %.1fms\n", timer.ElapsedMs());
+  wstring result;
+  timer.Restart();
+  ch.MoveInHistory(-1, L"ninja", &result);
+  printf("first prefix search, while indexing: %.1fms\n", timer.ElapsedMs());
+  ch.WaitForIndexing();
+
+  double worst = 0;
+  double total = 0;
+  int moves = 0;
+  for (int directory = 0; directory < 20; ++directory) {
+    ch.set_directory(L"c:\\src\\project" + to_wstring(directory * 37));
+    for (int i = 0; i < 100; ++i) {
+      timer.Restart();
+      // Enough to leave the directory's entries for the rest of history.
+      ch.MoveInHistory(-1, L"", &result);
+      ch.MoveInHistory(-1, L"ninja -C out\\Release target12", &result);
+      double ms = timer.ElapsedMs();
+      worst = max(worst, ms);
+      total += ms;
+      ++moves;
+    }
+  }
+  printf("per move: worst %.4fms, average %.4fms\n", worst, total / moves);
+}
@@ -0,0 +1,103 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completer_registry.h"
+
+#include <wctype.h>
+
+#include "common/util.h"
+
+namespace {
+
+wstring ToLower(const wstring& str) {
+  wstring result(str);
+  for (auto& ch : result)
+    ch = static_cast<wchar_t>(towlower(ch));
+  return result;
+}
+
+}  // namespace
+
+void CompleterRegistry::RegisterForCommand(const wstring& command,
+                                           Completer completer) {
+  CHECK(!command.empty());
+  by_command_[ToLower(command)].push_back(completer);
+}
+
+void CompleterRegistry::RegisterForWord(int word_index, Completer completer) {
+  CHECK(word_index >= 0);
+  if (by_word_.size() <= static_cast<size_t>(word_index))
+    by_word_.resize(word_index + 1);
+  by_word_[word_index].push_back(completer);
+}
+
+void CompleterRegistry::RegisterFallback(Completer completer) {
+  fallbacks_.push_back(completer);
+}
+
+void CompleterRegistry::MergeResultsForWord(int word_index) {
+  CHECK(word_index >= 0);
+  if (merge_words_.size() <= static_cast<size_t>(word_index))
+    merge_words_.resize(word_index + 1);
+  merge_words_[word_index] = true;
+}
+
+bool CompleterRegistry::MergesResults(const CompleterInput& input) const {
+  return input.word_index >= 0 &&
+         static_cast<size_t>(input.word_index) < merge_words_.size() &&
+         merge_words_[input.word_index];
+}
+
+void CompleterRegistry::GetCompleters(const CompleterInput& input,
+                                      vector<Completer>* completers) const {
+  completers->clear();
+  if (input.word_index > 0 && !input.word_data.empty() &&
+      !by_command_.empty()) {
+    auto it = by_command_.find(ToLower(input.word_data[0].deescaped_word));
+    if (it != by_command_.end()) {
+      completers->insert(
+          completers->end(), it->second.begin(), it->second.end());
+    }
+  }
+  if (input.word_index >= 0 &&
+      static_cast<size_t>(input.word_index) < by_word_.size()) {
+    const vector<Completer>& for_word = by_word_[input.word_index];
+    completers->insert(completers->end(), for_word.begin(), for_word.end());
+  }
+  completers->insert(completers->end(), fallbacks_.begin(), fallbacks_.end());
+}
+
+bool CompleterRegistry::Complete(const CompleterInput& input,
+                                 CompleterOutput* output) const {
+  vector<Completer> completers;
+  GetCompleters(input, &completers);
+  if (!MergesResults(input)) {
+    for (const auto& completer : completers) {
+      output->Reset();
+      if (completer(input, output))
+        return true;
+    }
+    return false;
+  }
+
+  bool completed = false;
+  vector<vector<wstring>> streams;
+  vector<vector<int>> scores;
+  output->Reset();
+  for (const auto& completer : completers) {
+    CompleterOutput part;
+    if (!completer(input, &part))
+      continue;
+    completed = true;
+    // Only ones that all want a space after them get one.
+    output->trailing_space = output->trailing_space && part.trailing_space;
+    // Ranked ones are already in the order they're wanted in.
+    if (part.scores.empty())
+      SortCompletions(&part.results);
+    streams.push_back(move(part.results));
+    scores.push_back(move(part.scores));
+  }
+  MergeCompletions(&streams, scores, &output->results, &output->scores);
+  return completed;
+}
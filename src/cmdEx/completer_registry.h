@@ -0,0 +1,59 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_COMPLETER_REGISTRY_H_
+#define CMDEX_COMPLETER_REGISTRY_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/completion.h"
+
+// Which completers to try for a line, and in what order. Rather than every
+// completer being asked in turn and checking the command itself, those for
+// a command are looked up by the line's first word (ignoring case, as cmd
+// does), and only tried for the words after it. Those are followed by the
+// ones for the position of the word being completed, and then the
+// fallbacks. Within each, they're tried in the order they were registered.
+//
+// The first to complete is used, unless the word's position has been set to
+// merge results, in which case all of them are run and their results are
+// merged (see MergeCompletions()), with that order deciding between
+// duplicates, and between results that were fuzzy matched equally well.
+class CompleterRegistry {
+ public:
+  // For the arguments of |command|.
+  void RegisterForCommand(const wstring& command, Completer completer);
+  // For the |word_index|th word, whatever the command is.
+  void RegisterForWord(int word_index, Completer completer);
+  // For anything that nothing more specific completes.
+  void RegisterFallback(Completer completer);
+
+  // Merges the results of all the completers for the |word_index|th word,
+  // e.g. so that the first word completes to both commands and files.
+  void MergeResultsForWord(int word_index);
+  bool MergesResults(const CompleterInput& input) const;
+
+  // Fills |completers| with the ones to try for |input|, in order.
+  void GetCompleters(const CompleterInput& input,
+                     vector<Completer>* completers) const;
+
+  // Tries the completers for |input| until one returns true, resetting
+  // |output| before each, or when merging, runs them all and merges the
+  // results of those that return true. Returns whether one did.
+  bool Complete(const CompleterInput& input, CompleterOutput* output) const;
+
+ private:
+  // Keyed by lower case command.
+  unordered_map<wstring, vector<Completer>> by_command_;
+  // Indexed by word index.
+  vector<vector<Completer>> by_word_;
+  vector<Completer> fallbacks_;
+  // Indexed by word index.
+  vector<bool> merge_words_;
+};
+
+#endif  // CMDEX_COMPLETER_REGISTRY_H_
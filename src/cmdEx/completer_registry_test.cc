@@ -0,0 +1,173 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completer_registry.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+bool GitCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"git");
+  return input.word_data[1].deescaped_word == L"co";
+}
+
+bool OtherGitCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"other git");
+  return true;
+}
+
+bool CommandCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"command");
+  return true;
+}
+
+bool FallbackCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"fallback");
+  return true;
+}
+
+CompleterInput MakeInput(const wchar_t* line, int word_index) {
+  CompleterInput input;
+  CompletionBreakIntoWords(line, &input.word_data);
+  input.word_index = word_index;
+  input.position_in_word = 0;
+  return input;
+}
+
+vector<Completer> GetCompleters(const CompleterRegistry& registry,
+                                const wchar_t* line,
+                                int word_index) {
+  vector<Completer> completers;
+  registry.GetCompleters(MakeInput(line, word_index), &completers);
+  return completers;
+}
+
+TEST(CompleterRegistryTest, Order) {
+  CompleterRegistry registry;
+  registry.RegisterFallback(FallbackCompleter);
+  registry.RegisterForWord(0, CommandCompleter);
+  registry.RegisterForCommand(L"git", GitCompleter);
+  registry.RegisterForCommand(L"Git", OtherGitCompleter);
+
+  vector<Completer> completers = GetCompleters(registry, L"gi", 0);
+  ASSERT_EQ(2u, completers.size());
+  EXPECT_EQ(CommandCompleter, completers[0]);
+  EXPECT_EQ(FallbackCompleter, completers[1]);
+
+  // Command ones come first, in the order registered, whatever the case.
+  completers = GetCompleters(registry, L"GIT co", 1);
+  ASSERT_EQ(3u, completers.size());
+  EXPECT_EQ(GitCompleter, completers[0]);
+  EXPECT_EQ(OtherGitCompleter, completers[1]);
+  EXPECT_EQ(FallbackCompleter, completers[2]);
+
+  // But only for the words after the command.
+  completers = GetCompleters(registry, L"git co", 0);
+  ASSERT_EQ(2u, completers.size());
+  EXPECT_EQ(CommandCompleter, completers[0]);
+
+  completers = GetCompleters(registry, L"ninja all", 1);
+  ASSERT_EQ(1u, completers.size());
+  EXPECT_EQ(FallbackCompleter, completers[0]);
+}
+
+TEST(CompleterRegistryTest, Complete) {
+  CompleterRegistry registry;
+  CompleterOutput output;
+  EXPECT_FALSE(registry.Complete(MakeInput(L"git co", 1), &output));
+
+  registry.RegisterForCommand(L"git", GitCompleter);
+  registry.RegisterFallback(FallbackCompleter);
+  ASSERT_TRUE(registry.Complete(MakeInput(L"git co", 1), &output));
+  ASSERT_EQ(1u, output.results.size());
+  EXPECT_EQ(L"git", output.results[0]);
+
+  // What a completer that doesn't complete added is thrown away.
+  output.trailing_space = false;
+  ASSERT_TRUE(registry.Complete(MakeInput(L"git x", 1), &output));
+  ASSERT_EQ(1u, output.results.size());
+  EXPECT_EQ(L"fallback", output.results[0]);
+  EXPECT_TRUE(output.trailing_space);
+}
+
+bool CommandsCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"notepad");
+  output->results.push_back(L"cmd");
+  return true;
+}
+
+bool FilesCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"out");
+  output->results.push_back(L"CMD");
+  output->trailing_space = false;
+  return true;
+}
+
+bool NothingCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"nothing");
+  return false;
+}
+
+bool RankedCommandsCompleter(const CompleterInput& input,
+                             CompleterOutput* output) {
+  AddCompletions(PackedCandidates(vector<wstring>{L"notepad", L"cl", L"cmd"}),
+                 input.word_data[0].deescaped_word,
+                 input.fuzzy,
+                 output);
+  return true;
+}
+
+TEST(CompleterRegistryTest, Merge) {
+  CompleterRegistry registry;
+  registry.RegisterForWord(0, NothingCompleter);
+  registry.RegisterForWord(0, CommandsCompleter);
+  registry.RegisterFallback(FilesCompleter);
+  registry.MergeResultsForWord(0);
+  EXPECT_TRUE(registry.MergesResults(MakeInput(L"x", 0)));
+  EXPECT_FALSE(registry.MergesResults(MakeInput(L"x y", 1)));
+
+  CompleterOutput output;
+  ASSERT_TRUE(registry.Complete(MakeInput(L"", 0), &output));
+  ASSERT_EQ(3u, output.results.size());
+  EXPECT_EQ(L"cmd", output.results[0]);
+  EXPECT_EQ(L"notepad", output.results[1]);
+  EXPECT_EQ(L"out", output.results[2]);
+  EXPECT_FALSE(output.trailing_space);
+
+  // Only the first for the rest.
+  ASSERT_TRUE(registry.Complete(MakeInput(L"x ", 1), &output));
+  ASSERT_EQ(2u, output.results.size());
+  EXPECT_EQ(L"out", output.results[0]);
+}
+
+TEST(CompleterRegistryTest, MergeRanked) {
+  CompleterRegistry registry;
+  registry.RegisterForWord(0, RankedCommandsCompleter);
+  registry.RegisterFallback(FilesCompleter);
+  registry.MergeResultsForWord(0);
+
+  CompleterInput input = MakeInput(L"cd", 0);
+  input.fuzzy = true;
+  CompleterOutput output;
+  ASSERT_TRUE(registry.Complete(input, &output));
+  // What was ranked first, and then the rest (but not "CMD" again).
+  ASSERT_EQ(2u, output.results.size());
+  EXPECT_EQ(L"cmd", output.results[0]);
+  EXPECT_EQ(L"out", output.results[1]);
+  ASSERT_EQ(2u, output.scores.size());
+  EXPECT_LT(0, output.scores[0]);
+  EXPECT_EQ(0, output.scores[1]);
+
+  // Not fuzzy, it's sorted, as always.
+  input = MakeInput(L"c", 0);
+  ASSERT_TRUE(registry.Complete(input, &output));
+  ASSERT_EQ(3u, output.results.size());
+  EXPECT_EQ(L"cl", output.results[0]);
+  EXPECT_EQ(L"cmd", output.results[1]);
+  EXPECT_EQ(L"out", output.results[2]);
+  EXPECT_TRUE(output.scores.empty());
+}
+
+}  // namespace
@@ -4,33 +4,22 @@
 
 #include "cmdEx/completion.h"
 
-#include <windows.h>
+#include <wctype.h>
 
-#include "common/util.h"
+#include <algorithm>
+#include <set>
 
-#pragma comment(lib, "shell32.lib")
+#include "cmdEx/fuzzy_match.h"
 
-static void CopyArg(const wchar_t* line_start,
-                    const wchar_t* arg_start,
-                    const wchar_t* arg_end,
-                    vector<WordData>* word_data) {
-  WordData wd;
-  wd.original_offset = static_cast<int>(arg_start - line_start);
-  wd.original_word.reserve(arg_end - arg_start);
-  for (const wchar_t* i = arg_start; i != arg_end; ++i)
-    wd.original_word.push_back(*i);
-  word_data->push_back(wd);
-}
+namespace {
 
-static void SkipWhitespace(const wchar_t** p) {
-  while (**p == L' ' || **p == L'\t')
-    ++(*p);
+bool IsSpace(wchar_t c) {
+  return c == L' ' || c == L'\t';
 }
-// We want to use CommandLineToArgvW here, but we need to be able to say in
-// which word and offset the given |position| in source falls into, and we
-// don't want to de-escape anything for completion. So, we need to reimplement
-// the somewhat subtle and complex splitting behaviour of CommandLineToArgvW
-// for quote escaping and quote doubling:
+
+// This reimplements the somewhat subtle and complex splitting behaviour of
+// CommandLineToArgvW (as Wine does it), because we need to know where each
+// word is in the line, as well as what it de-escapes to:
 // - " groups over space and tab
 // - \" -> "
 // - multiple \ before a quote (only; otherwise backslashes aren't magic):
@@ -40,101 +29,365 @@ static void SkipWhitespace(const wchar_t** p) {
 //   3n -> n
 //   3n+1 -> n, and close string
 //   3n+2 -> n+1 and close string
+// Nothing carries over from one word to the next, so each can be lexed on
+// its own, given where it starts.
 
-void CompletionBreakIntoWords(const wstring& line,
-                              vector<WordData>* word_data) {
-  if (line.empty()) {
-    // See comment about appending empty arg at end of function.
-    CopyArg(NULL, NULL, NULL, word_data);
-    return;
-  }
-
-  const wchar_t* p = line.c_str();
-  const wchar_t* line_start = p;
-  const wchar_t* arg_start = p;
-  // The executable gets special rules per CreateProcess docs: no quote
-  // escaping if it's quoted, and no space escaping if it's not.
-  if (*p == L'"') {
+// The executable gets special rules per CreateProcess docs: no quote
+// escaping if it's quoted, and no space escaping if it's not. It always
+// starts at the start of the line.
+CommandLineToken LexExecutable(const wchar_t* line,
+                               const wchar_t* end,
+                               wstring* deescaped) {
+  CommandLineToken token;
+  token.original_offset = 0;
+  token.deescaped_offset = static_cast<int>(deescaped->size());
+  const wchar_t* p = line;
+  if (p != end && *p == L'"') {
     ++p;
-    while (*p)
-      if (*p++ == L'"')
-        break;
-  } else {
-    while (*p && *p != L' ' && *p != L'\t')
+    while (p != end && *p != L'"')
+      deescaped->push_back(*p++);
+    if (p != end)
       ++p;
+  } else {
+    while (p != end && !IsSpace(*p))
+      deescaped->push_back(*p++);
   }
-  CopyArg(line_start, arg_start, p, word_data);
-
-  // Skip to the first argument.
-  SkipWhitespace(&p);
-  arg_start = p;
+  token.original_length = static_cast<int>(p - line);
+  token.deescaped_length =
+      static_cast<int>(deescaped->size()) - token.deescaped_offset;
+  return token;
+}
 
+// Lexes the argument that starts at |p|, which isn't a space, and returns
+// where it ends. Backslashes are copied as they're seen, and the ones that
+// turn out to be escapes are dropped again when a quote follows.
+const wchar_t* LexArgument(const wchar_t* p,
+                           const wchar_t* end,
+                           wstring* deescaped) {
   int num_active_quotes = 0;
-  int num_backslashes = 0;
-  while (*p) {
-    if ((*p == L' ' || *p == L'\t') && num_active_quotes == 0) {
-      // We hit a space and aren't in an active quote, skip to the next
-      // argument.
-      CopyArg(line_start, arg_start, p, word_data);
-      SkipWhitespace(&p);
-      arg_start = p;
-      num_backslashes = 0;
-    } else if (*p == L'\\') {
+  size_t num_backslashes = 0;
+  while (p != end && (!IsSpace(*p) || num_active_quotes != 0)) {
+    if (*p == L'\\') {
+      deescaped->push_back(*p++);
       ++num_backslashes;
-      ++p;
     } else if (*p == L'"') {
-      if (num_backslashes % 2 == 0)  // Unescaped quote.
+      if (num_backslashes % 2 == 0) {
+        // Unescaped quote.
+        deescaped->resize(deescaped->size() - num_backslashes / 2);
         ++num_active_quotes;
+      } else {
+        deescaped->resize(deescaped->size() - num_backslashes / 2 - 1);
+        deescaped->push_back(L'"');
+      }
       ++p;
       num_backslashes = 0;
-      while (*p == L'"') {
-        ++num_active_quotes;
+      while (p != end && *p == L'"') {
+        if (++num_active_quotes == 3) {
+          deescaped->push_back(L'"');
+          num_active_quotes = 0;
+        }
         ++p;
       }
-      num_active_quotes = num_active_quotes % 3;
       if (num_active_quotes == 2)
         num_active_quotes = 0;
     } else {
+      deescaped->push_back(*p++);
       num_backslashes = 0;
-      ++p;
     }
   }
-  if (arg_start != p)
-    CopyArg(line_start, arg_start, p, word_data);
+  return p;
+}
 
-  int num_args;
-  LPWSTR* escaped = CommandLineToArgvW(line_start, &num_args);
-  CHECK(num_args == static_cast<int>(word_data->size()));
-  for (int i = 0; i < num_args; ++i) {
-    word_data->at(i).deescaped_word = escaped[i];
+// Lexes the argument that starts at |p| onto the end of |tokens|. If
+// |after_executable|, the last of |tokens| is the executable, which it's
+// added to if it's attached and starts with \, for completing
+//   "C:\Program Files (x86)"\
+// which CommandLineToArgvW would otherwise split, unlike cmd.
+const wchar_t* LexArgumentToken(const wchar_t* line,
+                                const wchar_t* p,
+                                const wchar_t* end,
+                                bool after_executable,
+                                vector<CommandLineToken>* tokens,
+                                wstring* deescaped) {
+  int deescaped_start = static_cast<int>(deescaped->size());
+  const wchar_t* word_end = LexArgument(p, end, deescaped);
+  int deescaped_length = static_cast<int>(deescaped->size()) - deescaped_start;
+  // The executable starts at 0, so it ends at its length.
+  if (after_executable && *p == L'\\' &&
+      tokens->back().original_length == p - line) {
+    tokens->back().original_length = static_cast<int>(word_end - line);
+    tokens->back().deescaped_length += deescaped_length;
+  } else {
+    CommandLineToken token;
+    token.original_offset = static_cast<int>(p - line);
+    token.original_length = static_cast<int>(word_end - p);
+    token.deescaped_offset = deescaped_start;
+    token.deescaped_length = deescaped_length;
+    tokens->push_back(token);
+  }
+  return word_end;
+}
+
+const wchar_t* SkipSpace(const wchar_t* p, const wchar_t* end) {
+  while (p != end && IsSpace(*p))
+    ++p;
+  return p;
+}
+
+// Merges |matches| of |candidate|s, with |prepend| in front of them, with
+// what's already in |output| by score, keeping the best kMaxFuzzyResults.
+void MergeFuzzyMatches(const vector<FuzzyMatch>& matches,
+                       const function<WStringPiece(size_t)>& candidate,
+                       const wstring& prepend,
+                       CompleterOutput* output) {
+  // Anything that's already there without a score wasn't fuzzy matched, so
+  // goes after everything that was.
+  vector<wstring> existing;
+  existing.swap(output->results);
+  vector<int> existing_scores;
+  existing_scores.swap(output->scores);
+  existing_scores.resize(existing.size(), 0);
+  size_t total = min(existing.size() + matches.size(), kMaxFuzzyResults);
+  output->results.reserve(total);
+  output->scores.reserve(total);
+  size_t i = 0;
+  size_t j = 0;
+  while (output->results.size() < total) {
+    // Ties go to what was already there.
+    if (j == matches.size() ||
+        (i < existing.size() && existing_scores[i] >= matches[j].score)) {
+      output->results.push_back(move(existing[i]));
+      output->scores.push_back(existing_scores[i]);
+      ++i;
+    } else {
+      WStringPiece match = candidate(matches[j].position);
+      output->results.push_back(prepend +
+                                wstring(match.data(), match.size()));
+      output->scores.push_back(matches[j].score);
+      ++j;
+    }
+  }
+}
+
+}  // namespace
+
+void TokenizeCommandLine(const wchar_t* line,
+                         size_t size,
+                         TokenizedLine* result) {
+  result->line = line;
+  result->tokens.clear();
+  result->deescaped.clear();
+  // De-escaping never makes a word longer.
+  result->deescaped.reserve(size);
+  const wchar_t* end = line + size;
+  result->tokens.push_back(LexExecutable(line, end, &result->deescaped));
+  const wchar_t* p = line + result->tokens[0].original_length;
+  while ((p = SkipSpace(p, end)) != end) {
+    p = LexArgumentToken(line, p, end, result->tokens.size() == 1,
+                         &result->tokens, &result->deescaped);
   }
-  LocalFree(escaped);
 
   // If the cursor was spaced past the end of the last argument, add an empty
   // argument so that calling code knows we're not on any word, past the end
   // of existing arguments. Similarly if the command line is completely empty.
-  if (p - line_start >
-      static_cast<int>(word_data->at(num_args - 1).original_offset +
-                       word_data->at(num_args - 1).original_word.size())) {
-    CopyArg(line_start, p, p, word_data);
-  }
-
-  // Hack for completing
-  //   "C:\Program Files (x86)"\
-  // CommandLineToArgvW will split the trailing \ into a second argument. In
-  // order to match cmd's completion behaviour, merge an argument that's
-  // immediately attached and starts with a \ back into the one before it.
-  for (size_t i = 0; i < word_data->size() - 1; ++i) {
-    WordData* first = &word_data->at(i);
-    WordData* second = &word_data->at(i + 1);
-    if (second->original_word[0] == L'\\' &&
-        first->original_offset + first->original_word.size() ==
-            static_cast<size_t>(second->original_offset)) {
-      // Merge second onto first and remove second.
-      first->original_word += second->original_word;
-      first->deescaped_word += second->deescaped_word;
-      word_data->erase(word_data->begin() + i + 1);
+  // (The executable's word is already empty then.)
+  const CommandLineToken& last = result->tokens.back();
+  if (static_cast<int>(size) > last.original_offset + last.original_length) {
+    CommandLineToken token;
+    token.original_offset = static_cast<int>(size);
+    token.original_length = 0;
+    token.deescaped_offset = static_cast<int>(result->deescaped.size());
+    token.deescaped_length = 0;
+    result->tokens.push_back(token);
+  }
+}
+
+LineTokens::LineTokens(const wstring* line)
+    : line_(line), shift_from_(0), shift_(0), garbage_(0), lexed_count_(0) {
+  Reset();
+}
+
+void LineTokens::Reset() {
+  const wchar_t* line = line_->data();
+  const wchar_t* end = line + line_->size();
+  tokens_.clear();
+  deescaped_.clear();
+  garbage_ = 0;
+  shift_from_ = 0;
+  shift_ = 0;
+  tokens_.push_back(LexExecutable(line, end, &deescaped_));
+  const wchar_t* p = line + tokens_[0].original_length;
+  while ((p = SkipSpace(p, end)) != end) {
+    p = LexArgumentToken(line, p, end, tokens_.size() == 1, &tokens_,
+                         &deescaped_);
+  }
+  lexed_count_ += line_->size();
+}
+
+void LineTokens::Update(int offset, int removed, int inserted) {
+  const wchar_t* line = line_->data();
+  const wchar_t* end = line + line_->size();
+  int delta = inserted - removed;
+  int old_edit_end = offset + removed;
+  size_t count = tokens_.size();
+
+  // Start from the word that the edit is in (or after). The first two are
+  // always done together, in case they're joined (see LexArgumentToken()).
+  size_t lo = 1;
+  size_t hi = count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (Start(mid) <= offset)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t first = lo - 1;
+  if (first < 2)
+    first = 0;
+
+  // Lex until a word starts where one did before, after the edit. From
+  // there on, everything's the same as it was, just moved by |delta|.
+  fresh_.clear();
+  const wchar_t* p;
+  if (first == 0) {
+    fresh_.push_back(LexExecutable(line, end, &deescaped_));
+    p = line + fresh_[0].original_length;
+  } else {
+    p = line + Start(first);
+  }
+  const wchar_t* lexed_from = line + Start(first);
+  const wchar_t* lexed_to = p;
+  size_t resync = count;
+  // The executable's word is lexed differently, so it can't be picked up
+  // from.
+  size_t next = max<size_t>(first, 1);
+  while ((p = SkipSpace(p, end)) != end) {
+    int at = static_cast<int>(p - line);
+    if (first + fresh_.size() >= 2 && at >= offset + inserted) {
+      while (next < count &&
+             (Start(next) < old_edit_end || Start(next) + delta < at)) {
+        ++next;
+      }
+      if (next < count && Start(next) + delta == at) {
+        resync = next;
+        break;
+      }
     }
+    p = LexArgumentToken(line, p, end, first == 0 && fresh_.size() == 1,
+                         &fresh_, &deescaped_);
+    lexed_to = p;
+  }
+  lexed_count_ += static_cast<size_t>(lexed_to - lexed_from);
+
+  for (size_t i = first; i < resync; ++i)
+    garbage_ += tokens_[i].deescaped_length;
+
+  // The ones after are moved by |delta|, on top of any earlier edits' that
+  // are still pending, which only ever applies from one word on.
+  size_t pending_end = min(shift_from_, count);
+  if (shift_from_ < first) {
+    for (size_t i = shift_from_; i < first; ++i)
+      tokens_[i].original_offset += shift_;
+  } else if (pending_end > resync) {
+    for (size_t i = resync; i < pending_end; ++i)
+      tokens_[i].original_offset -= shift_;
+  }
+  shift_ += delta;
+
+  size_t replaced = resync - first;
+  size_t common = min(fresh_.size(), replaced);
+  copy(fresh_.begin(), fresh_.begin() + common, tokens_.begin() + first);
+  if (fresh_.size() > replaced) {
+    tokens_.insert(tokens_.begin() + first + common,
+                   fresh_.begin() + common,
+                   fresh_.end());
+  } else {
+    tokens_.erase(tokens_.begin() + first + common,
+                  tokens_.begin() + resync);
+  }
+  shift_from_ = first + fresh_.size();
+
+  if (garbage_ > kMinGarbage && garbage_ > deescaped_.size() / 2)
+    CompactDeescaped();
+}
+
+size_t LineTokens::size() const {
+  size_t last = tokens_.size() - 1;
+  bool trailing = static_cast<int>(line_->size()) >
+                  Start(last) + tokens_[last].original_length;
+  return tokens_.size() + (trailing ? 1 : 0);
+}
+
+int LineTokens::original_offset(size_t i) const {
+  return i < tokens_.size() ? Start(i) : static_cast<int>(line_->size());
+}
+
+WStringPiece LineTokens::original_word(size_t i) const {
+  if (i == tokens_.size())
+    return WStringPiece();
+  return WStringPiece(line_->data() + Start(i), tokens_[i].original_length);
+}
+
+WStringPiece LineTokens::deescaped_word(size_t i) const {
+  if (i == tokens_.size())
+    return WStringPiece();
+  return WStringPiece(deescaped_.data() + tokens_[i].deescaped_offset,
+                      tokens_[i].deescaped_length);
+}
+
+int LineTokens::WordIndex(int position) const {
+  size_t lo = 0;
+  size_t hi = size();
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (original_offset(mid) <= position)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return static_cast<int>(lo) - 1;
+}
+
+void LineTokens::GetWordData(vector<WordData>* word_data) const {
+  size_t start = word_data->size();
+  word_data->resize(start + size());
+  for (size_t i = 0; i < size(); ++i) {
+    WordData& wd = (*word_data)[start + i];
+    WStringPiece original = original_word(i);
+    WStringPiece deescaped = deescaped_word(i);
+    wd.original_word.assign(original.data(), original.size());
+    wd.original_offset = original_offset(i);
+    wd.deescaped_word.assign(deescaped.data(), deescaped.size());
+  }
+}
+
+void LineTokens::CompactDeescaped() {
+  wstring compacted;
+  compacted.reserve(deescaped_.size() - garbage_);
+  for (auto& token : tokens_) {
+    int offset = static_cast<int>(compacted.size());
+    compacted.append(deescaped_, token.deescaped_offset,
+                     token.deescaped_length);
+    token.deescaped_offset = offset;
+  }
+  deescaped_.swap(compacted);
+  garbage_ = 0;
+}
+
+void CompletionBreakIntoWords(const wstring& line,
+                              vector<WordData>* word_data) {
+  TokenizedLine tokenized;
+  TokenizeCommandLine(line.data(), line.size(), &tokenized);
+  size_t start = word_data->size();
+  word_data->resize(start + tokenized.size());
+  for (size_t i = 0; i < tokenized.size(); ++i) {
+    WordData& wd = (*word_data)[start + i];
+    WStringPiece original = tokenized.original_word(i);
+    WStringPiece deescaped = tokenized.deescaped_word(i);
+    wd.original_word.assign(original.data(), original.size());
+    wd.original_offset = tokenized.tokens[i].original_offset;
+    wd.deescaped_word.assign(deescaped.data(), deescaped.size());
   }
 }
 
@@ -185,6 +438,158 @@ wstring QuoteWord(const std::wstring& argument) {
   }
 }
 
+void FilterCompletions(const vector<wstring>& candidates,
+                       const wstring& prefix,
+                       bool ignore_case,
+                       vector<wstring>* results) {
+  for (const auto& candidate : candidates) {
+    if (candidate.size() < prefix.size())
+      continue;
+    size_t i = 0;
+    if (ignore_case) {
+      while (i < prefix.size() &&
+             towlower(candidate[i]) == towlower(prefix[i]))
+        ++i;
+    } else {
+      while (i < prefix.size() && candidate[i] == prefix[i])
+        ++i;
+    }
+    if (i == prefix.size())
+      results->push_back(candidate);
+  }
+}
+
+void AddCompletions(const PackedCandidates& candidates,
+                    const wstring& word,
+                    bool fuzzy,
+                    CompleterOutput* output) {
+  if (!fuzzy || word.empty()) {
+    FilterCompletions(candidates, word, true, &output->results);
+    return;
+  }
+  vector<FuzzyMatch> matches;
+  FindBestFuzzyMatches(candidates, word, kMaxFuzzyResults, &matches);
+  MergeFuzzyMatches(
+      matches,
+      [&candidates](size_t i) {
+        return WStringPiece(candidates.data(i), candidates.length(i));
+      },
+      wstring(),
+      output);
+}
+
+void AddFuzzyCompletions(size_t count,
+                         const function<WStringPiece(size_t)>& candidate,
+                         const wstring& query,
+                         const wstring& prepend,
+                         CompleterOutput* output) {
+  vector<FuzzyMatch> matches;
+  FindBestFuzzyMatches(count, candidate, query, kMaxFuzzyResults, &matches);
+  MergeFuzzyMatches(matches, candidate, prepend, output);
+}
+
+int CompareIgnoringCase(const wstring& a, const wstring& b) {
+  size_t size = min(a.size(), b.size());
+  for (size_t i = 0; i < size; ++i) {
+    if (a[i] != b[i]) {
+      wint_t lower_a = towlower(a[i]);
+      wint_t lower_b = towlower(b[i]);
+      if (lower_a != lower_b)
+        return lower_a < lower_b ? -1 : 1;
+    }
+  }
+  if (a.size() == b.size())
+    return 0;
+  return a.size() < b.size() ? -1 : 1;
+}
+
+void SortCompletions(vector<wstring>* results) {
+  stable_sort(results->begin(),
+              results->end(),
+              [](const wstring& a, const wstring& b) {
+                return CompareIgnoringCase(a, b) < 0;
+              });
+}
+
+void MergeCompletions(vector<vector<wstring>>* streams,
+                      vector<wstring>* merged) {
+  merged->clear();
+  size_t total = 0;
+  for (const auto& stream : *streams)
+    total += stream.size();
+  merged->reserve(total);
+  // There are only ever a few streams (one per completer), so finding the
+  // smallest head by going through them all beats keeping a heap.
+  vector<size_t> heads(streams->size(), 0);
+  for (;;) {
+    vector<wstring>* smallest = NULL;
+    size_t* smallest_head = NULL;
+    for (size_t i = 0; i < streams->size(); ++i) {
+      vector<wstring>& stream = (*streams)[i];
+      if (heads[i] == stream.size())
+        continue;
+      // Only strictly smaller, so that the earlier stream wins ties.
+      if (!smallest ||
+          CompareIgnoringCase(stream[heads[i]], (*smallest)[*smallest_head]) <
+              0) {
+        smallest = &stream;
+        smallest_head = &heads[i];
+      }
+    }
+    if (!smallest)
+      break;
+    wstring& result = (*smallest)[(*smallest_head)++];
+    if (merged->empty() || CompareIgnoringCase(merged->back(), result) != 0)
+      merged->push_back(move(result));
+  }
+}
+
+void MergeCompletions(vector<vector<wstring>>* streams,
+                      const vector<vector<int>>& scores,
+                      vector<wstring>* merged,
+                      vector<int>* merged_scores) {
+  merged_scores->clear();
+  bool ranked = false;
+  for (const auto& stream_scores : scores)
+    ranked = ranked || !stream_scores.empty();
+  if (!ranked) {
+    MergeCompletions(streams, merged);
+    return;
+  }
+
+  // Streams that weren't ranked score nothing, and come last.
+  struct Entry {
+    int score;
+    size_t stream;
+    size_t index;
+  };
+  vector<Entry> entries;
+  for (size_t i = 0; i < streams->size(); ++i) {
+    for (size_t j = 0; j < (*streams)[i].size(); ++j) {
+      Entry entry = {
+          i < scores.size() && j < scores[i].size() ? scores[i][j] : -1, i, j};
+      entries.push_back(entry);
+    }
+  }
+  // Each stream is already best first, so this only interleaves them, with
+  // ties going to the earlier stream.
+  stable_sort(entries.begin(),
+              entries.end(),
+              [](const Entry& a, const Entry& b) { return a.score > b.score; });
+  auto less = [](const wstring& a, const wstring& b) {
+    return CompareIgnoringCase(a, b) < 0;
+  };
+  set<wstring, decltype(less)> seen(less);
+  merged->clear();
+  for (const auto& entry : entries) {
+    wstring& result = (*streams)[entry.stream][entry.index];
+    if (!seen.insert(result).second)
+      continue;
+    merged->push_back(move(result));
+    merged_scores->push_back(max(entry.score, 0));
+  }
+}
+
 vector<vector<WordData>> CompletionBreakWordsIntoCommands(
     const vector<WordData>& words) {
   vector<vector<WordData>> result;
@@ -5,10 +5,42 @@
 #ifndef CMDEX_COMPLETION_H_
 #define CMDEX_COMPLETION_H_
 
+#include <functional>
 #include <string>
 #include <vector>
 using namespace std;
 
+#include "cmdEx/prefix_filter.h"
+#include "cmdEx/string_util.h"
+
+// Where a word of a command line is in the line, and where its de-escaped
+// text is in TokenizedLine::deescaped.
+struct CommandLineToken {
+  int original_offset;
+  int original_length;
+  int deescaped_offset;
+  int deescaped_length;
+};
+
+// A command line split into words by TokenizeCommandLine(). Refers to the
+// line, which has to outlive it.
+struct TokenizedLine {
+  const wchar_t* line;
+  vector<CommandLineToken> tokens;
+  // The de-escaped text of all the words, one after the other.
+  wstring deescaped;
+
+  size_t size() const { return tokens.size(); }
+  WStringPiece original_word(size_t i) const {
+    return WStringPiece(line + tokens[i].original_offset,
+                        tokens[i].original_length);
+  }
+  WStringPiece deescaped_word(size_t i) const {
+    return WStringPiece(deescaped.data() + tokens[i].deescaped_offset,
+                        tokens[i].deescaped_length);
+  }
+};
+
 // |original_word| will not have any of its escape characters interpreted.
 struct WordData {
   wstring original_word;
@@ -17,24 +49,134 @@ struct WordData {
 };
 
 struct CompleterInput {
+  CompleterInput() : word_index(0), position_in_word(0), fuzzy(false) {}
+
   vector<WordData> word_data;
   int word_index;
   int position_in_word;
+  // Whether the word can match anything it's a subsequence of (see
+  // AddCompletions()), rather than only what it's a prefix of.
+  bool fuzzy;
+};
+
+struct CompleterOutput;
+
+// Where a completer running in the background (see CompletionPool) reports
+// to.
+class CompletionProgressInterface {
+ public:
+  virtual bool IsCancelled() = 0;
+  virtual void Publish(const CompleterOutput& output) = 0;
 };
 
 struct CompleterOutput {
+  CompleterOutput() : trailing_space(true), progress(NULL) {}
+
   vector<wstring> results;
+  // Empty, unless the results were fuzzy matched, when it's how well each
+  // did, best first.
+  vector<int> scores;
   bool trailing_space;
+  // NULL when completing synchronously. Not owned.
+  CompletionProgressInterface* progress;
+
   void Reset() {
     results.clear();
+    scores.clear();
     trailing_space = true;
   }
+
+  // Whether the results are no longer wanted (e.g. because the line has been
+  // edited since). Completers that can take a while should check this as
+  // they go, and return false once it's set.
+  bool IsCancelled() const { return progress && progress->IsCancelled(); }
+  // Makes |results| so far available to be shown while the completer
+  // carries on looking for more.
+  void Publish() const {
+    if (progress)
+      progress->Publish(*this);
+  }
 };
 
 // Return false if can't complete for |input|. Otherwise, fill out |results|.
+// Completers can be called on any thread, including more than one at once.
 typedef bool (*Completer)(const CompleterInput& input,
                           CompleterOutput* output);
 
+// Splits |line| into words in one pass, de-escaping them as
+// CommandLineToArgvW does, with two additions for completion: an empty word
+// at the end if there's space after the last one (or the line is empty), and
+// a word that starts with \ straight after a quoted executable (as in
+// "C:\Program Files (x86)"\) is part of it. |result|'s storage is reused, so
+// once it's big enough, nothing is allocated.
+void TokenizeCommandLine(const wchar_t* line,
+                         size_t size,
+                         TokenizedLine* result);
+
+// A line's words, as TokenizeCommandLine() would split it, kept up to date
+// as the line is edited. An edit only lexes the words from the one it's in
+// up to the first that starts where one did before, which is usually just
+// the one, unless a quote has changed how the rest of the line splits.
+// Moving the words after an edit is deferred until the next edit that's
+// somewhere else, so typing in one place costs the same however long the
+// line is.
+class LineTokens {
+ public:
+  // |line| has to outlive this.
+  explicit LineTokens(const wstring* line);
+
+  // Tokenizes the whole line again, e.g. after it's been replaced.
+  void Reset();
+  // Updates for |removed| characters at |offset| having been replaced with
+  // |inserted| others.
+  void Update(int offset, int removed, int inserted);
+
+  // As TokenizedLine.
+  size_t size() const;
+  int original_offset(size_t i) const;
+  WStringPiece original_word(size_t i) const;
+  WStringPiece deescaped_word(size_t i) const;
+
+  // The word that |position| is in, as CompletionWordIndex().
+  int WordIndex(int position) const;
+
+  // Appends copies of the words to |word_data|.
+  void GetWordData(vector<WordData>* word_data) const;
+
+  // The number of characters lexed so far, for tests.
+  size_t lexed_count() const { return lexed_count_; }
+
+ private:
+  LineTokens(const LineTokens&);
+  void operator=(const LineTokens&);
+
+  // Where the |i|th of tokens_ starts in the line.
+  int Start(size_t i) const {
+    return tokens_[i].original_offset + (i >= shift_from_ ? shift_ : 0);
+  }
+  // Drops the text of words that have been replaced from deescaped_.
+  void CompactDeescaped();
+
+  // How much replaced text can build up before it's dropped.
+  static const size_t kMinGarbage = 4096;
+
+  const wstring* line_;
+  // Without the empty one that TokenizeCommandLine() adds at the end.
+  vector<CommandLineToken> tokens_;
+  // |shift_| hasn't been added to the offsets of tokens_ from |shift_from_|
+  // on yet.
+  size_t shift_from_;
+  int shift_;
+  // The de-escaped text of the words, and that of words that were since
+  // replaced, which adds up to |garbage_|.
+  wstring deescaped_;
+  size_t garbage_;
+  // The words being lexed by Update().
+  vector<CommandLineToken> fresh_;
+  size_t lexed_count_;
+};
+
+// As TokenizeCommandLine(), but copying the words out.
 void CompletionBreakIntoWords(const wstring& line,
                               vector<WordData>* word_data);
 
@@ -46,4 +188,60 @@ int CompletionWordIndex(const vector<WordData>& word_data, int position);
 
 wstring QuoteWord(const wstring& argument);
 
+// Appends those of |candidates| that start with |prefix| to |results|, in
+// order.
+void FilterCompletions(const vector<wstring>& candidates,
+                       const wstring& prefix,
+                       bool ignore_case,
+                       vector<wstring>* results);
+
+// The most results a fuzzy match keeps. Only the best few are ever looked at,
+// and ranking is cheap when there are only a few to rank.
+const size_t kMaxFuzzyResults = 200;
+
+// Adds |candidates| that |word| completes to to |output|: those that start
+// with it (ignoring case), or if |fuzzy|, the best kMaxFuzzyResults that it's
+// a subsequence of, ranked as FuzzyScore() scores them. An empty word matches
+// everything, unranked, either way.
+void AddCompletions(const PackedCandidates& candidates,
+                    const wstring& word,
+                    bool fuzzy,
+                    CompleterOutput* output);
+
+// Ranks |count| candidates, of which |candidate(i)| is the |i|th, against
+// |query|, and merges the best kMaxFuzzyResults with what's already in
+// |output| by score, keeping the best. Those that match are added with
+// |prepend| in front of them. Candidates can be skipped by returning an empty
+// piece.
+void AddFuzzyCompletions(size_t count,
+                         const function<WStringPiece(size_t)>& candidate,
+                         const wstring& query,
+                         const wstring& prepend,
+                         CompleterOutput* output);
+
+// Like wcsicmp(), but without stopping at a nul. This is the order
+// SortCompletions() sorts in.
+int CompareIgnoringCase(const wstring& a, const wstring& b);
+
+// Sorts |results| ignoring case (as Windows names are), keeping the order of
+// ones that are the same but for case, for MergeCompletions().
+void SortCompletions(vector<wstring>* results);
+
+// Merges |streams|, each sorted by SortCompletions(), into |merged|, which
+// is then sorted likewise. Of results that are the same ignoring case, only
+// the first is kept, taking the earliest of |streams| as the first. The
+// results are moved out of |streams|.
+void MergeCompletions(vector<vector<wstring>>* streams,
+                      vector<wstring>* merged);
+
+// As above, but for streams that might have been fuzzy matched, with
+// |scores| being each one's CompleterOutput::scores. If any of them were,
+// |merged| is ordered best first instead, with streams that weren't
+// (which are sorted) following in turn, and |merged_scores| is filled to
+// match. Otherwise, |merged_scores| is left empty.
+void MergeCompletions(vector<vector<wstring>>* streams,
+                      const vector<vector<int>>& scores,
+                      vector<wstring>* merged,
+                      vector<int>* merged_scores);
+
 #endif  // CMDEX_COMPLETION_H_
@@ -0,0 +1,92 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completion_cache.h"
+
+CompletionCache::CompletionCache(size_t max_candidates)
+    : max_candidates_(max_candidates),
+      num_candidates_(0),
+      clock_(0),
+      hits_(0),
+      misses_(0) {}
+
+CompletionCache::Candidates CompletionCache::Find(
+    const wstring& key,
+    const vector<int64_t>& validators) {
+  lock_guard<mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    ++misses_;
+    return Candidates();
+  }
+  if (it->second.validators != validators) {
+    // Whatever it came from has changed, so it's no use any more.
+    Remove(it);
+    ++misses_;
+    return Candidates();
+  }
+  ++hits_;
+  it->second.last_used = ++clock_;
+  return it->second.candidates;
+}
+
+CompletionCache::Candidates CompletionCache::Store(
+    const wstring& key,
+    const vector<int64_t>& validators,
+    vector<wstring>* candidates) {
+  Candidates stored(new PackedCandidates(*candidates));
+  candidates->clear();
+  lock_guard<mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end())
+    Remove(it);
+  if (stored->size() > max_candidates_)
+    return stored;
+  while (num_candidates_ + stored->size() > max_candidates_) {
+    auto oldest = entries_.begin();
+    for (auto i = entries_.begin(); i != entries_.end(); ++i) {
+      if (i->second.last_used < oldest->second.last_used)
+        oldest = i;
+    }
+    Remove(oldest);
+  }
+  num_candidates_ += stored->size();
+  Entry& entry = entries_[key];
+  entry.validators = validators;
+  entry.candidates = stored;
+  entry.last_used = ++clock_;
+  return stored;
+}
+
+void CompletionCache::Clear() {
+  lock_guard<mutex> lock(mutex_);
+  entries_.clear();
+  num_candidates_ = 0;
+}
+
+int CompletionCache::hits() const {
+  lock_guard<mutex> lock(mutex_);
+  return hits_;
+}
+
+int CompletionCache::misses() const {
+  lock_guard<mutex> lock(mutex_);
+  return misses_;
+}
+
+int64_t CompletionCache::Hash(const wstring& str) {
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& ch : str) {
+    hash ^= static_cast<uint64_t>(ch);
+    hash *= 1099511628211ULL;
+  }
+  return static_cast<int64_t>(hash);
+}
+
+void CompletionCache::Remove(unordered_map<wstring, Entry>::iterator it) {
+  // Callers that found it earlier still have their own reference.
+  num_candidates_ -= it->second.candidates->size();
+  entries_.erase(it);
+}
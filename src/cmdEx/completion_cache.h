@@ -0,0 +1,79 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_COMPLETION_CACHE_H_
+#define CMDEX_COMPLETION_CACHE_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/prefix_filter.h"
+
+// Keeps all the candidates a completer found for a context (e.g. every
+// command in PATH, or every name in a directory), before they were filtered
+// by what had been typed, so that completing another prefix in the same
+// context only has to filter them again.
+//
+// Entries are keyed by the completer and its context, and stored along with
+// validators: cheap stamps of what the candidates came from, like the
+// modification times of the directories that were listed, or a hash of the
+// environment variables that were used. An entry is only found while the
+// validators it's looked up with are the same as those it was stored with,
+// so it's up to the completer to pick ones that change whenever its
+// candidates would. Safe to use from several threads at once.
+class CompletionCache {
+ public:
+  typedef shared_ptr<const PackedCandidates> Candidates;
+
+  // Once more than |max_candidates| are stored in all, the least recently
+  // used entries are dropped.
+  explicit CompletionCache(size_t max_candidates);
+
+  // Returns what was stored for |key| with |validators|, or NULL if nothing
+  // was, or it was stored with other validators, in which case it's dropped.
+  Candidates Find(const wstring& key, const vector<int64_t>& validators);
+  // Stores |candidates|, which are cleared, for |key| with |validators|.
+  // Returns them packed, for filtering, even if there wasn't room to keep
+  // them.
+  Candidates Store(const wstring& key,
+                   const vector<int64_t>& validators,
+                   vector<wstring>* candidates);
+  void Clear();
+
+  // How many times Find() did and didn't find an entry.
+  int hits() const;
+  int misses() const;
+
+  // For validators from text, e.g. the value of an environment variable.
+  static int64_t Hash(const wstring& str);
+
+ private:
+  CompletionCache(const CompletionCache&);
+  void operator=(const CompletionCache&);
+
+  struct Entry {
+    vector<int64_t> validators;
+    Candidates candidates;
+    uint64_t last_used;
+  };
+
+  void Remove(unordered_map<wstring, Entry>::iterator it);
+
+  mutable mutex mutex_;
+  size_t max_candidates_;
+  size_t num_candidates_;
+  unordered_map<wstring, Entry> entries_;
+  // Counts uses of entries, to find the least recently used.
+  uint64_t clock_;
+  int hits_;
+  int misses_;
+};
+
+#endif  // CMDEX_COMPLETION_CACHE_H_
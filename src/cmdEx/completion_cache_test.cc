@@ -0,0 +1,99 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completion_cache.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+vector<int64_t> Validators(int64_t a, int64_t b) {
+  vector<int64_t> result;
+  result.push_back(a);
+  result.push_back(b);
+  return result;
+}
+
+vector<wstring> Candidates(size_t count, const wchar_t* name) {
+  return vector<wstring>(count, name);
+}
+
+vector<wstring> Unpack(const PackedCandidates& packed) {
+  vector<wstring> result;
+  for (size_t i = 0; i < packed.size(); ++i)
+    result.push_back(packed.Get(i));
+  return result;
+}
+
+TEST(CompletionCacheTest, FindAndStore) {
+  CompletionCache cache(100);
+  EXPECT_FALSE(cache.Find(L"path", Validators(1, 2)));
+  vector<wstring> candidates = Candidates(3, L"cmd");
+  cache.Store(L"path", Validators(1, 2), &candidates);
+  EXPECT_TRUE(candidates.empty());
+
+  CompletionCache::Candidates found = cache.Find(L"path", Validators(1, 2));
+  ASSERT_TRUE(found);
+  EXPECT_EQ(Candidates(3, L"cmd"), Unpack(*found));
+  EXPECT_FALSE(cache.Find(L"files\nC:\\", Validators(1, 2)));
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(2, cache.misses());
+
+  cache.Clear();
+  EXPECT_FALSE(cache.Find(L"path", Validators(1, 2)));
+  // What was found before is still there.
+  EXPECT_EQ(Candidates(3, L"cmd"), Unpack(*found));
+}
+
+TEST(CompletionCacheTest, Validators) {
+  CompletionCache cache(100);
+  vector<wstring> candidates = Candidates(3, L"cmd");
+  cache.Store(L"path", Validators(1, 2), &candidates);
+  // Something it came from has changed, so it's dropped.
+  EXPECT_FALSE(cache.Find(L"path", Validators(1, 3)));
+  EXPECT_FALSE(cache.Find(L"path", Validators(1, 2)));
+  EXPECT_FALSE(cache.Find(L"path", vector<int64_t>(1, 1)));
+
+  candidates = Candidates(2, L"git");
+  cache.Store(L"path", Validators(1, 3), &candidates);
+  candidates = Candidates(1, L"ninja");
+  cache.Store(L"path", Validators(1, 4), &candidates);
+  CompletionCache::Candidates found = cache.Find(L"path", Validators(1, 4));
+  ASSERT_TRUE(found);
+  EXPECT_EQ(Candidates(1, L"ninja"), Unpack(*found));
+}
+
+TEST(CompletionCacheTest, DropsLeastRecentlyUsed) {
+  CompletionCache cache(10);
+  vector<wstring> candidates = Candidates(4, L"a");
+  cache.Store(L"a", Validators(1, 1), &candidates);
+  candidates = Candidates(4, L"b");
+  cache.Store(L"b", Validators(1, 1), &candidates);
+  EXPECT_TRUE(cache.Find(L"a", Validators(1, 1)));
+
+  candidates = Candidates(4, L"c");
+  cache.Store(L"c", Validators(1, 1), &candidates);
+  EXPECT_TRUE(cache.Find(L"a", Validators(1, 1)));
+  EXPECT_FALSE(cache.Find(L"b", Validators(1, 1)));
+  EXPECT_TRUE(cache.Find(L"c", Validators(1, 1)));
+
+  // Too many to store at all.
+  candidates = Candidates(11, L"d");
+  CompletionCache::Candidates stored =
+      cache.Store(L"d", Validators(1, 1), &candidates);
+  // But they're still returned, to be used this once.
+  EXPECT_EQ(Candidates(11, L"d"), Unpack(*stored));
+  EXPECT_FALSE(cache.Find(L"d", Validators(1, 1)));
+  EXPECT_TRUE(cache.Find(L"a", Validators(1, 1)));
+}
+
+TEST(CompletionCacheTest, Hash) {
+  EXPECT_EQ(CompletionCache::Hash(L"C:\\Windows;C:\\bin"),
+            CompletionCache::Hash(L"C:\\Windows;C:\\bin"));
+  EXPECT_NE(CompletionCache::Hash(L"C:\\Windows;C:\\bin"),
+            CompletionCache::Hash(L"C:\\Windows;C:\\bin2"));
+  EXPECT_NE(CompletionCache::Hash(L""), CompletionCache::Hash(L";"));
+}
+
+}  // namespace
@@ -0,0 +1,168 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completion_menu.h"
+
+#include <algorithm>
+
+#include "cmdEx/line_editor.h"
+
+namespace {
+
+// Spaces between columns.
+const size_t kColumnGap = 2;
+
+}  // namespace
+
+CompletionMenu::CompletionMenu()
+    : items_(NULL),
+      column_width_(1),
+      top_row_(0),
+      measured_count_(0),
+      drawn_top_(0) {}
+
+void CompletionMenu::SetItems(const vector<wstring>* items) {
+  items_ = items;
+  column_width_ = 1;
+  top_row_ = 0;
+}
+
+int CompletionMenu::Layout(int width, int max_rows, int selected) {
+  rows_.clear();
+  size_t count = items_ ? items_->size() : 0;
+  if (count == 0 || width <= 0 || max_rows <= 0)
+    return 0;
+  const size_t max_width = static_cast<size_t>(width);
+  const size_t max_item_rows = static_cast<size_t>(max_rows);
+  size_t columns;
+  size_t total_rows;
+  size_t item_rows;
+  size_t first;
+  size_t end;
+  // Measuring what's shown can only make the columns wider, which means
+  // fewer of them, and different items shown, so it goes round until nothing
+  // that's shown is wider than they are.
+  for (;;) {
+    column_width_ = min(column_width_, max_width);
+    columns = max<size_t>(
+        1, (max_width + kColumnGap) / (column_width_ + kColumnGap));
+    total_rows = (count + columns - 1) / columns;
+    // With a row to say which are shown, if they aren't all.
+    item_rows = total_rows <= max_item_rows
+                    ? total_rows
+                    : max<size_t>(1, max_item_rows - 1);
+    if (selected >= 0 && static_cast<size_t>(selected) < count) {
+      size_t row = static_cast<size_t>(selected) / columns;
+      if (row < top_row_)
+        top_row_ = row;
+      else if (row >= top_row_ + item_rows)
+        top_row_ = row - item_rows + 1;
+    }
+    top_row_ = min(top_row_, total_rows - item_rows);
+    first = top_row_ * columns;
+    end = min(count, (top_row_ + item_rows) * columns);
+    size_t widest = column_width_;
+    for (size_t i = first; i < end; ++i)
+      widest = max(widest, (*items_)[i].size());
+    measured_count_ += end - first;
+    widest = min(widest, max_width);
+    if (widest == column_width_)
+      break;
+    column_width_ = widest;
+  }
+
+  for (size_t row = top_row_; row < top_row_ + item_rows; ++row) {
+    Row line = {wstring(), -1, -1, false};
+    for (size_t column = 0; column < columns; ++column) {
+      size_t i = row * columns + column;
+      if (i >= count)
+        break;
+      line.text.resize(column * (column_width_ + kColumnGap), L' ');
+      // Anything wider than the console is cut short.
+      size_t length = min((*items_)[i].size(), column_width_);
+      if (static_cast<int>(i) == selected) {
+        line.selected_begin = static_cast<int>(line.text.size());
+        line.selected_end = static_cast<int>(line.text.size() + length);
+      }
+      line.text.append((*items_)[i], 0, length);
+    }
+    rows_.push_back(line);
+  }
+  if (item_rows < total_rows && item_rows < max_item_rows) {
+    Row shown = {to_wstring(first + 1) + L"-" + to_wstring(end) + L" of " +
+                     to_wstring(count),
+                 -1,
+                 -1,
+                 true};
+    shown.text.resize(min(shown.text.size(), max_width));
+    rows_.push_back(shown);
+  }
+  return static_cast<int>(rows_.size());
+}
+
+void CompletionMenu::Draw(ConsoleInterface* console, int top) {
+  for (size_t i = 0; i < rows_.size(); ++i) {
+    const Row& row = rows_[i];
+    int y = top + static_cast<int>(i);
+    // Whatever was drawn there before, even if it was drawn as another row.
+    int was = y - drawn_top_;
+    const Row* old = was >= 0 && was < static_cast<int>(drawn_.size())
+                         ? &drawn_[was]
+                         : NULL;
+    if (old && *old == row)
+      continue;
+    DrawRow(console, row, y);
+    if (old && old->text.size() > row.text.size()) {
+      console->FillChar(L' ',
+                        static_cast<int>(old->text.size() - row.text.size()),
+                        static_cast<int>(row.text.size()),
+                        y);
+    }
+  }
+  // Rows below that aren't needed any more.
+  int bottom = top + static_cast<int>(rows_.size());
+  for (size_t i = 0; i < drawn_.size(); ++i) {
+    int y = drawn_top_ + static_cast<int>(i);
+    if (y >= bottom && !drawn_[i].text.empty())
+      console->FillChar(L' ', static_cast<int>(drawn_[i].text.size()), 0, y);
+  }
+  drawn_ = rows_;
+  drawn_top_ = top;
+}
+
+void CompletionMenu::Erase(ConsoleInterface* console) {
+  for (size_t i = 0; i < drawn_.size(); ++i) {
+    int y = drawn_top_ + static_cast<int>(i);
+    // Rows that have been scrolled off the top are gone already.
+    if (y >= 0 && !drawn_[i].text.empty())
+      console->FillChar(L' ', static_cast<int>(drawn_[i].text.size()), 0, y);
+  }
+  drawn_.clear();
+}
+
+void CompletionMenu::Scrolled(int lines) {
+  drawn_top_ -= lines;
+}
+
+void CompletionMenu::DrawRow(ConsoleInterface* console,
+                             const Row& row,
+                             int y) {
+  const wchar_t* text = row.text.data();
+  int size = static_cast<int>(row.text.size());
+  if (row.dimmed) {
+    console->DrawDimmedString(text, size, 0, y);
+  } else if (row.selected_begin == -1) {
+    console->DrawString(text, size, 0, y);
+  } else {
+    console->DrawString(text, row.selected_begin, 0, y);
+    console->DrawHighlightedString(text + row.selected_begin,
+                                   row.selected_end - row.selected_begin,
+                                   row.selected_begin,
+                                   y);
+    console->DrawString(text + row.selected_end,
+                        size - row.selected_end,
+                        row.selected_end,
+                        y);
+  }
+}
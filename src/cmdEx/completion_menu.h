@@ -0,0 +1,83 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_COMPLETION_MENU_H_
+#define CMDEX_COMPLETION_MENU_H_
+
+#include <string>
+#include <vector>
+using namespace std;
+
+class ConsoleInterface;
+
+// Completion results shown in a grid below the line being edited, a row at a
+// time left to right, with the selected one highlighted. However many results
+// there are, only the rows that are on screen are ever laid out: columns are
+// as wide as the widest result that's been on screen so far (so they only
+// ever get wider, as wider ones are scrolled to), rather than the widest of
+// them all. What was drawn is kept, so that drawing again only draws the rows
+// that have changed, e.g. just two when the selection moves within the rows
+// that are shown.
+class CompletionMenu {
+ public:
+  CompletionMenu();
+
+  // Shows |items|, which aren't owned, and have to outlive this or the next
+  // call. To be called again whenever they change.
+  void SetItems(const vector<wstring>* items);
+
+  // Lays out what's to be drawn in up to |max_rows| rows (the last of which
+  // says which are shown, if they aren't all) of |width|, scrolled so that
+  // the |selected|th item is shown, and highlighted. -1 is none. Returns the
+  // number of rows.
+  int Layout(int width, int max_rows, int selected);
+
+  // Draws what Layout() laid out, from row |top| down, leaving rows that are
+  // the same as what was last drawn there alone.
+  void Draw(ConsoleInterface* console, int top);
+
+  // Blanks what's been drawn.
+  void Erase(ConsoleInterface* console);
+
+  // For when the console has scrolled up by |lines|, taking what's been drawn
+  // with it.
+  void Scrolled(int lines);
+
+  // The row that what's been drawn starts at, if anything has.
+  int drawn_top() const { return drawn_top_; }
+  bool IsDrawn() const { return !drawn_.empty(); }
+
+  // How many items have been measured for column widths, for tests.
+  size_t measured_count() const { return measured_count_; }
+
+ private:
+  struct Row {
+    wstring text;
+    // Where the selected item is in |text|, if it's in this row.
+    int selected_begin;
+    int selected_end;
+    // For the row saying which are shown.
+    bool dimmed;
+
+    bool operator==(const Row& other) const {
+      return text == other.text && selected_begin == other.selected_begin &&
+             selected_end == other.selected_end && dimmed == other.dimmed;
+    }
+  };
+
+  void DrawRow(ConsoleInterface* console, const Row& row, int y);
+
+  const vector<wstring>* items_;
+  // The widest item that's been measured, up to the width.
+  size_t column_width_;
+  // The first row of items that's shown.
+  size_t top_row_;
+  size_t measured_count_;
+  vector<Row> rows_;
+  // What was last drawn, from row |drawn_top_| down.
+  vector<Row> drawn_;
+  int drawn_top_;
+};
+
+#endif  // CMDEX_COMPLETION_MENU_H_
@@ -0,0 +1,211 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completion_menu.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+vector<wstring> Numbered(const wchar_t* prefix, int count) {
+  vector<wstring> items;
+  for (int i = 0; i < count; ++i)
+    items.push_back(prefix + to_wstring(i));
+  return items;
+}
+
+TEST(CompletionMenuTest, Grid) {
+  MockConsoleInterface console(20, 10);
+  vector<wstring> items = {L"ab", L"cde", L"f", L"ghij", L"k"};
+  CompletionMenu menu;
+  menu.SetItems(&items);
+  ASSERT_EQ(2, menu.Layout(20, 5, 1));
+  menu.Draw(&console, 1);
+  // As wide as the widest, and as many of those as fit.
+  EXPECT_EQ(L"ab    cde   f!!!!!!!", console.GetLine(1, 20));
+  EXPECT_EQ(L"ghij  k!!!!!!!!!!!!!", console.GetLine(2, 20));
+  EXPECT_EQ(L"!!!!!!!!!!!!!!!!!!!!", console.GetLine(3, 20));
+  EXPECT_FALSE(console.IsHighlightedAt(5, 1));
+  EXPECT_TRUE(console.IsHighlightedAt(6, 1));
+  EXPECT_TRUE(console.IsHighlightedAt(8, 1));
+  EXPECT_FALSE(console.IsHighlightedAt(9, 1));
+  EXPECT_TRUE(menu.IsDrawn());
+  EXPECT_EQ(1, menu.drawn_top());
+
+  menu.Erase(&console);
+  EXPECT_FALSE(menu.IsDrawn());
+  EXPECT_EQ(L"             !!!!!!!", console.GetLine(1, 20));
+  EXPECT_EQ(L"       !!!!!!!!!!!!!", console.GetLine(2, 20));
+
+  // One that doesn't fit is cut short, and then there's only the one
+  // column.
+  items.push_back(L"an_item_far_too_wide_to_fit");
+  menu.SetItems(&items);
+  ASSERT_EQ(6, menu.Layout(20, 6, -1));
+  menu.Draw(&console, 0);
+  EXPECT_EQ(L"ab!!!!!!!!!!!!!!!!!!", console.GetLine(0, 20));
+  EXPECT_EQ(L"an_item_far_too_wide", console.GetLine(5, 20));
+  EXPECT_FALSE(console.IsHighlightedAt(0, 0));
+}
+
+TEST(CompletionMenuTest, OnlyRedrawsChangedRows) {
+  MockConsoleInterface console(20, 10);
+  vector<wstring> items = Numbered(L"item", 1000);
+  CompletionMenu menu;
+  menu.SetItems(&items);
+  // Three rows of items, and a row saying which they are.
+  ASSERT_EQ(4, menu.Layout(20, 4, 500));
+  menu.Draw(&console, 0);
+  EXPECT_EQ(4, console.CountRowsDrawn());
+  EXPECT_EQ(L"item496  item497", console.GetLine(0, 16));
+  EXPECT_EQ(L"item500  item501", console.GetLine(2, 16));
+  EXPECT_EQ(L"497-502 of 1000", console.GetLine(3, 15));
+  EXPECT_TRUE(console.IsDimmedAt(0, 3));
+  EXPECT_TRUE(console.IsHighlightedAt(0, 2));
+  // Only what's been on screen has been measured.
+  EXPECT_GT(50u, menu.measured_count());
+
+  // Along the row, only it changes.
+  console.ResetRowDraws();
+  menu.Layout(20, 4, 501);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(1, console.CountRowsDrawn());
+  EXPECT_FALSE(console.IsHighlightedAt(0, 2));
+  EXPECT_TRUE(console.IsHighlightedAt(9, 2));
+
+  // Up a row, only the two.
+  console.ResetRowDraws();
+  menu.Layout(20, 4, 499);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(2, console.CountRowsDrawn());
+
+  // Nothing.
+  console.ResetRowDraws();
+  menu.Layout(20, 4, 499);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(0, console.CountRowsDrawn());
+
+  // Scrolling down a row moves everything.
+  console.ResetRowDraws();
+  menu.Layout(20, 4, 502);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(4, console.CountRowsDrawn());
+  EXPECT_EQ(L"item498  item499", console.GetLine(0, 16));
+  EXPECT_EQ(L"item502  item503", console.GetLine(2, 16));
+  EXPECT_EQ(L"499-504 of 1000", console.GetLine(3, 15));
+}
+
+TEST(CompletionMenuTest, WidensAsWiderOnesAreShown) {
+  MockConsoleInterface console(20, 10);
+  vector<wstring> items = Numbered(L"a", 100);
+  items[90] = L"wider_than_the_rest";
+  CompletionMenu menu;
+  menu.SetItems(&items);
+  menu.Layout(20, 3, 0);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(L"a0   a1   a2   a3!!!", console.GetLine(0, 20));
+  EXPECT_EQ(L"1-8 of 100!", console.GetLine(2, 11));
+
+  menu.Layout(20, 3, 90);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(L"a89              !!!", console.GetLine(0, 20));
+  EXPECT_EQ(L"wider_than_the_rest!", console.GetLine(1, 20));
+  EXPECT_TRUE(console.IsHighlightedAt(0, 1));
+  EXPECT_EQ(L"90-91 of 100!", console.GetLine(2, 13));
+
+  // And stays that wide.
+  menu.Layout(20, 3, 0);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(L"a0 ", console.GetLine(0, 3));
+  EXPECT_EQ(L"a1 ", console.GetLine(1, 3));
+
+  // Until they change.
+  menu.SetItems(&items);
+  menu.Layout(20, 3, 0);
+  menu.Draw(&console, 0);
+  EXPECT_EQ(L"a0   a1   a2   a3", console.GetLine(0, 17));
+}
+
+TEST(CompletionMenuTest, MovesAndShrinks) {
+  MockConsoleInterface console(20, 10);
+  vector<wstring> items = {L"one", L"two", L"three"};
+  CompletionMenu menu;
+  menu.SetItems(&items);
+  ASSERT_EQ(2, menu.Layout(12, 5, 0));
+  menu.Draw(&console, 2);
+  EXPECT_EQ(L"one    two!", console.GetLine(2, 11));
+  EXPECT_EQ(L"three!", console.GetLine(3, 6));
+
+  // Drawn higher, the rows below that aren't used any more are cleared.
+  items.pop_back();
+  menu.SetItems(&items);
+  ASSERT_EQ(1, menu.Layout(12, 5, 1));
+  menu.Draw(&console, 1);
+  EXPECT_EQ(L"one  two!", console.GetLine(1, 9));
+  EXPECT_EQ(L"          !", console.GetLine(2, 11));
+  EXPECT_EQ(L"     !", console.GetLine(3, 6));
+
+  // Having been scrolled up with the console, it's erased from where it is.
+  menu.Scrolled(1);
+  EXPECT_EQ(0, menu.drawn_top());
+  menu.Erase(&console);
+  EXPECT_EQ(L"        !", console.GetLine(0, 9));
+
+  // Nothing to show.
+  items.clear();
+  menu.SetItems(&items);
+  EXPECT_EQ(0, menu.Layout(12, 5, -1));
+}
+
+TEST(CompletionMenuTest, DISABLED_PerfCompletionMenu) {
+  // Far more than any completer finds, e.g. every file in a big checkout.
+  const int kItems = 1000000;
+  const wchar_t* kDirectories[] = {
+    L"obj/chrome/browser/ui/views/", L"obj/content/renderer/",
+    L"obj/third_party/blink/renderer/core/", L"gen/components/",
+  };
+  vector<wstring> items;
+  items.reserve(kItems);
+  for (int i = 0; i < kItems; ++i) {
+    items.push_back(
+        kDirectories[i % (sizeof(kDirectories) / sizeof(kDirectories[0]))] +
+        wstring(L"file") + to_wstring(i) + L".obj");
+  }
+  MockConsoleInterface console(120, 40);
+  CompletionMenu menu;
+  menu.SetItems(&items);
+
+  // Showing a page (of 10 rows, as LineEditor does), wherever it is.
+  const int kPages[] = {0, kItems / 2, kItems - 1, 12345};
+  for (const auto& selected : kPages) {
+    PerfTimer timer;
+    menu.Layout(console.width, 10, selected);
+    menu.Draw(&console, 1);
+    printf("page at %7d: %.3fms\n", selected, timer.ElapsedMs());
+  }
+
+  // Going through them a Tab at a time, which scrolls every few.
+  const int kSteps = 10000;
+  double worst = 0;
+  PerfTimer total;
+  for (int i = 0; i < kSteps; ++i) {
+    PerfTimer timer;
+    menu.Layout(console.width, 10, kItems / 2 + i);
+    menu.Draw(&console, 1);
+    worst = max(worst, timer.ElapsedMs());
+  }
+  printf("%d items: %.4fms per Tab, worst %.3fms, %zu measured\n",
+         kItems,
+         total.ElapsedMs() / kSteps,
+         worst,
+         menu.measured_count());
+}
+
+}  // namespace
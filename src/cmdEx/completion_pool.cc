@@ -0,0 +1,283 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completion_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "common/util.h"
+
+bool CompletionRequest::Part::IsCancelled() {
+  return request->IsCancelled();
+}
+
+void CompletionRequest::Part::Publish(const CompleterOutput& output) {
+  vector<wstring> results(output.results);
+  vector<int> scores(output.scores);
+  if (scores.empty())
+    SortCompletions(&results);
+  request->UpdatePart(
+      index, &results, &scores, output.trailing_space, false, false);
+}
+
+CompletionRequest::CompletionRequest(const vector<Completer>& completers,
+                                     const CompleterInput& input,
+                                     bool merge,
+                                     const function<void()>& notify)
+    : completers_(completers),
+      input_(input),
+      notify_(notify),
+      cancelled_(false),
+      trailing_space_(true),
+      version_(0),
+      finished_(false),
+      unfinished_parts_(0) {
+  if (merge) {
+    for (size_t i = 0; i < completers_.size(); ++i) {
+      unique_ptr<Part> part(new Part);
+      part->request = this;
+      part->index = i;
+      part->trailing_space = true;
+      part->succeeded = false;
+      parts_.push_back(move(part));
+    }
+    unfinished_parts_ = parts_.size();
+  }
+}
+
+void CompletionRequest::Cancel() {
+  cancelled_ = true;
+}
+
+bool CompletionRequest::Wait(int timeout_ms) {
+  unique_lock<mutex> lock(mutex_);
+  return finished_changed_.wait_for(lock,
+                                    chrono::milliseconds(timeout_ms),
+                                    [this] { return finished_; });
+}
+
+bool CompletionRequest::GetResults(int* version,
+                                   CompleterOutput* output,
+                                   bool* finished) {
+  lock_guard<mutex> lock(mutex_);
+  if (version_ == *version)
+    return false;
+  // Not the progress, which is only for completers.
+  output->results = results_;
+  output->scores = scores_;
+  output->trailing_space = trailing_space_;
+  *version = version_;
+  *finished = finished_;
+  return true;
+}
+
+bool CompletionRequest::IsCancelled() {
+  return cancelled_;
+}
+
+void CompletionRequest::Publish(const CompleterOutput& output) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (cancelled_ || finished_)
+      return;
+    results_ = output.results;
+    scores_ = output.scores;
+    trailing_space_ = output.trailing_space;
+    ++version_;
+  }
+  if (notify_)
+    notify_();
+}
+
+void CompletionRequest::Run(int part) {
+  if (part != -1) {
+    CompleterOutput output;
+    output.progress = parts_[part].get();
+    bool succeeded = !cancelled_ && completers_[part](input_, &output);
+    if (succeeded && output.scores.empty())
+      SortCompletions(&output.results);
+    UpdatePart(part,
+               &output.results,
+               &output.scores,
+               output.trailing_space,
+               succeeded,
+               true);
+    return;
+  }
+
+  CompleterOutput output;
+  output.progress = this;
+  for (const auto& completer : completers_) {
+    if (cancelled_)
+      break;
+    output.Reset();
+    if (completer(input_, &output)) {
+      Finish(true, output);
+      return;
+    }
+  }
+  Finish(false, output);
+}
+
+void CompletionRequest::Finish(bool succeeded, const CompleterOutput& output) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (succeeded && !cancelled_) {
+      results_ = output.results;
+      scores_ = output.scores;
+      trailing_space_ = output.trailing_space;
+    } else {
+      // Including anything a completer that then failed published.
+      results_.clear();
+      scores_.clear();
+      trailing_space_ = true;
+    }
+    ++version_;
+    finished_ = true;
+  }
+  finished_changed_.notify_all();
+  if (notify_)
+    notify_();
+}
+
+void CompletionRequest::UpdatePart(size_t index,
+                                   vector<wstring>* results,
+                                   vector<int>* scores,
+                                   bool trailing_space,
+                                   bool succeeded,
+                                   bool finished) {
+  bool all_finished;
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (!finished && cancelled_)
+      return;
+    Part* part = parts_[index].get();
+    part->results.swap(*results);
+    part->scores.swap(*scores);
+    part->trailing_space = trailing_space;
+    part->succeeded = succeeded;
+    if (finished) {
+      --unfinished_parts_;
+      if (!succeeded) {
+        part->results.clear();
+        part->scores.clear();
+      }
+    }
+    if (unfinished_parts_ == 0) {
+      finished_ = true;
+      if (cancelled_) {
+        results_.clear();
+        scores_.clear();
+        trailing_space_ = true;
+      } else {
+        MergeParts();
+      }
+    } else if (!cancelled_) {
+      MergeParts();
+    }
+    ++version_;
+    all_finished = finished_;
+  }
+  if (all_finished)
+    finished_changed_.notify_all();
+  if (notify_)
+    notify_();
+}
+
+void CompletionRequest::MergeParts() {
+  vector<vector<wstring>> streams(parts_.size());
+  vector<vector<int>> scores(parts_.size());
+  trailing_space_ = true;
+  for (size_t i = 0; i < parts_.size(); ++i) {
+    Part* part = parts_[i].get();
+    if (part->results.empty())
+      continue;
+    // Only ones that all want a space after them get one.
+    trailing_space_ = trailing_space_ && part->trailing_space;
+    if (finished_) {
+      streams[i].swap(part->results);
+      scores[i].swap(part->scores);
+    } else {
+      streams[i] = part->results;
+      scores[i] = part->scores;
+    }
+  }
+  MergeCompletions(&streams, scores, &results_, &scores_);
+}
+
+CompletionPool::CompletionPool(int num_threads, const function<void()>& notify)
+    : num_threads_(num_threads), notify_(notify), stopping_(false) {
+  CHECK(num_threads_ > 0);
+}
+
+CompletionPool::~CompletionPool() {
+  vector<thread> threads;
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+    for (const auto& task : queue_)
+      task.request->Cancel();
+    for (const auto& request : running_)
+      request->Cancel();
+    threads.swap(threads_);
+  }
+  wake_.notify_all();
+  for (auto& worker : threads)
+    worker.join();
+  // Anything still queued was cancelled, so running it just finishes it with
+  // nothing.
+  for (const auto& task : queue_)
+    task.request->Run(task.part);
+}
+
+shared_ptr<CompletionRequest> CompletionPool::Start(
+    const CompleterRegistry& registry,
+    const CompleterInput& input) {
+  vector<Completer> completers;
+  registry.GetCompleters(input, &completers);
+  bool merge = registry.MergesResults(input) && !completers.empty();
+  shared_ptr<CompletionRequest> request(
+      new CompletionRequest(completers, input, merge, notify_));
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (merge) {
+      for (size_t i = 0; i < completers.size(); ++i) {
+        Task task = {request, static_cast<int>(i)};
+        queue_.push_back(task);
+      }
+    } else {
+      Task task = {request, -1};
+      queue_.push_back(task);
+    }
+    if (threads_.empty()) {
+      for (int i = 0; i < num_threads_; ++i)
+        threads_.push_back(thread(&CompletionPool::Run, this));
+    }
+  }
+  wake_.notify_all();
+  return request;
+}
+
+void CompletionPool::WaitForIdle() {
+  unique_lock<mutex> lock(mutex_);
+  idle_.wait(lock, [this] { return queue_.empty() && running_.empty(); });
+}
+
+void CompletionPool::Run() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+    if (stopping_)
+      return;
+    Task task = queue_.front();
+    queue_.pop_front();
+    running_.push_back(task.request);
+    lock.unlock();
+    task.request->Run(task.part);
+    lock.lock();
+    running_.erase(find(running_.begin(), running_.end(), task.request));
+    idle_.notify_all();
+  }
+}
@@ -0,0 +1,156 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_COMPLETION_POOL_H_
+#define CMDEX_COMPLETION_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/completer_registry.h"
+#include "cmdEx/completion.h"
+
+// One line being completed on a CompletionPool: its completers are tried in
+// turn, as CompleterRegistry::Complete() does, on one of the pool's threads.
+// Or if the registry merges results for the line, they're each run at once,
+// on as many threads as there are, and what each finds is merged as it comes
+// in. What they publish along the way can be picked up while they run.
+class CompletionRequest : public CompletionProgressInterface {
+ public:
+  // Stops it at the completer's next IsCancelled() check. Nothing more is
+  // published after this, and it finishes with no results.
+  void Cancel();
+
+  // Waits up to |timeout_ms| for it to finish. Returns whether it has.
+  bool Wait(int timeout_ms);
+
+  // If there are results newer than |*version| (which starts at 0), copies
+  // them to |output|, updates |*version|, and returns true. |*finished| is
+  // whether they're the final ones.
+  bool GetResults(int* version, CompleterOutput* output, bool* finished);
+
+  // CompletionProgressInterface:
+  bool IsCancelled() override;
+  void Publish(const CompleterOutput& output) override;
+
+ private:
+  friend class CompletionPool;
+
+  CompletionRequest(const vector<Completer>& completers,
+                    const CompleterInput& input,
+                    bool merge,
+                    const function<void()>& notify);
+  CompletionRequest(const CompletionRequest&);
+  void operator=(const CompletionRequest&);
+
+  // When merging, what one of the completers reports to.
+  struct Part : public CompletionProgressInterface {
+    bool IsCancelled() override;
+    void Publish(const CompleterOutput& output) override;
+
+    CompletionRequest* request;
+    size_t index;
+    // The rest are guarded by the request's mutex_. What it's published or
+    // finished with, sorted unless it's ranked by |scores|.
+    vector<wstring> results;
+    vector<int> scores;
+    bool trailing_space;
+    bool succeeded;
+  };
+
+  // Called on the pool's threads, with the index of the completer to run
+  // when merging, or -1 to try them all in turn.
+  void Run(int part);
+  void Finish(bool succeeded, const CompleterOutput& output);
+  // Records what the |index|th part has found so far, or finished with, and
+  // merges it with the rest. |results| are sorted unless they're ranked by
+  // |scores|, and both are taken.
+  void UpdatePart(size_t index,
+                  vector<wstring>* results,
+                  vector<int>* scores,
+                  bool trailing_space,
+                  bool succeeded,
+                  bool finished);
+  // Merges the parts into results_, taking their results if they're all
+  // finished.
+  void MergeParts();
+
+  vector<Completer> completers_;
+  CompleterInput input_;
+  function<void()> notify_;
+  atomic<bool> cancelled_;
+  // Empty unless merging.
+  vector<unique_ptr<Part>> parts_;
+
+  // Guards everything below.
+  mutex mutex_;
+  condition_variable finished_changed_;
+  vector<wstring> results_;
+  vector<int> scores_;
+  bool trailing_space_;
+  // Incremented each time results_ changes.
+  int version_;
+  bool finished_;
+  // When merging, how many of parts_ haven't finished.
+  size_t unfinished_parts_;
+};
+
+// Runs completion in the background, so that a completer that's slow (a big
+// build directory, or a slow share) doesn't stop input being handled. Unless
+// it's merging, each request runs on one thread, so then there only needs to
+// be more than one if a completer could keep going for a while after it's
+// been cancelled.
+class CompletionPool {
+ public:
+  // |notify| is called, on one of the pool's threads, whenever a request has
+  // new results.
+  CompletionPool(int num_threads, const function<void()>& notify);
+  // Cancels everything, and waits for it to stop.
+  ~CompletionPool();
+
+  // Starts completing |input| with the completers |registry| has for it.
+  // |registry| doesn't have to outlive the request.
+  shared_ptr<CompletionRequest> Start(const CompleterRegistry& registry,
+                                      const CompleterInput& input);
+
+  // For tests: waits until every request that's been started has finished.
+  void WaitForIdle();
+
+ private:
+  CompletionPool(const CompletionPool&);
+  void operator=(const CompletionPool&);
+
+  void Run();
+
+  int num_threads_;
+  function<void()> notify_;
+
+  // Guards everything below.
+  mutex mutex_;
+  // A request, and which of its parts to run (see CompletionRequest::Run()).
+  struct Task {
+    shared_ptr<CompletionRequest> request;
+    int part;
+  };
+
+  // Signalled when there's a task for a thread to run.
+  condition_variable wake_;
+  // Signalled when a thread finishes a request.
+  condition_variable idle_;
+  // Started on the first Start(), so that nothing waits on them before then
+  // (e.g. while holding the loader lock in DllMain).
+  vector<thread> threads_;
+  deque<Task> queue_;
+  vector<shared_ptr<CompletionRequest>> running_;
+  bool stopping_;
+};
+
+#endif  // CMDEX_COMPLETION_POOL_H_
@@ -0,0 +1,285 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/completion_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+CompletionGate g_gate;
+atomic<bool> g_saw_cancel;
+atomic<bool> g_stubborn_started;
+
+bool FastCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"fast");
+  return true;
+}
+
+bool FailingCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"failed");
+  output->Publish();
+  return false;
+}
+
+bool StreamingCompleter(const CompleterInput& input,
+                        CompleterOutput* output) {
+  output->results.push_back(L"a");
+  output->trailing_space = false;
+  output->Publish();
+  if (!g_gate.Wait(output)) {
+    g_saw_cancel = true;
+    return false;
+  }
+  output->results.push_back(L"b");
+  return true;
+}
+
+// As fuzzy matching would, publishing its best so far, and then finding a
+// better one.
+bool RankedStreamingCompleter(const CompleterInput& input,
+                              CompleterOutput* output) {
+  output->results.push_back(L"zz");
+  output->scores.push_back(5);
+  output->Publish();
+  if (!g_gate.Wait(output))
+    return false;
+  output->results.insert(output->results.begin(), L"ab");
+  output->scores.insert(output->scores.begin(), 10);
+  return true;
+}
+
+bool StubbornCompleter(const CompleterInput& input, CompleterOutput* output) {
+  g_stubborn_started = true;
+  g_gate.Wait(NULL);
+  output->results.push_back(L"stubborn");
+  return true;
+}
+
+CompleterInput MakeInput() {
+  CompleterInput input;
+  CompletionBreakIntoWords(L"x y", &input.word_data);
+  input.word_index = 1;
+  input.position_in_word = 1;
+  return input;
+}
+
+vector<wstring> GetFinalResults(CompletionRequest* request) {
+  EXPECT_TRUE(request->Wait(5000));
+  int version = 0;
+  CompleterOutput output;
+  bool finished = false;
+  EXPECT_TRUE(request->GetResults(&version, &output, &finished));
+  EXPECT_TRUE(finished);
+  return output.results;
+}
+
+TEST(CompletionPoolTest, Complete) {
+  CompletionPool pool(1, nullptr);
+  CompleterRegistry registry;
+  registry.RegisterFallback(FailingCompleter);
+  registry.RegisterFallback(FastCompleter);
+  shared_ptr<CompletionRequest> request = pool.Start(registry, MakeInput());
+  // What the failing one published is gone.
+  EXPECT_EQ(vector<wstring>(1, L"fast"), GetFinalResults(request.get()));
+
+  CompleterRegistry nothing;
+  request = pool.Start(nothing, MakeInput());
+  EXPECT_TRUE(GetFinalResults(request.get()).empty());
+}
+
+TEST(CompletionPoolTest, StreamsResults) {
+  atomic<int> notified(0);
+  CompletionPool pool(1, [&notified] { ++notified; });
+  CompleterRegistry registry;
+  registry.RegisterFallback(StreamingCompleter);
+  g_gate.Close();
+  shared_ptr<CompletionRequest> request = pool.Start(registry, MakeInput());
+  EXPECT_FALSE(request->Wait(10));
+
+  int version = 0;
+  CompleterOutput output;
+  bool finished = true;
+  while (!request->GetResults(&version, &output, &finished))
+    this_thread::sleep_for(chrono::milliseconds(1));
+  EXPECT_FALSE(finished);
+  EXPECT_EQ(vector<wstring>(1, L"a"), output.results);
+  EXPECT_FALSE(output.trailing_space);
+  EXPECT_FALSE(request->GetResults(&version, &output, &finished));
+
+  g_gate.Open();
+  EXPECT_TRUE(request->Wait(5000));
+  EXPECT_TRUE(request->GetResults(&version, &output, &finished));
+  EXPECT_TRUE(finished);
+  ASSERT_EQ(2u, output.results.size());
+  EXPECT_EQ(L"b", output.results[1]);
+  pool.WaitForIdle();
+  EXPECT_EQ(2, notified);
+}
+
+TEST(CompletionPoolTest, Cancel) {
+  CompletionPool pool(1, nullptr);
+  CompleterRegistry registry;
+  registry.RegisterFallback(StreamingCompleter);
+  registry.RegisterFallback(FastCompleter);
+  g_gate.Close();
+  g_saw_cancel = false;
+  shared_ptr<CompletionRequest> request = pool.Start(registry, MakeInput());
+  EXPECT_FALSE(request->Wait(10));
+  request->Cancel();
+  // Nothing, not even the ones after it.
+  EXPECT_TRUE(GetFinalResults(request.get()).empty());
+  EXPECT_TRUE(g_saw_cancel);
+  g_gate.Open();
+}
+
+TEST(CompletionPoolTest, CancelledDoesntHoldUpNext) {
+  CompletionPool pool(2, nullptr);
+  CompleterRegistry stubborn;
+  stubborn.RegisterFallback(StubbornCompleter);
+  CompleterRegistry fast;
+  fast.RegisterFallback(FastCompleter);
+  g_gate.Close();
+  g_stubborn_started = false;
+  shared_ptr<CompletionRequest> first = pool.Start(stubborn, MakeInput());
+  while (!g_stubborn_started)
+    this_thread::sleep_for(chrono::milliseconds(1));
+  first->Cancel();
+  shared_ptr<CompletionRequest> second = pool.Start(fast, MakeInput());
+  EXPECT_EQ(vector<wstring>(1, L"fast"), GetFinalResults(second.get()));
+  EXPECT_FALSE(first->Wait(0));
+  g_gate.Open();
+  EXPECT_TRUE(GetFinalResults(first.get()).empty());
+}
+
+atomic<int> g_waiting;
+
+// Each of these only finishes once both are running.
+bool WaitForOtherCompleter(const wchar_t* result, CompleterOutput* output) {
+  output->results.push_back(result);
+  output->Publish();
+  ++g_waiting;
+  while (g_waiting < 2) {
+    if (output->IsCancelled())
+      return false;
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  output->results.push_back(wstring(result) + L"2");
+  return true;
+}
+
+bool LeftCompleter(const CompleterInput& input, CompleterOutput* output) {
+  return WaitForOtherCompleter(L"left", output);
+}
+
+bool RightCompleter(const CompleterInput& input, CompleterOutput* output) {
+  output->trailing_space = false;
+  return WaitForOtherCompleter(L"right", output);
+}
+
+TEST(CompletionPoolTest, MergeRunsAtOnce) {
+  CompletionPool pool(2, nullptr);
+  CompleterRegistry registry;
+  registry.RegisterFallback(FailingCompleter);
+  registry.RegisterFallback(RightCompleter);
+  registry.RegisterFallback(LeftCompleter);
+  registry.RegisterFallback(FastCompleter);
+  registry.MergeResultsForWord(1);
+  g_waiting = 0;
+  shared_ptr<CompletionRequest> request = pool.Start(registry, MakeInput());
+  vector<wstring> results = GetFinalResults(request.get());
+  ASSERT_EQ(5u, results.size());
+  EXPECT_EQ(L"fast", results[0]);
+  EXPECT_EQ(L"left", results[1]);
+  EXPECT_EQ(L"left2", results[2]);
+  EXPECT_EQ(L"right", results[3]);
+  EXPECT_EQ(L"right2", results[4]);
+  int version = 0;
+  CompleterOutput output;
+  bool finished;
+  request->GetResults(&version, &output, &finished);
+  EXPECT_FALSE(output.trailing_space);
+}
+
+TEST(CompletionPoolTest, MergeStreamsResults) {
+  CompletionPool pool(2, nullptr);
+  CompleterRegistry registry;
+  registry.RegisterFallback(StreamingCompleter);
+  registry.RegisterFallback(FastCompleter);
+  registry.MergeResultsForWord(1);
+  g_gate.Close();
+  shared_ptr<CompletionRequest> request = pool.Start(registry, MakeInput());
+
+  // Both what the finished one found, and what the other's found so far.
+  int version = 0;
+  CompleterOutput output;
+  bool finished = true;
+  while (output.results.size() < 2) {
+    EXPECT_FALSE(request->Wait(1));
+    request->GetResults(&version, &output, &finished);
+  }
+  EXPECT_FALSE(finished);
+  EXPECT_EQ(L"a", output.results[0]);
+  EXPECT_EQ(L"fast", output.results[1]);
+
+  g_gate.Open();
+  vector<wstring> results = GetFinalResults(request.get());
+  ASSERT_EQ(3u, results.size());
+  EXPECT_EQ(L"b", results[1]);
+}
+
+TEST(CompletionPoolTest, MergeRanked) {
+  CompletionPool pool(2, nullptr);
+  CompleterRegistry registry;
+  registry.RegisterFallback(FastCompleter);
+  registry.RegisterFallback(RankedStreamingCompleter);
+  registry.MergeResultsForWord(1);
+  g_gate.Close();
+  shared_ptr<CompletionRequest> request = pool.Start(registry, MakeInput());
+
+  // What's ranked goes first, while it's still going, and after.
+  int version = 0;
+  CompleterOutput output;
+  bool finished = true;
+  while (output.results.size() < 2) {
+    EXPECT_FALSE(request->Wait(1));
+    request->GetResults(&version, &output, &finished);
+  }
+  EXPECT_FALSE(finished);
+  EXPECT_EQ(L"zz", output.results[0]);
+  EXPECT_EQ(L"fast", output.results[1]);
+  EXPECT_EQ((vector<int>{5, 0}), output.scores);
+
+  g_gate.Open();
+  EXPECT_TRUE(request->Wait(5000));
+  EXPECT_TRUE(request->GetResults(&version, &output, &finished));
+  EXPECT_TRUE(finished);
+  ASSERT_EQ(3u, output.results.size());
+  EXPECT_EQ(L"ab", output.results[0]);
+  EXPECT_EQ(L"zz", output.results[1]);
+  EXPECT_EQ((vector<int>{10, 5, 0}), output.scores);
+}
+
+TEST(CompletionPoolTest, DestroyCancels) {
+  shared_ptr<CompletionRequest> running;
+  shared_ptr<CompletionRequest> queued;
+  {
+    CompletionPool pool(1, nullptr);
+    CompleterRegistry registry;
+    registry.RegisterFallback(StreamingCompleter);
+    g_gate.Close();
+    running = pool.Start(registry, MakeInput());
+    queued = pool.Start(registry, MakeInput());
+  }
+  EXPECT_TRUE(GetFinalResults(running.get()).empty());
+  EXPECT_TRUE(GetFinalResults(queued.get()).empty());
+  g_gate.Open();
+}
+
+}  // namespace
@@ -4,6 +4,10 @@
 
 #include "cmdEx/completion.h"
 
+#include <stdio.h>
+
+#include "cmdEx/fuzzy_match.h"
+#include "cmdEx/perf_timer.h"
 #include "gtest/gtest.h"
 
 // Some tests based on:
@@ -242,6 +246,234 @@ TEST(CompletionTest, MergeStartingSlashWithTrailingQuote) {
   EXPECT_EQ(L"\"C:\\Program Files (x86)\"\\", words[0].original_word);
 }
 
+// The rules CommandLineToArgvW follows, as lines and the words (de-escaped)
+// that they should be split into.
+struct QuotingRule {
+  const wchar_t* line;
+  const wchar_t* words[5];
+};
+
+const QuotingRule kQuotingRules[] = {
+  // Splitting on space and tab only.
+  {L"exe a  b\tc", {L"exe", L"a", L"b", L"c"}},
+  {L"exe a\rb\nc", {L"exe", L"a\rb\nc"}},
+  // Quotes group, and can start or end part way through a word.
+  {L"exe \"a b\" c", {L"exe", L"a b", L"c"}},
+  {L"exe a\"b c\"d", {L"exe", L"ab cd"}},
+  {L"exe \"a b", {L"exe", L"a b"}},
+  {L"exe \"\"", {L"exe", L""}},
+  // Backslashes are only special before a quote.
+  {L"exe a\\b a\\\\b", {L"exe", L"a\\b", L"a\\\\b"}},
+  {L"exe \\\"a", {L"exe", L"\"a"}},
+  {L"exe \\\\\"a b\"", {L"exe", L"\\a b"}},
+  {L"exe \\\\\\\"a b", {L"exe", L"\\\"a", L"b"}},
+  {L"exe \"a\\\\\" b", {L"exe", L"a\\", L"b"}},
+  // Runs of quotes.
+  {L"exe a\"\"b", {L"exe", L"ab"}},
+  {L"exe a\"\"\"b c", {L"exe", L"a\"b", L"c"}},
+  {L"exe a\"\"\"\" b\"", {L"exe", L"a\" b"}},
+  {L"exe \"a\"\"b c", {L"exe", L"a\"b", L"c"}},
+  {L"exe \"a\\\"\"\" b", {L"exe", L"a\"\"", L"b"}},
+  // The executable is only split on space and tab, or quoted without
+  // escaping.
+  {L"a\\\"b c", {L"a\\\"b", L"c"}},
+  {L"\"a b\\\" c", {L"a b\\", L"c"}},
+  {L"\"a b\"c d", {L"a b", L"c", L"d"}},
+  {L" a", {L"", L"a"}},
+  // Extensions for completion.
+  {L"", {L""}},
+  {L"exe a ", {L"exe", L"a", L""}},
+  {L"\"a b\"\\c d", {L"a b\\c", L"d"}},
+};
+
+TEST(CompletionTest, QuotingRules) {
+  TokenizedLine tokenized;
+  for (const auto& rule : kQuotingRules) {
+    SCOPED_TRACE(testing::Message() << "line: " << rule.line);
+    wstring line(rule.line);
+    TokenizeCommandLine(line.data(), line.size(), &tokenized);
+    size_t num_words = 0;
+    while (num_words < 5 && rule.words[num_words])
+      ++num_words;
+    ASSERT_EQ(num_words, tokenized.size());
+    int end = 0;
+    for (size_t i = 0; i < num_words; ++i) {
+      EXPECT_EQ(rule.words[i], tokenized.deescaped_word(i).as_string());
+      // Words are in order.
+      const CommandLineToken& token = tokenized.tokens[i];
+      EXPECT_LE(end, token.original_offset);
+      end = token.original_offset + token.original_length;
+    }
+  }
+}
+
+TEST(CompletionTest, TokenizeOffsets) {
+  wstring line(L"\"a b\"\\c  \"d e\\\"\" f ");
+  TokenizedLine tokenized;
+  TokenizeCommandLine(line.data(), line.size(), &tokenized);
+  ASSERT_EQ(4u, tokenized.size());
+  EXPECT_EQ(L"\"a b\"\\c", tokenized.original_word(0).as_string());
+  EXPECT_EQ(0, tokenized.tokens[0].original_offset);
+  EXPECT_EQ(L"\"d e\\\"\"", tokenized.original_word(1).as_string());
+  EXPECT_EQ(L"d e\"", tokenized.deescaped_word(1).as_string());
+  EXPECT_EQ(9, tokenized.tokens[1].original_offset);
+  EXPECT_EQ(L"f", tokenized.original_word(2).as_string());
+  EXPECT_EQ(17, tokenized.tokens[2].original_offset);
+  EXPECT_EQ(19, tokenized.tokens[3].original_offset);
+  EXPECT_EQ(0, tokenized.tokens[3].original_length);
+
+  // Storage is reused.
+  const wchar_t* deescaped = tokenized.deescaped.data();
+  TokenizeCommandLine(line.data(), 5, &tokenized);
+  ASSERT_EQ(1u, tokenized.size());
+  EXPECT_EQ(L"a b", tokenized.deescaped_word(0).as_string());
+  EXPECT_EQ(deescaped, tokenized.deescaped.data());
+}
+
+TEST(CompletionTest, DISABLED_PerfTokenize) {
+  wstring line(L"git log --format=\"%h %an %s\" --since=\"2 weeks ago\" "
+               L"-- \"C:\\Program Files (x86)\\Some Thing\\\\\" src\\cmdEx\\ "
+               L"&& ninja -C out\\Release cmdEx_tests && echo \"\"\"done\"");
+  const int kIterations = 100000;
+  TokenizedLine tokenized;
+  PerfTimer timer;
+  for (int i = 0; i < kIterations; ++i)
+    TokenizeCommandLine(line.data(), line.size(), &tokenized);
+  printf("TokenizeCommandLine: %.3fus per line\n",
+         timer.ElapsedMs() * 1000 / kIterations);
+  PerfTimer copy_timer;
+  for (int i = 0; i < kIterations; ++i) {
+    vector<WordData> words;
+    CompletionBreakIntoWords(line, &words);
+  }
+  printf("CompletionBreakIntoWords: %.3fus per line\n",
+         copy_timer.ElapsedMs() * 1000 / kIterations);
+}
+
+void ExpectSameTokens(const wstring& line, const LineTokens& tokens) {
+  TokenizedLine tokenized;
+  TokenizeCommandLine(line.data(), line.size(), &tokenized);
+  ASSERT_EQ(tokenized.size(), tokens.size());
+  for (size_t i = 0; i < tokenized.size(); ++i) {
+    EXPECT_EQ(tokenized.tokens[i].original_offset, tokens.original_offset(i));
+    EXPECT_EQ(tokenized.original_word(i).as_string(),
+              tokens.original_word(i).as_string());
+    EXPECT_EQ(tokenized.deescaped_word(i).as_string(),
+              tokens.deescaped_word(i).as_string());
+  }
+}
+
+TEST(CompletionTest, LineTokensMatchesTokenizing) {
+  // Random edits of random lines, made mostly of the characters that
+  // matter.
+  const wchar_t kChars[] = L"ab  \t\\\"\"";
+  unsigned int seed = 1;
+  auto random = [&seed](int n) {
+    seed = seed * 1103515245 + 12345;
+    return static_cast<int>((seed >> 16) % n);
+  };
+  for (int lines = 0; lines < 200; ++lines) {
+    wstring line;
+    LineTokens tokens(&line);
+    for (int edits = 0; edits < 50; ++edits) {
+      int offset = random(static_cast<int>(line.size()) + 1);
+      int removed = random(3) == 0
+                        ? random(static_cast<int>(line.size()) - offset + 1)
+                        : 0;
+      wstring inserted;
+      for (int i = random(4); i > 0; --i)
+        inserted.push_back(kChars[random(sizeof(kChars) / sizeof(wchar_t) - 1)]);
+      line.replace(offset, removed, inserted);
+      tokens.Update(offset, removed, static_cast<int>(inserted.size()));
+      SCOPED_TRACE(testing::Message() << "line: [" << line << "]");
+      ExpectSameTokens(line, tokens);
+      if (HasFailure())
+        return;
+    }
+  }
+}
+
+TEST(CompletionTest, LineTokensOnlyLexesAroundEdits) {
+  wstring line(L"exe");
+  for (int i = 0; i < 1000; ++i)
+    line += L" word";
+  LineTokens tokens(&line);
+  size_t lexed = tokens.lexed_count();
+
+  // Typing in a word only lexes that word.
+  line.insert(10, L"x");
+  tokens.Update(10, 0, 1);
+  EXPECT_EQ(5u, tokens.lexed_count() - lexed);
+  lexed = tokens.lexed_count();
+  line.insert(11, L" ");
+  tokens.Update(11, 0, 1);
+  EXPECT_EQ(6u, tokens.lexed_count() - lexed);
+  lexed = tokens.lexed_count();
+  ExpectSameTokens(line, tokens);
+
+  // Opening a quote changes how the rest of the line splits.
+  line.insert(20, L"\"");
+  tokens.Update(20, 0, 1);
+  EXPECT_EQ(line.size() - 16, tokens.lexed_count() - lexed);
+  EXPECT_EQ(5u, tokens.size());
+  lexed = tokens.lexed_count();
+  // As does closing it again.
+  line.insert(22, L"\"");
+  tokens.Update(22, 0, 1);
+  EXPECT_EQ(line.size() - 16, tokens.lexed_count() - lexed);
+  EXPECT_EQ(1001u, tokens.size());
+  lexed = tokens.lexed_count();
+  // But after that, it's back to one word.
+  line.insert(30, L"x");
+  tokens.Update(30, 0, 1);
+  EXPECT_EQ(5u, tokens.lexed_count() - lexed);
+  ExpectSameTokens(line, tokens);
+
+  line.erase(4, line.size() - 8);
+  tokens.Update(4, static_cast<int>(line.size()) - 8, 0);
+  ExpectSameTokens(line, tokens);
+}
+
+TEST(CompletionTest, DISABLED_PerfLineTokens) {
+  // Typing a word into the middle, and then at the end, of ever longer
+  // lines, which should cost the same per key however long they are.
+  for (size_t size = 1024; size <= 8192; size *= 2) {
+    wstring line(L"echo");
+    while (line.size() < size)
+      line += L" \"C:\\Program Files\\x\" src\\cmdEx";
+    LineTokens tokens(&line);
+    // Type a word and a space, and then delete them.
+    const int kWords = 5000;
+    const wchar_t kTyped[] = L"typed ";
+    const int kTypedSize = sizeof(kTyped) / sizeof(wchar_t) - 1;
+    const int kKeys = kWords * (kTypedSize + 1);
+    double ms[2];
+    for (int at_end = 0; at_end < 2; ++at_end) {
+      int start = static_cast<int>(at_end ? line.size() : line.size() / 2);
+      PerfTimer timer;
+      for (int i = 0; i < kWords; ++i) {
+        for (int j = 0; j < kTypedSize; ++j) {
+          line.insert(start + j, 1, kTyped[j]);
+          tokens.Update(start + j, 0, 1);
+        }
+        line.erase(start, kTypedSize);
+        tokens.Update(start, kTypedSize, 0);
+      }
+      ms[at_end] = timer.ElapsedMs();
+    }
+    PerfTimer full_timer;
+    TokenizedLine tokenized;
+    for (int i = 0; i < kKeys; ++i)
+      TokenizeCommandLine(line.data(), line.size(), &tokenized);
+    printf("%5zu chars: %.3fus per key in the middle, %.3fus at the end, "
+           "%.3fus to tokenize it all\n",
+           line.size(),
+           ms[0] * 1000 / kKeys,
+           ms[1] * 1000 / kKeys,
+           full_timer.ElapsedMs() * 1000 / kKeys);
+  }
+}
+
 TEST(CompletionTest, Quoting) {
   EXPECT_EQ(L"stuff", QuoteWord(L"stuff"));
   EXPECT_EQ(L"\"st uff\"", QuoteWord(L"st uff"));
@@ -292,3 +524,221 @@ TEST(CompletionTest, WordsToCommandsVariousSeparators) {
 // TODO
 // - special executable handling
 // - ^ escape not handled
+
+vector<wstring> Words(const wchar_t* words) {
+  vector<wstring> result;
+  for (const auto& word : StringSplit(words, L' ')) {
+    if (!word.empty())
+      result.push_back(word);
+  }
+  return result;
+}
+
+TEST(CompletionTest, FilterCompletions) {
+  vector<wstring> candidates = Words(L"Git gitk git g GIT-lfs notepad");
+  vector<wstring> results(1, L"already");
+  FilterCompletions(candidates, L"git", false, &results);
+  EXPECT_EQ(Words(L"already gitk git"), results);
+
+  results.clear();
+  FilterCompletions(candidates, L"git", true, &results);
+  EXPECT_EQ(Words(L"Git gitk git GIT-lfs"), results);
+
+  results.clear();
+  FilterCompletions(candidates, L"", false, &results);
+  EXPECT_EQ(candidates, results);
+}
+
+TEST(CompletionTest, MergeCompletions) {
+  vector<vector<wstring>> streams;
+  streams.push_back(Words(L"cmake Cmd cmd git"));
+  streams.push_back(Words(L"CMD cl"));
+  streams.push_back(Words(L""));
+  streams.push_back(Words(L"zip cmake Git"));
+  for (auto& stream : streams)
+    SortCompletions(&stream);
+  EXPECT_EQ(Words(L"cmake Cmd cmd git"), streams[0]);
+  EXPECT_EQ(Words(L"cl CMD"), streams[1]);
+  EXPECT_EQ(Words(L"cmake Git zip"), streams[3]);
+  vector<wstring> merged;
+  MergeCompletions(&streams, &merged);
+  // Sorted ignoring case, and where there's more than one the same but for
+  // case, the first stream's first.
+  EXPECT_EQ(Words(L"cl cmake Cmd git zip"), merged);
+
+  streams.clear();
+  MergeCompletions(&streams, &merged);
+  EXPECT_TRUE(merged.empty());
+}
+
+TEST(CompletionTest, AddCompletions) {
+  PackedCandidates candidates(Words(L"git-commit Git gitk cmake cargo"));
+  CompleterOutput output;
+  AddCompletions(candidates, L"GI", false, &output);
+  EXPECT_EQ(Words(L"git-commit Git gitk"), output.results);
+  EXPECT_TRUE(output.scores.empty());
+
+  // Best first, and only what it's a subsequence of.
+  output.Reset();
+  AddCompletions(candidates, L"gc", true, &output);
+  EXPECT_EQ(Words(L"git-commit"), output.results);
+  ASSERT_EQ(1u, output.scores.size());
+  EXPECT_EQ(FuzzyScore(L"git-commit", L"gc"), output.scores[0]);
+
+  output.Reset();
+  AddCompletions(candidates, L"cm", true, &output);
+  EXPECT_EQ(Words(L"cmake git-commit"), output.results);
+  ASSERT_EQ(2u, output.scores.size());
+  EXPECT_GT(output.scores[0], output.scores[1]);
+
+  // Passing over those that lack some of the word's characters (ignoring
+  // case) ranks the same as scoring them all.
+  output.Reset();
+  AddCompletions(candidates, L"G-C", true, &output);
+  CompleterOutput all;
+  AddFuzzyCompletions(
+      candidates.size(),
+      [&candidates](size_t i) {
+        return WStringPiece(candidates.data(i), candidates.length(i));
+      },
+      L"G-C",
+      L"",
+      &all);
+  EXPECT_EQ(Words(L"git-commit"), output.results);
+  EXPECT_EQ(all.results, output.results);
+  EXPECT_EQ(all.scores, output.scores);
+
+  // Nothing to rank by.
+  output.Reset();
+  AddCompletions(candidates, L"", true, &output);
+  EXPECT_EQ(Words(L"git-commit Git gitk cmake cargo"), output.results);
+  EXPECT_TRUE(output.scores.empty());
+}
+
+TEST(CompletionTest, AddFuzzyCompletions) {
+  vector<wstring> names = Words(L"readme.txt src build.ninja x");
+  auto name = [&names](size_t i) {
+    return i == 3 ? WStringPiece() : WStringPiece(names[i]);
+  };
+  CompleterOutput output;
+  output.results.push_back(L"unranked");
+  AddFuzzyCompletions(names.size(), name, L"r", L"dir\\", &output);
+  // Ranked ahead of what was there without a score, which scores nothing.
+  EXPECT_EQ(Words(L"dir\\readme.txt dir\\src unranked"), output.results);
+  ASSERT_EQ(3u, output.scores.size());
+  EXPECT_EQ(0, output.scores[2]);
+
+  // Merged with what's there by score, with ties going to what was there.
+  AddFuzzyCompletions(names.size(), name, L"r", L"", &output);
+  EXPECT_EQ(Words(L"dir\\readme.txt readme.txt dir\\src src unranked"),
+            output.results);
+
+  // No more than the most there can be.
+  output.Reset();
+  vector<wstring> many(kMaxFuzzyResults + 10, L"abc");
+  for (int i = 0; i < 2; ++i) {
+    AddFuzzyCompletions(many.size(),
+                        [&many](size_t j) { return WStringPiece(many[j]); },
+                        L"ac",
+                        L"",
+                        &output);
+  }
+  EXPECT_EQ(kMaxFuzzyResults, output.results.size());
+  EXPECT_EQ(kMaxFuzzyResults, output.scores.size());
+}
+
+TEST(CompletionTest, MergeRankedCompletions) {
+  vector<vector<wstring>> streams;
+  streams.push_back(Words(L"gitk git-gui"));
+  streams.push_back(Words(L"cl CMD"));
+  streams.push_back(Words(L"GITK gc"));
+  vector<vector<int>> scores;
+  scores.push_back({50, 20});
+  scores.push_back({});
+  scores.push_back({50, 30});
+  vector<wstring> merged;
+  vector<int> merged_scores;
+  MergeCompletions(&streams, scores, &merged, &merged_scores);
+  // Best first, the earlier stream's first between equals, and those that
+  // weren't ranked last.
+  EXPECT_EQ(Words(L"gitk gc git-gui cl CMD"), merged);
+  EXPECT_EQ((vector<int>{50, 30, 20, 0, 0}), merged_scores);
+
+  // None ranked is as before.
+  streams.clear();
+  streams.push_back(Words(L"b c"));
+  streams.push_back(Words(L"a"));
+  MergeCompletions(&streams, vector<vector<int>>(2), &merged, &merged_scores);
+  EXPECT_EQ(Words(L"a b c"), merged);
+  EXPECT_TRUE(merged_scores.empty());
+}
+
+TEST(CompletionTest, DISABLED_PerfMergeCompletions) {
+  // About as many as there are commands in a well-stocked PATH, and files in
+  // a big directory.
+  vector<wstring> commands;
+  for (int i = 0; i < 5000; ++i)
+    commands.push_back(L"command" + to_wstring(i * 7 % 5000) + L"_tool");
+  vector<wstring> files;
+  for (int i = 0; i < 20000; ++i)
+    files.push_back(L"File" + to_wstring(i * 13 % 20000) + L".txt");
+  const int kIterations = 20;
+  double sort_ms = 0;
+  double merge_ms = 0;
+  vector<wstring> merged;
+  for (int i = 0; i < kIterations; ++i) {
+    vector<vector<wstring>> streams;
+    streams.push_back(commands);
+    streams.push_back(files);
+    streams.push_back(commands);
+    PerfTimer sort_timer;
+    for (auto& stream : streams)
+      SortCompletions(&stream);
+    sort_ms += sort_timer.ElapsedMs();
+    PerfTimer merge_timer;
+    MergeCompletions(&streams, &merged);
+    merge_ms += merge_timer.ElapsedMs();
+  }
+  printf("%zu merged: sorting %.2fms, merging %.2fms\n",
+         merged.size(),
+         sort_ms / kIterations,
+         merge_ms / kIterations);
+}
+
+TEST(CompletionTest, DISABLED_PerfFuzzyCompletions) {
+  // About what a big build has in targets, as ninja lists them.
+  const wchar_t* kDirectories[] = {
+    L"obj/chrome/browser/ui/views/", L"obj/content/renderer/",
+    L"obj/third_party/blink/renderer/core/", L"gen/components/",
+  };
+  const int kTargets = 200000;
+  vector<wstring> targets;
+  for (int i = 0; i < kTargets; ++i) {
+    targets.push_back(
+        kDirectories[i % (sizeof(kDirectories) / sizeof(kDirectories[0]))] +
+        wstring(L"file") + to_wstring(i * 7919LL % kTargets) + L".obj");
+  }
+  PackedCandidates candidates(targets);
+  const wchar_t* kQueries[] = {
+    L"o", L"ob", L"views", L"cbuv", L"rend1234", L"blinkcore99", L"gen/x",
+  };
+  const int kIterations = 5;
+  double worst = 0;
+  CompleterOutput output;
+  for (const auto& query : kQueries) {
+    double slowest = 0;
+    for (int i = 0; i < kIterations; ++i) {
+      output.Reset();
+      PerfTimer timer;
+      AddCompletions(candidates, query, true, &output);
+      slowest = max(slowest, timer.ElapsedMs());
+    }
+    printf("%-12ls %zu %.2fms\n", query, output.results.size(), slowest);
+    worst = max(worst, slowest);
+  }
+  printf("%d targets: worst %.2fms\n", kTargets, worst);
+  // Within a frame.
+  if (kCheckPerfBudgets) {
+    EXPECT_GT(16.0, worst);
+  }
+}
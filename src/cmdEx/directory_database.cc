@@ -0,0 +1,413 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/directory_database.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "cmdEx/history_file.h"
+#include "common/util.h"
+
+namespace {
+
+const uint32_t kMagic = 0x44445843;  // "CXDD".
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 12;
+// Rank, last visit and the size of the path.
+const size_t kEntryHeaderSize = 8 + 8 + 4;
+
+// Don't bother compacting tiny databases.
+const size_t kMinCompactSize = 1024;
+
+// Find() looks at every entry once the components it would otherwise look
+// at are more than this fraction of them.
+const size_t kScanFraction = 8;
+
+const int64_t kHour = 60 * 60;
+const int64_t kDay = 24 * kHour;
+const int64_t kWeek = 7 * kDay;
+
+bool IsSeparator(char c) {
+  return c == '\\' || c == '/';
+}
+
+string ToLower(const string& str) {
+  string result(str);
+  for (auto& c : result) {
+    if (c >= 'A' && c <= 'Z')
+      c = static_cast<char>(c - 'A' + 'a');
+  }
+  return result;
+}
+
+// Where the last component of |path| starts and ends, ignoring trailing
+// separators. A root (e.g. "c:\") is its own last component.
+void FindLastComponent(const string& path, size_t* begin, size_t* end) {
+  *end = path.size();
+  while (*end > 0 && IsSeparator(path[*end - 1]))
+    --*end;
+  *begin = *end;
+  while (*begin > 0 && !IsSeparator(path[*begin - 1]))
+    --*begin;
+  if (*begin == *end) {
+    *begin = 0;
+    *end = path.size();
+  }
+}
+
+uint32_t GramKey(const char* gram, size_t size) {
+  uint32_t key = static_cast<uint32_t>(size) << 24;
+  for (size_t i = 0; i < size; ++i)
+    key |= static_cast<uint32_t>(static_cast<unsigned char>(gram[i]))
+           << (16 - 8 * i);
+  return key;
+}
+
+uint64_t DoubleBits(double value) {
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+double BitsDouble(uint64_t bits) {
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+}  // namespace
+
+DirectoryDatabase::DirectoryDatabase()
+    : max_total_rank_(10000), total_rank_(0), removed_count_(0) {}
+
+void DirectoryDatabase::Visit(const string& dir, int64_t now) {
+  if (dir.empty())
+    return;
+  lock_guard<mutex> lock(mutex_);
+  changes_.push_back(make_pair(dir, now));
+  Add(dir, 1, now);
+  if (total_rank_ > max_total_rank_)
+    Age();
+}
+
+void DirectoryDatabase::Remove(const string& dir) {
+  lock_guard<mutex> lock(mutex_);
+  changes_.push_back(make_pair(dir, static_cast<int64_t>(-1)));
+  auto it = ids_.find(ToLower(dir));
+  if (it == ids_.end())
+    return;
+  RemoveEntry(it->second);
+  CompactIfNecessary();
+}
+
+double DirectoryDatabase::GetScore(const string& dir, int64_t now) const {
+  lock_guard<mutex> lock(mutex_);
+  auto it = ids_.find(ToLower(dir));
+  if (it == ids_.end())
+    return 0;
+  const Rank& rank = ranks_[it->second];
+  return Frecency(rank.rank, rank.last_visit, now);
+}
+
+void DirectoryDatabase::Find(const vector<string>& fragments,
+                             int64_t now,
+                             size_t max_results,
+                             vector<string>* results) const {
+  results->clear();
+  vector<string> lower;
+  for (const auto& fragment : fragments) {
+    if (!fragment.empty())
+      lower.push_back(ToLower(fragment));
+  }
+  lock_guard<mutex> lock(mutex_);
+
+  // The best max_results so far, as a heap with the worst on top. An
+  // entry's score doesn't depend on the query, so checking whether it
+  // matches can be skipped unless it would make the cut.
+  struct Candidate {
+    double score;
+    int64_t last_visit;
+    int id;
+  };
+  auto better = [](const Candidate& a, const Candidate& b) {
+    if (a.score != b.score)
+      return a.score > b.score;
+    if (a.last_visit != b.last_visit)
+      return a.last_visit > b.last_visit;
+    return a.id < b.id;
+  };
+  vector<Candidate> best;
+  if (max_results == 0)
+    return;
+  auto consider = [&](int id) {
+    const Rank& rank = ranks_[id];
+    if (rank.rank <= 0)
+      return;
+    Candidate candidate = {
+        Frecency(rank.rank, rank.last_visit, now), rank.last_visit, id};
+    if (best.size() == max_results && !better(candidate, best.front()))
+      return;
+    if (!Matches(id, lower))
+      return;
+    if (best.size() == max_results) {
+      pop_heap(best.begin(), best.end(), better);
+      best.pop_back();
+    }
+    best.push_back(candidate);
+    push_heap(best.begin(), best.end(), better);
+  };
+
+  // The components that have the last fragment in them are in the postings
+  // of each of its grams, so only the shortest of those has to be checked.
+  const string* last = lower.empty() ? NULL : &lower.back();
+  const vector<int>* shortest = NULL;
+  if (last &&
+      find_if(last->begin(), last->end(), IsSeparator) == last->end()) {
+    size_t gram_size = min(last->size(), static_cast<size_t>(3));
+    for (size_t i = 0; i + gram_size <= last->size(); ++i) {
+      auto it = grams_.find(GramKey(last->data() + i, gram_size));
+      if (it == grams_.end())
+        return;
+      if (!shortest || it->second.size() < shortest->size())
+        shortest = &it->second;
+    }
+  }
+  if (!shortest || shortest->size() > entries_.size() / kScanFraction) {
+    // Going through everything is quicker than looking up that many
+    // components. Newest first, as those are likely to score best, so fewer
+    // of the rest need checking.
+    for (int id = static_cast<int>(entries_.size()); id-- > 0;)
+      consider(id);
+  } else {
+    for (const auto& component : *shortest) {
+      if (last->size() > 3 &&
+          components_[component].find(*last) == string::npos) {
+        continue;
+      }
+      for (const auto& id : component_entries_[component])
+        consider(id);
+    }
+  }
+
+  sort_heap(best.begin(), best.end(), better);
+  results->reserve(best.size());
+  for (const auto& candidate : best)
+    results->push_back(entries_[candidate.id].path);
+}
+
+size_t DirectoryDatabase::size() const {
+  lock_guard<mutex> lock(mutex_);
+  return ids_.size();
+}
+
+bool DirectoryDatabase::Load(const string& path) {
+  // Parsing doesn't age anything, so this doesn't need max_total_rank_.
+  DirectoryDatabase loaded;
+  MappedFile file;
+  bool ok = file.Open(path) && loaded.Parse(file.data(), file.size());
+  DirectoryDatabase empty;
+  lock_guard<mutex> lock(mutex_);
+  double max_total_rank = max_total_rank_;
+  MoveFrom(ok ? &loaded : &empty);
+  max_total_rank_ = max_total_rank;
+  return ok;
+}
+
+bool DirectoryDatabase::Save(const string& path) {
+  lock_guard<mutex> lock(mutex_);
+  DirectoryDatabase merged;
+  merged.max_total_rank_ = max_total_rank_;
+  // Anything unreadable there is replaced.
+  merged.Load(path);
+  for (const auto& change : changes_) {
+    if (change.second == -1)
+      merged.Remove(change.first);
+    else
+      merged.Visit(change.first, change.second);
+  }
+  merged.changes_.clear();
+  if (!WriteFileAtomically(path, merged.Serialize()))
+    return false;
+  MoveFrom(&merged);
+  return true;
+}
+
+void DirectoryDatabase::Add(const string& dir,
+                            double rank,
+                            int64_t last_visit) {
+  string lower = ToLower(dir);
+  auto inserted =
+      ids_.insert(make_pair(lower, static_cast<int>(entries_.size())));
+  total_rank_ += rank;
+  if (!inserted.second) {
+    Rank& existing = ranks_[inserted.first->second];
+    existing.rank += rank;
+    existing.last_visit = max(existing.last_visit, last_visit);
+    return;
+  }
+  size_t begin;
+  size_t end;
+  FindLastComponent(lower, &begin, &end);
+  Entry entry;
+  entry.path = dir;
+  entry.component = InternComponent(lower.substr(begin, end - begin));
+  entry.lower.swap(lower);
+  component_entries_[entry.component].push_back(inserted.first->second);
+  entries_.push_back(entry);
+  Rank new_rank = {rank, last_visit};
+  ranks_.push_back(new_rank);
+}
+
+void DirectoryDatabase::RemoveEntry(int id) {
+  total_rank_ -= ranks_[id].rank;
+  ranks_[id].rank = 0;
+  ids_.erase(entries_[id].lower);
+  ++removed_count_;
+}
+
+void DirectoryDatabase::Age() {
+  for (int id = 0; id < static_cast<int>(entries_.size()); ++id) {
+    Rank& rank = ranks_[id];
+    if (rank.rank <= 0)
+      continue;
+    total_rank_ -= rank.rank * 0.01;
+    rank.rank *= 0.99;
+    if (rank.rank < 1)
+      RemoveEntry(id);
+  }
+  CompactIfNecessary();
+}
+
+void DirectoryDatabase::CompactIfNecessary() {
+  if (entries_.size() < kMinCompactSize ||
+      removed_count_ * 2 < entries_.size()) {
+    return;
+  }
+  vector<Entry> entries;
+  vector<Rank> ranks;
+  entries.swap(entries_);
+  ranks.swap(ranks_);
+  removed_count_ = 0;
+  total_rank_ = 0;
+  ids_.clear();
+  components_.clear();
+  component_entries_.clear();
+  component_ids_.clear();
+  grams_.clear();
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (ranks[i].rank > 0)
+      Add(entries[i].path, ranks[i].rank, ranks[i].last_visit);
+  }
+}
+
+int DirectoryDatabase::InternComponent(const string& component) {
+  auto inserted = component_ids_.insert(
+      make_pair(component, static_cast<int>(components_.size())));
+  if (!inserted.second)
+    return inserted.first->second;
+  int id = inserted.first->second;
+  components_.push_back(component);
+  component_entries_.push_back(vector<int>());
+  vector<uint32_t> keys;
+  for (size_t i = 0; i < component.size(); ++i) {
+    for (size_t size = 1; size <= 3 && i + size <= component.size(); ++size)
+      keys.push_back(GramKey(component.data() + i, size));
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  for (const auto& key : keys)
+    grams_[key].push_back(id);
+  return id;
+}
+
+bool DirectoryDatabase::Matches(int id, const vector<string>& fragments) const {
+  if (fragments.empty())
+    return true;
+  const string& path = entries_[id].lower;
+  size_t pos = 0;
+  for (size_t i = 0; i + 1 < fragments.size(); ++i) {
+    size_t found = path.find(fragments[i], pos);
+    if (found == string::npos)
+      return false;
+    pos = found + fragments[i].size();
+  }
+  // The last has to end in the last component, which the last place it
+  // appears does if any does.
+  const string& last = fragments.back();
+  size_t begin;
+  size_t end;
+  FindLastComponent(path, &begin, &end);
+  size_t found = path.rfind(last);
+  return found != string::npos && found >= pos && found + last.size() > begin;
+}
+
+double DirectoryDatabase::Frecency(double rank,
+                                   int64_t last_visit,
+                                   int64_t now) {
+  int64_t age = now - last_visit;
+  if (age < kHour)
+    return rank * 4;
+  if (age < kDay)
+    return rank * 2;
+  if (age < kWeek)
+    return rank / 2;
+  return rank / 4;
+}
+
+// The file is a header (magic, version, entry count), then each entry as its
+// rank (a double), last visit, the size of its path and the path, all
+// little-endian.
+bool DirectoryDatabase::Parse(const char* data, size_t size) {
+  if (size < kHeaderSize || Get32(data) != kMagic ||
+      Get32(data + 4) != kVersion) {
+    return false;
+  }
+  size_t count = Get32(data + 8);
+  size_t pos = kHeaderSize;
+  for (size_t i = 0; i < count; ++i) {
+    if (size - pos < kEntryHeaderSize)
+      return false;
+    double rank = BitsDouble(Get64(data + pos));
+    int64_t last_visit = static_cast<int64_t>(Get64(data + pos + 8));
+    size_t path_size = Get32(data + pos + 16);
+    pos += kEntryHeaderSize;
+    if (path_size > size - pos || !(rank > 0))
+      return false;
+    Add(string(data + pos, path_size), rank, last_visit);
+    pos += path_size;
+  }
+  return true;
+}
+
+string DirectoryDatabase::Serialize() const {
+  string contents;
+  Put32(kMagic, &contents);
+  Put32(kVersion, &contents);
+  Put32(static_cast<uint32_t>(ids_.size()), &contents);
+  for (size_t i = 0; i < entries_.size(); ++i) {
+    if (ranks_[i].rank <= 0)
+      continue;
+    Put64(DoubleBits(ranks_[i].rank), &contents);
+    Put64(static_cast<uint64_t>(ranks_[i].last_visit), &contents);
+    Put32(static_cast<uint32_t>(entries_[i].path.size()), &contents);
+    contents += entries_[i].path;
+  }
+  return contents;
+}
+
+void DirectoryDatabase::MoveFrom(DirectoryDatabase* other) {
+  max_total_rank_ = other->max_total_rank_;
+  total_rank_ = other->total_rank_;
+  entries_ = move(other->entries_);
+  ranks_ = move(other->ranks_);
+  removed_count_ = other->removed_count_;
+  ids_ = move(other->ids_);
+  components_ = move(other->components_);
+  component_entries_ = move(other->component_entries_);
+  component_ids_ = move(other->component_ids_);
+  grams_ = move(other->grams_);
+  changes_ = move(other->changes_);
+}
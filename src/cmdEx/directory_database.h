@@ -0,0 +1,118 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_DIRECTORY_DATABASE_H_
+#define CMDEX_DIRECTORY_DATABASE_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Directories that have been visited, ranked by "frecency" as z does: each
+// visit adds one to a directory's rank, which is then weighted by how
+// recently it was last visited. Once the ranks add up to more than
+// max_total_rank(), they're all aged by 1%, and any that drop below one are
+// forgotten, so directories that aren't used any more fade away.
+//
+// Find() takes fragments of a path, which have to appear in it in order
+// (ignoring case), the last of them in its last component. An index from
+// 1-, 2- and 3-grams to the distinct last components that contain them, and
+// from those to the directories, means only directories whose last
+// component contains the last fragment are looked at.
+//
+// It can be used from more than one thread at once (completion looks up
+// scores in the background), other than set_max_total_rank().
+class DirectoryDatabase {
+ public:
+  DirectoryDatabase();
+
+  // Times are seconds since the Unix epoch.
+  void Visit(const string& dir, int64_t now);
+  // Forgets |dir|, e.g. because it no longer exists.
+  void Remove(const string& dir);
+
+  // The frecency of |dir| at |now|, or 0 if it isn't known.
+  double GetScore(const string& dir, int64_t now) const;
+
+  // Fills |results| with up to |max_results| directories that match all of
+  // |fragments|, highest score at |now| first.
+  void Find(const vector<string>& fragments,
+            int64_t now,
+            size_t max_results,
+            vector<string>* results) const;
+
+  size_t size() const;
+
+  double max_total_rank() const { return max_total_rank_; }
+  void set_max_total_rank(double rank) { max_total_rank_ = rank; }
+
+  // Replaces everything with what's in |path|. Returns false if it couldn't
+  // be read, leaving this empty.
+  bool Load(const string& path);
+  // Adds what's been visited and removed since the last Load() or Save() to
+  // what's in |path| (so that other instances' visits are kept), and writes
+  // that back. This then holds the result.
+  bool Save(const string& path);
+
+ private:
+  struct Entry {
+    string path;
+    // |path| in lower case, for matching.
+    string lower;
+    int component;  // Index in components_ of its last component.
+  };
+  // Kept apart from the Entry they're for, so that going through them to
+  // find which entries could make the cut is quick.
+  struct Rank {
+    double rank;
+    int64_t last_visit;
+  };
+
+  // Adds to |rank| without aging.
+  void Add(const string& dir, double rank, int64_t last_visit);
+  void RemoveEntry(int id);
+  void Age();
+  // Rebuilds the index without the removed entries, once they're the
+  // majority.
+  void CompactIfNecessary();
+  int InternComponent(const string& component);
+  // Whether the entry at |id| matches |fragments|, which are lower case.
+  bool Matches(int id, const vector<string>& fragments) const;
+  static double Frecency(double rank, int64_t last_visit, int64_t now);
+  bool Parse(const char* data, size_t size);
+  string Serialize() const;
+  // Takes everything but mutex_ from |other|.
+  void MoveFrom(DirectoryDatabase* other);
+
+  // Held by the public methods, other than to get at max_total_rank_.
+  mutable mutex mutex_;
+
+  double max_total_rank_;
+  double total_rank_;
+
+  // Removed entries stay, with a rank of 0, until they're compacted away.
+  vector<Entry> entries_;
+  vector<Rank> ranks_;
+  size_t removed_count_;
+  // Keyed by lower case path, as paths on Windows aren't case sensitive.
+  unordered_map<string, int> ids_;
+
+  // Distinct last components, lower case, and the entries that end in each.
+  vector<string> components_;
+  vector<vector<int>> component_entries_;
+  unordered_map<string, int> component_ids_;
+  // From each n-gram to the components that contain it, in increasing
+  // order.
+  unordered_map<uint32_t, vector<int>> grams_;
+
+  // What's changed since the last Load() or Save(), for Save() to merge:
+  // visits, and removals (with a time of -1).
+  vector<pair<string, int64_t>> changes_;
+};
+
+#endif  // CMDEX_DIRECTORY_DATABASE_H_
@@ -0,0 +1,239 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/directory_database.h"
+
+#include <stdio.h>
+
+#include "cmdEx/directory_history.h"
+#include "cmdEx/history_file.h"
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const int64_t kNow = 1000000000;
+const int64_t kDay = 24 * 60 * 60;
+
+vector<string> Fragments(const string& a, const string& b = "") {
+  vector<string> fragments;
+  fragments.push_back(a);
+  if (!b.empty())
+    fragments.push_back(b);
+  return fragments;
+}
+
+vector<string> Find(const DirectoryDatabase& database,
+                    const vector<string>& fragments) {
+  vector<string> results;
+  database.Find(fragments, kNow, 10, &results);
+  return results;
+}
+
+TEST(DirectoryDatabaseTest, RanksByFrecency) {
+  DirectoryDatabase database;
+  for (int i = 0; i < 3; ++i)
+    database.Visit("c:\\src\\chrome", kNow - 10 * kDay);
+  database.Visit("c:\\src\\chromium", kNow - 10);
+  // 3 visits long ago is less than 1 just now.
+  vector<string> results = Find(database, Fragments("chr"));
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ("c:\\src\\chromium", results[0]);
+  EXPECT_EQ("c:\\src\\chrome", results[1]);
+  EXPECT_EQ(0.75, database.GetScore("c:\\src\\chrome", kNow));
+  EXPECT_EQ(4, database.GetScore("C:\\SRC\\CHROMIUM", kNow));
+  EXPECT_EQ(0, database.GetScore("c:\\src", kNow));
+
+  for (int i = 0; i < 10; ++i)
+    database.Visit("c:\\src\\chrome", kNow);
+  results = Find(database, Fragments("chr"));
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ("c:\\src\\chrome", results[0]);
+}
+
+TEST(DirectoryDatabaseTest, Matching) {
+  DirectoryDatabase database;
+  database.Visit("c:\\src\\cmdEx\\src", kNow);
+  database.Visit("c:\\src\\chrome\\src\\out", kNow);
+  database.Visit("C:\\Users\\Scott\\Documents", kNow);
+  database.Visit("d:\\", kNow);
+
+  // Case doesn't matter, and the last fragment has to be in the last
+  // component.
+  EXPECT_EQ(Fragments("C:\\Users\\Scott\\Documents"),
+            Find(database, Fragments("DOC")));
+  EXPECT_EQ(Fragments("c:\\src\\chrome\\src\\out"),
+            Find(database, Fragments("out")));
+  EXPECT_TRUE(Find(database, Fragments("chrome")).empty());
+  EXPECT_EQ(Fragments("c:\\src\\chrome\\src\\out"),
+            Find(database, Fragments("chrome", "ou")));
+  // In order.
+  EXPECT_EQ(Fragments("c:\\src\\cmdEx\\src"),
+            Find(database, Fragments("cmd", "src")));
+  EXPECT_TRUE(Find(database, Fragments("src", "cmd")).empty());
+  EXPECT_EQ(2u, Find(database, Fragments("c:", "s")).size());
+  // A fragment with a separator in it only has to end in the last
+  // component.
+  EXPECT_EQ(Fragments("c:\\src\\chrome\\src\\out"),
+            Find(database, Fragments("src\\out")));
+  EXPECT_EQ(Fragments("d:\\"), Find(database, Fragments("d:")));
+  EXPECT_TRUE(Find(database, Fragments("missing")).empty());
+  EXPECT_EQ(4u, Find(database, vector<string>()).size());
+}
+
+TEST(DirectoryDatabaseTest, AgesOut) {
+  DirectoryDatabase database;
+  database.set_max_total_rank(100);
+  database.Visit("c:\\once", kNow);
+  for (int i = 0; i < 200; ++i)
+    database.Visit("c:\\often", kNow);
+  EXPECT_EQ(1u, database.size());
+  EXPECT_GE(100 * 4, database.GetScore("c:\\often", kNow));
+  EXPECT_TRUE(Find(database, Fragments("once")).empty());
+}
+
+TEST(DirectoryDatabaseTest, Remove) {
+  DirectoryDatabase database;
+  database.Visit("c:\\a", kNow);
+  database.Visit("c:\\b", kNow);
+  database.Remove("C:\\A");
+  EXPECT_EQ(1u, database.size());
+  EXPECT_TRUE(Find(database, Fragments("a")).empty());
+  database.Visit("c:\\a", kNow);
+  EXPECT_EQ(Fragments("c:\\a"), Find(database, Fragments("a")));
+}
+
+TEST(DirectoryDatabaseTest, SaveMergesWithOtherInstances) {
+  ScopedTempPath path("directories");
+  DirectoryDatabase a;
+  DirectoryDatabase b;
+  EXPECT_FALSE(a.Load(path.path()));
+  EXPECT_FALSE(b.Load(path.path()));
+  a.Visit("c:\\a", kNow);
+  a.Visit("c:\\both", kNow);
+  b.Visit("c:\\b", kNow);
+  b.Visit("c:\\both", kNow);
+  ASSERT_TRUE(a.Save(path.path()));
+  ASSERT_TRUE(b.Save(path.path()));
+  EXPECT_EQ(3u, b.size());
+  // Saving again doesn't count the same visits twice.
+  ASSERT_TRUE(a.Save(path.path()));
+
+  DirectoryDatabase loaded;
+  ASSERT_TRUE(loaded.Load(path.path()));
+  EXPECT_EQ(3u, loaded.size());
+  EXPECT_EQ(8, loaded.GetScore("c:\\both", kNow));
+  EXPECT_EQ(4, loaded.GetScore("c:\\b", kNow));
+
+  loaded.Remove("c:\\a");
+  ASSERT_TRUE(loaded.Save(path.path()));
+  ASSERT_TRUE(a.Load(path.path()));
+  EXPECT_EQ(2u, a.size());
+}
+
+TEST(DirectoryDatabaseTest, RejectsCorrupt) {
+  ScopedTempPath path("directories");
+  DirectoryDatabase database;
+  database.Visit("c:\\src\\chrome", kNow);
+  database.Visit("c:\\src\\cmdEx", kNow);
+  ASSERT_TRUE(database.Save(path.path()));
+  string contents;
+  {
+    MappedFile file;
+    ASSERT_TRUE(file.Open(path.path()));
+    contents.assign(file.data(), file.size());
+  }
+  ASSERT_TRUE(WriteFileAtomically(path.path(),
+                                  contents.substr(0, contents.size() - 1)));
+  EXPECT_FALSE(database.Load(path.path()));
+  EXPECT_EQ(0u, database.size());
+}
+
+TEST(DirectoryDatabaseTest, JumpTo) {
+  DirectoryDatabase database;
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\");
+  DirectoryHistory dh(&wd);
+  dh.set_database(&database);
+  EXPECT_FALSE(dh.JumpTo(Fragments("src")));
+
+  wd.Set("c:\\src\\chrome");
+  dh.StartingEdit();
+  wd.Set("c:\\src\\cmdEx");
+  dh.StartingEdit();
+  wd.Set("c:\\src\\chrome");
+  dh.StartingEdit();
+  EXPECT_EQ(2u, database.size());
+
+  // The best match is where we are, so go to the next.
+  EXPECT_TRUE(dh.JumpTo(Fragments("c")));
+  EXPECT_EQ("c:\\src\\cmdEx", wd.Get());
+  dh.StartingEdit();
+  EXPECT_TRUE(dh.JumpTo(Fragments("chr")));
+  EXPECT_EQ("c:\\src\\chrome", wd.Get());
+  dh.StartingEdit();
+  // But it's still fine if it's the only one.
+  EXPECT_TRUE(dh.JumpTo(Fragments("chr")));
+  EXPECT_EQ("c:\\src\\chrome", wd.Get());
+  EXPECT_FALSE(dh.JumpTo(Fragments("missing")));
+
+  // Ones that have gone are forgotten.
+  wd.SetMissing("c:\\src\\deleted", true);
+  for (int i = 0; i < 10; ++i)
+    database.Visit("c:\\src\\deleted", kNow * 2);
+  EXPECT_TRUE(dh.JumpTo(Fragments("src", "e")));
+  EXPECT_EQ("c:\\src\\cmdEx", wd.Get());
+  EXPECT_EQ(2u, database.size());
+}
+
+TEST(DirectoryDatabaseTest, DISABLED_PerfFind) {
+  // Visits a tree of 100k directories through DirectoryHistory, as a shell
+  // would, with some visited far more than others.
+  DirectoryDatabase database;
+  database.set_max_total_rank(1e9);
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\");
+  DirectoryHistory dh(&wd);
+  dh.set_database(&database);
+  const char* kWords[] = {"src", "out", "build", "chrome", "third_party",
+                          "tools", "docs", "test", "gen", "release"};
+  PerfTimer visit_timer;
+  for (int i = 0; i < 100000; ++i) {
+    string dir = "c:\\";
+    int n = i;
+    for (int depth = 0; depth < 4; ++depth) {
+      dir += kWords[n % 10];
+      dir += "\\";
+      n /= 10;
+    }
+    dir += "dir" + to_string(i);
+    for (int visits = 0; visits <= (i % 97 == 0 ? 10 : 0); ++visits) {
+      wd.Set(visits % 2 ? "c:\\" : dir);
+      dh.StartingEdit();
+    }
+  }
+  printf("visited %d directories in %.0fms\n",
+         static_cast<int>(database.size()),
+         visit_timer.ElapsedMs());
+
+  const char* kQueries[][2] = {{"dir5", ""},    {"dir12345", ""},
+                               {"chrome", "7"}, {"src", "dir9"},
+                               {"ir", ""},      {"r", ""},
+                               {"missing", ""}};
+  vector<string> results;
+  for (const auto& query : kQueries) {
+    PerfTimer timer;
+    const int kIterations = 100;
+    for (int i = 0; i < kIterations; ++i)
+      database.Find(Fragments(query[0], query[1]), kNow, 10, &results);
+    printf("%-12s %-6s %zu results in %.3fms\n",
+           query[0],
+           query[1],
+           results.size(),
+           timer.ElapsedMs() / kIterations);
+  }
+}
+
+}  // namespace
@@ -4,48 +4,223 @@
 
 #include "cmdEx/directory_history.h"
 
+#include <time.h>
+
 #include <algorithm>
 
+#include "cmdEx/directory_database.h"
 #include "common/util.h"
 
+namespace {
+
+// How many of the best matches JumpTo() tries, in case the first ones no
+// longer exist.
+const size_t kMaxJumpCandidates = 8;
+
+}  // namespace
+
+const size_t DirectoryHistory::kDefaultCapacity;
+
 DirectoryHistory::DirectoryHistory(WorkingDirectoryInterface* working_dir)
-    : working_dir_(working_dir), position_(0) {
+    : working_dir_(working_dir),
+      database_(NULL),
+      capacity_(kDefaultCapacity),
+      oldest_(NULL),
+      newest_(NULL),
+      position_(NULL),
+      checking_(false),
+      stopping_(false) {
   last_known_ = working_dir_->Get();
 }
 
+DirectoryHistory::~DirectoryHistory() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  if (checker_.joinable())
+    checker_.join();
+}
+
+void DirectoryHistory::set_capacity(size_t capacity) {
+  CHECK(capacity > 0);
+  capacity_ = capacity;
+  EvictIfNecessary();
+}
+
 void DirectoryHistory::StartingEdit() {
+  ApplyChecks();
   string current = working_dir_->Get();
   if (last_known_ != current) {
     CommitLastKnown();
     last_known_ = current;
+    if (database_)
+      database_->Visit(current, time(NULL));
   }
+  QueueChecks(false);
 }
 
 bool DirectoryHistory::NavigateInHistory(int direction) {
   CHECK(direction == 1 || direction == -1);
-  if (position_ == static_cast<int>(dirs_.size()) && direction == -1) {
+  ApplyChecks();
+  if (!position_) {
+    // Going forward from the end goes nowhere.
+    if (direction == 1)
+      return false;
     CommitLastKnown();
-    position_--;
-  }
-  int original = position_;
-  position_ += direction;
-  position_ = max(position_, 0);
-  position_ = min(position_, static_cast<int>(dirs_.size() - 1));
-  // TODO: If a directory has since been removed, remove from history list,
-  // and either go to the next or say something maybe?
-  working_dir_->Set(dirs_[position_]);
-  last_known_ = dirs_[position_];
-  return original != position_;
-}
-
-bool DirectoryHistory::CommitLastKnown() {
-  for (vector<string>::const_iterator i(dirs_.begin()); i != dirs_.end(); ++i) {
-    if (*i == last_known_) {
-      dirs_.erase(i);
-      break;
-    }
+    position_ = newest_;
+    // Some might have gone since they were checked. This won't be done in
+    // time for this step, but probably will for the next.
+    QueueChecks(true);
+  }
+  Entry* next = direction == -1 ? position_->older : position_->newer;
+  while (next && !working_dir_->Set(*next->dir)) {
+    Entry* missing = next;
+    next = direction == -1 ? next->older : next->newer;
+    Remove(missing);
   }
-  dirs_.push_back(last_known_);
-  position_ = static_cast<int>(dirs_.size());
+  if (!next)
+    return false;
+  position_ = next;
+  last_known_ = *position_->dir;
   return true;
 }
+
+bool DirectoryHistory::JumpTo(const vector<string>& fragments) {
+  if (!database_)
+    return false;
+  vector<string> candidates;
+  database_->Find(fragments, time(NULL), kMaxJumpCandidates, &candidates);
+  string current = working_dir_->Get();
+  // The current directory is only a last resort.
+  auto it = find(candidates.begin(), candidates.end(), current);
+  if (it != candidates.end()) {
+    candidates.erase(it);
+    candidates.push_back(current);
+  }
+  for (const auto& candidate : candidates) {
+    if (working_dir_->Set(candidate))
+      return true;
+    database_->Remove(candidate);
+  }
+  return false;
+}
+
+void DirectoryHistory::WaitForChecks() {
+  {
+    unique_lock<mutex> lock(mutex_);
+    checked_.wait(lock, [this] { return to_check_.empty() && !checking_; });
+  }
+  ApplyChecks();
+}
+
+void DirectoryHistory::CommitLastKnown() {
+  auto inserted =
+      entries_.insert(make_pair(last_known_, unique_ptr<Entry>()));
+  unique_ptr<Entry>& entry = inserted.first->second;
+  if (inserted.second) {
+    entry.reset(new Entry);
+    entry->dir = &inserted.first->first;
+    entry->queued = false;
+  } else {
+    Unlink(entry.get());
+  }
+  LinkNewest(entry.get());
+  position_ = NULL;
+  EvictIfNecessary();
+}
+
+void DirectoryHistory::Unlink(Entry* entry) {
+  if (entry->older)
+    entry->older->newer = entry->newer;
+  else
+    oldest_ = entry->newer;
+  if (entry->newer)
+    entry->newer->older = entry->older;
+  else
+    newest_ = entry->older;
+  entry->older = entry->newer = NULL;
+}
+
+void DirectoryHistory::LinkNewest(Entry* entry) {
+  entry->older = newest_;
+  entry->newer = NULL;
+  if (newest_)
+    newest_->newer = entry;
+  else
+    oldest_ = entry;
+  newest_ = entry;
+}
+
+void DirectoryHistory::EvictIfNecessary() {
+  while (entries_.size() > capacity_)
+    Remove(oldest_);
+}
+
+void DirectoryHistory::Remove(Entry* entry) {
+  if (position_ == entry)
+    position_ = NULL;
+  Unlink(entry);
+  entries_.erase(entries_.find(*entry->dir));
+}
+
+void DirectoryHistory::QueueChecks(bool all) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    // Everything will be checked soon enough anyway.
+    if (all && (checking_ || !to_check_.empty()))
+      return;
+    size_t queued = to_check_.size();
+    for (Entry* entry = oldest_; entry; entry = entry->newer) {
+      if (all || !entry->queued) {
+        to_check_.push_back(*entry->dir);
+        entry->queued = true;
+      }
+    }
+    if (to_check_.size() == queued)
+      return;
+    if (!checker_.joinable())
+      checker_ = thread(&DirectoryHistory::RunChecks, this);
+  }
+  wake_.notify_one();
+}
+
+void DirectoryHistory::ApplyChecks() {
+  vector<string> missing;
+  {
+    lock_guard<mutex> lock(mutex_);
+    missing.swap(missing_);
+  }
+  for (const auto& dir : missing) {
+    auto it = entries_.find(dir);
+    // We can only be here if it's been recreated since.
+    if (it != entries_.end() && dir != last_known_)
+      Remove(it->second.get());
+  }
+}
+
+void DirectoryHistory::RunChecks() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return stopping_ || !to_check_.empty(); });
+    if (stopping_)
+      return;
+    vector<string> dirs;
+    dirs.swap(to_check_);
+    checking_ = true;
+    lock.unlock();
+
+    vector<bool> exists;
+    working_dir_->CheckExist(dirs, &exists);
+    CHECK(exists.size() == dirs.size());
+
+    lock.lock();
+    for (size_t i = 0; i < dirs.size(); ++i) {
+      if (!exists[i])
+        missing_.push_back(dirs[i]);
+    }
+    checking_ = false;
+    checked_.notify_all();
+  }
+}
@@ -5,37 +5,129 @@
 #ifndef CMDEX_DIRECTORY_HISTORY_H_
 #define CMDEX_DIRECTORY_HISTORY_H_
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
+class DirectoryDatabase;
+
 class WorkingDirectoryInterface {
  public:
   virtual bool Set(const string& dir) = 0;
   virtual string Get() = 0;
+  // Appends whether each of |dirs| is a directory that exists to |exists|.
+  // This can be slow (e.g. on a network drive that's gone), so it's called on
+  // a background thread, at the same time as the others.
+  virtual void CheckExist(const vector<string>& dirs, vector<bool>* exists) = 0;
 };
 
+// Directories that have been changed to, oldest to newest, navigated like
+// vim's jumplist: changing to one that's already in the list moves it to the
+// end, and once there are more than capacity(), the least recently used are
+// dropped.
+//
+// Directories that no longer exist are found in the background, by checking
+// ones as they're added and all of them again when navigation starts, and
+// are dropped the next time there's a prompt or navigation, so that
+// navigating doesn't try (and wait) to change to them.
 class DirectoryHistory {
  public:
   DirectoryHistory(WorkingDirectoryInterface* working_dir);
+  // Waits for any check that's under way.
+  ~DirectoryHistory();
+
+  static const size_t kDefaultCapacity = 100;
+
+  size_t capacity() const { return capacity_; }
+  void set_capacity(size_t capacity);
+  size_t size() const { return entries_.size(); }
+
+  // Where directories that are changed to are recorded, for JumpTo(). Not
+  // owned, and optional.
+  void set_database(DirectoryDatabase* database) { database_ = database; }
 
   // Called when we resume editing again. If the directory isn't the same as
-  // the last known, then we jumped: add last known to the list.
+  // the last known, then we jumped: add last known to the list, and record a
+  // visit to the new one in the database.
   void StartingEdit();
 
+  // Moves to the previous (-1) or next (1) directory in the list, skipping
+  // (and dropping) any that can't be changed to. Returns false if there was
+  // nowhere to go.
   bool NavigateInHistory(int direction);
 
+  // Changes to the highest ranked directory in the database that matches
+  // |fragments| (see DirectoryDatabase::Find()), preferring one other than
+  // the current directory, as z does. Directories that turn out not to exist
+  // any more are removed from the database. Returns false if there's no
+  // match.
+  bool JumpTo(const vector<string>& fragments);
+
   WorkingDirectoryInterface* GetWorkingDirectoryInterface() {
     return working_dir_;
   }
 
+  // Blocks until the directories that have been queued for checking have
+  // been checked, and drops any that are missing. For tests.
+  void WaitForChecks();
+
  private:
-  bool CommitLastKnown();
+  DirectoryHistory(const DirectoryHistory&);
+  void operator=(const DirectoryHistory&);
+
+  struct Entry {
+    const string* dir;  // The key in entries_.
+    Entry* older;
+    Entry* newer;
+    // Whether it's been queued to be checked since it was added.
+    bool queued;
+  };
+
+  void CommitLastKnown();
+  void Unlink(Entry* entry);
+  void LinkNewest(Entry* entry);
+  void EvictIfNecessary();
+  void Remove(Entry* entry);
+
+  // Queues the entries that haven't been to be checked on the thread, or if
+  // |all|, all of them, unless it's busy.
+  void QueueChecks(bool all);
+  // Drops entries that the thread has found are missing.
+  void ApplyChecks();
+  void RunChecks();
 
   WorkingDirectoryInterface* working_dir_;
-  vector<string> dirs_;
+  DirectoryDatabase* database_;
+  size_t capacity_;
+  // Keyed by directory, with each linked into the list from oldest_ to
+  // newest_.
+  unordered_map<string, unique_ptr<Entry>> entries_;
+  Entry* oldest_;
+  Entry* newest_;
   string last_known_;
-  int position_;
+  // Where navigation is, or NULL when it's past the newest (i.e. not
+  // navigating).
+  Entry* position_;
+
+  // Guards everything below, which is shared with checker_.
+  mutex mutex_;
+  // Signalled when there's something to check, and when it's been checked.
+  condition_variable wake_;
+  condition_variable checked_;
+  // Started on the first QueueChecks().
+  thread checker_;
+  // Waiting to be checked.
+  vector<string> to_check_;
+  // Whether the thread is checking some.
+  bool checking_;
+  // Those that have been found not to exist.
+  vector<string> missing_;
+  bool stopping_;
 };
 
 #endif  // CMDEX_DIRECTORY_HISTORY_H_
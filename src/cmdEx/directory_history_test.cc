@@ -4,27 +4,11 @@
 
 #include "gtest/gtest.h"
 #include "cmdEx/directory_history.h"
-
-namespace {
-
-class MockWorkingDirectory : public WorkingDirectoryInterface {
- public:
-  bool Set(const string& dir) override {
-    dir_ = dir;
-    return true;
-  }
-  string Get() override {
-    return dir_;
-  }
-
- private:
-  string dir_;
-};
-
-}  // namespace
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
 
 TEST(DirectoryHistoryTest, Basic) {
-  MockWorkingDirectory wd;
+  FakeWorkingDirectory wd;
   wd.Set("c:\\x");
 
   DirectoryHistory dh(&wd);
@@ -54,7 +38,7 @@ TEST(DirectoryHistoryTest, Basic) {
 }
 
 TEST(DirectoryHistoryTest, WithSetAfterNavigate) {
-  MockWorkingDirectory wd;
+  FakeWorkingDirectory wd;
   wd.Set("c:\\x");
 
   DirectoryHistory dh(&wd);
@@ -87,8 +71,127 @@ TEST(DirectoryHistoryTest, WithSetAfterNavigate) {
   EXPECT_EQ("c:\\x", wd.Get());
 }
 
-// TODO
-/*
-TEST(DirectoryHistory, SetFails) {
+TEST(DirectoryHistoryTest, RevisitMovesToEnd) {
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\x");
+  DirectoryHistory dh(&wd);
+  const char* kDirs[] = {"c:\\y", "c:\\z", "c:\\x", "c:\\a"};
+  for (const auto& dir : kDirs) {
+    wd.Set(dir);
+    dh.StartingEdit();
+  }
+  EXPECT_EQ(3u, dh.size());
+
+  // Nothing after the newest.
+  EXPECT_FALSE(dh.NavigateInHistory(1));
+  EXPECT_EQ("c:\\a", wd.Get());
+
+  const char* kExpected[] = {"c:\\x", "c:\\z", "c:\\y"};
+  for (const auto& dir : kExpected) {
+    EXPECT_TRUE(dh.NavigateInHistory(-1));
+    dh.StartingEdit();
+    EXPECT_EQ(dir, wd.Get());
+  }
+  EXPECT_FALSE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\y", wd.Get());
+}
+
+TEST(DirectoryHistoryTest, Capacity) {
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\0");
+  DirectoryHistory dh(&wd);
+  dh.set_capacity(3);
+  for (int i = 1; i < 10; ++i) {
+    wd.Set("c:\\" + to_string(i));
+    dh.StartingEdit();
+  }
+  EXPECT_EQ(3u, dh.size());
+
+  // 9 is committed when navigating, so 6 is dropped.
+  const char* kExpected[] = {"c:\\8", "c:\\7"};
+  for (const auto& dir : kExpected) {
+    EXPECT_TRUE(dh.NavigateInHistory(-1));
+    dh.StartingEdit();
+    EXPECT_EQ(dir, wd.Get());
+  }
+  EXPECT_FALSE(dh.NavigateInHistory(-1));
+
+  // Shrinking past where navigation is ends it.
+  dh.set_capacity(1);
+  EXPECT_EQ(1u, dh.size());
+  EXPECT_FALSE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\7", wd.Get());
+  EXPECT_EQ(1u, dh.size());
+}
+
+TEST(DirectoryHistoryTest, SetFails) {
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\x");
+  DirectoryHistory dh(&wd);
+  wd.Set("c:\\y");
+  dh.StartingEdit();
+  wd.Set("c:\\z");
+  dh.StartingEdit();
+
+  // Gone before it could be checked, so it has to be tried.
+  wd.SetMissing("c:\\y", true);
+  EXPECT_TRUE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\x", wd.Get());
+  dh.StartingEdit();
+  EXPECT_EQ(2u, dh.size());
+  EXPECT_TRUE(dh.NavigateInHistory(1));
+  EXPECT_EQ("c:\\z", wd.Get());
+
+  // If there's nothing else, we stay where we are.
+  wd.SetMissing("c:\\x", true);
+  EXPECT_FALSE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\z", wd.Get());
+  EXPECT_EQ(1u, dh.size());
+}
+
+TEST(DirectoryHistoryTest, DropsMissingInBackground) {
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\x");
+  DirectoryHistory dh(&wd);
+  const char* kDirs[] = {"\\\\server\\share", "c:\\y", "c:\\z"};
+  for (const auto& dir : kDirs) {
+    wd.Set(dir);
+    dh.StartingEdit();
+  }
+  dh.WaitForChecks();
+  EXPECT_EQ(3, wd.check_count());
+  EXPECT_EQ(3u, dh.size());
+
+  // The share goes away; starting to navigate checks everything again.
+  wd.SetMissing("\\\\server\\share", true);
+  wd.SetDelayMs("\\\\server\\share", 100);
+  EXPECT_TRUE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\y", wd.Get());
+  dh.WaitForChecks();
+  EXPECT_EQ(3u, dh.size());
+
+  // So going back doesn't try it.
+  int set_count = wd.set_count();
+  EXPECT_TRUE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\x", wd.Get());
+  EXPECT_FALSE(dh.NavigateInHistory(-1));
+  EXPECT_EQ(set_count + 1, wd.set_count());
+}
+
+TEST(DirectoryHistoryTest, SlowChecksDontBlock) {
+  FakeWorkingDirectory wd;
+  wd.Set("c:\\x");
+  DirectoryHistory dh(&wd);
+  wd.Set("\\\\server\\share");
+  dh.StartingEdit();
+  // Unplugged while we were there.
+  wd.SetDelayMs("\\\\server\\share", 500);
+  PerfTimer timer;
+  wd.Set("c:\\y");
+  dh.StartingEdit();
+  wd.Set("c:\\z");
+  dh.StartingEdit();
+  EXPECT_TRUE(dh.NavigateInHistory(-1));
+  EXPECT_EQ("c:\\y", wd.Get());
+  EXPECT_LT(timer.ElapsedMs(), 250);
 }
-*/
@@ -0,0 +1,200 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/directory_listing.h"
+
+#include <wctype.h>
+
+#include <algorithm>
+
+#include "common/util.h"
+
+namespace {
+
+wstring Fold(const wstring& str) {
+  wstring folded(str);
+  for (auto& ch : folded)
+    ch = static_cast<wchar_t>(towlower(ch));
+  return folded;
+}
+
+}  // namespace
+
+DirectoryListing::DirectoryListing(const vector<wstring>& names,
+                                   const vector<bool>& is_directory) {
+  CHECK(names.size() == is_directory.size());
+  // Folded as listed into one block first, so that sorting doesn't need a
+  // string for each.
+  wstring folded;
+  vector<uint32_t> starts;
+  starts.reserve(names.size() + 1);
+  for (const auto& name : names) {
+    starts.push_back(static_cast<uint32_t>(folded.size()));
+    folded += name;
+    CHECK(folded.size() <= UINT32_MAX);
+  }
+  starts.push_back(static_cast<uint32_t>(folded.size()));
+  for (auto& ch : folded)
+    ch = static_cast<wchar_t>(towlower(ch));
+
+  vector<uint32_t> order(names.size());
+  for (size_t i = 0; i < order.size(); ++i)
+    order[i] = static_cast<uint32_t>(i);
+  // Stably, so that names that differ only in case keep the order they were
+  // listed in.
+  stable_sort(order.begin(),
+              order.end(),
+              [&folded, &starts](uint32_t a, uint32_t b) {
+                return folded.compare(starts[a],
+                                      starts[a + 1] - starts[a],
+                                      folded.c_str() + starts[b],
+                                      starts[b + 1] - starts[b]) < 0;
+              });
+
+  names_.reserve(folded.size());
+  folded_.reserve(folded.size());
+  offsets_.reserve(names.size() + 1);
+  directories_.resize((names.size() + 63) / 64);
+  for (size_t i = 0; i < order.size(); ++i) {
+    uint32_t from = order[i];
+    offsets_.push_back(static_cast<uint32_t>(names_.size()));
+    names_ += names[from];
+    folded_.append(folded, starts[from], starts[from + 1] - starts[from]);
+    if (is_directory[from])
+      directories_[i / 64] |= 1ULL << (i % 64);
+  }
+  offsets_.push_back(static_cast<uint32_t>(names_.size()));
+}
+
+void DirectoryListing::Find(const wstring& prefix,
+                            bool dir_only,
+                            const wstring& prepend,
+                            vector<wstring>* results) const {
+  const wstring folded_prefix = Fold(prefix);
+  // The names that start with |prefix| are those from the first that doesn't
+  // sort before it, up to the first that, cut to its length, sorts after it.
+  size_t begin = 0;
+  size_t end = size();
+  while (begin < end) {
+    size_t mid = begin + (end - begin) / 2;
+    if (folded_.compare(Start(mid), Length(mid), folded_prefix) < 0)
+      begin = mid + 1;
+    else
+      end = mid;
+  }
+  end = size();
+  size_t low = begin;
+  while (low < end) {
+    size_t mid = low + (end - low) / 2;
+    if (folded_.compare(Start(mid),
+                        min(Length(mid), folded_prefix.size()),
+                        folded_prefix) <= 0) {
+      low = mid + 1;
+    } else {
+      end = mid;
+    }
+  }
+
+  for (size_t i = begin; i < end; ++i) {
+    if (dir_only) {
+      if ((directories_[i / 64] >> (i % 64)) == 0) {
+        // No more directories in this word.
+        i |= 63;
+        continue;
+      }
+      if (!IsDirectory(i))
+        continue;
+    }
+    results->push_back(prepend);
+    results->back().append(names_, Start(i), Length(i));
+  }
+}
+
+DirectoryListingCache::DirectoryListingCache(FileSystemInterface* file_system,
+                                             size_t max_names)
+    : file_system_(file_system),
+      max_names_(max_names),
+      num_names_(0),
+      clock_(0),
+      hits_(0),
+      misses_(0) {}
+
+shared_ptr<const DirectoryListing> DirectoryListingCache::Get(
+    const wstring& dir) {
+  // Before it's listed, so that anything that changes while it is makes it
+  // out of date.
+  int64_t modified = file_system_->GetModifiedTime(dir);
+  if (modified == -1)
+    return shared_ptr<const DirectoryListing>();
+  shared_ptr<const DirectoryListing> listing = Find(dir, modified);
+  if (listing)
+    return listing;
+  vector<wstring> names;
+  vector<bool> is_directory;
+  if (!file_system_->ListDirectory(dir, &names, &is_directory))
+    return listing;
+  listing.reset(new DirectoryListing(names, is_directory));
+  Store(dir, modified, listing);
+  return listing;
+}
+
+shared_ptr<const DirectoryListing> DirectoryListingCache::Find(
+    const wstring& dir,
+    int64_t modified) {
+  lock_guard<mutex> lock(mutex_);
+  auto it = entries_.find(dir);
+  if (it == entries_.end()) {
+    ++misses_;
+    return shared_ptr<const DirectoryListing>();
+  }
+  if (it->second.modified != modified) {
+    Remove(it);
+    ++misses_;
+    return shared_ptr<const DirectoryListing>();
+  }
+  ++hits_;
+  it->second.last_used = ++clock_;
+  return it->second.listing;
+}
+
+void DirectoryListingCache::Store(const wstring& dir,
+                                  int64_t modified,
+                                  shared_ptr<const DirectoryListing> listing) {
+  lock_guard<mutex> lock(mutex_);
+  auto it = entries_.find(dir);
+  if (it != entries_.end())
+    Remove(it);
+  if (listing->size() > max_names_)
+    return;
+  while (num_names_ + listing->size() > max_names_) {
+    auto oldest = entries_.begin();
+    for (auto i = entries_.begin(); i != entries_.end(); ++i) {
+      if (i->second.last_used < oldest->second.last_used)
+        oldest = i;
+    }
+    Remove(oldest);
+  }
+  num_names_ += listing->size();
+  Entry& entry = entries_[dir];
+  entry.modified = modified;
+  entry.listing = listing;
+  entry.last_used = ++clock_;
+}
+
+int DirectoryListingCache::hits() const {
+  lock_guard<mutex> lock(mutex_);
+  return hits_;
+}
+
+int DirectoryListingCache::misses() const {
+  lock_guard<mutex> lock(mutex_);
+  return misses_;
+}
+
+void DirectoryListingCache::Remove(
+    unordered_map<wstring, Entry>::iterator it) {
+  // Callers that found it earlier still have their own reference.
+  num_names_ -= it->second.listing->size();
+  entries_.erase(it);
+}
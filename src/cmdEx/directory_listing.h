@@ -0,0 +1,114 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_DIRECTORY_LISTING_H_
+#define CMDEX_DIRECTORY_LISTING_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/file_system.h"
+#include "cmdEx/string_util.h"
+
+// What's in a directory, sorted ignoring case, so that the names that start
+// with a prefix are one range, found by binary search, however big the
+// directory is. The names are kept one after the other in one block, along
+// with a case-folded copy to search, and which are directories is a bitset,
+// so that looking for only directories skips the rest 64 at a time.
+class DirectoryListing {
+ public:
+  // |names| and |is_directory| are as FileSystemInterface::ListDirectory()
+  // fills them.
+  DirectoryListing(const vector<wstring>& names,
+                   const vector<bool>& is_directory);
+
+  // Appends each name that starts with |prefix| (ignoring case), and is a
+  // directory if |dir_only|, to |results|, in order, with |prepend| before
+  // it.
+  void Find(const wstring& prefix,
+            bool dir_only,
+            const wstring& prepend,
+            vector<wstring>* results) const;
+
+  size_t size() const { return offsets_.size() - 1; }
+  // The |i|th name in sorted order, e.g. for fuzzy matching.
+  WStringPiece name(size_t i) const {
+    return WStringPiece(names_.data() + Start(i), Length(i));
+  }
+  bool IsDirectory(size_t i) const {
+    return (directories_[i / 64] >> (i % 64)) & 1;
+  }
+
+ private:
+  DirectoryListing(const DirectoryListing&);
+  void operator=(const DirectoryListing&);
+
+  size_t Start(size_t i) const { return offsets_[i]; }
+  size_t Length(size_t i) const { return offsets_[i + 1] - offsets_[i]; }
+
+  // In sorted order. The |i|th name is at offsets_[i] in each, up to the
+  // next.
+  wstring names_;
+  wstring folded_;
+  vector<uint32_t> offsets_;
+  // Bit i % 64 of directories_[i / 64] is whether the |i|th is a directory.
+  vector<uint64_t> directories_;
+};
+
+// Listings of directories, for as long as their modification times stay the
+// same. Can be used from more than one thread at once.
+class DirectoryListingCache {
+ public:
+  // Once more than |max_names| are cached in all, the least recently used
+  // listings are dropped.
+  DirectoryListingCache(FileSystemInterface* file_system, size_t max_names);
+
+  // Returns the listing of |dir|, listing it if it isn't cached, or has
+  // been modified since it was. NULL if it can't be listed.
+  shared_ptr<const DirectoryListing> Get(const wstring& dir);
+
+  // As Get(), but never lists |dir|, for when the caller lists it itself (so
+  // that it can show what it's found as it goes), and then Store()s that.
+  // |modified| is its modification time, as got before listing it.
+  shared_ptr<const DirectoryListing> Find(const wstring& dir,
+                                          int64_t modified);
+  void Store(const wstring& dir,
+             int64_t modified,
+             shared_ptr<const DirectoryListing> listing);
+
+  // How many times a listing was and wasn't cached.
+  int hits() const;
+  int misses() const;
+
+ private:
+  DirectoryListingCache(const DirectoryListingCache&);
+  void operator=(const DirectoryListingCache&);
+
+  struct Entry {
+    int64_t modified;
+    shared_ptr<const DirectoryListing> listing;
+    uint64_t last_used;
+  };
+
+  void Remove(unordered_map<wstring, Entry>::iterator it);
+
+  FileSystemInterface* file_system_;
+
+  mutable mutex mutex_;
+  size_t max_names_;
+  size_t num_names_;
+  unordered_map<wstring, Entry> entries_;
+  // Counts uses of entries, to find the least recently used.
+  uint64_t clock_;
+  int hits_;
+  int misses_;
+};
+
+#endif  // CMDEX_DIRECTORY_LISTING_H_
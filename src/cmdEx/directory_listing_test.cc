@@ -0,0 +1,232 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/directory_listing.h"
+
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/string_util.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+vector<wstring> Find(const DirectoryListing& listing,
+                     const wchar_t* prefix,
+                     bool dir_only) {
+  vector<wstring> results;
+  listing.Find(prefix, dir_only, L"", &results);
+  return results;
+}
+
+vector<wstring> Words(const wchar_t* words) {
+  vector<wstring> result;
+  for (const auto& word : StringSplit(words, L' ')) {
+    if (!word.empty())
+      result.push_back(word);
+  }
+  return result;
+}
+
+TEST(DirectoryListingTest, Find) {
+  vector<wstring> names = Words(L"src README Makefile readme.txt SConstruct "
+                                L"build out Release scripts");
+  vector<bool> is_directory(names.size(), false);
+  for (auto dir : {0, 5, 6, 7, 8})
+    is_directory[dir] = true;
+  DirectoryListing listing(names, is_directory);
+  EXPECT_EQ(names.size(), listing.size());
+
+  // Sorted ignoring case, as they were named.
+  EXPECT_EQ(Words(L"build Makefile out README readme.txt Release SConstruct "
+                  L"scripts src"),
+            Find(listing, L"", false));
+  EXPECT_EQ(Words(L"README readme.txt Release"), Find(listing, L"RE", false));
+  EXPECT_EQ(Words(L"README readme.txt"), Find(listing, L"readme", false));
+  EXPECT_EQ(Words(L"readme.txt"), Find(listing, L"Readme.", false));
+  EXPECT_EQ(Words(L"SConstruct scripts src"), Find(listing, L"s", false));
+  EXPECT_TRUE(Find(listing, L"a", false).empty());
+  EXPECT_TRUE(Find(listing, L"z", false).empty());
+  EXPECT_TRUE(Find(listing, L"srcs", false).empty());
+
+  EXPECT_EQ(Words(L"build out Release scripts src"), Find(listing, L"", true));
+  EXPECT_EQ(Words(L"Release"), Find(listing, L"re", true));
+  EXPECT_EQ(Words(L"scripts src"), Find(listing, L"S", true));
+  EXPECT_TRUE(Find(listing, L"m", true).empty());
+
+  vector<wstring> results(1, L"first");
+  listing.Find(L"b", false, L"C:\\", &results);
+  EXPECT_EQ(Words(L"first C:\\build"), results);
+}
+
+TEST(DirectoryListingTest, ManyDirectoriesOnly) {
+  // Spanning a few words of the bitset, with some words with no directories.
+  vector<wstring> names;
+  vector<bool> is_directory;
+  for (int i = 0; i < 1000; ++i) {
+    wchar_t name[16];
+    swprintf(name, sizeof(name) / sizeof(name[0]), L"f%04d", i);
+    names.push_back(name);
+    is_directory.push_back(i % 150 == 0 || i == 999);
+  }
+  DirectoryListing listing(names, is_directory);
+  EXPECT_EQ(Words(L"f0000 f0150 f0300 f0450 f0600 f0750 f0900 f0999"),
+            Find(listing, L"F", true));
+  EXPECT_EQ(Words(L"f0600"), Find(listing, L"f06", true));
+  EXPECT_EQ(Words(L"f0900 f0999"), Find(listing, L"f09", true));
+  EXPECT_EQ(100u, Find(listing, L"f02", false).size());
+  EXPECT_TRUE(Find(listing, L"f02", true).empty());
+}
+
+TEST(DirectoryListingTest, Empty) {
+  DirectoryListing listing((vector<wstring>()), vector<bool>());
+  EXPECT_EQ(0u, listing.size());
+  EXPECT_TRUE(Find(listing, L"", false).empty());
+  EXPECT_TRUE(Find(listing, L"a", true).empty());
+}
+
+TEST(DirectoryListingCacheTest, ListedOnceUntilModified) {
+  FakeFileSystem file_system;
+  file_system.AddFile(L"C:\\src", L"main.cc");
+  file_system.AddDirectory(L"C:\\src", L"lib");
+  DirectoryListingCache cache(&file_system, 100);
+
+  shared_ptr<const DirectoryListing> listing = cache.Get(L"C:\\src");
+  ASSERT_TRUE(listing);
+  EXPECT_EQ(Words(L"lib main.cc"), Find(*listing, L"", false));
+  EXPECT_EQ(Words(L"lib"), Find(*listing, L"", true));
+  EXPECT_EQ(listing, cache.Get(L"C:\\src"));
+  EXPECT_EQ(1, file_system.list_count());
+  EXPECT_EQ(1, cache.hits());
+  EXPECT_EQ(1, cache.misses());
+
+  file_system.AddFile(L"C:\\src", L"main.h");
+  shared_ptr<const DirectoryListing> relisted = cache.Get(L"C:\\src");
+  ASSERT_TRUE(relisted);
+  EXPECT_EQ(2, file_system.list_count());
+  EXPECT_EQ(Words(L"main.cc main.h"), Find(*relisted, L"m", false));
+  // What was got before is still there.
+  EXPECT_EQ(2u, listing->size());
+
+  // A subdirectory is one too.
+  file_system.AddFile(L"C:\\src\\lib", L"lib.cc");
+  listing = cache.Get(L"C:\\src\\lib");
+  ASSERT_TRUE(listing);
+  EXPECT_EQ(Words(L"lib.cc"), Find(*listing, L"", false));
+
+  EXPECT_FALSE(cache.Get(L"C:\\missing"));
+}
+
+TEST(DirectoryListingCacheTest, DropsLeastRecentlyUsed) {
+  FakeFileSystem file_system;
+  for (const auto& dir : {L"C:\\a", L"C:\\b", L"C:\\c"}) {
+    file_system.AddFile(dir, L"1");
+    file_system.AddFile(dir, L"2");
+  }
+  DirectoryListingCache cache(&file_system, 5);
+  cache.Get(L"C:\\a");
+  cache.Get(L"C:\\b");
+  cache.Get(L"C:\\a");
+  // Doesn't fit with both, so b goes.
+  cache.Get(L"C:\\c");
+  EXPECT_EQ(3, file_system.list_count());
+  cache.Get(L"C:\\a");
+  cache.Get(L"C:\\c");
+  EXPECT_EQ(3, file_system.list_count());
+  cache.Get(L"C:\\b");
+  EXPECT_EQ(4, file_system.list_count());
+
+  // Nor is one that would never fit kept.
+  DirectoryListingCache small(&file_system, 1);
+  small.Get(L"C:\\a");
+  small.Get(L"C:\\a");
+  EXPECT_EQ(6, file_system.list_count());
+}
+
+TEST(DirectoryListingCacheTest, FindAndStore) {
+  FakeFileSystem file_system;
+  DirectoryListingCache cache(&file_system, 100);
+  EXPECT_FALSE(cache.Find(L"C:\\src", 1));
+  shared_ptr<const DirectoryListing> listing(
+      new DirectoryListing(Words(L"a b"), vector<bool>(2, false)));
+  cache.Store(L"C:\\src", 1, listing);
+  EXPECT_EQ(listing, cache.Find(L"C:\\src", 1));
+  EXPECT_FALSE(cache.Find(L"C:\\src", 2));
+  // And it was dropped for being out of date.
+  EXPECT_FALSE(cache.Find(L"C:\\src", 1));
+  EXPECT_EQ(0, file_system.list_count());
+}
+
+TEST(DirectoryListingTest, DISABLED_PerfDirectoryListing) {
+  // About what a big build output directory has.
+  const int kFiles = 200000;
+  ScopedTempDirectory dir("listing_perf");
+  ASSERT_TRUE(MakeDirectory(dir.path()));
+  for (int i = 0; i < kFiles; ++i) {
+    const char* ext = i % 4 == 0 ? ".obj" : i % 4 == 1 ? ".pdb" : ".o";
+    string name = "file" + to_string(i) + ext;
+    if (i % 100 == 0)
+      ASSERT_TRUE(MakeDirectory(dir.path() + kPathSeparator + name));
+    else
+      ASSERT_TRUE(MakeFile(dir.path() + kPathSeparator + name));
+  }
+
+  RealFileSystem file_system;
+  const wstring path = Widen(dir.path());
+  const int kCompletions = 10;
+  const wchar_t* kPrefixes[] = {L"file1234", L"FILE99", L"file5", L"x"};
+
+  // As it was: listed and filtered on every completion.
+  PerfTimer timer;
+  size_t scanned = 0;
+  for (int i = 0; i < kCompletions; ++i) {
+    vector<wstring> names;
+    file_system.ListDirectory(path, &names, NULL);
+    const wstring prefix = kPrefixes[i % 4];
+    for (const auto& name : names) {
+      if (CompareIgnoringCase(name.substr(0, prefix.size()), prefix) == 0)
+        ++scanned;
+    }
+  }
+  double scan_ms = timer.ElapsedMs();
+
+  DirectoryListingCache cache(&file_system, kFiles);
+  timer.Restart();
+  size_t found = 0;
+  {
+    vector<wstring> results;
+    cache.Get(path)->Find(kPrefixes[0], false, L"", &results);
+    found += results.size();
+  }
+  double cold_ms = timer.ElapsedMs();
+
+  timer.Restart();
+  for (int i = 1; i < kCompletions; ++i) {
+    vector<wstring> results;
+    cache.Get(path)->Find(kPrefixes[i % 4], false, L"", &results);
+    found += results.size();
+  }
+  double warm_ms = timer.ElapsedMs() / (kCompletions - 1);
+  EXPECT_EQ(scanned, found);
+  EXPECT_EQ(1, cache.misses());
+
+  timer.Restart();
+  size_t dirs = 0;
+  for (int i = 0; i < kCompletions; ++i) {
+    vector<wstring> results;
+    cache.Get(path)->Find(L"file", true, L"", &results);
+    dirs += results.size();
+  }
+  double dir_only_ms = timer.ElapsedMs() / kCompletions;
+  EXPECT_EQ(kCompletions * kFiles / 100u, dirs);
+
+  printf("%d entries: list and filter %.1fms, cold %.1fms, warm %.3fms, "
+         "all directories %.2fms\n",
+         kFiles,
+         scan_ms / kCompletions,
+         cold_ms,
+         warm_ms,
+         dir_only_ms);
+}
+
+}  // namespace
@@ -0,0 +1,49 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_ENTRY_LIST_H_
+#define CMDEX_ENTRY_LIST_H_
+
+#include <deque>
+using namespace std;
+
+#include "cmdEx/string_util.h"
+
+// History entries, numbered consecutively from first() to end() - 1. Older
+// ones can be added in front as well as newer ones after, and neither
+// renumbers anything, so what refers to entries by number (like
+// PrefixIndex and FuzzySearcher) only has to take in what's been added.
+class EntryList {
+ public:
+  // The first entry added is numbered |origin|. Those added in front of it
+  // go below that, so there has to be room if negative numbers mean
+  // something else, as -1 usually does.
+  explicit EntryList(int origin = 0) : origin_(origin), first_(origin) {}
+
+  int first() const { return first_; }
+  int end() const { return first_ + static_cast<int>(entries_.size()); }
+  size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  const WStringPiece& operator[](int i) const { return entries_[i - first_]; }
+
+  void push_back(const WStringPiece& entry) { entries_.push_back(entry); }
+  void push_front(const WStringPiece& entry) {
+    entries_.push_front(entry);
+    --first_;
+  }
+
+  // Numbering starts again from the origin.
+  void clear() {
+    entries_.clear();
+    first_ = origin_;
+  }
+
+ private:
+  deque<WStringPiece> entries_;
+  int origin_;
+  int first_;
+};
+
+#endif  // CMDEX_ENTRY_LIST_H_
@@ -0,0 +1,34 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/entry_list.h"
+
+#include "gtest/gtest.h"
+
+TEST(EntryListTest, AddAtEitherEnd) {
+  wstring a(L"a");
+  wstring b(L"b");
+  wstring c(L"c");
+  EntryList entries(10);
+  EXPECT_TRUE(entries.empty());
+  EXPECT_EQ(10, entries.first());
+  EXPECT_EQ(10, entries.end());
+
+  entries.push_back(b);
+  entries.push_back(c);
+  entries.push_front(a);
+  EXPECT_EQ(3u, entries.size());
+  EXPECT_EQ(9, entries.first());
+  EXPECT_EQ(12, entries.end());
+  // Those added before keep their numbers.
+  EXPECT_EQ(L"a", entries[9].as_string());
+  EXPECT_EQ(L"b", entries[10].as_string());
+  EXPECT_EQ(L"c", entries[11].as_string());
+
+  entries.clear();
+  EXPECT_TRUE(entries.empty());
+  EXPECT_EQ(10, entries.first());
+  entries.push_back(c);
+  EXPECT_EQ(L"c", entries[10].as_string());
+}
@@ -0,0 +1,133 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/file_system.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(_WIN32)
+
+bool RealFileSystem::ListDirectory(const wstring& dir,
+                                   vector<wstring>* names,
+                                   vector<bool>* is_directory) {
+  WIN32_FIND_DATAW data;
+  HANDLE find = FindFirstFileW((dir + L"\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return GetLastError() == ERROR_FILE_NOT_FOUND;
+  do {
+    if (data.cFileName[0] == L'.' &&
+        (data.cFileName[1] == 0 ||
+         (data.cFileName[1] == L'.' && data.cFileName[2] == 0)))
+      continue;
+    names->push_back(data.cFileName);
+    if (is_directory) {
+      is_directory->push_back(
+          (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0);
+    }
+  } while (FindNextFileW(find, &data));
+  FindClose(find);
+  return true;
+}
+
+int64_t RealFileSystem::GetModifiedTime(const wstring& path) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
+    return -1;
+  return (static_cast<int64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+         data.ftLastWriteTime.dwLowDateTime;
+}
+
+#else
+
+namespace {
+
+string ToUtf8(const wstring& str) {
+  string result;
+  for (const auto& wide : str) {
+    uint32_t ch = static_cast<uint32_t>(wide);
+    if (ch < 0x80) {
+      result.push_back(static_cast<char>(ch));
+    } else if (ch < 0x800) {
+      result.push_back(static_cast<char>(0xc0 | (ch >> 6)));
+      result.push_back(static_cast<char>(0x80 | (ch & 0x3f)));
+    } else if (ch < 0x10000) {
+      result.push_back(static_cast<char>(0xe0 | (ch >> 12)));
+      result.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3f)));
+      result.push_back(static_cast<char>(0x80 | (ch & 0x3f)));
+    } else {
+      result.push_back(static_cast<char>(0xf0 | (ch >> 18)));
+      result.push_back(static_cast<char>(0x80 | ((ch >> 12) & 0x3f)));
+      result.push_back(static_cast<char>(0x80 | ((ch >> 6) & 0x3f)));
+      result.push_back(static_cast<char>(0x80 | (ch & 0x3f)));
+    }
+  }
+  return result;
+}
+
+// Bytes that aren't valid UTF-8 are taken as Latin-1.
+wstring FromUtf8(const char* str) {
+  wstring result;
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(str);
+  while (*p) {
+    uint32_t lead = *p;
+    int continuation =
+        lead >= 0xf0 ? 3 : lead >= 0xe0 ? 2 : lead >= 0xc0 ? 1 : 0;
+    uint32_t ch = continuation ? lead & (0x3f >> continuation) : lead;
+    int i = 1;
+    for (; i <= continuation && (p[i] & 0xc0) == 0x80; ++i)
+      ch = (ch << 6) | (p[i] & 0x3f);
+    if (i <= continuation) {
+      ch = lead;
+      i = 1;
+    }
+    result.push_back(static_cast<wchar_t>(ch));
+    p += i;
+  }
+  return result;
+}
+
+}  // namespace
+
+bool RealFileSystem::ListDirectory(const wstring& dir,
+                                   vector<wstring>* names,
+                                   vector<bool>* is_directory) {
+  DIR* handle = opendir(ToUtf8(dir).c_str());
+  if (!handle)
+    return false;
+  while (struct dirent* entry = readdir(handle)) {
+    if (entry->d_name[0] == '.' &&
+        (entry->d_name[1] == 0 ||
+         (entry->d_name[1] == '.' && entry->d_name[2] == 0)))
+      continue;
+    names->push_back(FromUtf8(entry->d_name));
+    if (is_directory) {
+      bool directory = entry->d_type == DT_DIR;
+      if (entry->d_type == DT_UNKNOWN) {
+        // Not all file systems say, so then it takes a stat().
+        struct stat buffer;
+        string path = ToUtf8(dir) + "/" + entry->d_name;
+        directory =
+            stat(path.c_str(), &buffer) == 0 && S_ISDIR(buffer.st_mode);
+      }
+      is_directory->push_back(directory);
+    }
+  }
+  closedir(handle);
+  return true;
+}
+
+int64_t RealFileSystem::GetModifiedTime(const wstring& path) {
+  struct stat buffer;
+  if (stat(ToUtf8(path).c_str(), &buffer) != 0)
+    return -1;
+  return static_cast<int64_t>(buffer.st_mtim.tv_sec) * 1000000000 +
+         buffer.st_mtim.tv_nsec;
+}
+
+#endif
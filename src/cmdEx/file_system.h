@@ -0,0 +1,43 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_FILE_SYSTEM_H_
+#define CMDEX_FILE_SYSTEM_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// The file system as completion looks at it, so that it can be faked.
+class FileSystemInterface {
+ public:
+  virtual ~FileSystemInterface() {}
+
+  // Appends the names of everything in |dir| other than . and .. to
+  // |names|, and whether each is a directory to |is_directory|, unless it's
+  // NULL. Returns false if |dir| can't be listed.
+  virtual bool ListDirectory(const wstring& dir,
+                             vector<wstring>* names,
+                             vector<bool>* is_directory) = 0;
+
+  // When |path| was last modified, or -1 if it doesn't exist. For a
+  // directory, that changes whenever something in it is added, removed or
+  // renamed.
+  virtual int64_t GetModifiedTime(const wstring& path) = 0;
+};
+
+// FindFirstFileW() on Windows, and readdir() and stat() elsewhere (with
+// paths in UTF-8), so that what uses it can be tested and benchmarked
+// against a real file system on Linux too.
+class RealFileSystem : public FileSystemInterface {
+ public:
+  bool ListDirectory(const wstring& dir,
+                     vector<wstring>* names,
+                     vector<bool>* is_directory) override;
+  int64_t GetModifiedTime(const wstring& path) override;
+};
+
+#endif  // CMDEX_FILE_SYSTEM_H_
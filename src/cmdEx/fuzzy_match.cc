@@ -0,0 +1,587 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/fuzzy_match.h"
+
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CMDEX_HAVE_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+const int kMatchScore = 16;
+const int kConsecutiveBonus = 16;
+const int kWordStartBonus = 12;
+const int kPathComponentStartBonus = 14;
+const int kMaxGapPenalty = 8;
+// The most a single character can score.
+const int kMaxCharScore = kMatchScore + kConsecutiveBonus;
+
+#if defined(CMDEX_HAVE_SSE2)
+int CountTrailingZeros(unsigned int x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, x);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(x);
+#endif
+}
+#endif
+
+wchar_t ToLowerAscii(wchar_t c) {
+  return c >= L'A' && c <= L'Z' ? static_cast<wchar_t>(c - L'A' + L'a') : c;
+}
+
+bool IsAscii(wchar_t c) {
+  return static_cast<uint32_t>(c) < 0x80;
+}
+
+uint64_t CharBit(wchar_t c) {
+  c = ToLowerAscii(c);
+  if (c >= L'a' && c <= L'z')
+    return 1ull << (c - L'a');
+  if (c >= L'0' && c <= L'9')
+    return 1ull << (26 + c - L'0');
+  return 1ull << (36 + static_cast<uint32_t>(c) % 28);
+}
+
+bool IsWordStart(int before) {
+  switch (before) {
+    case 0:
+    case L' ':
+    case L'\t':
+    case L'\\':
+    case L'/':
+    case L'-':
+    case L'_':
+    case L'.':
+    case L':':
+    case L'=':
+    case L'"':
+      return true;
+  }
+  return false;
+}
+
+// The score for a character of the query matching after |before|, |gap|
+// characters on from where the previous one did (or from the start, for the
+// first). |consecutive| is whether the previous one matched |before|.
+int CharScore(int before, int gap, bool consecutive) {
+  int score = kMatchScore;
+  if (consecutive)
+    score += kConsecutiveBonus;
+  else if (before == L'\\' || before == L'/')
+    score += kPathComponentStartBonus;
+  else if (IsWordStart(before))
+    score += kWordStartBonus;
+  return score - min(gap, kMaxGapPenalty);
+}
+
+// The most CharScore() could add for a word start after any of the
+// characters in |signature|.
+int MaxBonus(uint64_t signature) {
+  static const uint64_t kPathSeparators = CharBit(L'\\') | CharBit(L'/');
+  static const uint64_t kWordSeparators =
+      CharBit(0) | CharBit(L' ') | CharBit(L'\t') | CharBit(L'-') |
+      CharBit(L'_') | CharBit(L'.') | CharBit(L':') | CharBit(L'=') |
+      CharBit(L'"');
+  if (signature & kPathSeparators)
+    return kPathComponentStartBonus;
+  if (signature & kWordSeparators)
+    return kWordStartBonus;
+  return 0;
+}
+
+// In FuzzySearcher::older_copies_ and newer_copies_.
+const int kExcluded = -2;
+
+// Heap order, so that the worst is at the front. Ties go to earlier
+// positions.
+bool Better(const FuzzyMatch& a, const FuzzyMatch& b) {
+  return a.score > b.score || (a.score == b.score && a.position < b.position);
+}
+
+// FuzzyScore() of the |length| characters at |str|, found through |folded|,
+// FoldChar() of each of them. |folded_query| is FoldChar() of each of
+// |query|'s. What's before a match only matters if it's an ASCII separator,
+// and folding leaves those as they are.
+int FoldedFuzzyScore(const wchar_t* str,
+                     const char* folded,
+                     size_t length,
+                     const wstring& query,
+                     const string& folded_query) {
+  int score = 0;
+  const char* end = folded + length;
+  const char* from = folded;
+  for (size_t i = 0; i < query.size(); ++i) {
+    char c = folded_query[i];
+    const char* found = FindEitherByte(from, end, c, c);
+    while (found != end && !IsAscii(query[i]) &&
+           str[found - folded] != query[i]) {
+      found = FindEitherByte(found + 1, end, c, c);
+    }
+    if (found == end)
+      return -1;
+    int gap = static_cast<int>(found - from);
+    int before = found == folded ? 0 : found[-1];
+    score += CharScore(before, gap, i > 0 && gap == 0);
+    from = found + 1;
+  }
+  return score;
+}
+
+// Adds |match| to the heap of the best |max_results| in |results|, if it's
+// one of them.
+void KeepIfBest(const FuzzyMatch& match,
+                size_t max_results,
+                vector<FuzzyMatch>* results) {
+  if (results->size() == max_results) {
+    // Only something strictly better displaces the worst that's kept.
+    if (!Better(match, results->front()))
+      return;
+    pop_heap(results->begin(), results->end(), Better);
+    results->pop_back();
+  }
+  results->push_back(match);
+  push_heap(results->begin(), results->end(), Better);
+}
+
+}  // namespace
+
+const char* FindEitherByte(const char* begin,
+                           const char* end,
+                           char a,
+                           char b) {
+  const char* p = begin;
+#if defined(CMDEX_HAVE_SSE2)
+  const __m128i va = _mm_set1_epi8(a);
+  const __m128i vb = _mm_set1_epi8(b);
+  while (end - p >= 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, va), _mm_cmpeq_epi8(chunk, vb)));
+    if (mask != 0)
+      return p + CountTrailingZeros(static_cast<unsigned int>(mask));
+    p += 16;
+  }
+#endif
+  while (p != end && *p != a && *p != b)
+    ++p;
+  return p;
+}
+
+char FoldChar(wchar_t c) {
+  if (IsAscii(c))
+    return static_cast<char>(ToLowerAscii(c));
+  return static_cast<char>(0x80 | (c & 0x7f));
+}
+
+uint64_t CharSignature(const WStringPiece& str) {
+  uint64_t signature = 0;
+  for (size_t i = 0; i < str.size(); ++i)
+    signature |= CharBit(str[i]);
+  return signature;
+}
+
+int FuzzyScore(const WStringPiece& str, const wstring& query) {
+  int score = 0;
+  size_t from = 0;
+  for (size_t i = 0; i < query.size(); ++i) {
+    wchar_t c = ToLowerAscii(query[i]);
+    size_t found = from;
+    while (found < str.size() && ToLowerAscii(str[found]) != c)
+      ++found;
+    if (found == str.size())
+      return -1;
+    int gap = static_cast<int>(found - from);
+    score += CharScore(found == 0 ? 0 : str[found - 1], gap, i > 0 && gap == 0);
+    from = found + 1;
+  }
+  return score;
+}
+
+void FindBestFuzzyMatches(size_t count,
+                          const function<WStringPiece(size_t)>& candidate,
+                          const wstring& query,
+                          size_t max_results,
+                          vector<FuzzyMatch>* results) {
+  results->clear();
+  if (max_results == 0)
+    return;
+  for (size_t i = 0; i < count; ++i) {
+    WStringPiece str = candidate(i);
+    if (str.size() < query.size())
+      continue;
+    int score = FuzzyScore(str, query);
+    if (score < 0)
+      continue;
+    FuzzyMatch match = {static_cast<int>(i), score};
+    KeepIfBest(match, max_results, results);
+  }
+  sort_heap(results->begin(), results->end(), Better);
+}
+
+void FindBestFuzzyMatches(const PackedCandidates& candidates,
+                          const wstring& query,
+                          size_t max_results,
+                          vector<FuzzyMatch>* results) {
+  results->clear();
+  if (max_results == 0)
+    return;
+  uint64_t required = CharSignature(query);
+  string folded_query;
+  for (size_t i = 0; i < query.size(); ++i)
+    folded_query.push_back(FoldChar(query[i]));
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if ((candidates.signature(i) & required) != required)
+      continue;
+    int score = FoldedFuzzyScore(candidates.data(i),
+                                 candidates.folded(i),
+                                 candidates.length(i),
+                                 query,
+                                 folded_query);
+    if (score < 0)
+      continue;
+    FuzzyMatch match = {static_cast<int>(i), score};
+    KeepIfBest(match, max_results, results);
+  }
+  sort_heap(results->begin(), results->end(), Better);
+}
+
+FuzzySearcher::FuzzySearcher() : first_(0) {}
+
+void FuzzySearcher::Reset() {
+  nodes_.clear();
+  labels_.clear();
+  folded_.clear();
+  ends_.clear();
+  older_copies_.clear();
+  newer_copies_.clear();
+  first_ = 0;
+  pending_exclusions_.clear();
+}
+
+void FuzzySearcher::Update(const EntryList& entries) {
+  int end = first_ + static_cast<int>(ends_.size());
+  if (!ends_.empty() && (entries.first() > first_ || entries.end() < end))
+    Reset();
+  if (nodes_.empty()) {
+    Node root = {0, 0, 0, -1, -1, -1, -1, -1, 0};
+    nodes_.push_back(root);
+  }
+  if (ends_.empty())
+    first_ = end = entries.first();
+  for (int i = end; i < entries.end(); ++i)
+    Insert(entries[i], i);
+  // Older ones newest first, so each goes in just before the rest.
+  for (int i = first_ - 1; i >= entries.first(); --i)
+    Insert(entries[i], i);
+  end = first_ + static_cast<int>(ends_.size());
+  vector<int> still_pending;
+  for (const auto& position : pending_exclusions_) {
+    if (position >= first_ && position < end)
+      Exclude(position);
+    else
+      still_pending.push_back(position);
+  }
+  pending_exclusions_.swap(still_pending);
+}
+
+void FuzzySearcher::Exclude(int position) {
+  if (position < first_ ||
+      position >= first_ + static_cast<int>(ends_.size())) {
+    pending_exclusions_.push_back(position);
+    return;
+  }
+  int older = older_copies_[position - first_];
+  int newer = newer_copies_[position - first_];
+  if (older == kExcluded)
+    return;
+  older_copies_[position - first_] = newer_copies_[position - first_] =
+      kExcluded;
+  if (older == position) {
+    older = -1;
+  } else {
+    newer_copies_[older - first_] = newer;
+    older_copies_[newer - first_] = older;
+  }
+  int node = ends_[position - first_];
+  if (nodes_[node].terminal != position)
+    return;
+  // It was the newest copy, so the newest entry below its node, and maybe
+  // those above, changes.
+  nodes_[node].terminal = older;
+  for (; node != -1; node = nodes_[node].parent) {
+    int newest = nodes_[node].terminal;
+    for (int child = nodes_[node].first_child; child != -1;
+         child = nodes_[child].next_sibling) {
+      newest = max(newest, nodes_[child].newest);
+    }
+    if (newest == nodes_[node].newest)
+      break;
+    nodes_[node].newest = newest;
+  }
+}
+
+void FuzzySearcher::Search(const EntryList& entries,
+                           const wstring& query,
+                           size_t max_results,
+                           vector<FuzzyMatch>* results) {
+  Update(entries);
+  results->clear();
+  if (query.empty() || max_results == 0)
+    return;
+  query_.resize(query.size());
+  required_.assign(query.size() + 1, 0);
+  for (size_t i = query.size(); i-- > 0;) {
+    query_[i] = ToLowerAscii(query[i]);
+    required_[i] = required_[i + 1] | CharBit(query_[i]);
+  }
+  queue_.clear();
+  State start = {0, 0, 0, 0, 0, 0};
+  Expand(start);
+
+  // Take the best score that's left, and everything else with it, then the
+  // next best, and so on. Bounds only get lower further down the tree, so
+  // once the best bound is a whole match's score, nothing else can beat it.
+  vector<int> best;
+  while (results->size() < max_results) {
+    best.clear();
+    int score = -1;
+    while (!queue_.empty() && queue_.front().bound >= score) {
+      pop_heap(queue_.begin(), queue_.end(), WorseBound);
+      State state = queue_.back();
+      queue_.pop_back();
+      if (state.matched < static_cast<int>(query_.size())) {
+        Expand(state);
+      } else {
+        score = state.score;
+        best.push_back(state.node);
+      }
+    }
+    if (best.empty())
+      break;
+    AddNewest(best, score, max_results, results);
+  }
+}
+
+bool FuzzySearcher::WorseBound(const State& a, const State& b) {
+  return a.bound < b.bound;
+}
+
+void FuzzySearcher::Insert(const WStringPiece& entry, int position) {
+  size_t size = entry.size();
+  vector<uint64_t> suffixes(size + 1, 0);
+  for (size_t i = size; i-- > 0;)
+    suffixes[i] = suffixes[i + 1] | CharBit(entry[i]);
+
+  // Follow the entry down as far as it matches, splitting the label where it
+  // stops matching, and then add what's left as a new leaf.
+  int node = 0;
+  size_t start = 0;  // Where |node|'s label starts in |entry|.
+  for (;;) {
+    Node& current = nodes_[node];
+    current.signature |= suffixes[start];
+    current.newest = max(current.newest, position);
+    size_t i = start + current.length;
+    if (i == size)
+      break;
+    int child = current.first_child;
+    while (child != -1 && nodes_[child].first != entry[i])
+      child = nodes_[child].next_sibling;
+    if (child == -1) {
+      Node leaf = {suffixes[i],
+                   static_cast<int>(labels_.size()),
+                   static_cast<int>(size - i),
+                   node,
+                   -1,
+                   current.first_child,
+                   -1,
+                   position,
+                   entry[i]};
+      for (size_t j = i; j < size; ++j) {
+        labels_.push_back(entry[j]);
+        folded_.push_back(FoldChar(entry[j]));
+      }
+      current.first_child = static_cast<int>(nodes_.size());
+      node = current.first_child;
+      nodes_.push_back(leaf);
+      break;
+    }
+    const Node& next = nodes_[child];
+    size_t length = 1;
+    while (length < static_cast<size_t>(next.length) && i + length < size &&
+           labels_[next.label + length] == entry[i + length]) {
+      ++length;
+    }
+    if (length < static_cast<size_t>(next.length))
+      Split(child, static_cast<int>(length));
+    node = child;
+    start = i;
+  }
+
+  // Into the ring of copies between the oldest and the newest, which it
+  // then either is.
+  Node& end = nodes_[node];
+  int newest = end.terminal;
+  int oldest = newest == -1 ? -1 : newer_copies_[newest - first_];
+  if (position < first_) {
+    ends_.push_front(node);
+    older_copies_.push_front(newest == -1 ? position : newest);
+    newer_copies_.push_front(newest == -1 ? position : oldest);
+    --first_;
+  } else {
+    ends_.push_back(node);
+    older_copies_.push_back(newest == -1 ? position : newest);
+    newer_copies_.push_back(newest == -1 ? position : oldest);
+  }
+  if (newest != -1) {
+    newer_copies_[newest - first_] = position;
+    older_copies_[oldest - first_] = position;
+  }
+  end.terminal = max(newest, position);
+}
+
+void FuzzySearcher::Split(int node, int length) {
+  Node rest = nodes_[node];
+  rest.label += length;
+  rest.length -= length;
+  rest.parent = node;
+  rest.next_sibling = -1;
+  rest.first = labels_[rest.label];
+  rest.signature =
+      CharSignature(WStringPiece(labels_.data() + rest.label, rest.length));
+  int index = static_cast<int>(nodes_.size());
+  for (int child = rest.first_child; child != -1;
+       child = nodes_[child].next_sibling) {
+    nodes_[child].parent = index;
+    rest.signature |= nodes_[child].signature;
+  }
+  if (rest.terminal != -1) {
+    int copy = rest.terminal;
+    do {
+      ends_[copy - first_] = index;
+      copy = older_copies_[copy - first_];
+    } while (copy != rest.terminal);
+  }
+  nodes_.push_back(rest);
+
+  // Its subtree, and so its signature and newest entry, are the same.
+  Node& split = nodes_[node];
+  split.length = length;
+  split.first_child = index;
+  split.terminal = -1;
+}
+
+const char* FuzzySearcher::Find(const char* from,
+                                const char* end,
+                                wchar_t c) const {
+  char folded = FoldChar(c);
+  for (;;) {
+    const char* found = FindEitherByte(from, end, folded, folded);
+    if (found == end || IsAscii(c) || labels_[found - folded_.data()] == c)
+      return found;
+    from = found + 1;
+  }
+}
+
+void FuzzySearcher::Expand(const State& state) {
+  const Node& node = nodes_[state.node];
+  State next = state;
+  const char* label = folded_.data() + node.label;
+  const char* end = label + node.length;
+  const char* from = label;
+  while (from != end) {
+    const char* found = Find(from, end, query_[next.matched]);
+    next.gap += static_cast<int>(found - from);
+    if (found == end)
+      break;
+    wchar_t before = found == label
+                         ? next.before
+                         : labels_[node.label + (found - label) - 1];
+    next.score +=
+        CharScore(before, next.gap, next.matched > 0 && next.gap == 0);
+    next.gap = 0;
+    from = found + 1;
+    if (++next.matched == static_cast<int>(query_.size())) {
+      // Everything below here matches, with the same score.
+      next.bound = next.score;
+      queue_.push_back(next);
+      push_heap(queue_.begin(), queue_.end(), WorseBound);
+      return;
+    }
+  }
+  if (node.length > 0)
+    next.before = labels_[node.label + node.length - 1];
+  for (int child = node.first_child; child != -1;
+       child = nodes_[child].next_sibling) {
+    Push(next, child);
+  }
+}
+
+void FuzzySearcher::Push(const State& state, int child) {
+  const Node& node = nodes_[child];
+  uint64_t required = required_[state.matched];
+  if (node.newest == -1 || (node.signature & required) != required)
+    return;
+  // The next character scores exactly this if it's first in the label, and
+  // otherwise at most what a word start after a gap could.
+  int next;
+  if (ToLowerAscii(node.first) == query_[state.matched]) {
+    next = CharScore(
+        state.before, state.gap, state.matched > 0 && state.gap == 0);
+  } else {
+    next = kMatchScore + MaxBonus(node.signature) -
+           min(state.gap + 1, kMaxGapPenalty);
+  }
+  State pushed = state;
+  pushed.node = child;
+  pushed.bound =
+      state.score + next +
+      kMaxCharScore * (static_cast<int>(query_.size()) - state.matched - 1);
+  queue_.push_back(pushed);
+  push_heap(queue_.begin(), queue_.end(), WorseBound);
+}
+
+void FuzzySearcher::AddNewest(const vector<int>& nodes,
+                              int score,
+                              size_t max_results,
+                              vector<FuzzyMatch>* results) {
+  // A heap, newest first, of the newest entry in each subtree still to be
+  // looked at, and of entries themselves, which have no node (-1).
+  vector<pair<int, int>> newest;
+  for (const auto& node : nodes)
+    newest.push_back(make_pair(nodes_[node].newest, node));
+  make_heap(newest.begin(), newest.end());
+  while (!newest.empty() && results->size() < max_results) {
+    pop_heap(newest.begin(), newest.end());
+    pair<int, int> next = newest.back();
+    newest.pop_back();
+    if (next.second == -1) {
+      FuzzyMatch match = {next.first, score};
+      results->push_back(match);
+      continue;
+    }
+    const Node& node = nodes_[next.second];
+    if (node.terminal != -1) {
+      newest.push_back(make_pair(node.terminal, -1));
+      push_heap(newest.begin(), newest.end());
+    }
+    for (int child = node.first_child; child != -1;
+         child = nodes_[child].next_sibling) {
+      if (nodes_[child].newest != -1) {
+        newest.push_back(make_pair(nodes_[child].newest, child));
+        push_heap(newest.begin(), newest.end());
+      }
+    }
+  }
+}
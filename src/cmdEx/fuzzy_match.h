@@ -0,0 +1,185 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_FUZZY_MATCH_H_
+#define CMDEX_FUZZY_MATCH_H_
+
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/entry_list.h"
+#include "cmdEx/prefix_filter.h"
+#include "cmdEx/string_util.h"
+
+// Returns the first of |a| or |b| in [begin, end), or |end|. Vectorized where
+// SSE2 is available.
+const char* FindEitherByte(const char* begin, const char* end, char a, char b);
+
+// A byte that stands for |c|, ignoring ASCII case, for searching a byte per
+// character with FindEitherByte(). ASCII is lower cased, and anything else is
+// folded into bytes with the top bit set, so has to be checked against the
+// character itself.
+char FoldChar(wchar_t c);
+
+// A bit for each letter and digit (ignoring case) that |str| contains, and
+// for buckets of everything else. If a's signature doesn't include all of
+// b's, b can't be a subsequence of a.
+uint64_t CharSignature(const WStringPiece& str);
+
+// Scores |str| as a match for |query|: every character of |query| has to
+// appear in |str| in order, ignoring ASCII case. Higher is better; matches at
+// the start of words (and more so of path components) and runs of
+// consecutive characters score more, and gaps less. Returns -1 if it doesn't
+// match.
+//
+// Characters are matched greedily, leftmost first, which is what lets
+// FuzzySearcher extend a match by one character at a time.
+int FuzzyScore(const WStringPiece& str, const wstring& query);
+
+struct FuzzyMatch {
+  int position;  // Index into the searched list.
+  int score;
+};
+
+// Fills |results| with the best |max_results| of |count| candidates, as
+// FuzzyScore() scores them against |query|, best first, with ties going to
+// earlier candidates. |candidate(i)| is the |i|th. Only the best so far are
+// kept, in a heap, so that ranking a lot of candidates doesn't sort them all.
+void FindBestFuzzyMatches(size_t count,
+                          const function<WStringPiece(size_t)>& candidate,
+                          const wstring& query,
+                          size_t max_results,
+                          vector<FuzzyMatch>* results);
+
+// The same for all of |candidates|, but only those whose signature has all
+// of the query's characters are scored, and they're searched through their
+// folded copies, so scoring a lot of them mostly reads bytes rather than
+// wide characters.
+void FindBestFuzzyMatches(const PackedCandidates& candidates,
+                          const wstring& query,
+                          size_t max_results,
+                          vector<FuzzyMatch>* results);
+
+// Incremental fuzzy search of a list that's only appended to, as used for
+// Ctrl-R in history.
+//
+// The entries are kept in a radix tree, so however many of them start the
+// same way ("git checkout ", say), that's only matched against the query
+// once. Each node knows the newest entry below it, and which characters are
+// (as CharSignature()), so that nothing lacking the rest of the query is
+// looked at. Nodes are searched best first, by the most that anything below
+// them could still score, so a search stops once its best matches are known,
+// having looked at few of the entries that match at all.
+class FuzzySearcher {
+ public:
+  FuzzySearcher();
+
+  // Forgets everything. Needed if entries are changed other than by being
+  // added to at either end.
+  void Reset();
+
+  // Adds whatever has been added to |entries| since it was last passed here
+  // or to Search(). That's most of the cost of the first search, so this
+  // lets it be done beforehand, on another thread if need be.
+  void Update(const EntryList& entries);
+
+  // Stops the entry at |position| from matching anything from now on.
+  void Exclude(int position);
+
+  // Fills |results| with the best |max_results| matches of |query| in
+  // |entries|, best first, as scored by FuzzyScore(). Ties go to later
+  // entries, and only the latest of identical entries is included. An empty
+  // query matches nothing.
+  void Search(const EntryList& entries,
+              const wstring& query,
+              size_t max_results,
+              vector<FuzzyMatch>* results);
+
+ private:
+  struct Node {
+    // CharSignature() of everything from the start of the label down.
+    uint64_t signature;
+    // Where the label is in labels_ and folded_. Only the root's is empty.
+    int label;
+    int length;
+    int parent;
+    // Children are linked through next_sibling.
+    int first_child;
+    int next_sibling;
+    // The newest live entry that ends here, or -1.
+    int terminal;
+    // The newest live entry in this subtree, or -1.
+    int newest;
+    // The first character of the label, so that finding a child doesn't have
+    // to look in labels_.
+    wchar_t first;
+  };
+  // Part way through matching the query down a path of the tree.
+  struct State {
+    // The most that any entry below |node| can score; the score itself
+    // once the whole query is matched.
+    int bound;
+    int node;
+    // Characters of query_ matched before |node|'s label, and their score.
+    int matched;
+    int score;
+    // Characters passed since the last match (or the start).
+    int gap;
+    // The character before |node|'s label, 0 at the start.
+    wchar_t before;
+  };
+
+  // Heap order for queue_.
+  static bool WorseBound(const State& a, const State& b);
+
+  // |position| is either just after or just before those added so far.
+  void Insert(const WStringPiece& entry, int position);
+  // Splits |node|'s label after |length| characters, moving the rest, and
+  // everything below, to a new child.
+  void Split(int node, int length);
+  // The first character in [from, end) of folded_ that's |c|, or |end|.
+  const char* Find(const char* from, const char* end, wchar_t c) const;
+  // Matches as much of the query as |state|'s node's label has, and queues
+  // what follows.
+  void Expand(const State& state);
+  // Queues the search of |child| carrying on from |state|, unless it can't
+  // match.
+  void Push(const State& state, int child);
+  // Adds the newest entries below |nodes|, all of which score |score|, to
+  // |results|, until it has |max_results|.
+  void AddNewest(const vector<int>& nodes,
+                 int score,
+                 size_t max_results,
+                 vector<FuzzyMatch>* results);
+
+  // nodes_[0] is the root.
+  vector<Node> nodes_;
+  // The labels of nodes_, and FoldChar() of each of their characters.
+  wstring labels_;
+  string folded_;
+  // For each entry from first_ on, the node it ends at, and the next older
+  // and newer live entries the same as it, or kExcluded in both. They're
+  // linked in a ring, the oldest's older being the newest and the newest's
+  // newer the oldest, so that a copy can go in at either end.
+  deque<int> ends_;
+  deque<int> older_copies_;
+  deque<int> newer_copies_;
+  int first_;
+  // Exclusions of entries that haven't been added yet.
+  vector<int> pending_exclusions_;
+
+  // Only used during Search(), but kept for their memory. Lower cased.
+  wstring query_;
+  // CharSignature() of each suffix of query_.
+  vector<uint64_t> required_;
+  // A heap, best bound first.
+  vector<State> queue_;
+};
+
+#endif  // CMDEX_FUZZY_MATCH_H_
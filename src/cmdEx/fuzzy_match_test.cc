@@ -0,0 +1,335 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/fuzzy_match.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <deque>
+
+#include "cmdEx/perf_timer.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const char* ScalarFindEitherByte(const char* begin,
+                                 const char* end,
+                                 char a,
+                                 char b) {
+  while (begin != end && *begin != a && *begin != b)
+    ++begin;
+  return begin;
+}
+
+// What FuzzySearcher::Search() should return, by scoring everything.
+// |excluded| is indexed from entries.first().
+vector<FuzzyMatch> ReferenceSearch(const EntryList& entries,
+                                   const deque<bool>& excluded,
+                                   const wstring& query,
+                                   size_t max_results) {
+  vector<FuzzyMatch> all;
+  if (query.empty())
+    return all;
+  for (int i = entries.first(); i < entries.end(); ++i) {
+    int score = FuzzyScore(entries[i], query);
+    if (score >= 0 && !excluded[i - entries.first()]) {
+      FuzzyMatch match = {i, score};
+      all.push_back(match);
+    }
+  }
+  sort(all.begin(), all.end(), [](const FuzzyMatch& a, const FuzzyMatch& b) {
+    return a.score > b.score || (a.score == b.score && a.position > b.position);
+  });
+  vector<FuzzyMatch> result;
+  for (const auto& match : all) {
+    if (result.size() == max_results)
+      break;
+    bool duplicate = false;
+    for (const auto& kept : result) {
+      if (kept.score == match.score &&
+          entries[kept.position] == entries[match.position]) {
+        duplicate = true;
+      }
+    }
+    if (!duplicate)
+      result.push_back(match);
+  }
+  return result;
+}
+
+void ExpectSameMatches(const vector<FuzzyMatch>& expected,
+                       const vector<FuzzyMatch>& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].position, actual[i].position) << i;
+    EXPECT_EQ(expected[i].score, actual[i].score) << i;
+  }
+}
+
+wstring RandomCommand() {
+  const wchar_t kChars[] = L"abcdefgABC -\\.\x00e9\x0169";
+  wstring result;
+  int length = rand() % 12;
+  for (int i = 0; i < length; ++i)
+    result.push_back(kChars[rand() % (sizeof(kChars) / sizeof(kChars[0]) - 1)]);
+  return result;
+}
+
+}  // namespace
+
+TEST(FuzzyMatchTest, FindEitherByte) {
+  srand(1);
+  for (int i = 0; i < 1000; ++i) {
+    string str;
+    int length = rand() % 70;
+    for (int j = 0; j < length; ++j)
+      str.push_back(static_cast<char>(rand() % 256));
+    const char* begin = str.data() + (length ? rand() % length : 0);
+    const char* end = str.data() + str.size();
+    char a = static_cast<char>(rand() % 256);
+    char b = static_cast<char>(rand() % 256);
+    EXPECT_EQ(ScalarFindEitherByte(begin, end, a, b),
+              FindEitherByte(begin, end, a, b));
+  }
+}
+
+TEST(FuzzyMatchTest, CharSignature) {
+  EXPECT_EQ(CharSignature(L"Git"), CharSignature(L"gIT"));
+  uint64_t signature = CharSignature(L"git status");
+  uint64_t query = CharSignature(L"gst");
+  EXPECT_EQ(query, signature & query);
+  query = CharSignature(L"gx");
+  EXPECT_NE(query, signature & query);
+}
+
+TEST(FuzzyMatchTest, FuzzyScore) {
+  EXPECT_EQ(-1, FuzzyScore(L"git status", L"gx"));
+  EXPECT_EQ(-1, FuzzyScore(L"git status", L"tig"));
+  EXPECT_EQ(-1, FuzzyScore(L"", L"g"));
+  EXPECT_EQ(0, FuzzyScore(L"git status", L""));
+  EXPECT_LT(0, FuzzyScore(L"git status", L"GST"));
+
+  // Consecutive beats scattered.
+  EXPECT_GT(FuzzyScore(L"git status", L"sta"),
+            FuzzyScore(L"sxtxa", L"sta"));
+  // Word starts beat the middle of words.
+  EXPECT_GT(FuzzyScore(L"git checkout", L"gc"),
+            FuzzyScore(L"logic", L"gc"));
+  EXPECT_EQ(FuzzyScore(L"Make", L"m"), FuzzyScore(L"make", L"M"));
+  // Shorter gaps are better.
+  EXPECT_GT(FuzzyScore(L"ab", L"ab"), FuzzyScore(L"a b", L"ab"));
+  EXPECT_GT(FuzzyScore(L"a_b", L"ab"), FuzzyScore(L"axxxxb", L"ab"));
+  // Path components beat other words.
+  EXPECT_GT(FuzzyScore(L"src\\base", L"b"), FuzzyScore(L"src-base", L"b"));
+  EXPECT_GT(FuzzyScore(L"src/base", L"sb"), FuzzyScore(L"src_base", L"sb"));
+}
+
+TEST(FuzzyMatchTest, FindBestFuzzyMatches) {
+  vector<wstring> candidates = {
+    L"out/Release/base_unittests", L"base", L"chrome/browser:browser",
+    L"", L"Base", L"obj/base/base.lib", L"abase",
+  };
+  auto candidate = [&candidates](size_t i) {
+    return WStringPiece(candidates[i]);
+  };
+  vector<FuzzyMatch> results;
+  FindBestFuzzyMatches(candidates.size(), candidate, L"base", 3, &results);
+  ASSERT_EQ(3u, results.size());
+  // The whole thing, then its equal, then a path component.
+  EXPECT_EQ(1, results[0].position);
+  EXPECT_EQ(4, results[1].position);
+  EXPECT_EQ(results[0].score, results[1].score);
+  EXPECT_EQ(0, results[2].position);
+  EXPECT_GT(results[1].score, results[2].score);
+
+  FindBestFuzzyMatches(candidates.size(), candidate, L"xyz", 3, &results);
+  EXPECT_TRUE(results.empty());
+  FindBestFuzzyMatches(candidates.size(), candidate, L"base", 0, &results);
+  EXPECT_TRUE(results.empty());
+}
+
+TEST(FuzzyMatchTest, FindBestFuzzyMatchesSameAsSorting) {
+  srand(3);
+  vector<wstring> candidates;
+  for (int i = 0; i < 3000; ++i)
+    candidates.push_back(RandomCommand());
+  auto candidate = [&candidates](size_t i) {
+    return WStringPiece(candidates[i]);
+  };
+  // \x00e9 and \x0169 fold to the same byte.
+  PackedCandidates packed(candidates);
+  for (int i = 0; i < 200; ++i) {
+    wstring query;
+    for (int j = rand() % 4; j > 0; --j)
+      query.push_back(L"abcgAB -\\\x00e9"[rand() % 10]);
+    size_t max_results = rand() % 40;
+    vector<FuzzyMatch> expected;
+    for (size_t j = 0; j < candidates.size(); ++j) {
+      FuzzyMatch match = {static_cast<int>(j),
+                          FuzzyScore(candidates[j], query)};
+      if (match.score >= 0)
+        expected.push_back(match);
+    }
+    stable_sort(expected.begin(),
+                expected.end(),
+                [](const FuzzyMatch& a, const FuzzyMatch& b) {
+                  return a.score > b.score;
+                });
+    if (expected.size() > max_results)
+      expected.resize(max_results);
+    vector<FuzzyMatch> results;
+    FindBestFuzzyMatches(
+        candidates.size(), candidate, query, max_results, &results);
+    ExpectSameMatches(expected, results);
+    if (HasFatalFailure())
+      return;
+    FindBestFuzzyMatches(packed, query, max_results, &results);
+    ExpectSameMatches(expected, results);
+    if (HasFatalFailure())
+      return;
+  }
+}
+
+TEST(FuzzyMatchTest, Search) {
+  deque<wstring> storage;
+  EntryList entries;
+  const wchar_t* kCommands[] = {
+    L"git status", L"ninja -C out", L"git stash", L"git status", L"dir",
+  };
+  for (const auto& command : kCommands) {
+    storage.push_back(command);
+    entries.push_back(storage.back());
+  }
+  FuzzySearcher searcher;
+  vector<FuzzyMatch> results;
+  searcher.Search(entries, L"", 10, &results);
+  EXPECT_TRUE(results.empty());
+
+  searcher.Search(entries, L"gst", 10, &results);
+  // The later "git status" only.
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ(3, results[0].position);
+  EXPECT_EQ(2, results[1].position);
+
+  searcher.Search(entries, L"gsta", 1, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(3, results[0].position);
+
+  searcher.Search(entries, L"gsth", 10, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(2, results[0].position);
+
+  searcher.Search(entries, L"x", 10, &results);
+  EXPECT_TRUE(results.empty());
+
+  // Picks up appended entries.
+  storage.push_back(L"git stash pop");
+  entries.push_back(storage.back());
+  searcher.Search(entries, L"gsth", 10, &results);
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ(5, results[0].position);
+  EXPECT_EQ(2, results[1].position);
+
+  // Non-ASCII characters that share a byte in the searcher's copy.
+  storage.push_back(L"caf\x00e9");
+  entries.push_back(storage.back());
+  storage.push_back(L"caf\x0169");
+  entries.push_back(storage.back());
+  searcher.Search(entries, L"f\x00e9", 10, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(6, results[0].position);
+
+  searcher.Exclude(3);
+  searcher.Search(entries, L"gstu", 10, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(0, results[0].position);
+}
+
+TEST(FuzzyMatchTest, MatchesReference) {
+  srand(2);
+  deque<wstring> storage;
+  // Room for those added in front, as history loaded from the archive is.
+  EntryList entries(5000);
+  deque<bool> excluded;
+  FuzzySearcher searcher;
+  wstring query;
+  vector<FuzzyMatch> results;
+  for (int i = 0; i < 5000; ++i) {
+    int action = rand() % 10;
+    if (action < 1) {
+      storage.push_back(RandomCommand());
+      entries.push_front(storage.back());
+      excluded.push_front(false);
+    } else if (action < 3) {
+      storage.push_back(RandomCommand());
+      entries.push_back(storage.back());
+      excluded.push_back(false);
+    } else if (action < 4 && !entries.empty()) {
+      int position =
+          entries.first() + rand() % static_cast<int>(entries.size());
+      searcher.Exclude(position);
+      excluded[position - entries.first()] = true;
+    } else if (action < 6 && !query.empty()) {
+      query.pop_back();
+    } else if (action < 7) {
+      query.clear();
+    } else {
+      query.push_back(L"abcgAB -\x00e9"[rand() % 9]);
+    }
+    size_t max_results = 1 + rand() % 8;
+    searcher.Search(entries, query, max_results, &results);
+    ExpectSameMatches(ReferenceSearch(entries, excluded, query, max_results),
+                      results);
+    if (HasFatalFailure())
+      return;
+  }
+}
+
+TEST(FuzzyMatchTest, DISABLED_PerfFuzzySearch500k) {
+  const wchar_t* kCommands[] = {
+    L"git checkout ", L"ninja -C out\\Release ", L"cd c:\\src\\chrome\\",
+    L"python build\\run.py --verbose ", L"git rebase -i origin/",
+    L"dir /s /b *.cc | findstr ",
+  };
+  const int kEntries = 500000;
+  deque<wstring> storage;
+  EntryList entries;
+  for (int i = 0; i < kEntries; ++i) {
+    storage.push_back(
+        kCommands[i % (sizeof(kCommands) / sizeof(kCommands[0]))] +
+        to_wstring(i * 7919LL % kEntries));
+    entries.push_back(storage.back());
+  }
+  FuzzySearcher searcher;
+  vector<FuzzyMatch> results;
+  PerfTimer timer;
+  searcher.Update(entries);
+  printf("build: %.1fms\n", timer.ElapsedMs());
+
+  // As typed, with a typo corrected part way.
+  const wchar_t* kQueries[] = {
+    L"n", L"ni", L"nin", L"ninx", L"nin", L"nin ", L"nin r", L"nin re",
+    L"nin rel", L"nin rel1", L"nin rel12", L"nin rel123",
+    L"g", L"gi", L"git", L"git c", L"git ch", L"git ch9", L"git ch99",
+    L"r", L"rb", L"rbo", L"rbor", L"rbori", L"rbori4",
+  };
+  double worst = 0;
+  double total = 0;
+  for (const auto& query : kQueries) {
+    timer.Restart();
+    searcher.Search(entries, query, 50, &results);
+    double ms = timer.ElapsedMs();
+    printf("%-12ls %.3fms\n", query, ms);
+    worst = max(worst, ms);
+    total += ms;
+  }
+  printf("per keystroke: worst %.3fms, average %.3fms\n",
+         worst,
+         total / (sizeof(kQueries) / sizeof(kQueries[0])));
+  if (kCheckPerfBudgets) {
+    EXPECT_GT(1.0, worst);
+  }
+}
@@ -0,0 +1,278 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_archive.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+#endif
+
+#include <algorithm>
+
+#include "common/util.h"
+
+namespace {
+
+const char kSegmentExtension[] = ".seg";
+
+#if defined(_WIN32)
+const char kPathSeparator = '\\';
+#else
+const char kPathSeparator = '/';
+#endif
+
+bool CreateDirectoryIfNecessary(const string& dir) {
+#if defined(_WIN32)
+  return CreateDirectory(dir.c_str(), NULL) ||
+         GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+  return mkdir(dir.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+bool ListDirectory(const string& dir, vector<string>* names) {
+#if defined(_WIN32)
+  WIN32_FIND_DATA data;
+  HANDLE find = FindFirstFile((dir + "\\*").c_str(), &data);
+  if (find == INVALID_HANDLE_VALUE)
+    return GetLastError() == ERROR_FILE_NOT_FOUND;
+  do {
+    names->push_back(data.cFileName);
+  } while (FindNextFile(find, &data));
+  FindClose(find);
+  return true;
+#else
+  DIR* handle = opendir(dir.c_str());
+  if (!handle)
+    return false;
+  while (struct dirent* entry = readdir(handle))
+    names->push_back(entry->d_name);
+  closedir(handle);
+  return true;
+#endif
+}
+
+// Names are "<first>_<last>.seg".
+bool ParseSegmentName(const string& name, int64_t* first, int64_t* last) {
+  size_t extension = name.size() - (sizeof(kSegmentExtension) - 1);
+  if (name.size() <= sizeof(kSegmentExtension) - 1 ||
+      name.compare(extension, string::npos, kSegmentExtension) != 0) {
+    return false;
+  }
+  const char* begin = name.c_str();
+  char* end;
+  *first = strtoll(begin, &end, 10);
+  if (end == begin || *end != '_')
+    return false;
+  begin = end + 1;
+  *last = strtoll(begin, &end, 10);
+  return end != begin && static_cast<size_t>(end - name.c_str()) == extension &&
+         *first <= *last;
+}
+
+}  // namespace
+
+HistoryArchive::HistoryArchive()
+    : compress_(true), max_segment_lines_(64 * 1024) {}
+
+bool HistoryArchive::Open(const string& dir) {
+  dir_ = dir;
+  return CreateDirectoryIfNecessary(dir_);
+}
+
+bool HistoryArchive::Add(const vector<wstring>& lines, int64_t last_seq) {
+  if (lines.empty())
+    return true;
+  int64_t first_seq = last_seq - static_cast<int64_t>(lines.size()) + 1;
+  if (!HistorySegment::Write(GetPath(first_seq, last_seq),
+                             lines,
+                             compress_ ? HistorySegment::kCompressed : 0)) {
+    return false;
+  }
+  // From here on it's only tidying up. The new segment's there either way,
+  // and any that aren't merged are still read as they are.
+  vector<SegmentInfo> segments;
+  vector<SegmentInfo> replaced;
+  if (!List(&segments, &replaced))
+    return true;
+  // Left by a merge that didn't finish removing them.
+  for (const auto& segment : replaced)
+    remove(segment.path.c_str());
+  MergeNewest(&segments);
+  return true;
+}
+
+bool HistoryArchive::GetLastSeq(int64_t* last_seq) {
+  vector<SegmentInfo> segments;
+  if (!List(&segments, NULL))
+    return false;
+  *last_seq = segments.empty() ? 0 : segments.back().last_seq;
+  return true;
+}
+
+bool HistoryArchive::ReadOlder(
+    int64_t before_seq,
+    const function<bool(const HistorySegment&)>& matches,
+    vector<wstring>* lines,
+    int64_t* first_seq) {
+  // A segment can be merged away between being listed and opened, in which
+  // case listing again finds what replaced it.
+  for (int attempt = 0; attempt < 2; ++attempt) {
+    vector<SegmentInfo> segments;
+    if (!List(&segments, NULL))
+      return false;
+    size_t end = 0;
+    while (end < segments.size() && segments[end].first_seq < before_seq)
+      ++end;
+    bool missing = false;
+    size_t found = end;
+    while (found > 0) {
+      const HistorySegment* segment = GetSegment(segments[found - 1]);
+      if (!segment) {
+        missing = true;
+        break;
+      }
+      if (matches(*segment))
+        break;
+      --found;
+    }
+    if (missing)
+      continue;
+    if (found == 0)
+      return false;
+
+    size_t start = lines->size();
+    for (size_t i = found - 1; i < end && !missing; ++i) {
+      const HistorySegment* segment = GetSegment(segments[i]);
+      vector<wstring> segment_lines;
+      if (!segment || !segment->ReadLines(&segment_lines)) {
+        missing = true;
+        break;
+      }
+      // The newest can overlap what's already loaded, if it was archived
+      // from the snapshot after that was read.
+      size_t count = segment_lines.size();
+      if (segments[i].last_seq >= before_seq) {
+        count = min(count,
+                    static_cast<size_t>(before_seq - segments[i].first_seq));
+      }
+      lines->insert(lines->end(),
+                    segment_lines.begin(),
+                    segment_lines.begin() + count);
+    }
+    if (missing) {
+      lines->resize(start);
+      continue;
+    }
+    *first_seq = segments[found - 1].first_seq;
+    return true;
+  }
+  return false;
+}
+
+string HistoryArchive::GetPath(int64_t first_seq, int64_t last_seq) const {
+  return dir_ + kPathSeparator + to_string(first_seq) + "_" +
+         to_string(last_seq) + kSegmentExtension;
+}
+
+bool HistoryArchive::List(vector<SegmentInfo>* segments,
+                          vector<SegmentInfo>* replaced) {
+  vector<string> names;
+  if (!ListDirectory(dir_, &names))
+    return false;
+  vector<SegmentInfo> all;
+  for (const auto& name : names) {
+    SegmentInfo info;
+    if (ParseSegmentName(name, &info.first_seq, &info.last_seq)) {
+      info.path = dir_ + kPathSeparator + name;
+      all.push_back(info);
+    }
+  }
+  // By start, and widest first among those that start together, so that
+  // one that's covered always comes after what covers it.
+  sort(all.begin(), all.end(), [](const SegmentInfo& a, const SegmentInfo& b) {
+    if (a.first_seq != b.first_seq)
+      return a.first_seq < b.first_seq;
+    return a.last_seq > b.last_seq;
+  });
+  segments->clear();
+  for (const auto& info : all) {
+    if (!segments->empty() && info.last_seq <= segments->back().last_seq) {
+      if (replaced)
+        replaced->push_back(info);
+    } else {
+      segments->push_back(info);
+    }
+  }
+
+  // Forget ones that have gone.
+  for (auto it = open_segments_.begin(); it != open_segments_.end();) {
+    bool listed = false;
+    for (const auto& info : *segments)
+      listed = listed || info.path == it->first;
+    if (listed)
+      ++it;
+    else
+      it = open_segments_.erase(it);
+  }
+  return true;
+}
+
+const HistorySegment* HistoryArchive::GetSegment(const SegmentInfo& info) {
+  unique_ptr<HistorySegment>& segment = open_segments_[info.path];
+  if (!segment) {
+    segment.reset(new HistorySegment);
+    if (!segment->Open(info.path)) {
+      open_segments_.erase(info.path);
+      return NULL;
+    }
+  }
+  return segment.get();
+}
+
+bool HistoryArchive::MergeNewest(vector<SegmentInfo>* segments) {
+  while (segments->size() >= 2) {
+    const SegmentInfo& older = (*segments)[segments->size() - 2];
+    const SegmentInfo& newer = segments->back();
+    uint64_t older_size = older.last_seq - older.first_seq + 1;
+    uint64_t newer_size = newer.last_seq - newer.first_seq + 1;
+    if (older_size > 2 * newer_size ||
+        older_size + newer_size > max_segment_lines_) {
+      break;
+    }
+    vector<wstring> lines;
+    HistorySegment older_segment;
+    HistorySegment newer_segment;
+    if (!older_segment.Open(older.path) ||
+        !older_segment.ReadLines(&lines) ||
+        !newer_segment.Open(newer.path) ||
+        !newer_segment.ReadLines(&lines)) {
+      return false;
+    }
+    SegmentInfo merged;
+    merged.first_seq = older.first_seq;
+    merged.last_seq = newer.last_seq;
+    merged.path = GetPath(merged.first_seq, merged.last_seq);
+    if (!HistorySegment::Write(
+            merged.path,
+            lines,
+            compress_ ? HistorySegment::kCompressed : 0)) {
+      return false;
+    }
+    open_segments_.erase(older.path);
+    open_segments_.erase(newer.path);
+    remove(older.path.c_str());
+    remove(newer.path.c_str());
+    segments->pop_back();
+    segments->back() = merged;
+  }
+  return true;
+}
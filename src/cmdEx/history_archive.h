@@ -0,0 +1,86 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_ARCHIVE_H_
+#define CMDEX_HISTORY_ARCHIVE_H_
+
+#include <stdint.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/history_segment.h"
+
+// History older than the snapshot that HistoryJournal keeps, however much
+// there is, as a directory of HistorySegments. Lines are numbered with the
+// journal's sequence numbers, and each segment is named for the range it
+// holds, so that an instance that has loaded everything from some number on
+// can tell what it's missing.
+//
+// Segments are only ever added at the new end, by whoever's compacting the
+// journal (so one at a time, and on HistoryWriter's thread). Adding one
+// merges it with the one before while that's no more than twice its size,
+// up to a limit, so there are O(log N) segments, no larger than the limit,
+// and paging one in never costs more than that. A merged segment is written
+// before the ones it replaces are removed; in between, the smaller ones are
+// ignored.
+class HistoryArchive {
+ public:
+  HistoryArchive();
+
+  // Uses the segments in |dir|, creating it if necessary. Returns false on
+  // failure.
+  bool Open(const string& dir);
+
+  // Whether segments written from now on are compressed (see
+  // HistorySegment).
+  void set_compress(bool compress) { compress_ = compress; }
+  void set_max_segment_lines(size_t count) { max_segment_lines_ = count; }
+
+  // Adds |lines|, oldest first, the last of which is numbered |last_seq|, as
+  // a new segment. Returns false only if it couldn't be written. Merging it
+  // afterwards can fail harmlessly, leaving the segments as they were.
+  bool Add(const vector<wstring>& lines, int64_t last_seq);
+
+  // Sets |last_seq| to the number of the newest line archived, or 0 if there
+  // aren't any. Returns false if the segments couldn't be listed.
+  bool GetLastSeq(int64_t* last_seq);
+
+  // Finds the newest segment that has lines before |before_seq| and for
+  // which |matches| is true, and appends the lines before |before_seq| from
+  // it and any newer segments to |lines|, oldest first. |first_seq| is set
+  // to the number of the first. Returns false if no segment matches.
+  bool ReadOlder(int64_t before_seq,
+                 const function<bool(const HistorySegment&)>& matches,
+                 vector<wstring>* lines,
+                 int64_t* first_seq);
+
+ private:
+  struct SegmentInfo {
+    int64_t first_seq;
+    int64_t last_seq;
+    string path;
+  };
+
+  string GetPath(int64_t first_seq, int64_t last_seq) const;
+  // Oldest first. Segments that another covers (left by a merge) go in
+  // |replaced| instead, if it isn't NULL.
+  bool List(vector<SegmentInfo>* segments, vector<SegmentInfo>* replaced);
+  // Opened segments stay mapped, so that searching the archive again is
+  // cheap. Returns NULL if |info| couldn't be opened.
+  const HistorySegment* GetSegment(const SegmentInfo& info);
+  // Merges the newest segments while they're of a similar size.
+  bool MergeNewest(vector<SegmentInfo>* segments);
+
+  string dir_;
+  bool compress_;
+  size_t max_segment_lines_;
+  map<string, unique_ptr<HistorySegment>> open_segments_;
+};
+
+#endif  // CMDEX_HISTORY_ARCHIVE_H_
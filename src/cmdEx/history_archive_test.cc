@@ -0,0 +1,603 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_archive.h"
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <numeric>
+
+#include "cmdEx/command_history.h"
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+vector<wstring> Numbered(int first, int last) {
+  vector<wstring> lines;
+  for (int i = first; i <= last; ++i)
+    lines.push_back(L"cmd" + to_wstring(i));
+  return lines;
+}
+
+bool Always(const HistorySegment&) { return true; }
+
+TEST(HistorySegmentTest, RoundTrip) {
+  ScopedTempPath path("segment");
+  vector<wstring> lines;
+  lines.push_back(L"git status");
+  lines.push_back(L"git stash pop");
+  lines.push_back(L"");
+  lines.push_back(MakeHistoryLine(L"ninja -C out", L"c:\\src"));
+  lines.push_back(L"git status");
+  for (int i = 0; i < 100; ++i)
+    lines.push_back(L"echo " + to_wstring(i));
+  for (int flags = 0; flags <= 1; ++flags) {
+    ASSERT_TRUE(HistorySegment::Write(path.path(), lines, flags));
+    HistorySegment segment;
+    ASSERT_TRUE(segment.Open(path.path()));
+    EXPECT_EQ(lines.size(), segment.size());
+    vector<wstring> read;
+    ASSERT_TRUE(segment.ReadLines(&read));
+    EXPECT_TRUE(read == lines);
+  }
+}
+
+TEST(HistorySegmentTest, CompressionShrinks) {
+  ScopedTempPath plain_path("plain");
+  ScopedTempPath compressed_path("compressed");
+  vector<wstring> lines;
+  for (int i = 0; i < 1000; ++i)
+    lines.push_back(L"cl /nologo /c src\\cmdEx\\file" + to_wstring(i) + L".cc");
+  ASSERT_TRUE(HistorySegment::Write(plain_path.path(), lines, 0));
+  ASSERT_TRUE(HistorySegment::Write(
+      compressed_path.path(), lines, HistorySegment::kCompressed));
+  MappedFile plain;
+  MappedFile compressed;
+  ASSERT_TRUE(plain.Open(plain_path.path()));
+  ASSERT_TRUE(compressed.Open(compressed_path.path()));
+  EXPECT_LT(compressed.size() * 2, plain.size());
+}
+
+TEST(HistorySegmentTest, HasPrefix) {
+  ScopedTempPath path("segment");
+  vector<wstring> lines;
+  // Enough to span several key blocks.
+  for (int i = 0; i < 500; ++i)
+    lines.push_back(L"make target" + to_wstring(i * 2));
+  lines.push_back(MakeHistoryLine(L"cd build", L"c:\\work"));
+  ASSERT_TRUE(HistorySegment::Write(
+      path.path(), lines, HistorySegment::kCompressed));
+  HistorySegment segment;
+  ASSERT_TRUE(segment.Open(path.path()));
+  EXPECT_TRUE(segment.HasPrefix(L""));
+  EXPECT_TRUE(segment.HasPrefix(L"make"));
+  EXPECT_TRUE(segment.HasPrefix(L"make target0"));
+  EXPECT_TRUE(segment.HasPrefix(L"make target998"));
+  EXPECT_TRUE(segment.HasPrefix(L"make target31"));
+  EXPECT_FALSE(segment.HasPrefix(L"make target999"));
+  EXPECT_FALSE(segment.HasPrefix(L"make target3x"));
+  EXPECT_TRUE(segment.HasPrefix(L"cd b"));
+  // Only commands are indexed, not directories.
+  EXPECT_FALSE(segment.HasPrefix(L"cd buildc"));
+  EXPECT_FALSE(segment.HasPrefix(L"a"));
+  EXPECT_FALSE(segment.HasPrefix(L"z"));
+}
+
+TEST(HistorySegmentTest, HasFuzzyMatch) {
+  ScopedTempPath path("segment");
+  vector<wstring> lines;
+  for (int i = 0; i < 200; ++i)
+    lines.push_back(L"echo " + to_wstring(i));
+  lines.push_back(L"git checkout master");
+  ASSERT_TRUE(HistorySegment::Write(
+      path.path(), lines, HistorySegment::kCompressed));
+  HistorySegment segment;
+  ASSERT_TRUE(segment.Open(path.path()));
+  EXPECT_TRUE(segment.HasFuzzyMatch(L"gcm"));
+  EXPECT_TRUE(segment.HasFuzzyMatch(L"e199"));
+  EXPECT_FALSE(segment.HasFuzzyMatch(L"mcg"));
+  EXPECT_FALSE(segment.HasFuzzyMatch(L"xyz"));
+}
+
+TEST(HistorySegmentTest, RejectsCorrupt) {
+  ScopedTempPath path("segment");
+  ASSERT_TRUE(HistorySegment::Write(
+      path.path(), Numbered(0, 99), HistorySegment::kCompressed));
+  string contents;
+  {
+    MappedFile file;
+    ASSERT_TRUE(file.Open(path.path()));
+    contents.assign(file.data(), file.size());
+  }
+  // A truncated file is rejected, or at least doesn't read back wrong.
+  for (size_t size = 0; size < contents.size(); size += 7) {
+    ASSERT_TRUE(WriteFileAtomically(path.path(), contents.substr(0, size)));
+    HistorySegment segment;
+    if (!segment.Open(path.path()))
+      continue;
+    vector<wstring> read;
+    if (segment.ReadLines(&read)) {
+      EXPECT_TRUE(read == Numbered(0, 99));
+    }
+    segment.HasPrefix(L"cmd5");
+    segment.HasFuzzyMatch(L"c5");
+  }
+}
+
+class HistoryArchiveTest : public testing::Test {
+ protected:
+  HistoryArchiveTest() : dir_("archive") {}
+
+  ScopedTempDirectory dir_;
+};
+
+TEST_F(HistoryArchiveTest, ReadOlder) {
+  HistoryArchive archive;
+  ASSERT_TRUE(archive.Open(dir_.path()));
+  vector<wstring> lines;
+  int64_t first_seq;
+  EXPECT_FALSE(archive.ReadOlder(1, Always, &lines, &first_seq));
+
+  // Sizes that can't be merged, so they stay separate.
+  ASSERT_TRUE(archive.Add(Numbered(1, 100), 100));
+  ASSERT_TRUE(archive.Add(Numbered(101, 110), 110));
+  ASSERT_TRUE(archive.Add(Numbered(111, 112), 112));
+
+  EXPECT_TRUE(archive.ReadOlder(113, Always, &lines, &first_seq));
+  EXPECT_EQ(111, first_seq);
+  EXPECT_TRUE(lines == Numbered(111, 112));
+
+  lines.clear();
+  auto has_cmd5 = [](const HistorySegment& segment) {
+    return segment.HasPrefix(L"cmd5");
+  };
+  EXPECT_TRUE(archive.ReadOlder(111, has_cmd5, &lines, &first_seq));
+  EXPECT_EQ(1, first_seq);
+  EXPECT_TRUE(lines == Numbered(1, 110));
+
+  lines.clear();
+  EXPECT_FALSE(archive.ReadOlder(1, Always, &lines, &first_seq));
+  EXPECT_TRUE(lines.empty());
+
+  // Only what's before |before_seq|, even from the newest.
+  EXPECT_TRUE(archive.ReadOlder(112, Always, &lines, &first_seq));
+  EXPECT_EQ(111, first_seq);
+  EXPECT_TRUE(lines == Numbered(111, 111));
+}
+
+TEST_F(HistoryArchiveTest, MergesSimilarSizes) {
+  HistoryArchive archive;
+  ASSERT_TRUE(archive.Open(dir_.path()));
+  archive.set_max_segment_lines(1000);
+  for (int i = 0; i < 100; ++i)
+    ASSERT_TRUE(archive.Add(Numbered(i * 50 + 1, i * 50 + 50), i * 50 + 50));
+
+  // Count the segments by reading them one at a time.
+  int segments = 0;
+  int64_t before_seq = 5001;
+  vector<wstring> all;
+  for (;;) {
+    vector<wstring> lines;
+    int64_t first_seq;
+    if (!archive.ReadOlder(before_seq, Always, &lines, &first_seq))
+      break;
+    EXPECT_GE(1000u, lines.size());
+    ++segments;
+    lines.insert(lines.end(), all.begin(), all.end());
+    all.swap(lines);
+    before_seq = first_seq;
+  }
+  EXPECT_TRUE(all == Numbered(1, 5000));
+  EXPECT_LE(5, segments);
+  EXPECT_GE(15, segments);
+}
+
+TEST_F(HistoryArchiveTest, IgnoresReplacedSegments) {
+  HistoryArchive archive;
+  ASSERT_TRUE(archive.Open(dir_.path()));
+  ASSERT_TRUE(archive.Add(Numbered(1, 10), 10));
+  ASSERT_TRUE(archive.Add(Numbered(11, 20), 20));
+  // As if a merge had died before removing what it merged.
+  ASSERT_TRUE(HistorySegment::Write(
+      dir_.path() + "/11_20.seg", Numbered(11, 20), 0));
+  HistoryArchive other;
+  ASSERT_TRUE(other.Open(dir_.path()));
+  vector<wstring> lines;
+  int64_t first_seq;
+  auto has_cmd1 = [](const HistorySegment& segment) {
+    return segment.HasPrefix(L"cmd1");
+  };
+  EXPECT_TRUE(other.ReadOlder(21, has_cmd1, &lines, &first_seq));
+  EXPECT_EQ(1, first_seq);
+  EXPECT_TRUE(lines == Numbered(1, 20));
+}
+
+TEST_F(HistoryArchiveTest, JournalArchivesDroppedCommands) {
+  ScopedTempPath journal_path("journal");
+  ScopedTempPath history_path("history");
+  unique_ptr<HistoryJournal> writer(new HistoryJournal);
+  ASSERT_TRUE(writer->Open(journal_path.path(), history_path.path()));
+  writer->set_compact_threshold(200);
+  writer->set_max_snapshot_commands(10);
+  unique_ptr<HistoryArchive> archive(new HistoryArchive);
+  ASSERT_TRUE(archive->Open(dir_.path()));
+  writer->set_archive(move(archive));
+  vector<wstring> commands;
+  ASSERT_TRUE(writer->Load(&commands));
+  for (int i = 1; i <= 100; ++i)
+    ASSERT_TRUE(writer->Append(L"cmd" + to_wstring(i), &commands));
+
+  HistoryJournal fresh;
+  ASSERT_TRUE(fresh.Open(journal_path.path(), history_path.path()));
+  commands.clear();
+  ASSERT_TRUE(fresh.Load(&commands));
+  EXPECT_EQ(L"cmd100", commands.back());
+  EXPECT_EQ(101 - static_cast<int64_t>(commands.size()),
+            fresh.loaded_first_seq());
+
+  HistoryArchive reader;
+  ASSERT_TRUE(reader.Open(dir_.path()));
+  vector<wstring> older;
+  int64_t first_seq;
+  int64_t before_seq = fresh.loaded_first_seq();
+  while (reader.ReadOlder(before_seq, Always, &older, &first_seq)) {
+    commands.insert(commands.begin(), older.begin(), older.end());
+    older.clear();
+    before_seq = first_seq;
+  }
+  EXPECT_TRUE(commands == Numbered(1, 100));
+}
+
+TEST_F(HistoryArchiveTest, FailedCompactionsDontArchiveTwice) {
+  ScopedTempPath journal_path("journal");
+  // The snapshot can't be replaced until its directory exists.
+  ScopedTempDirectory snapshot_dir("snapshot_dir");
+  string history_path = snapshot_dir.path() + kPathSeparator + "history";
+  HistoryJournal writer;
+  ASSERT_TRUE(writer.Open(journal_path.path(), history_path));
+  writer.set_compact_threshold(200);
+  writer.set_max_snapshot_commands(10);
+  unique_ptr<HistoryArchive> archive(new HistoryArchive);
+  ASSERT_TRUE(archive->Open(dir_.path()));
+  writer.set_archive(move(archive));
+  vector<wstring> commands;
+  ASSERT_TRUE(writer.Load(&commands));
+  for (int i = 1; i <= 100; ++i)
+    ASSERT_TRUE(writer.Append(L"cmd" + to_wstring(i), &commands));
+  ASSERT_TRUE(MakeDirectory(snapshot_dir.path()));
+  for (int i = 101; i <= 200; ++i)
+    ASSERT_TRUE(writer.Append(L"cmd" + to_wstring(i), &commands));
+
+  HistoryJournal fresh;
+  ASSERT_TRUE(fresh.Open(journal_path.path(), history_path));
+  commands.clear();
+  ASSERT_TRUE(fresh.Load(&commands));
+  EXPECT_GT(20u, commands.size());
+  HistoryArchive reader;
+  ASSERT_TRUE(reader.Open(dir_.path()));
+  vector<wstring> older;
+  int64_t first_seq;
+  int64_t before_seq = fresh.loaded_first_seq();
+  while (reader.ReadOlder(before_seq, Always, &older, &first_seq)) {
+    commands.insert(commands.begin(), older.begin(), older.end());
+    older.clear();
+    before_seq = first_seq;
+  }
+  // Once each.
+  EXPECT_TRUE(commands == Numbered(1, 200));
+}
+
+TEST_F(HistoryArchiveTest, FailedArchivingKeepsJournal) {
+  ScopedTempPath journal_path("journal");
+  ScopedTempPath history_path("history");
+  HistoryJournal writer;
+  ASSERT_TRUE(writer.Open(journal_path.path(), history_path.path()));
+  writer.set_compact_threshold(200);
+  writer.set_max_snapshot_commands(10);
+  // Segments can't be written while there's a file where the directory
+  // should be.
+  ASSERT_TRUE(WriteFileAtomically(dir_.path(), ""));
+  unique_ptr<HistoryArchive> archive(new HistoryArchive);
+  archive->Open(dir_.path());
+  writer.set_archive(move(archive));
+  vector<wstring> commands;
+  ASSERT_TRUE(writer.Load(&commands));
+  for (int i = 1; i <= 100; ++i)
+    ASSERT_TRUE(writer.Append(L"cmd" + to_wstring(i), &commands));
+  {
+    // Compacting failed along with archiving, so nothing's been dropped.
+    HistoryJournal fresh;
+    ASSERT_TRUE(fresh.Open(journal_path.path(), history_path.path()));
+    commands.clear();
+    ASSERT_TRUE(fresh.Load(&commands));
+    EXPECT_TRUE(commands == Numbered(1, 100));
+  }
+
+  remove(dir_.path().c_str());
+  ASSERT_TRUE(MakeDirectory(dir_.path()));
+  for (int i = 101; i <= 200; ++i)
+    ASSERT_TRUE(writer.Append(L"cmd" + to_wstring(i), &commands));
+  HistoryJournal fresh;
+  ASSERT_TRUE(fresh.Open(journal_path.path(), history_path.path()));
+  commands.clear();
+  ASSERT_TRUE(fresh.Load(&commands));
+  EXPECT_GT(20u, commands.size());
+  HistoryArchive reader;
+  ASSERT_TRUE(reader.Open(dir_.path()));
+  vector<wstring> older;
+  int64_t first_seq;
+  int64_t before_seq = fresh.loaded_first_seq();
+  while (reader.ReadOlder(before_seq, Always, &older, &first_seq)) {
+    commands.insert(commands.begin(), older.begin(), older.end());
+    older.clear();
+    before_seq = first_seq;
+  }
+  EXPECT_TRUE(commands == Numbered(1, 200));
+}
+
+class CommandHistoryArchiveTest : public HistoryArchiveTest {
+ protected:
+  CommandHistoryArchiveTest()
+      : journal_path_("journal"), history_path_("history") {}
+
+  // Enters |commands| through a journal that only keeps the last 10 in its
+  // snapshot, archiving the rest, then loads them into |history|.
+  void Populate(CommandHistory* history, const vector<wstring>& commands) {
+    {
+      unique_ptr<HistoryJournal> journal = OpenJournal();
+      journal->set_compact_threshold(200);
+      journal->set_max_snapshot_commands(10);
+      vector<wstring> others;
+      ASSERT_TRUE(journal->Load(&others));
+      for (const auto& command : commands)
+        ASSERT_TRUE(journal->Append(command, &others));
+    }
+    history->set_archive(OpenArchive());
+    ASSERT_TRUE(history->Populate(OpenJournal()));
+  }
+
+  unique_ptr<HistoryJournal> OpenJournal() {
+    unique_ptr<HistoryJournal> journal(new HistoryJournal);
+    EXPECT_TRUE(journal->Open(journal_path_.path(), history_path_.path()));
+    unique_ptr<HistoryArchive> archive = OpenArchive();
+    archive->set_max_segment_lines(50);
+    journal->set_archive(move(archive));
+    return journal;
+  }
+
+  unique_ptr<HistoryArchive> OpenArchive() {
+    unique_ptr<HistoryArchive> archive(new HistoryArchive);
+    EXPECT_TRUE(archive->Open(dir_.path()));
+    return archive;
+  }
+
+  ScopedTempPath journal_path_;
+  ScopedTempPath history_path_;
+};
+
+TEST_F(CommandHistoryArchiveTest, MovesBackIntoArchive) {
+  CommandHistory history;
+  Populate(&history, Numbered(1, 200));
+  wstring result;
+  for (int i = 200; i >= 1; --i) {
+    ASSERT_TRUE(history.MoveInHistory(-1, L"", &result));
+    EXPECT_EQ(L"cmd" + to_wstring(i), result);
+  }
+  // Everything's loaded now, so this wraps around.
+  ASSERT_TRUE(history.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"cmd200", result);
+  ASSERT_TRUE(history.MoveInHistory(1, L"", &result));
+  EXPECT_EQ(L"cmd1", result);
+}
+
+TEST_F(CommandHistoryArchiveTest, PrefixSearchLoadsWhatMatches) {
+  CommandHistory history;
+  vector<wstring> commands = Numbered(1, 200);
+  commands[4] = L"rare command";
+  Populate(&history, commands);
+  wstring result;
+  ASSERT_TRUE(history.MoveInHistory(-1, L"rare", &result));
+  EXPECT_EQ(L"rare command", result);
+  // Then carries on back from there.
+  ASSERT_TRUE(history.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"cmd4", result);
+  ASSERT_TRUE(history.MoveInHistory(1, L"", &result));
+  EXPECT_EQ(L"rare command", result);
+  ASSERT_TRUE(history.MoveInHistory(1, L"", &result));
+  EXPECT_EQ(L"cmd6", result);
+  EXPECT_FALSE(history.MoveInHistory(-1, L"missing", &result));
+}
+
+TEST_F(CommandHistoryArchiveTest, KeepsCurrentDirectoryFirst) {
+  CommandHistory history;
+  history.set_deduplicate(true);
+  history.set_directory(L"c:\\src");
+  vector<wstring> commands = Numbered(1, 100);
+  commands[2] = MakeHistoryLine(L"build", L"c:\\src");
+  commands[90] = MakeHistoryLine(L"test", L"c:\\src");
+  commands[95] = L"cmd10";
+  Populate(&history, commands);
+  wstring result;
+  ASSERT_TRUE(history.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"test", result);
+  ASSERT_TRUE(history.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"cmd100", result);
+  // Loading "build" from the archive leaves the position where it was.
+  ASSERT_TRUE(history.MoveInHistory(-1, L"b", &result));
+  EXPECT_EQ(L"build", result);
+  ASSERT_TRUE(history.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"cmd100", result);
+  // Deduplicated against what was already loaded.
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(history.MoveInHistory(-1, L"cmd10", &result));
+    EXPECT_TRUE(result == L"cmd100" || result == L"cmd10") << i;
+  }
+}
+
+TEST_F(CommandHistoryArchiveTest, FuzzySearchLoadsMatches) {
+  CommandHistory history;
+  vector<wstring> commands = Numbered(1, 200);
+  commands[9] = L"git checkout master";
+  commands[99] = L"git commit -m";
+  Populate(&history, commands);
+  vector<wstring> results;
+  // A search only loads once, so the second finds the older one.
+  history.FuzzySearch(L"gcm", 10, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(L"git commit -m", results[0]);
+  history.FuzzySearch(L"gcm", 10, &results);
+  ASSERT_EQ(2u, results.size());
+  history.FuzzySearch(L"gcma", 10, &results);
+  ASSERT_EQ(1u, results.size());
+  EXPECT_EQ(L"git checkout master", results[0]);
+}
+
+TEST_F(CommandHistoryArchiveTest, LoadedMatchesPopulated) {
+  // Loading the archive a piece at a time ends up the same as having had it
+  // all to begin with.
+  srand(97);
+  vector<wstring> commands;
+  for (int i = 0; i < 300; ++i) {
+    wstring command;
+    for (int length = 1 + rand() % 3; length > 0; --length)
+      command.push_back(L"abc"[rand() % 3]);
+    const wchar_t* kDirectories[] = {L"", L"x", L"y"};
+    commands.push_back(MakeHistoryLine(command, kDirectories[rand() % 3]));
+  }
+  for (int deduplicate = 0; deduplicate <= 1; ++deduplicate) {
+    CommandHistory loaded;
+    loaded.set_deduplicate(deduplicate != 0);
+    loaded.set_directory(L"x");
+    if (deduplicate) {
+      loaded.set_archive(OpenArchive());
+      ASSERT_TRUE(loaded.Populate(OpenJournal()));
+    } else {
+      Populate(&loaded, commands);
+    }
+    wstring result;
+    for (int i = 0; i < 3000; ++i)
+      loaded.MoveInHistory(-1, L"", &result);
+    CommandHistory populated;
+    populated.set_deduplicate(deduplicate != 0);
+    populated.set_directory(L"x");
+    populated.Populate(commands);
+    EXPECT_TRUE(loaded.GetListForSaving() == populated.GetListForSaving());
+
+    loaded.set_directory(L"y");
+    populated.set_directory(L"y");
+    for (int i = 0; i < 500; ++i) {
+      int direction = rand() % 3 == 0 ? 1 : -1;
+      wstring prefix;
+      for (int length = rand() % 3; length > 0; --length)
+        prefix.push_back(L"abc"[rand() % 3]);
+      wstring loaded_result;
+      wstring populated_result;
+      ASSERT_EQ(populated.MoveInHistory(direction, prefix, &populated_result),
+                loaded.MoveInHistory(direction, prefix, &loaded_result));
+      ASSERT_EQ(populated_result, loaded_result) << i;
+      vector<wstring> loaded_matches;
+      vector<wstring> populated_matches;
+      loaded.FuzzySearch(prefix, 5, &loaded_matches);
+      populated.FuzzySearch(prefix, 5, &populated_matches);
+      EXPECT_TRUE(loaded_matches == populated_matches) << i;
+    }
+  }
+}
+
+TEST_F(CommandHistoryArchiveTest, DISABLED_PerfPageInArchive) {
+  // A search for what's only in every so many commands loads a segment back
+  // each time, which shouldn't get slower for all that's loaded already.
+  const int kCommands = 500000;
+  const int kRareEvery = 5000;
+  {
+    unique_ptr<HistoryJournal> journal(new HistoryJournal);
+    ASSERT_TRUE(journal->Open(journal_path_.path(), history_path_.path()));
+    unique_ptr<HistoryArchive> archive = OpenArchive();
+    archive->set_max_segment_lines(kRareEvery);
+    journal->set_archive(move(archive));
+    journal->set_compact_threshold(1 << 20);
+    journal->set_max_snapshot_commands(1000);
+    vector<wstring> others;
+    ASSERT_TRUE(journal->Load(&others));
+    for (int i = 0; i < kCommands; ++i) {
+      wstring command = i % kRareEvery == kRareEvery / 2
+                            ? L"qzx " + to_wstring(i)
+                            : L"ninja -C out\\Release target" + to_wstring(i);
+      ASSERT_TRUE(journal->Append(command, &others));
+    }
+  }
+  CommandHistory history;
+  history.set_deduplicate(true);
+  history.set_archive(OpenArchive());
+  ASSERT_TRUE(history.Populate(OpenJournal()));
+  history.WaitForIndexing();
+
+  vector<wstring> results;
+  vector<double> times;
+  while (results.size() < kCommands / kRareEvery) {
+    PerfTimer timer;
+    history.FuzzySearch(L"qzx", kCommands, &results);
+    times.push_back(timer.ElapsedMs());
+  }
+  size_t half = times.size() / 2;
+  double first_half = accumulate(times.begin(), times.begin() + half, 0.0);
+  double second_half = accumulate(times.end() - half, times.end(), 0.0);
+  printf("%zu searches to load %d commands: first half %.1fms, second %.1fms, "
+         "worst %.1fms\n",
+         times.size(),
+         kCommands,
+         first_half,
+         second_half,
+         *max_element(times.begin(), times.end()));
+  // Each load costs about what it loads, not what's loaded already.
+  if (kCheckPerfBudgets) {
+    EXPECT_GT(2 * first_half, second_half);
+  }
+}
+
+TEST(HistoryArchivePerfTest, DISABLED_PerfSearchTenMillion) {
+  ScopedTempDirectory dir("archive");
+  HistoryArchive archive;
+  ASSERT_TRUE(archive.Open(dir.path()));
+  const int kCount = 10 * 1000 * 1000;
+  const int kBatch = 10000;
+  PerfTimer write_timer;
+  for (int i = 0; i < kCount; i += kBatch) {
+    vector<wstring> lines;
+    for (int j = i; j < i + kBatch; ++j) {
+      lines.push_back(L"build target" + to_wstring(j % 50000) + L" --jobs=" +
+                      to_wstring(j % 64));
+    }
+    ASSERT_TRUE(archive.Add(lines, i + kBatch));
+  }
+  printf("archived %d lines in %.0fms\n", kCount, write_timer.ElapsedMs());
+
+  HistoryArchive reader;
+  ASSERT_TRUE(reader.Open(dir.path()));
+  PerfTimer search_timer;
+  vector<wstring> lines;
+  int64_t first_seq;
+  EXPECT_FALSE(reader.ReadOlder(
+      kCount + 1,
+      [](const HistorySegment& segment) {
+        return segment.HasPrefix(L"missing");
+      },
+      &lines,
+      &first_seq));
+  printf("prefix search missed in %.2fms\n", search_timer.ElapsedMs());
+  PerfTimer again_timer;
+  EXPECT_FALSE(reader.ReadOlder(
+      kCount + 1,
+      [](const HistorySegment& segment) {
+        return segment.HasFuzzyMatch(L"zq");
+      },
+      &lines,
+      &first_seq));
+  printf("fuzzy search missed in %.2fms\n", again_timer.ElapsedMs());
+}
+
+}  // namespace
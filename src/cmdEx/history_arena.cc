@@ -0,0 +1,55 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_arena.h"
+
+#include <string.h>
+
+namespace {
+
+// In wchar_ts.
+const size_t kBlockSize = 64 * 1024;
+
+}  // namespace
+
+HistoryArena::HistoryArena() : used_(0) {}
+
+WStringPiece HistoryArena::Add(const WStringPiece& str) {
+  // The last block is always the one being filled, so there has to be one
+  // before anything else goes in.
+  if (blocks_.empty() ||
+      (str.size() <= kBlockSize / 4 && used_ + str.size() > kBlockSize)) {
+    blocks_.push_back(unique_ptr<wchar_t[]>(new wchar_t[kBlockSize]));
+    block_sizes_.push_back(kBlockSize);
+    used_ = 0;
+  }
+  if (str.size() > kBlockSize / 4) {
+    // Big enough to be worth its own block, which goes before the current
+    // one so that that can still be filled.
+    unique_ptr<wchar_t[]> block(new wchar_t[str.size()]);
+    memcpy(block.get(), str.data(), str.size() * sizeof(wchar_t));
+    WStringPiece result(block.get(), str.size());
+    blocks_.insert(blocks_.end() - 1, move(block));
+    block_sizes_.insert(block_sizes_.end() - 1, str.size());
+    return result;
+  }
+  wchar_t* copy = blocks_.back().get() + used_;
+  memcpy(copy, str.data(), str.size() * sizeof(wchar_t));
+  used_ += str.size();
+  return WStringPiece(copy, str.size());
+}
+
+void HistoryArena::Clear() {
+  vector<unique_ptr<wchar_t[]>>().swap(blocks_);
+  vector<size_t>().swap(block_sizes_);
+  used_ = 0;
+}
+
+size_t HistoryArena::memory_usage() const {
+  size_t total = blocks_.capacity() * sizeof(blocks_[0]) +
+                 block_sizes_.capacity() * sizeof(block_sizes_[0]);
+  for (const auto& size : block_sizes_)
+    total += size * sizeof(wchar_t);
+  return total;
+}
@@ -0,0 +1,45 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_ARENA_H_
+#define CMDEX_HISTORY_ARENA_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/string_util.h"
+
+// Append-only storage for history lines, in large blocks, so that adding one
+// is a copy rather than an allocation of its own. Lines never move once
+// added, so views of them stay valid for as long as the arena does (moving
+// the arena included).
+//
+// Lines are stored whole, not front coded against the one before, because
+// everything that refers to them (PrefixIndex, FuzzySearcher, the
+// per-directory lists) needs each as a contiguous view. Front coding is only
+// used for history that's been archived (see HistorySegment), which is read
+// in order.
+class HistoryArena {
+ public:
+  HistoryArena();
+
+  // Returns a view of the copy.
+  WStringPiece Add(const WStringPiece& str);
+  void Clear();
+
+  // Bytes allocated.
+  size_t memory_usage() const;
+
+ private:
+  vector<unique_ptr<wchar_t[]>> blocks_;
+  vector<size_t> block_sizes_;
+  // How much of the last block is used.
+  size_t used_;
+};
+
+#endif  // CMDEX_HISTORY_ARENA_H_
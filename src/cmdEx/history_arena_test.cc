@@ -0,0 +1,97 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_arena.h"
+
+#include <stdio.h>
+
+#include <deque>
+
+#include "cmdEx/perf_timer.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Commands come in runs of similar ones, as they do when typed.
+vector<wstring> MakeLines(int count) {
+  const wchar_t* kCommands[] = {
+    L"git checkout ", L"ninja -C out\\Release ", L"cd c:\\src\\chrome\\",
+    L"python build\\run.py ", L"git rebase -i origin/",
+  };
+  vector<wstring> lines;
+  for (int i = 0; i < count; ++i)
+    lines.push_back(kCommands[i / 3 % 5] + to_wstring(i * 7919LL % 1000));
+  return lines;
+}
+
+// Roughly what a deque<wstring> holding |lines| allocates, in MB.
+double DequeMemoryUsage(const deque<wstring>& lines) {
+  size_t total = lines.size() * sizeof(wstring);
+  for (const auto& line : lines) {
+    const char* object = reinterpret_cast<const char*>(&line);
+    const char* data = reinterpret_cast<const char*>(line.data());
+    // Short strings are stored in the object itself.
+    if (data < object || data >= object + sizeof(line))
+      total += (line.capacity() + 1) * sizeof(wchar_t);
+  }
+  return static_cast<double>(total) / 1e6;
+}
+
+double Megabytes(size_t bytes) {
+  return static_cast<double>(bytes) / 1e6;
+}
+
+}  // namespace
+
+TEST(HistoryArenaTest, Add) {
+  HistoryArena arena;
+  vector<wstring> lines = MakeLines(50000);
+  // One that needs its own block.
+  lines[1000] = wstring(100000, L'x');
+  vector<WStringPiece> added;
+  for (const auto& line : lines)
+    added.push_back(arena.Add(line));
+  ASSERT_EQ(lines.size(), added.size());
+  for (size_t i = 0; i < lines.size(); ++i)
+    EXPECT_EQ(lines[i], added[i].as_string());
+  EXPECT_EQ(L"", arena.Add(L"").as_string());
+
+  // Views survive the arena being moved.
+  HistoryArena moved(move(arena));
+  EXPECT_EQ(lines.back(), added.back().as_string());
+  moved.Clear();
+  EXPECT_EQ(0u, moved.memory_usage());
+}
+
+TEST(HistoryArenaTest, AddBigFirst) {
+  HistoryArena arena;
+  wstring big(100000, L'x');
+  WStringPiece added_big = arena.Add(big);
+  // Goes in the block being filled, not over the start of the big one.
+  WStringPiece added_small = arena.Add(L"a");
+  EXPECT_EQ(big, added_big.as_string());
+  EXPECT_EQ(L"a", added_small.as_string());
+}
+
+TEST(HistoryArenaTest, DISABLED_PerfMemory1M) {
+  const int kLines = 1000000;
+  vector<wstring> lines = MakeLines(kLines);
+
+  PerfTimer timer;
+  deque<wstring> strings;
+  for (const auto& line : lines)
+    strings.push_back(line);
+  double strings_ms = timer.ElapsedMs();
+
+  timer.Restart();
+  HistoryArena arena;
+  for (const auto& line : lines)
+    arena.Add(line);
+  double arena_ms = timer.ElapsedMs();
+
+  printf("deque<wstring>: %6.1fMB, add %.1fms\n",
+         DequeMemoryUsage(strings), strings_ms);
+  printf("HistoryArena:   %6.1fMB, add %.1fms\n",
+         Megabytes(arena.memory_usage()), arena_ms);
+}
@@ -0,0 +1,351 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_file.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define CMDEX_HAVE_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "common/util.h"
+
+namespace {
+
+const uint16_t kByteOrderMark = 0xfeff;
+// Can't be typed at the prompt, so won't be in commands.
+const wchar_t kDirectorySeparator = L'\x1f';
+
+#if defined(CMDEX_HAVE_SSE2)
+int CountTrailingZeros(unsigned int x) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, x);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctz(x);
+#endif
+}
+#endif
+
+bool IsHighSurrogate(uint16_t c) {
+  return c >= 0xd800 && c < 0xdc00;
+}
+
+bool IsLowSurrogate(uint16_t c) {
+  return c >= 0xdc00 && c < 0xe000;
+}
+
+}  // namespace
+
+wstring MakeHistoryLine(const wstring& command, const wstring& directory) {
+  if (directory.empty())
+    return command;
+  wstring line;
+  line.reserve(command.size() + 1 + directory.size());
+  line += command;
+  line.push_back(kDirectorySeparator);
+  line += directory;
+  return line;
+}
+
+void SplitHistoryLine(const WStringPiece& line,
+                      WStringPiece* command,
+                      WStringPiece* directory) {
+  // From the end, as directories are generally shorter than commands.
+  size_t i = line.size();
+  while (i > 0 && line[i - 1] != kDirectorySeparator)
+    --i;
+  if (i == 0) {
+    *command = line;
+    *directory = WStringPiece();
+    return;
+  }
+  *command = WStringPiece(line.data(), i - 1);
+  *directory = WStringPiece(line.data() + i, line.size() - i);
+}
+
+void AppendUtf16Le(const WStringPiece& str, string* out) {
+  for (size_t i = 0; i < str.size(); ++i) {
+    uint32_t c = static_cast<uint32_t>(str[i]);
+    if (c >= 0x10000 && c <= 0x10ffff) {
+      c -= 0x10000;
+      uint16_t high = static_cast<uint16_t>(0xd800 + (c >> 10));
+      uint16_t low = static_cast<uint16_t>(0xdc00 + (c & 0x3ff));
+      out->push_back(static_cast<char>(high & 0xff));
+      out->push_back(static_cast<char>(high >> 8));
+      out->push_back(static_cast<char>(low & 0xff));
+      out->push_back(static_cast<char>(low >> 8));
+    } else {
+      out->push_back(static_cast<char>(c & 0xff));
+      out->push_back(static_cast<char>((c >> 8) & 0xff));
+    }
+  }
+}
+
+void Put32(uint32_t value, string* out) {
+  for (int i = 0; i < 4; ++i)
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+void Put64(uint64_t value, string* out) {
+  for (int i = 0; i < 8; ++i)
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+}
+
+uint32_t Get32(const char* data) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  uint32_t value = 0;
+  for (int i = 3; i >= 0; --i)
+    value = (value << 8) | bytes[i];
+  return value;
+}
+
+uint64_t Get64(const char* data) {
+  return Get32(data) | (static_cast<uint64_t>(Get32(data + 4)) << 32);
+}
+
+void AppendFromUtf16Le(const char* data, size_t size, wstring* out) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+  size_t units = size / 2;
+  for (size_t i = 0; i < units; ++i) {
+    uint32_t c = static_cast<uint32_t>(bytes[2 * i] | (bytes[2 * i + 1] << 8));
+    if (sizeof(wchar_t) > sizeof(uint16_t) &&
+        IsHighSurrogate(static_cast<uint16_t>(c)) && i + 1 < units) {
+      uint16_t low =
+          static_cast<uint16_t>(bytes[2 * i + 2] | (bytes[2 * i + 3] << 8));
+      if (IsLowSurrogate(low)) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+        ++i;
+      }
+    }
+    out->push_back(static_cast<wchar_t>(c));
+  }
+}
+
+MappedFile::MappedFile() : data_(NULL), size_(0) {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::Open(const string& path) {
+  Close();
+  // Share everything, so that other shells can still read and append to the
+  // file while it's open here. Once it's mapped, though, it can't be replaced
+  // or deleted until it's closed.
+  HANDLE file = CreateFile(path.c_str(),
+                           GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           NULL,
+                           OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+                           NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    return false;
+  }
+  if (size.QuadPart == 0) {
+    // Zero-length files can't be mapped.
+    CloseHandle(file);
+    return true;
+  }
+  HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping)
+    return false;
+  // The view keeps the mapping alive.
+  void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  if (!view)
+    return false;
+  data_ = static_cast<const char*>(view);
+  size_ = static_cast<size_t>(size.QuadPart);
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+#else
+
+bool MappedFile::Open(const string& path) {
+  Close();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat buffer;
+  if (fstat(fd, &buffer) != 0) {
+    close(fd);
+    return false;
+  }
+  if (buffer.st_size == 0) {
+    close(fd);
+    return true;
+  }
+  size_t size = static_cast<size_t>(buffer.st_size);
+  void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (view == MAP_FAILED)
+    return false;
+  data_ = static_cast<const char*>(view);
+  size_ = size;
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+  data_ = NULL;
+  size_ = 0;
+}
+
+#endif
+
+const uint16_t* FindNewline(const uint16_t* begin, const uint16_t* end) {
+  const uint16_t* p = begin;
+#if defined(CMDEX_HAVE_SSE2)
+  const __m128i newline = _mm_set1_epi16(L'\n');
+  while (end - p >= 8) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(chunk, newline));
+    if (mask != 0)
+      return p + CountTrailingZeros(static_cast<unsigned int>(mask)) / 2;
+    p += 8;
+  }
+#endif
+  while (p != end && *p != L'\n')
+    ++p;
+  return p;
+}
+
+HistoryFile::HistoryFile() {}
+
+bool HistoryFile::Open(const string& path) {
+  lines_.clear();
+  widened_.clear();
+  if (!file_.Open(path))
+    return false;
+  // Views are at least page aligned, so this is suitably aligned for
+  // uint16_t. A stray odd byte at the end is ignored.
+  const uint16_t* begin = reinterpret_cast<const uint16_t*>(file_.data());
+  const uint16_t* end = begin + file_.size() / 2;
+  if (begin != end && *begin == kByteOrderMark)
+    ++begin;
+  SplitLines(begin, end);
+  return true;
+}
+
+void HistoryFile::SplitLines(const uint16_t* begin, const uint16_t* end) {
+  // Where wchar_t is UTF-16 the file's contents can be used directly.
+  // Elsewhere, decode everything into |widened_| first. It never needs more
+  // wchar_ts than there are UTF-16 code units, so reserving that up front
+  // keeps the offsets recorded below valid as pointers afterwards.
+  bool direct = sizeof(wchar_t) == sizeof(uint16_t);
+  vector<size_t> widened_lines;
+  if (!direct)
+    widened_.reserve(static_cast<size_t>(end - begin));
+
+  const uint16_t* line = begin;
+  while (line != end) {
+    const uint16_t* newline = FindNewline(line, end);
+    const uint16_t* line_end = newline;
+    if (line_end != line && line_end[-1] == L'\r')
+      --line_end;
+    if (line_end != line) {
+      if (direct) {
+        lines_.push_back(WStringPiece(reinterpret_cast<const wchar_t*>(line),
+                                      static_cast<size_t>(line_end - line)));
+      } else {
+        widened_lines.push_back(widened_.size());
+        AppendFromUtf16Le(reinterpret_cast<const char*>(line),
+                          static_cast<size_t>(line_end - line) * 2,
+                          &widened_);
+        widened_lines.push_back(widened_.size());
+      }
+    }
+    line = newline == end ? end : newline + 1;
+  }
+
+  for (size_t i = 0; i < widened_lines.size(); i += 2) {
+    lines_.push_back(WStringPiece(widened_.data() + widened_lines[i],
+                                  widened_lines[i + 1] - widened_lines[i]));
+  }
+}
+
+bool WriteFileAtomically(const string& path, const string& contents) {
+#if defined(_WIN32)
+  string temp_path = path + "." + to_string(_getpid()) + ".tmp";
+#else
+  string temp_path = path + "." + to_string(getpid()) + ".tmp";
+#endif
+  FILE* f = fopen(temp_path.c_str(), "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    remove(temp_path.c_str());
+    return false;
+  }
+#if defined(_WIN32)
+  if (!MoveFileEx(temp_path.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+    // ERROR_ACCESS_DENIED or ERROR_USER_MAPPED_FILE if it's mapped.
+    Log("couldn't replace %s: error %lu", path.c_str(), GetLastError());
+    ok = false;
+  }
+#else
+  if (rename(temp_path.c_str(), path.c_str()) != 0) {
+    Log("couldn't replace %s: %s", path.c_str(), strerror(errno));
+    ok = false;
+  }
+#endif
+  if (!ok)
+    remove(temp_path.c_str());
+  return ok;
+}
+
+bool WriteHistoryFile(const string& path,
+                      const vector<wstring>& commands,
+                      size_t max_commands) {
+  size_t first =
+      commands.size() > max_commands ? commands.size() - max_commands : 0;
+  string contents;
+  contents.push_back(static_cast<char>(kByteOrderMark & 0xff));
+  contents.push_back(static_cast<char>(kByteOrderMark >> 8));
+  for (size_t i = first; i < commands.size(); ++i) {
+    AppendUtf16Le(commands[i], &contents);
+    contents.push_back('\n');
+    contents.push_back('\0');
+  }
+  return WriteFileAtomically(path, contents);
+}
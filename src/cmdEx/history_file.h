@@ -0,0 +1,101 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_FILE_H_
+#define CMDEX_HISTORY_FILE_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/string_util.h"
+
+// A whole file mapped read-only into memory. On Windows, the file can't be
+// replaced (e.g. by WriteFileAtomically()) by any process while it's mapped.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Returns false if |path| couldn't be opened or mapped. An empty file maps
+  // successfully, with no data.
+  bool Open(const string& path);
+  void Close();
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  MappedFile(const MappedFile&);
+  void operator=(const MappedFile&);
+
+  const char* data_;
+  size_t size_;
+};
+
+// The saved command history: UTF-16LE, optionally starting with a BOM, one
+// command per line (see MakeHistoryLine()), oldest first. The lines are views
+// of the mapped file rather than copies, so loading a large history is one
+// scan over it.
+class HistoryFile {
+ public:
+  HistoryFile();
+
+  // Returns false if |path| couldn't be read. Blank lines are skipped, and a
+  // trailing \r on a line is dropped.
+  bool Open(const string& path);
+
+  // Valid for as long as this object is.
+  const vector<WStringPiece>& lines() const { return lines_; }
+
+ private:
+  void SplitLines(const uint16_t* begin, const uint16_t* end);
+
+  MappedFile file_;
+  // Only used where wchar_t isn't UTF-16 (i.e. not on Windows), in which case
+  // the lines point in here instead of into |file_|.
+  wstring widened_;
+  vector<WStringPiece> lines_;
+};
+
+// A line of history: |command|, then, if |directory| (where it was run) isn't
+// empty, a \x1f separator and |directory|. Lines from before directories were
+// recorded are just the command.
+wstring MakeHistoryLine(const wstring& command, const wstring& directory);
+
+// The reverse of MakeHistoryLine(). Both pieces point into |line|.
+void SplitHistoryLine(const WStringPiece& line,
+                      WStringPiece* command,
+                      WStringPiece* directory);
+
+// Appends |str| encoded as UTF-16LE to |out|.
+void AppendUtf16Le(const WStringPiece& str, string* out);
+
+// Appends the |size| bytes of UTF-16LE at |data| to |out|, decoded.
+void AppendFromUtf16Le(const char* data, size_t size, wstring* out);
+
+// Little-endian integers, as history's binary files are written.
+void Put32(uint32_t value, string* out);
+void Put64(uint64_t value, string* out);
+uint32_t Get32(const char* data);
+uint64_t Get64(const char* data);
+
+// Returns the first L'\n' in [begin, end), or |end|. Vectorized where SSE2 is
+// available.
+const uint16_t* FindNewline(const uint16_t* begin, const uint16_t* end);
+
+// Writes |contents| alongside |path| and then renames it into place, so that
+// other processes that have the old file open, or read it concurrently, never
+// see a partial one. Fails on Windows if any process has |path| mapped.
+bool WriteFileAtomically(const string& path, const string& contents);
+
+// Saves the last |max_commands| of |commands| to |path| in the format
+// HistoryFile reads, with WriteFileAtomically(). Returns false on failure.
+bool WriteHistoryFile(const string& path,
+                      const vector<wstring>& commands,
+                      size_t max_commands);
+
+#endif  // CMDEX_HISTORY_FILE_H_
@@ -0,0 +1,240 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_file.h"
+
+#include <stdio.h>
+
+#include "cmdEx/command_history.h"
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Writes |units| as UTF-16LE, plus |extra_byte| if it's not -1.
+void WriteRaw(const string& path,
+              const vector<uint16_t>& units,
+              int extra_byte = -1) {
+  FILE* f = fopen(path.c_str(), "wb");
+  ASSERT_TRUE(f != NULL);
+  for (const auto& unit : units) {
+    fputc(unit & 0xff, f);
+    fputc(unit >> 8, f);
+  }
+  if (extra_byte != -1)
+    fputc(extra_byte, f);
+  fclose(f);
+}
+
+vector<uint16_t> Units(const wchar_t* str) {
+  vector<uint16_t> result;
+  for (; *str; ++str)
+    result.push_back(static_cast<uint16_t>(*str));
+  return result;
+}
+
+vector<wstring> Lines(const HistoryFile& file) {
+  vector<wstring> result;
+  for (const auto& line : file.lines())
+    result.push_back(line.as_string());
+  return result;
+}
+
+}  // namespace
+
+TEST(HistoryFileTest, RoundTrip) {
+  ScopedTempPath temp("roundtrip");
+  vector<wstring> commands;
+  commands.push_back(L"dir");
+  commands.push_back(L"cd \"c:\\program files\"");
+  commands.push_back(L"echo \u00e9\u4e2d\U0001F600!");
+  commands.push_back(wstring(10000, L'x'));
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+  HistoryFile file;
+  ASSERT_TRUE(file.Open(temp.path()));
+  EXPECT_EQ(commands, Lines(file));
+}
+
+TEST(HistoryFileTest, KeepsMostRecent) {
+  ScopedTempPath temp("recent");
+  vector<wstring> commands;
+  commands.push_back(L"a");
+  commands.push_back(L"b");
+  commands.push_back(L"c");
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 2));
+  HistoryFile file;
+  ASSERT_TRUE(file.Open(temp.path()));
+  ASSERT_EQ(2u, file.lines().size());
+  EXPECT_EQ(L"b", file.lines()[0].as_string());
+  EXPECT_EQ(L"c", file.lines()[1].as_string());
+}
+
+TEST(HistoryFileTest, ReplacesExistingWhileOpen) {
+  ScopedTempPath temp("replace");
+  vector<wstring> commands(1, L"old");
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+  commands.push_back(L"new");
+  {
+    HistoryFile old_file;
+    ASSERT_TRUE(old_file.Open(temp.path()));
+#if defined(_WIN32)
+    // Windows won't replace a file while it's mapped.
+    EXPECT_FALSE(WriteHistoryFile(temp.path(), commands, 1000));
+#else
+    ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+#endif
+    // Either way, the old mapping is still intact.
+    EXPECT_EQ(vector<wstring>(1, L"old"), Lines(old_file));
+  }
+  // Once it's unmapped, it can be replaced everywhere.
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+  HistoryFile new_file;
+  ASSERT_TRUE(new_file.Open(temp.path()));
+  EXPECT_EQ(commands, Lines(new_file));
+}
+
+TEST(HistoryFileTest, Missing) {
+  ScopedTempPath temp("missing");
+  HistoryFile file;
+  EXPECT_FALSE(file.Open(temp.path()));
+}
+
+TEST(HistoryFileTest, Empty) {
+  ScopedTempPath temp("empty");
+  WriteRaw(temp.path(), vector<uint16_t>());
+  HistoryFile file;
+  EXPECT_TRUE(file.Open(temp.path()));
+  EXPECT_TRUE(file.lines().empty());
+
+  WriteRaw(temp.path(), Units(L"\xfeff"));
+  EXPECT_TRUE(file.Open(temp.path()));
+  EXPECT_TRUE(file.lines().empty());
+}
+
+TEST(HistoryFileTest, Tolerant) {
+  ScopedTempPath temp("tolerant");
+  // No BOM, \r\n, blank lines, no final newline, and a stray odd byte.
+  WriteRaw(temp.path(), Units(L"abc\r\n\n\ndef\n\r\nghi"), 'x');
+  HistoryFile file;
+  ASSERT_TRUE(file.Open(temp.path()));
+  vector<wstring> expected;
+  expected.push_back(L"abc");
+  expected.push_back(L"def");
+  expected.push_back(L"ghi");
+  EXPECT_EQ(expected, Lines(file));
+}
+
+TEST(HistoryFileTest, FindNewline) {
+  vector<uint16_t> units(67, L'a');
+  for (size_t newline = 0; newline <= units.size(); ++newline) {
+    vector<uint16_t> test(units);
+    if (newline < test.size())
+      test[newline] = L'\n';
+    for (size_t start = 0; start <= newline; ++start) {
+      const uint16_t* begin = test.data() + start;
+      const uint16_t* end = test.data() + test.size();
+      EXPECT_EQ(test.data() + newline, FindNewline(begin, end));
+    }
+  }
+}
+
+TEST(HistoryFileTest, PopulatesCommandHistory) {
+  ScopedTempPath temp("populate");
+  vector<wstring> commands;
+  commands.push_back(L"git status");
+  commands.push_back(L"ninja -C out");
+  commands.push_back(L"git diff");
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+  unique_ptr<HistoryFile> file(new HistoryFile);
+  ASSERT_TRUE(file->Open(temp.path()));
+  CommandHistory ch;
+  ch.Populate(move(file));
+  ch.AddCommand(L"git log");
+  wstring result;
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"git", &result));
+  EXPECT_EQ(L"git log", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"git", &result));
+  EXPECT_EQ(L"git diff", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"n", &result));
+  EXPECT_EQ(L"ninja -C out", result);
+  commands.push_back(L"git log");
+  EXPECT_EQ(commands, ch.GetListForSaving());
+}
+
+TEST(HistoryFileTest, SavesOverFileItWasLoadedFrom) {
+  // As on exit when history isn't shared: the file can only be replaced once
+  // it's not mapped.
+  ScopedTempPath temp("resave");
+  vector<wstring> commands;
+  commands.push_back(L"git status");
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+  unique_ptr<HistoryFile> file(new HistoryFile);
+  ASSERT_TRUE(file->Open(temp.path()));
+  CommandHistory ch;
+  ch.Populate(move(file));
+  ch.AddCommand(L"git diff");
+  commands = ch.GetListForSaving();
+  ch.Clear();
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, 1000));
+  HistoryFile reloaded;
+  ASSERT_TRUE(reloaded.Open(temp.path()));
+  ASSERT_EQ(2u, reloaded.lines().size());
+  EXPECT_EQ(L"git diff", reloaded.lines()[1].as_string());
+}
+
+TEST(HistoryFileTest, Directories) {
+  WStringPiece command, directory;
+  wstring line = MakeHistoryLine(L"dir", L"c:\\src");
+  SplitHistoryLine(line, &command, &directory);
+  EXPECT_EQ(L"dir", command.as_string());
+  EXPECT_EQ(L"c:\\src", directory.as_string());
+  // Without a directory, and from before they were recorded.
+  EXPECT_EQ(L"dir", MakeHistoryLine(L"dir", L""));
+  SplitHistoryLine(L"dir", &command, &directory);
+  EXPECT_EQ(L"dir", command.as_string());
+  EXPECT_TRUE(directory.empty());
+
+  ScopedTempPath temp("directories");
+  vector<wstring> lines;
+  lines.push_back(MakeHistoryLine(L"ninja", L"c:\\src"));
+  lines.push_back(L"git status");
+  lines.push_back(MakeHistoryLine(L"dir", L"c:\\"));
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), lines, 1000));
+  unique_ptr<HistoryFile> file(new HistoryFile);
+  ASSERT_TRUE(file->Open(temp.path()));
+  CommandHistory ch;
+  ch.set_directory(L"c:\\src");
+  ch.Populate(move(file));
+  wstring result;
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"ninja", result);
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"dir", result);
+  EXPECT_EQ(lines, ch.GetListForSaving());
+}
+
+TEST(HistoryFileTest, DISABLED_PerfLoad100MB) {
+  ScopedTempPath temp("perf");
+  // Lines are ~60 bytes as UTF-16.
+  const int kLines = 1700000;
+  vector<wstring> commands;
+  commands.reserve(kLines);
+  for (int i = 0; i < kLines; ++i)
+    commands.push_back(L"git commit -m \"change " + to_wstring(i) + L"\"");
+  ASSERT_TRUE(WriteHistoryFile(temp.path(), commands, kLines));
+  commands.clear();
+
+  PerfTimer timer;
+  unique_ptr<HistoryFile> file(new HistoryFile);
+  ASSERT_TRUE(file->Open(temp.path()));
+  CommandHistory ch;
+  ch.Populate(move(file));
+  double elapsed = timer.ElapsedMs();
+  wstring result;
+  EXPECT_TRUE(ch.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"git commit -m \"change " + to_wstring(kLines - 1) + L"\"",
+            result);
+  printf("loaded %d lines in %.1fms\n", kLines, elapsed);
+}
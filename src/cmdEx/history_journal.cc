@@ -0,0 +1,458 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_journal.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+
+#include "common/util.h"
+
+namespace {
+
+const uint32_t kMagic = 0x4a485843;  // "CXHJ".
+const size_t kHeaderSize = 16;
+const size_t kRecordHeaderSize = 16;
+
+// FNV-1a over the sequence number and the payload.
+uint32_t Checksum(uint64_t seq, const char* payload, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (int i = 0; i < 8; ++i) {
+    hash ^= static_cast<uint32_t>((seq >> (8 * i)) & 0xff);
+    hash *= 16777619u;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(payload[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Decodes the complete, valid records at the start of |data|, appending the
+// ones after |*last_seq| to |commands| and updating |*last_seq|. Returns the
+// number of bytes used.
+size_t ParseRecords(const string& data,
+                    uint64_t* last_seq,
+                    vector<wstring>* commands) {
+  size_t pos = 0;
+  while (data.size() - pos >= kRecordHeaderSize) {
+    const char* record = data.data() + pos;
+    uint32_t size = Get32(record);
+    uint32_t checksum = Get32(record + 4);
+    uint64_t seq = Get64(record + 8);
+    if (size % 2 != 0 || size > data.size() - pos - kRecordHeaderSize)
+      break;
+    const char* payload = record + kRecordHeaderSize;
+    if (Checksum(seq, payload, size) != checksum)
+      break;
+    if (seq > *last_seq) {
+      commands->push_back(wstring());
+      AppendFromUtf16Le(payload, size, &commands->back());
+      *last_seq = seq;
+    }
+    pos += kRecordHeaderSize + size;
+  }
+  return pos;
+}
+
+}  // namespace
+
+HistoryJournal::HistoryJournal()
+    : compact_threshold_(256 * 1024),
+      max_snapshot_commands_(1000),
+#if defined(_WIN32)
+      file_(INVALID_HANDLE_VALUE),
+#else
+      fd_(-1),
+#endif
+      generation_(0),
+      offset_(kHeaderSize),
+      last_seq_(0),
+      retry_compact_at_(0),
+      loaded_first_seq_(1) {
+}
+
+#if defined(_WIN32)
+
+HistoryJournal::~HistoryJournal() {
+  if (file_ != INVALID_HANDLE_VALUE)
+    CloseHandle(file_);
+}
+
+bool HistoryJournal::Open(const string& journal_path,
+                          const string& history_path) {
+  CHECK(file_ == INVALID_HANDLE_VALUE);
+  history_path_ = history_path;
+  file_ = CreateFile(journal_path.c_str(),
+                     GENERIC_READ | GENERIC_WRITE,
+                     FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                     NULL,
+                     OPEN_ALWAYS,
+                     FILE_ATTRIBUTE_NORMAL,
+                     NULL);
+  if (file_ == INVALID_HANDLE_VALUE)
+    return false;
+  return InitializeIfEmpty();
+}
+
+bool HistoryJournal::Lock(LockType type) {
+  // Byte range locks on Windows are mandatory, so lock a byte far past the
+  // end of the file rather than anything that's going to be read.
+  OVERLAPPED overlapped = {0};
+  overlapped.OffsetHigh = 0x7fffffff;
+  DWORD flags = type == kExclusive ? LOCKFILE_EXCLUSIVE_LOCK : 0;
+  return LockFileEx(file_, flags, 0, 1, 0, &overlapped) != 0;
+}
+
+void HistoryJournal::Unlock() {
+  OVERLAPPED overlapped = {0};
+  overlapped.OffsetHigh = 0x7fffffff;
+  UnlockFileEx(file_, 0, 1, 0, &overlapped);
+}
+
+bool HistoryJournal::GetSize(uint64_t* size) {
+  LARGE_INTEGER result;
+  if (!GetFileSizeEx(file_, &result))
+    return false;
+  *size = static_cast<uint64_t>(result.QuadPart);
+  return true;
+}
+
+bool HistoryJournal::ReadAt(uint64_t offset, size_t size, string* data) {
+  data->resize(size);
+  size_t done = 0;
+  while (done < size) {
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = static_cast<DWORD>(offset + done);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+    DWORD read;
+    if (!ReadFile(file_,
+                  &(*data)[done],
+                  static_cast<DWORD>(size - done),
+                  &read,
+                  &overlapped) ||
+        read == 0) {
+      break;
+    }
+    done += read;
+  }
+  data->resize(done);
+  return true;
+}
+
+bool HistoryJournal::WriteAt(uint64_t offset, const string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    OVERLAPPED overlapped = {0};
+    overlapped.Offset = static_cast<DWORD>(offset + done);
+    overlapped.OffsetHigh = static_cast<DWORD>((offset + done) >> 32);
+    DWORD written;
+    if (!WriteFile(file_,
+                   data.data() + done,
+                   static_cast<DWORD>(data.size() - done),
+                   &written,
+                   &overlapped)) {
+      return false;
+    }
+    done += written;
+  }
+  return true;
+}
+
+bool HistoryJournal::Truncate(uint64_t size) {
+  FILE_END_OF_FILE_INFO info;
+  info.EndOfFile.QuadPart = static_cast<LONGLONG>(size);
+  return SetFileInformationByHandle(
+             file_, FileEndOfFileInfo, &info, sizeof(info)) != 0;
+}
+
+#else
+
+HistoryJournal::~HistoryJournal() {
+  if (fd_ >= 0)
+    close(fd_);
+}
+
+bool HistoryJournal::Open(const string& journal_path,
+                          const string& history_path) {
+  CHECK(fd_ < 0);
+  history_path_ = history_path;
+  fd_ = open(journal_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd_ < 0)
+    return false;
+  return InitializeIfEmpty();
+}
+
+bool HistoryJournal::Lock(LockType type) {
+  int operation = type == kExclusive ? LOCK_EX : LOCK_SH;
+  while (flock(fd_, operation) != 0) {
+    if (errno != EINTR)
+      return false;
+  }
+  return true;
+}
+
+void HistoryJournal::Unlock() {
+  flock(fd_, LOCK_UN);
+}
+
+bool HistoryJournal::GetSize(uint64_t* size) {
+  struct stat buffer;
+  if (fstat(fd_, &buffer) != 0)
+    return false;
+  *size = static_cast<uint64_t>(buffer.st_size);
+  return true;
+}
+
+bool HistoryJournal::ReadAt(uint64_t offset, size_t size, string* data) {
+  data->resize(size);
+  size_t done = 0;
+  while (done < size) {
+    ssize_t read = pread(fd_,
+                         &(*data)[done],
+                         size - done,
+                         static_cast<off_t>(offset + done));
+    if (read < 0 && errno == EINTR)
+      continue;
+    if (read < 0) {
+      data->clear();
+      return false;
+    }
+    if (read == 0)
+      break;
+    done += static_cast<size_t>(read);
+  }
+  data->resize(done);
+  return true;
+}
+
+bool HistoryJournal::WriteAt(uint64_t offset, const string& data) {
+  size_t done = 0;
+  while (done < data.size()) {
+    ssize_t written = pwrite(fd_,
+                             data.data() + done,
+                             data.size() - done,
+                             static_cast<off_t>(offset + done));
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0)
+      return false;
+    done += static_cast<size_t>(written);
+  }
+  return true;
+}
+
+bool HistoryJournal::Truncate(uint64_t size) {
+  return ftruncate(fd_, static_cast<off_t>(size)) == 0;
+}
+
+#endif
+
+bool HistoryJournal::InitializeIfEmpty() {
+  if (!Lock(kExclusive))
+    return false;
+  uint32_t generation;
+  uint64_t first_seq;
+  bool ok = true;
+  if (!ReadHeader(&generation, &first_seq))
+    ok = WriteHeader(1, 1) && Truncate(kHeaderSize);
+  Unlock();
+  return ok;
+}
+
+bool HistoryJournal::ReadHeader(uint32_t* generation, uint64_t* first_seq) {
+  string header;
+  if (!ReadAt(0, kHeaderSize, &header) || header.size() != kHeaderSize ||
+      Get32(header.data()) != kMagic) {
+    return false;
+  }
+  *generation = Get32(header.data() + 4);
+  *first_seq = Get64(header.data() + 8);
+  return true;
+}
+
+bool HistoryJournal::WriteHeader(uint32_t generation, uint64_t first_seq) {
+  string header;
+  Put32(kMagic, &header);
+  Put32(generation, &header);
+  Put64(first_seq, &header);
+  return WriteAt(0, header);
+}
+
+bool HistoryJournal::Load(vector<wstring>* commands) {
+  if (!Lock(kShared))
+    return false;
+  uint32_t generation;
+  uint64_t first_seq;
+  bool ok = ReadHeader(&generation, &first_seq);
+  if (ok) {
+    loaded_first_seq_ = static_cast<int64_t>(first_seq);
+    {
+      HistoryFile snapshot;
+      if (snapshot.Open(history_path_)) {
+        const vector<WStringPiece>& lines = snapshot.lines();
+        commands->reserve(commands->size() + lines.size());
+        for (const auto& line : lines)
+          commands->push_back(line.as_string());
+        loaded_first_seq_ -= static_cast<int64_t>(lines.size());
+      }
+    }
+    generation_ = generation;
+    offset_ = kHeaderSize;
+    last_seq_ = first_seq - 1;
+    ok = ReadNewLocked(commands);
+  }
+  Unlock();
+  return ok;
+}
+
+bool HistoryJournal::Append(const vector<wstring>& commands,
+                            vector<wstring>* others) {
+  if (!Lock(kExclusive))
+    return false;
+  uint64_t size;
+  bool ok = ReadNewLocked(others) && GetSize(&size);
+  // Anything after the last good record can only have been left by a writer
+  // that died part way through, since we hold the lock.
+  if (ok && size > offset_)
+    ok = Truncate(offset_);
+  if (ok) {
+    uint64_t seq = last_seq_;
+    string records;
+    string payload;
+    for (const auto& command : commands) {
+      payload.clear();
+      AppendUtf16Le(command, &payload);
+      ++seq;
+      Put32(static_cast<uint32_t>(payload.size()), &records);
+      Put32(Checksum(seq, payload.data(), payload.size()), &records);
+      Put64(seq, &records);
+      records += payload;
+    }
+    ok = WriteAt(offset_, records);
+    if (ok) {
+      offset_ += records.size();
+      last_seq_ = seq;
+    }
+  }
+  // The commands are in the journal regardless, so failing to compact it
+  // isn't failing to append.
+  if (ok && offset_ > compact_threshold_ && offset_ > retry_compact_at_ &&
+      !CompactLocked()) {
+    Log("couldn't compact history journal, will retry");
+    retry_compact_at_ = offset_ + compact_threshold_;
+  }
+  Unlock();
+  return ok;
+}
+
+bool HistoryJournal::Append(const wstring& command, vector<wstring>* others) {
+  return Append(vector<wstring>(1, command), others);
+}
+
+bool HistoryJournal::ReadNew(vector<wstring>* commands) {
+  if (!Lock(kShared))
+    return false;
+  bool ok = ReadNewLocked(commands);
+  Unlock();
+  return ok;
+}
+
+bool HistoryJournal::ReadNewLocked(vector<wstring>* commands) {
+  uint32_t generation;
+  uint64_t first_seq;
+  uint64_t size;
+  if (!ReadHeader(&generation, &first_seq) || !GetSize(&size))
+    return false;
+  if (generation != generation_ || size < offset_) {
+    // Compacted since we last looked. Anything we hadn't seen that's no
+    // longer in the journal is at the end of the snapshot.
+    if (first_seq > last_seq_ + 1) {
+      HistoryFile snapshot;
+      if (snapshot.Open(history_path_)) {
+        const vector<WStringPiece>& lines = snapshot.lines();
+        uint64_t missed = first_seq - 1 - last_seq_;
+        size_t start = lines.size() > missed
+                           ? lines.size() - static_cast<size_t>(missed)
+                           : 0;
+        for (size_t i = start; i < lines.size(); ++i)
+          commands->push_back(lines[i].as_string());
+      }
+      last_seq_ = first_seq - 1;
+    }
+    generation_ = generation;
+    offset_ = kHeaderSize;
+    retry_compact_at_ = 0;
+  }
+  if (size <= offset_)
+    return true;
+  string data;
+  if (!ReadAt(offset_, static_cast<size_t>(size - offset_), &data))
+    return false;
+  offset_ += ParseRecords(data, &last_seq_, commands);
+  return true;
+}
+
+bool HistoryJournal::CompactLocked() {
+  uint32_t generation;
+  uint64_t first_seq;
+  if (!ReadHeader(&generation, &first_seq))
+    return false;
+  vector<wstring> commands;
+  {
+    HistoryFile snapshot;
+    if (snapshot.Open(history_path_)) {
+      for (const auto& line : snapshot.lines())
+        commands.push_back(line.as_string());
+    }
+  }
+  string data;
+  if (!ReadAt(kHeaderSize, static_cast<size_t>(offset_ - kHeaderSize), &data))
+    return false;
+  uint64_t seq = first_seq - 1;
+  ParseRecords(data, &seq, &commands);
+
+  // Sequence numbers count back from the journal through the snapshot, so
+  // what's dropped from it is numbered consistently whenever it's archived.
+  // Archiving happens first so that dying part way loses nothing, and if it
+  // fails, so does compacting, leaving the lines in the journal. If the
+  // snapshot isn't then replaced, the next attempt drops the same lines and
+  // more, so it only archives the ones that aren't already.
+  if (archive_ && commands.size() > max_snapshot_commands_) {
+    size_t dropped = commands.size() - max_snapshot_commands_;
+    int64_t last_dropped = static_cast<int64_t>(seq) -
+                           static_cast<int64_t>(max_snapshot_commands_);
+    int64_t first_dropped =
+        last_dropped - static_cast<int64_t>(dropped) + 1;
+    int64_t archived;
+    size_t skip = 0;
+    if (archive_->GetLastSeq(&archived) && archived >= first_dropped) {
+      skip = static_cast<size_t>(
+          min(archived - first_dropped + 1, static_cast<int64_t>(dropped)));
+    }
+    vector<wstring> old(commands.begin() + skip, commands.begin() + dropped);
+    if (!archive_->Add(old, last_dropped))
+      return false;
+  }
+
+  // If we die between these two steps, the journal's records will also be in
+  // the snapshot, and so appear twice in history. That's preferable to losing
+  // them.
+  if (!WriteHistoryFile(history_path_, commands, max_snapshot_commands_))
+    return false;
+  if (!WriteHeader(generation_ + 1, last_seq_ + 1) || !Truncate(kHeaderSize))
+    return false;
+  ++generation_;
+  offset_ = kHeaderSize;
+  return true;
+}
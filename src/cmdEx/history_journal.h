@@ -0,0 +1,126 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_JOURNAL_H_
+#define CMDEX_HISTORY_JOURNAL_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/history_archive.h"
+#include "cmdEx/history_file.h"
+#include "cmdEx/history_writer.h"
+
+// Command history shared live between concurrently running shells.
+//
+// The journal is a file of records appended by every shell as commands are
+// entered, each with a sequence number one more than the last. It sits
+// alongside a history file (as read by HistoryFile), which is a snapshot
+// holding everything before the journal's first record. Appends happen under
+// an exclusive lock on the journal; each instance remembers how far it has
+// read, so picking up other shells' commands is a size check and a read of
+// just the new records.
+//
+// When the journal grows past a threshold, whoever is appending folds it into
+// the snapshot, truncates it, and bumps the generation in its header. An
+// instance that finds the generation changed takes any records it hadn't
+// seen from the end of the new snapshot. Commands that no longer fit in the
+// snapshot go to the archive, if there is one, rather than being dropped. If
+// the snapshot can't be replaced (on Windows, that's whenever any process has
+// it mapped), the journal carries on growing until a later attempt succeeds,
+// and what the failed one archived isn't archived again.
+//
+// On disk, everything is little-endian:
+//   header: magic, generation (both uint32), first sequence number (uint64)
+//   record: payload size in bytes, checksum (both uint32), sequence number
+//           (uint64), then the command as UTF-16
+// A record with a bad checksum or that's incomplete is treated as not written
+// yet. If it's still there when the next writer takes the lock, its writer
+// must have died, so it's truncated away.
+class HistoryJournal : public HistoryStoreInterface {
+ public:
+  HistoryJournal();
+  ~HistoryJournal();
+
+  // Opens the journal at |journal_path|, creating it if necessary, for the
+  // snapshot at |history_path|. Returns false on failure.
+  bool Open(const string& journal_path, const string& history_path);
+
+  // Reads the whole history into |commands|: the snapshot, followed by the
+  // journal. Subsequent reads return only what's added after this. The
+  // snapshot's lines are copied rather than kept mapped, as on Windows a
+  // mapped file can't be replaced, and compacting (in any instance) has to.
+  bool Load(vector<wstring>* commands);
+  // The sequence number of the first command that Load() returned, so
+  // anything older is in the archive.
+  int64_t loaded_first_seq() const { return loaded_first_seq_; }
+
+  // Appends |commands| in one write. Commands appended by other instances
+  // since the last Load(), ReadNew() or Append() come before them, and are
+  // added to |others|.
+  virtual bool Append(const vector<wstring>& commands,
+                      vector<wstring>* others) override;
+  bool Append(const wstring& command, vector<wstring>* others);
+
+  // Adds any commands that other instances have appended to |commands|.
+  virtual bool ReadNew(vector<wstring>* commands) override;
+
+  // The journal is folded into the snapshot once it's larger than this many
+  // bytes. If that fails, it's tried again once it's grown by as much again.
+  void set_compact_threshold(uint64_t bytes) { compact_threshold_ = bytes; }
+  // How many of the most recent commands the snapshot keeps.
+  void set_max_snapshot_commands(size_t count) {
+    max_snapshot_commands_ = count;
+  }
+  // Where commands dropped from the snapshot are kept. Optional.
+  void set_archive(unique_ptr<HistoryArchive> archive) {
+    archive_ = move(archive);
+  }
+
+ private:
+  HistoryJournal(const HistoryJournal&);
+  void operator=(const HistoryJournal&);
+
+  enum LockType { kShared, kExclusive };
+  bool Lock(LockType type);
+  void Unlock();
+  bool GetSize(uint64_t* size);
+  bool ReadAt(uint64_t offset, size_t size, string* data);
+  bool WriteAt(uint64_t offset, const string& data);
+  bool Truncate(uint64_t size);
+
+  // Writes a header if the journal's new (or unreadable).
+  bool InitializeIfEmpty();
+  bool ReadHeader(uint32_t* generation, uint64_t* first_seq);
+  bool WriteHeader(uint32_t generation, uint64_t first_seq);
+  // Reads records starting at |offset_| that follow |last_seq_|, advancing
+  // both. These must be called with the lock held.
+  bool ReadNewLocked(vector<wstring>* commands);
+  bool CompactLocked();
+
+  string history_path_;
+  uint64_t compact_threshold_;
+  size_t max_snapshot_commands_;
+  unique_ptr<HistoryArchive> archive_;
+
+#if defined(_WIN32)
+  void* file_;
+#else
+  int fd_;
+#endif
+
+  uint32_t generation_;
+  uint64_t offset_;    // Where the next record to be read starts.
+  uint64_t last_seq_;  // Sequence number of the last record read or written.
+  // After a compaction fails, how large the journal has to grow before this
+  // instance tries again, or 0.
+  uint64_t retry_compact_at_;
+  int64_t loaded_first_seq_;
+};
+
+#endif  // CMDEX_HISTORY_JOURNAL_H_
@@ -0,0 +1,317 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_journal.h"
+
+#include <stdio.h>
+
+#if !defined(_WIN32)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <thread>
+
+#include "cmdEx/command_history.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class HistoryJournalTest : public testing::Test {
+ protected:
+  HistoryJournalTest() : journal_("journal"), history_("history") {}
+
+  unique_ptr<HistoryJournal> Open() {
+    unique_ptr<HistoryJournal> journal(new HistoryJournal);
+    EXPECT_TRUE(journal->Open(journal_.path(), history_.path()));
+    return journal;
+  }
+
+  // Everything a new instance would start with.
+  vector<wstring> LoadAll(HistoryJournal* journal) {
+    vector<wstring> result;
+    EXPECT_TRUE(journal->Load(&result));
+    return result;
+  }
+
+  ScopedTempPath journal_;
+  ScopedTempPath history_;
+};
+
+// Appends |count| commands tagged with |id|, keeping track of everything the
+// instance sees, in the order it sees it.
+void AppendMany(HistoryJournal* journal,
+                int id,
+                int count,
+                vector<wstring>* seen) {
+  for (int i = 0; i < count; ++i) {
+    wstring command = to_wstring(id) + L":" + to_wstring(i);
+    ASSERT_TRUE(journal->Append(command, seen));
+    seen->push_back(command);
+    if (i % 7 == 0) {
+      ASSERT_TRUE(journal->ReadNew(seen));
+    }
+  }
+  ASSERT_TRUE(journal->ReadNew(seen));
+}
+
+// Checks that |commands| has |count| from each of |writers|, each in order.
+void ExpectAllInOrder(const vector<wstring>& commands, int writers, int count) {
+  EXPECT_EQ(static_cast<size_t>(writers * count), commands.size());
+  vector<int> next(writers, 0);
+  for (const auto& command : commands) {
+    size_t colon = command.find(L':');
+    ASSERT_NE(wstring::npos, colon);
+    int id = stoi(command.substr(0, colon));
+    int i = stoi(command.substr(colon + 1));
+    ASSERT_TRUE(id >= 0 && id < writers);
+    EXPECT_EQ(next[id], i);
+    next[id] = i + 1;
+  }
+}
+
+}  // namespace
+
+TEST_F(HistoryJournalTest, SharedBetweenInstances) {
+  unique_ptr<HistoryJournal> a = Open();
+  unique_ptr<HistoryJournal> b = Open();
+  EXPECT_TRUE(LoadAll(a.get()).empty());
+  EXPECT_TRUE(LoadAll(b.get()).empty());
+
+  vector<wstring> others;
+  EXPECT_TRUE(a->Append(L"dir", &others));
+  EXPECT_TRUE(a->Append(L"cd src", &others));
+  EXPECT_TRUE(others.empty());
+
+  EXPECT_TRUE(b->ReadNew(&others));
+  ASSERT_EQ(2u, others.size());
+  EXPECT_EQ(L"dir", others[0]);
+  EXPECT_EQ(L"cd src", others[1]);
+  others.clear();
+  EXPECT_TRUE(b->ReadNew(&others));
+  EXPECT_TRUE(others.empty());
+
+  EXPECT_TRUE(b->Append(L"git status", &others));
+  EXPECT_TRUE(others.empty());
+  EXPECT_TRUE(a->Append(L"ninja", &others));
+  ASSERT_EQ(1u, others.size());
+  EXPECT_EQ(L"git status", others[0]);
+
+  unique_ptr<HistoryJournal> c = Open();
+  vector<wstring> all = LoadAll(c.get());
+  ASSERT_EQ(4u, all.size());
+  EXPECT_EQ(L"ninja", all[3]);
+}
+
+TEST_F(HistoryJournalTest, StartsFromExistingHistoryFile) {
+  vector<wstring> old;
+  old.push_back(L"from before");
+  ASSERT_TRUE(WriteHistoryFile(history_.path(), old, 1000));
+  unique_ptr<HistoryJournal> a = Open();
+  vector<wstring> others;
+  EXPECT_TRUE(LoadAll(a.get()) == old);
+  EXPECT_TRUE(a->Append(L"new", &others));
+  unique_ptr<HistoryJournal> b = Open();
+  vector<wstring> all = LoadAll(b.get());
+  ASSERT_EQ(2u, all.size());
+  EXPECT_EQ(L"from before", all[0]);
+  EXPECT_EQ(L"new", all[1]);
+}
+
+TEST_F(HistoryJournalTest, CompactsIntoHistoryFile) {
+  unique_ptr<HistoryJournal> writer = Open();
+  unique_ptr<HistoryJournal> reader = Open();
+  writer->set_compact_threshold(200);
+  LoadAll(writer.get());
+  LoadAll(reader.get());
+  vector<wstring> seen;
+  AppendMany(writer.get(), 0, 100, &seen);
+  ExpectAllInOrder(seen, 1, 100);
+
+  // The reader missed several compactions, and catches up from the snapshot.
+  vector<wstring> caught_up;
+  EXPECT_TRUE(reader->ReadNew(&caught_up));
+  ExpectAllInOrder(caught_up, 1, 100);
+
+  HistoryFile snapshot;
+  ASSERT_TRUE(snapshot.Open(history_.path()));
+  EXPECT_LT(90u, snapshot.lines().size());
+
+  unique_ptr<HistoryJournal> fresh = Open();
+  ExpectAllInOrder(LoadAll(fresh.get()), 1, 100);
+}
+
+TEST_F(HistoryJournalTest, SnapshotKeepsMostRecent) {
+  unique_ptr<HistoryJournal> writer = Open();
+  writer->set_compact_threshold(200);
+  writer->set_max_snapshot_commands(10);
+  LoadAll(writer.get());
+  vector<wstring> seen;
+  AppendMany(writer.get(), 0, 100, &seen);
+  unique_ptr<HistoryJournal> fresh = Open();
+  vector<wstring> all = LoadAll(fresh.get());
+  ASSERT_LE(10u, all.size());
+  ASSERT_GT(20u, all.size());
+  EXPECT_EQ(L"0:99", all.back());
+}
+
+TEST_F(HistoryJournalTest, RetriesCompactionThatFails) {
+  // The snapshot can't be written until its directory exists, as it can't be
+  // replaced on Windows while another shell has it mapped.
+  ScopedTempDirectory dir("snapshot_dir");
+  string history_path = dir.path() + kPathSeparator + "history";
+  HistoryJournal writer;
+  ASSERT_TRUE(writer.Open(journal_.path(), history_path));
+  writer.set_compact_threshold(200);
+  vector<wstring> seen;
+  ASSERT_TRUE(writer.Load(&seen));
+  AppendMany(&writer, 0, 100, &seen);
+  ExpectAllInOrder(seen, 1, 100);
+  {
+    HistoryJournal fresh;
+    ASSERT_TRUE(fresh.Open(journal_.path(), history_path));
+    vector<wstring> all;
+    ASSERT_TRUE(fresh.Load(&all));
+    ExpectAllInOrder(all, 1, 100);
+  }
+
+  ASSERT_TRUE(MakeDirectory(dir.path()));
+  for (int i = 100; i < 200; ++i)
+    ASSERT_TRUE(writer.Append(L"0:" + to_wstring(i), &seen));
+  HistoryFile snapshot;
+  ASSERT_TRUE(snapshot.Open(history_path));
+  EXPECT_LT(100u, snapshot.lines().size());
+  HistoryJournal fresh;
+  ASSERT_TRUE(fresh.Open(journal_.path(), history_path));
+  vector<wstring> all;
+  ASSERT_TRUE(fresh.Load(&all));
+  ExpectAllInOrder(all, 1, 200);
+}
+
+TEST_F(HistoryJournalTest, IgnoresTornRecord) {
+  unique_ptr<HistoryJournal> a = Open();
+  unique_ptr<HistoryJournal> b = Open();
+  LoadAll(a.get());
+  LoadAll(b.get());
+  vector<wstring> others;
+  EXPECT_TRUE(a->Append(L"complete", &others));
+
+  // As if a writer died part way through a record.
+  FILE* f = fopen(journal_.path().c_str(), "ab");
+  ASSERT_TRUE(f != NULL);
+  fwrite("\x10\0\0\0garbage", 1, 11, f);
+  fclose(f);
+
+  EXPECT_TRUE(b->ReadNew(&others));
+  ASSERT_EQ(1u, others.size());
+  EXPECT_EQ(L"complete", others[0]);
+  others.clear();
+  EXPECT_TRUE(b->Append(L"after", &others));
+  EXPECT_TRUE(others.empty());
+  EXPECT_TRUE(a->ReadNew(&others));
+  ASSERT_EQ(1u, others.size());
+  EXPECT_EQ(L"after", others[0]);
+}
+
+TEST_F(HistoryJournalTest, CommandHistoryPicksUpOthers) {
+  CommandHistory first;
+  CommandHistory second;
+  ASSERT_TRUE(first.Populate(Open()));
+  ASSERT_TRUE(second.Populate(Open()));
+  EXPECT_TRUE(first.is_shared());
+
+  first.AddCommand(L"git status");
+  wstring result;
+  EXPECT_FALSE(second.MoveInHistory(-1, L"", &result));
+  // Saved in the background.
+  EXPECT_TRUE(first.Flush());
+  second.StartingEdit();
+  EXPECT_TRUE(second.MoveInHistory(-1, L"", &result));
+  EXPECT_EQ(L"git status", result);
+
+  second.AddCommand(L"git diff");
+  EXPECT_TRUE(second.Flush());
+  first.AddCommand(L"git log");
+  EXPECT_TRUE(first.Flush());
+  // Each has its own commands in the order they were entered, and picks up
+  // the other's as it goes.
+  first.StartingEdit();
+  second.StartingEdit();
+  vector<wstring> expected;
+  expected.push_back(L"git status");
+  expected.push_back(L"git log");
+  expected.push_back(L"git diff");
+  EXPECT_EQ(expected, first.GetListForSaving());
+  expected[1] = L"git diff";
+  expected[2] = L"git log";
+  EXPECT_EQ(expected, second.GetListForSaving());
+  CommandHistory fresh;
+  ASSERT_TRUE(fresh.Populate(Open()));
+  EXPECT_EQ(expected, fresh.GetListForSaving());
+}
+
+TEST_F(HistoryJournalTest, StressThreads) {
+  const int kWriters = 8;
+  const int kCommands = 300;
+  vector<unique_ptr<HistoryJournal>> journals;
+  for (int i = 0; i < kWriters; ++i) {
+    journals.push_back(Open());
+    journals.back()->set_compact_threshold(4096);
+    journals.back()->set_max_snapshot_commands(kWriters * kCommands);
+    LoadAll(journals.back().get());
+  }
+  vector<vector<wstring>> seen(kWriters);
+  vector<thread> threads;
+  for (int i = 0; i < kWriters; ++i) {
+    threads.push_back(
+        thread(AppendMany, journals[i].get(), i, kCommands, &seen[i]));
+  }
+  for (auto& thread : threads)
+    thread.join();
+  for (int i = 0; i < kWriters; ++i)
+    EXPECT_TRUE(journals[i]->ReadNew(&seen[i]));
+
+  unique_ptr<HistoryJournal> fresh = Open();
+  vector<wstring> all = LoadAll(fresh.get());
+  ExpectAllInOrder(all, kWriters, kCommands);
+  // Every instance saw the same history, in the same order.
+  for (int i = 0; i < kWriters; ++i)
+    EXPECT_TRUE(all == seen[i]) << "writer " << i;
+}
+
+#if !defined(_WIN32)
+TEST_F(HistoryJournalTest, StressProcesses) {
+  const int kWriters = 8;
+  const int kCommands = 300;
+  vector<pid_t> children;
+  for (int i = 0; i < kWriters; ++i) {
+    pid_t pid = fork();
+    ASSERT_NE(-1, pid);
+    if (pid == 0) {
+      HistoryJournal journal;
+      journal.set_compact_threshold(4096);
+      journal.set_max_snapshot_commands(kWriters * kCommands);
+      vector<wstring> seen;
+      bool ok = journal.Open(journal_.path(), history_.path()) &&
+                journal.Load(&seen);
+      for (int j = 0; ok && j < kCommands; ++j) {
+        ok = journal.Append(to_wstring(i) + L":" + to_wstring(j), &seen);
+        if (j % 7 == 0)
+          ok = ok && journal.ReadNew(&seen);
+      }
+      _exit(ok ? 0 : 1);
+    }
+    children.push_back(pid);
+  }
+  for (const auto& pid : children) {
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+
+  unique_ptr<HistoryJournal> fresh = Open();
+  ExpectAllInOrder(LoadAll(fresh.get()), kWriters, kCommands);
+}
+#endif
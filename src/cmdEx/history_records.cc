@@ -0,0 +1,239 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_records.h"
+
+#include <algorithm>
+
+#include "cmdEx/history_file.h"
+#include "common/util.h"
+
+namespace {
+
+const uint32_t kMagic = 0x52485843;  // "CXHR".
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 16;
+// Start time, duration, exit code, directory and command.
+const size_t kRecordSize = 8 + 4 + 4 + 4 + 4;
+
+// Durations are stored in 32 bits, which is a little over 49 days.
+uint32_t ClampDuration(int64_t duration_ms) {
+  if (duration_ms < 0)
+    return 0;
+  if (duration_ms > static_cast<int64_t>(UINT32_MAX))
+    return UINT32_MAX;
+  return static_cast<uint32_t>(duration_ms);
+}
+
+}  // namespace
+
+const int HistoryRecords::kNoExitCode;
+
+HistoryRecords::HistoryRecords() : saved_count_(0) {}
+
+void HistoryRecords::Add(const CommandRecord& record) {
+  start_times_.push_back(record.start_time);
+  durations_.push_back(ClampDuration(record.duration_ms));
+  exit_codes_.push_back(record.exit_code);
+  directories_.push_back(Intern(record.directory));
+  commands_.push_back(Intern(record.command));
+}
+
+CommandRecord HistoryRecords::Get(size_t index) const {
+  CommandRecord record;
+  record.command = strings_[commands_[index]].as_string();
+  record.directory = strings_[directories_[index]].as_string();
+  record.start_time = start_times_[index];
+  record.duration_ms = durations_[index];
+  record.exit_code = exit_codes_[index];
+  return record;
+}
+
+void HistoryRecords::Query(const RecordQuery& query,
+                           vector<CommandRecord>* results) const {
+  results->clear();
+  int64_t directory = -1;
+  if (!query.directory.empty()) {
+    directory = FindId(query.directory);
+    if (directory == -1)
+      return;
+  }
+  int64_t command = -1;
+  if (!query.command.empty()) {
+    command = FindId(query.command);
+    if (command == -1)
+      return;
+  }
+
+  // Newest first, which is also the order ties are broken in.
+  vector<size_t> matches;
+  for (size_t i = size(); i-- > 0;) {
+    if ((directory != -1 && directories_[i] != directory) ||
+        (command != -1 && commands_[i] != command) ||
+        start_times_[i] < query.since ||
+        (query.failed_only &&
+         (exit_codes_[i] == 0 || exit_codes_[i] == kNoExitCode))) {
+      continue;
+    }
+    matches.push_back(i);
+    if (query.order == RecordQuery::kNewestFirst &&
+        matches.size() == query.max_results) {
+      break;
+    }
+  }
+
+  if (query.order == RecordQuery::kSlowestFirst) {
+    size_t count = min(query.max_results, matches.size());
+    partial_sort(matches.begin(),
+                 matches.begin() + count,
+                 matches.end(),
+                 [this](size_t a, size_t b) {
+                   if (durations_[a] != durations_[b])
+                     return durations_[a] > durations_[b];
+                   return a > b;
+                 });
+    matches.resize(count);
+  }
+
+  results->reserve(matches.size());
+  for (const auto& i : matches)
+    results->push_back(Get(i));
+}
+
+bool HistoryRecords::Load(const string& path) {
+  *this = HistoryRecords();
+  MappedFile file;
+  if (!file.Open(path))
+    return false;
+  if (!Parse(file.data(), file.size())) {
+    *this = HistoryRecords();
+    return false;
+  }
+  saved_count_ = size();
+  return true;
+}
+
+bool HistoryRecords::Save(const string& path, size_t max_records) {
+  HistoryRecords merged;
+  // Anything unreadable there is replaced.
+  merged.Load(path);
+  for (size_t i = saved_count_; i < size(); ++i)
+    merged.Add(Get(i));
+  size_t first =
+      merged.size() > max_records ? merged.size() - max_records : 0;
+  if (!WriteFileAtomically(path, merged.Serialize(first)))
+    return false;
+  saved_count_ = size();
+  return true;
+}
+
+uint32_t HistoryRecords::Intern(const WStringPiece& str) {
+  auto it = string_ids_.find(str);
+  if (it != string_ids_.end())
+    return it->second;
+  uint32_t id = static_cast<uint32_t>(strings_.size());
+  WStringPiece copy = arena_.Add(str);
+  strings_.push_back(copy);
+  string_ids_[copy] = id;
+  return id;
+}
+
+int64_t HistoryRecords::FindId(const wstring& str) const {
+  auto it = string_ids_.find(WStringPiece(str));
+  return it == string_ids_.end() ? -1 : it->second;
+}
+
+// The file is a header (magic, version, record count, string count), then
+// each string as its size in bytes and UTF-16LE, then each column in turn,
+// all little-endian.
+bool HistoryRecords::Parse(const char* data, size_t size) {
+  if (size < kHeaderSize || Get32(data) != kMagic ||
+      Get32(data + 4) != kVersion) {
+    return false;
+  }
+  size_t count = Get32(data + 8);
+  size_t string_count = Get32(data + 12);
+  size_t pos = kHeaderSize;
+  wstring str;
+  for (size_t i = 0; i < string_count; ++i) {
+    if (size - pos < 4)
+      return false;
+    size_t bytes = Get32(data + pos);
+    pos += 4;
+    if (bytes % 2 != 0 || bytes > size - pos)
+      return false;
+    str.clear();
+    AppendFromUtf16Le(data + pos, bytes, &str);
+    pos += bytes;
+    // Each is only stored once, so this is always a new one.
+    Intern(str);
+  }
+  if (strings_.size() != string_count || (size - pos) / kRecordSize < count)
+    return false;
+
+  start_times_.resize(count);
+  durations_.resize(count);
+  exit_codes_.resize(count);
+  directories_.resize(count);
+  commands_.resize(count);
+  for (size_t i = 0; i < count; ++i, pos += 8)
+    start_times_[i] = static_cast<int64_t>(Get64(data + pos));
+  for (size_t i = 0; i < count; ++i, pos += 4)
+    durations_[i] = Get32(data + pos);
+  for (size_t i = 0; i < count; ++i, pos += 4)
+    exit_codes_[i] = static_cast<int32_t>(Get32(data + pos));
+  for (size_t i = 0; i < count; ++i, pos += 4)
+    directories_[i] = Get32(data + pos);
+  for (size_t i = 0; i < count; ++i, pos += 4)
+    commands_[i] = Get32(data + pos);
+  for (size_t i = 0; i < count; ++i) {
+    if (directories_[i] >= string_count || commands_[i] >= string_count)
+      return false;
+  }
+  return true;
+}
+
+string HistoryRecords::Serialize(size_t first) const {
+  // Only the strings that the records being saved use, renumbered in the
+  // order they're first used.
+  vector<uint32_t> new_ids(strings_.size(), UINT32_MAX);
+  vector<uint32_t> used;
+  auto renumber = [&new_ids, &used](uint32_t id) {
+    if (new_ids[id] == UINT32_MAX) {
+      new_ids[id] = static_cast<uint32_t>(used.size());
+      used.push_back(id);
+    }
+    return new_ids[id];
+  };
+  vector<uint32_t> directories;
+  vector<uint32_t> commands;
+  for (size_t i = first; i < size(); ++i) {
+    directories.push_back(renumber(directories_[i]));
+    commands.push_back(renumber(commands_[i]));
+  }
+
+  string contents;
+  Put32(kMagic, &contents);
+  Put32(kVersion, &contents);
+  Put32(static_cast<uint32_t>(size() - first), &contents);
+  Put32(static_cast<uint32_t>(used.size()), &contents);
+  string encoded;
+  for (const auto& id : used) {
+    encoded.clear();
+    AppendUtf16Le(strings_[id], &encoded);
+    Put32(static_cast<uint32_t>(encoded.size()), &contents);
+    contents += encoded;
+  }
+  for (size_t i = first; i < size(); ++i)
+    Put64(static_cast<uint64_t>(start_times_[i]), &contents);
+  for (size_t i = first; i < size(); ++i)
+    Put32(durations_[i], &contents);
+  for (size_t i = first; i < size(); ++i)
+    Put32(static_cast<uint32_t>(exit_codes_[i]), &contents);
+  for (const auto& directory : directories)
+    Put32(directory, &contents);
+  for (const auto& command : commands)
+    Put32(command, &contents);
+  return contents;
+}
@@ -0,0 +1,113 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_RECORDS_H_
+#define CMDEX_HISTORY_RECORDS_H_
+
+#include <limits.h>
+#include <stdint.h>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/history_arena.h"
+#include "cmdEx/string_util.h"
+
+// One run of a command.
+struct CommandRecord {
+  CommandRecord() : start_time(0), duration_ms(0), exit_code(0) {}
+
+  wstring command;
+  // Where it was run from, or empty if that isn't known.
+  wstring directory;
+  // Milliseconds since the Unix epoch.
+  int64_t start_time;
+  int64_t duration_ms;
+  // HistoryRecords::kNoExitCode if cmd didn't report one (e.g. for a
+  // builtin).
+  int exit_code;
+};
+
+struct RecordQuery {
+  RecordQuery()
+      : since(0),
+        failed_only(false),
+        order(kNewestFirst),
+        max_results(20) {}
+
+  enum Order {
+    kNewestFirst,
+    kSlowestFirst,
+  };
+
+  // Only runs from |directory|, if it's not empty.
+  wstring directory;
+  // Only runs of exactly |command|, if it's not empty.
+  wstring command;
+  // Only runs that started at or after |since|.
+  int64_t since;
+  // Only runs that reported a non-zero exit code.
+  bool failed_only;
+  Order order;
+  size_t max_results;
+};
+
+// Timing and exit codes of commands as they're run, for looking back at
+// where time went. Unlike CommandHistory, every run is kept, not just the
+// command lines.
+//
+// Records are stored by column, with commands and directories each stored
+// once and referred to by id, so that a query like "the slowest runs in this
+// directory" is a lookup of the directory's id and then a scan of integers,
+// without comparing any text. The file is laid out the same way (see
+// Save()), so loading is a copy of each column.
+class HistoryRecords {
+ public:
+  static const int kNoExitCode = INT_MIN;
+
+  HistoryRecords();
+
+  void Add(const CommandRecord& record);
+  size_t size() const { return start_times_.size(); }
+  // Oldest (that is, first added) first.
+  CommandRecord Get(size_t index) const;
+
+  // Fills |results| with the records that match |query|, in its order.
+  void Query(const RecordQuery& query, vector<CommandRecord>* results) const;
+
+  // Replaces the records with those in |path|. Returns false, leaving none,
+  // if it couldn't be read.
+  bool Load(const string& path);
+  // Saves the last |max_records| to |path|. Other instances may have saved
+  // since this one loaded, so what's there is read back first, and only the
+  // records added here since the last Load() or Save() are added to it.
+  bool Save(const string& path, size_t max_records);
+
+ private:
+  uint32_t Intern(const WStringPiece& str);
+  // Returns the id of |str| if it's been interned, or -1.
+  int64_t FindId(const wstring& str) const;
+  bool Parse(const char* data, size_t size);
+  // The file contents for the records from |first| on.
+  string Serialize(size_t first) const;
+
+  // Commands and directories, by id.
+  HistoryArena arena_;
+  vector<WStringPiece> strings_;
+  unordered_map<WStringPiece, uint32_t, WStringPieceHash> string_ids_;
+
+  // The columns, one entry per record each.
+  vector<int64_t> start_times_;
+  vector<uint32_t> durations_;
+  vector<int32_t> exit_codes_;
+  vector<uint32_t> directories_;
+  vector<uint32_t> commands_;
+
+  // Records before this came from the file.
+  size_t saved_count_;
+};
+
+#endif  // CMDEX_HISTORY_RECORDS_H_
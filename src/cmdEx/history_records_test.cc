@@ -0,0 +1,214 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_records.h"
+
+#include <stdio.h>
+
+#include "cmdEx/history_file.h"
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+CommandRecord MakeRecord(const wstring& command,
+                         const wstring& directory,
+                         int64_t start_time,
+                         int64_t duration_ms,
+                         int exit_code) {
+  CommandRecord record;
+  record.command = command;
+  record.directory = directory;
+  record.start_time = start_time;
+  record.duration_ms = duration_ms;
+  record.exit_code = exit_code;
+  return record;
+}
+
+vector<wstring> Commands(const vector<CommandRecord>& records) {
+  vector<wstring> commands;
+  for (const auto& record : records)
+    commands.push_back(record.command);
+  return commands;
+}
+
+void ExpectEqual(const CommandRecord& expected, const CommandRecord& actual) {
+  EXPECT_EQ(expected.command, actual.command);
+  EXPECT_EQ(expected.directory, actual.directory);
+  EXPECT_EQ(expected.start_time, actual.start_time);
+  EXPECT_EQ(expected.duration_ms, actual.duration_ms);
+  EXPECT_EQ(expected.exit_code, actual.exit_code);
+}
+
+// Runs of "ninja" that take a while in c:\src, and quick ones elsewhere.
+void AddTestRecords(HistoryRecords* records) {
+  records->Add(MakeRecord(L"ninja", L"c:\\src", 100, 5000, 0));
+  records->Add(MakeRecord(L"dir", L"c:\\src", 200, 10, 0));
+  records->Add(MakeRecord(L"ninja", L"c:\\src", 300, 9000, 1));
+  records->Add(MakeRecord(L"ninja", L"c:\\", 400, 20, 1));
+  records->Add(MakeRecord(L"cd ..", L"c:\\src", 500, 0,
+                          HistoryRecords::kNoExitCode));
+  records->Add(MakeRecord(L"git status", L"c:\\src", 600, 300, 0));
+}
+
+}  // namespace
+
+TEST(HistoryRecordsTest, AddGet) {
+  HistoryRecords records;
+  CommandRecord record =
+      MakeRecord(L"ninja -C out", L"c:\\src", 1381000000000LL, 123456, -5);
+  records.Add(record);
+  record.duration_ms = -1;
+  records.Add(record);
+  ASSERT_EQ(2u, records.size());
+  ExpectEqual(MakeRecord(L"ninja -C out", L"c:\\src", 1381000000000LL, 123456,
+                         -5),
+              records.Get(0));
+  EXPECT_EQ(0, records.Get(1).duration_ms);
+}
+
+TEST(HistoryRecordsTest, Query) {
+  HistoryRecords records;
+  AddTestRecords(&records);
+  vector<CommandRecord> results;
+
+  RecordQuery newest;
+  newest.max_results = 3;
+  records.Query(newest, &results);
+  vector<wstring> expected;
+  expected.push_back(L"git status");
+  expected.push_back(L"cd ..");
+  expected.push_back(L"ninja");
+  EXPECT_EQ(expected, Commands(results));
+  EXPECT_EQ(400, results[2].start_time);
+
+  RecordQuery slowest_here;
+  slowest_here.directory = L"c:\\src";
+  slowest_here.order = RecordQuery::kSlowestFirst;
+  slowest_here.max_results = 3;
+  records.Query(slowest_here, &results);
+  ASSERT_EQ(3u, results.size());
+  EXPECT_EQ(9000, results[0].duration_ms);
+  EXPECT_EQ(5000, results[1].duration_ms);
+  EXPECT_EQ(L"git status", results[2].command);
+
+  RecordQuery failed;
+  failed.command = L"ninja";
+  failed.failed_only = true;
+  records.Query(failed, &results);
+  ASSERT_EQ(2u, results.size());
+  EXPECT_EQ(400, results[0].start_time);
+  EXPECT_EQ(300, results[1].start_time);
+
+  RecordQuery since;
+  since.since = 450;
+  records.Query(since, &results);
+  EXPECT_EQ(2u, results.size());
+
+  RecordQuery nowhere;
+  nowhere.directory = L"c:\\nowhere";
+  records.Query(nowhere, &results);
+  EXPECT_TRUE(results.empty());
+}
+
+TEST(HistoryRecordsTest, SaveLoad) {
+  ScopedTempPath temp("records");
+  HistoryRecords records;
+  EXPECT_FALSE(records.Load(temp.path()));
+  AddTestRecords(&records);
+  records.Add(MakeRecord(L"echo \u4e2d\u6587", L"", 700, 1, 0));
+  ASSERT_TRUE(records.Save(temp.path(), 1000));
+
+  HistoryRecords loaded;
+  ASSERT_TRUE(loaded.Load(temp.path()));
+  ASSERT_EQ(records.size(), loaded.size());
+  for (size_t i = 0; i < records.size(); ++i)
+    ExpectEqual(records.Get(i), loaded.Get(i));
+
+  // Only the most recent are kept.
+  ASSERT_TRUE(loaded.Save(temp.path(), 2));
+  ASSERT_TRUE(loaded.Load(temp.path()));
+  ASSERT_EQ(2u, loaded.size());
+  EXPECT_EQ(L"git status", loaded.Get(0).command);
+  EXPECT_EQ(L"echo \u4e2d\u6587", loaded.Get(1).command);
+}
+
+TEST(HistoryRecordsTest, SaveMergesOthers) {
+  ScopedTempPath temp("records_merge");
+  HistoryRecords first;
+  HistoryRecords second;
+  first.Add(MakeRecord(L"a", L"c:\\", 1, 1, 0));
+  second.Add(MakeRecord(L"b", L"c:\\", 2, 1, 0));
+  ASSERT_TRUE(first.Save(temp.path(), 1000));
+  ASSERT_TRUE(second.Save(temp.path(), 1000));
+  first.Add(MakeRecord(L"c", L"c:\\", 3, 1, 0));
+  // Only "c" is new to the file.
+  ASSERT_TRUE(first.Save(temp.path(), 1000));
+
+  HistoryRecords loaded;
+  ASSERT_TRUE(loaded.Load(temp.path()));
+  ASSERT_EQ(3u, loaded.size());
+  EXPECT_EQ(L"a", loaded.Get(0).command);
+  EXPECT_EQ(L"b", loaded.Get(1).command);
+  EXPECT_EQ(L"c", loaded.Get(2).command);
+}
+
+TEST(HistoryRecordsTest, Corrupt) {
+  ScopedTempPath temp("records_corrupt");
+  HistoryRecords records;
+  AddTestRecords(&records);
+  ASSERT_TRUE(records.Save(temp.path(), 1000));
+
+  // Truncated.
+  MappedFile file;
+  ASSERT_TRUE(file.Open(temp.path()));
+  string contents(file.data(), file.size());
+  file.Close();
+  ASSERT_TRUE(WriteFileAtomically(temp.path(),
+                                  contents.substr(0, contents.size() - 1)));
+  HistoryRecords loaded;
+  EXPECT_FALSE(loaded.Load(temp.path()));
+  EXPECT_EQ(0u, loaded.size());
+
+  // Saving replaces it.
+  records.Add(MakeRecord(L"dir", L"c:\\", 700, 1, 0));
+  ASSERT_TRUE(records.Save(temp.path(), 1000));
+  ASSERT_TRUE(loaded.Load(temp.path()));
+  ASSERT_EQ(1u, loaded.size());
+  EXPECT_EQ(700, loaded.Get(0).start_time);
+}
+
+TEST(HistoryRecordsTest, DISABLED_PerfQuery1M) {
+  ScopedTempPath temp("records_perf");
+  const int kRecords = 1000000;
+  const int kDirectories = 1000;
+  HistoryRecords records;
+  for (int i = 0; i < kRecords; ++i) {
+    records.Add(MakeRecord(L"ninja -C out\\Release target" + to_wstring(i % 5000),
+                           L"c:\\src\\project" + to_wstring(i % kDirectories),
+                           1381000000000LL + i * 1000LL,
+                           i * 7919LL % 100000,
+                           i % 3));
+  }
+  ASSERT_TRUE(records.Save(temp.path(), kRecords));
+
+  PerfTimer timer;
+  HistoryRecords loaded;
+  ASSERT_TRUE(loaded.Load(temp.path()));
+  printf("load: %.1fms\n", timer.ElapsedMs());
+
+  const int kQueries = 100;
+  RecordQuery query;
+  query.order = RecordQuery::kSlowestFirst;
+  vector<CommandRecord> results;
+  timer.Restart();
+  for (int i = 0; i < kQueries; ++i) {
+    query.directory = L"c:\\src\\project" + to_wstring(i);
+    loaded.Query(query, &results);
+    ASSERT_EQ(20u, results.size());
+  }
+  printf("slowest in directory: %.2fms/query\n",
+         timer.ElapsedMs() / kQueries);
+}
@@ -0,0 +1,284 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_segment.h"
+
+#include <algorithm>
+
+#include "cmdEx/fuzzy_match.h"
+#include "common/util.h"
+
+namespace {
+
+const uint32_t kMagic = 0x53485843;  // "CXHS".
+const uint32_t kVersion = 1;
+const size_t kHeaderSize = 28;
+const size_t kKeyBlockEntrySize = 12;
+
+void PutVarint(size_t value, string* out) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+// Appends |utf16| (UTF-16LE) to |out|, sharing what it can with |previous|
+// if |share|.
+void PutString(const string& utf16,
+               const string& previous,
+               bool share,
+               string* out) {
+  size_t shared = 0;
+  if (share) {
+    size_t limit = min(utf16.size(), previous.size()) / 2 * 2;
+    while (shared < limit && utf16[shared] == previous[shared] &&
+           utf16[shared + 1] == previous[shared + 1]) {
+      shared += 2;
+    }
+  }
+  PutVarint(shared / 2, out);
+  PutVarint((utf16.size() - shared) / 2, out);
+  out->append(utf16, shared, string::npos);
+}
+
+// Decodes strings as written by PutString().
+class StringReader {
+ public:
+  StringReader(const char* data, size_t size)
+      : pos_(data), end_(data + size), corrupt_(false) {}
+
+  // Returns false at the end, or if the data's corrupt.
+  bool Next(wstring* str) {
+    if (pos_ == end_)
+      return false;
+    size_t shared;
+    size_t suffix;
+    if (!GetVarint(&shared) || !GetVarint(&suffix) ||
+        shared > current_.size() / 2 ||
+        suffix > static_cast<size_t>(end_ - pos_) / 2) {
+      corrupt_ = true;
+      return false;
+    }
+    current_.resize(shared * 2);
+    current_.append(pos_, suffix * 2);
+    pos_ += suffix * 2;
+    str->clear();
+    AppendFromUtf16Le(current_.data(), current_.size(), str);
+    return true;
+  }
+
+  bool corrupt() const { return corrupt_; }
+
+ private:
+  bool GetVarint(size_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+      if (pos_ == end_)
+        return false;
+      unsigned char byte = static_cast<unsigned char>(*pos_++);
+      *value |= static_cast<size_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  const char* pos_;
+  const char* end_;
+  // The last string, as UTF-16LE.
+  string current_;
+  bool corrupt_;
+};
+
+}  // namespace
+
+HistorySegment::HistorySegment()
+    : line_count_(0),
+      key_count_(0),
+      key_block_count_(0),
+      lines_(NULL),
+      lines_size_(0),
+      key_blocks_(NULL),
+      keys_(NULL),
+      keys_size_(0) {}
+
+bool HistorySegment::Write(const string& path,
+                           const vector<wstring>& lines,
+                           uint32_t flags) {
+  string lines_data;
+  string utf16;
+  string previous;
+  vector<wstring> keys;
+  keys.reserve(lines.size());
+  for (size_t i = 0; i < lines.size(); ++i) {
+    utf16.clear();
+    AppendUtf16Le(lines[i], &utf16);
+    PutString(utf16,
+              previous,
+              (flags & kCompressed) && i % kRestartInterval != 0,
+              &lines_data);
+    previous.swap(utf16);
+
+    WStringPiece command;
+    WStringPiece directory;
+    SplitHistoryLine(lines[i], &command, &directory);
+    keys.push_back(command.as_string());
+  }
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+  string key_blocks;
+  string keys_data;
+  previous.clear();
+  uint64_t signature = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (i % kKeysPerBlock == 0) {
+      if (i > 0)
+        Put64(signature, &key_blocks);
+      Put32(static_cast<uint32_t>(keys_data.size()), &key_blocks);
+      signature = 0;
+    }
+    signature |= CharSignature(keys[i]);
+    utf16.clear();
+    AppendUtf16Le(keys[i], &utf16);
+    PutString(utf16, previous, i % kKeysPerBlock != 0, &keys_data);
+    previous.swap(utf16);
+  }
+  if (!keys.empty())
+    Put64(signature, &key_blocks);
+
+  string contents;
+  Put32(kMagic, &contents);
+  Put32(kVersion, &contents);
+  Put32(flags, &contents);
+  Put32(static_cast<uint32_t>(lines.size()), &contents);
+  Put32(static_cast<uint32_t>(keys.size()), &contents);
+  Put32(static_cast<uint32_t>(
+            (keys.size() + kKeysPerBlock - 1) / kKeysPerBlock),
+        &contents);
+  Put32(static_cast<uint32_t>(lines_data.size()), &contents);
+  contents += lines_data;
+  contents += key_blocks;
+  contents += keys_data;
+  return WriteFileAtomically(path, contents);
+}
+
+bool HistorySegment::Open(const string& path) {
+  if (!file_.Open(path))
+    return false;
+  const char* data = file_.data();
+  size_t size = file_.size();
+  if (size < kHeaderSize || Get32(data) != kMagic ||
+      Get32(data + 4) != kVersion) {
+    return false;
+  }
+  line_count_ = Get32(data + 12);
+  key_count_ = Get32(data + 16);
+  key_block_count_ = Get32(data + 20);
+  lines_size_ = Get32(data + 24);
+  if (key_block_count_ !=
+          (key_count_ + kKeysPerBlock - 1) / kKeysPerBlock ||
+      lines_size_ > size - kHeaderSize ||
+      key_block_count_ >
+          (size - kHeaderSize - lines_size_) / kKeyBlockEntrySize) {
+    return false;
+  }
+  lines_ = data + kHeaderSize;
+  key_blocks_ = lines_ + lines_size_;
+  keys_ = key_blocks_ + key_block_count_ * kKeyBlockEntrySize;
+  keys_size_ = static_cast<size_t>(data + size - keys_);
+  for (size_t i = 0; i < key_block_count_; ++i) {
+    if (Get32(key_blocks_ + i * kKeyBlockEntrySize) > keys_size_)
+      return false;
+  }
+  return true;
+}
+
+bool HistorySegment::ReadLines(vector<wstring>* lines) const {
+  StringReader reader(lines_, lines_size_);
+  size_t start = lines->size();
+  lines->reserve(start + line_count_);
+  wstring line;
+  while (reader.Next(&line))
+    lines->push_back(line);
+  if (reader.corrupt() || lines->size() - start != line_count_) {
+    lines->resize(start);
+    return false;
+  }
+  return true;
+}
+
+bool HistorySegment::HasPrefix(const wstring& prefix) const {
+  if (key_count_ == 0)
+    return false;
+  // The first key that's not less than |prefix| is the only one that needs
+  // checking: either it starts with |prefix|, or nothing does. It's in the
+  // last block whose first key is less than |prefix|, or first in the one
+  // after.
+  size_t lo = 0;
+  size_t hi = key_block_count_;
+  wstring key;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (!GetFirstKey(mid, &key))
+      return false;
+    if (key < prefix)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo > 0) {
+    vector<wstring> keys;
+    if (!GetKeys(lo - 1, &keys))
+      return false;
+    auto found = lower_bound(keys.begin(), keys.end(), prefix);
+    if (found != keys.end())
+      return found->compare(0, prefix.size(), prefix) == 0;
+  }
+  if (lo == key_block_count_ || !GetFirstKey(lo, &key))
+    return false;
+  return key.compare(0, prefix.size(), prefix) == 0;
+}
+
+bool HistorySegment::HasFuzzyMatch(const wstring& query) const {
+  if (query.empty())
+    return false;
+  uint64_t signature = CharSignature(query);
+  vector<wstring> keys;
+  for (size_t block = 0; block < key_block_count_; ++block) {
+    uint64_t block_signature =
+        Get64(key_blocks_ + block * kKeyBlockEntrySize + 4);
+    if ((block_signature & signature) != signature)
+      continue;
+    if (!GetKeys(block, &keys))
+      return false;
+    for (const auto& key : keys) {
+      if (FuzzyScore(key, query) >= 0)
+        return true;
+    }
+  }
+  return false;
+}
+
+bool HistorySegment::GetFirstKey(size_t block, wstring* key) const {
+  size_t offset = Get32(key_blocks_ + block * kKeyBlockEntrySize);
+  StringReader reader(keys_ + offset, keys_size_ - offset);
+  return reader.Next(key);
+}
+
+bool HistorySegment::GetKeys(size_t block, vector<wstring>* keys) const {
+  size_t begin = Get32(key_blocks_ + block * kKeyBlockEntrySize);
+  size_t end = block + 1 < key_block_count_
+                   ? Get32(key_blocks_ + (block + 1) * kKeyBlockEntrySize)
+                   : keys_size_;
+  if (end < begin)
+    return false;
+  keys->clear();
+  StringReader reader(keys_ + begin, end - begin);
+  wstring key;
+  while (keys->size() < kKeysPerBlock && reader.Next(&key))
+    keys->push_back(key);
+  return !reader.corrupt();
+}
@@ -0,0 +1,82 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_SEGMENT_H_
+#define CMDEX_HISTORY_SEGMENT_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/history_file.h"
+
+// An immutable file holding a run of old history lines (see
+// MakeHistoryLine()), oldest first, as kept by HistoryArchive.
+//
+// Besides the lines themselves, a segment has an index of the distinct
+// commands in it, sorted, so that whether it has anything that starts with a
+// prefix is a binary search, and whether anything fuzzily matches a query
+// only has to look at the blocks of the index whose CharSignature()s allow
+// it. So the archive can be searched without reading the lines in.
+//
+// On disk, everything is little-endian:
+//   header: magic, version, flags, line count, key count, key block count,
+//           size of the lines in bytes (all uint32)
+//   lines: each as the number of UTF-16 units it shares with the line before
+//          and the number that follow (both LEB128), then those units
+//   key blocks: each's offset from the start of the first (uint32) and
+//               CharSignature() of its keys (uint64)
+//   keys: as lines, in blocks of kKeysPerBlock, the first of each whole
+// Lines are only front coded (share anything with the one before) if the
+// segment's compressed, and even then every kRestartInterval'th is whole.
+class HistorySegment {
+ public:
+  HistorySegment();
+
+  static const uint32_t kCompressed = 1;
+  static const size_t kRestartInterval = 16;
+  static const size_t kKeysPerBlock = 64;
+
+  // Writes |lines| to |path|, with WriteFileAtomically(). |flags| is 0 or
+  // kCompressed.
+  static bool Write(const string& path,
+                    const vector<wstring>& lines,
+                    uint32_t flags);
+
+  // Returns false if |path| couldn't be read, or isn't a valid segment.
+  bool Open(const string& path);
+
+  size_t size() const { return line_count_; }
+  // Appends the lines to |lines|. Returns false if they're corrupt.
+  bool ReadLines(vector<wstring>* lines) const;
+
+  // Whether any command (that is, a line less its directory) starts with
+  // |prefix|.
+  bool HasPrefix(const wstring& prefix) const;
+  // Whether any command matches |query|, as FuzzyScore() sees it.
+  bool HasFuzzyMatch(const wstring& query) const;
+
+ private:
+  HistorySegment(const HistorySegment&);
+  void operator=(const HistorySegment&);
+
+  // The first key in |block|.
+  bool GetFirstKey(size_t block, wstring* key) const;
+  // Decodes all the keys in |block|.
+  bool GetKeys(size_t block, vector<wstring>* keys) const;
+
+  MappedFile file_;
+  size_t line_count_;
+  size_t key_count_;
+  size_t key_block_count_;
+  const char* lines_;
+  size_t lines_size_;
+  const char* key_blocks_;
+  const char* keys_;
+  size_t keys_size_;
+};
+
+#endif  // CMDEX_HISTORY_SEGMENT_H_
@@ -0,0 +1,97 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_writer.h"
+
+#include "common/util.h"
+
+HistoryWriter::HistoryWriter(unique_ptr<HistoryStoreInterface> store,
+                             int max_delay_ms)
+    : store_(move(store)),
+      max_delay_(max_delay_ms),
+      written_count_(0),
+      appended_count_(0),
+      flushing_(false),
+      stopping_(false),
+      failed_(false) {}
+
+HistoryWriter::~HistoryWriter() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void HistoryWriter::Write(const wstring& line) {
+  {
+    lock_guard<mutex> lock(mutex_);
+    if (pending_.empty())
+      pending_since_ = chrono::steady_clock::now();
+    pending_.push_back(line);
+    ++written_count_;
+    if (!thread_.joinable())
+      thread_ = thread(&HistoryWriter::Run, this);
+  }
+  wake_.notify_one();
+}
+
+void HistoryWriter::ReadNew(vector<wstring>* lines) {
+  unique_lock<mutex> store_lock(store_mutex_, try_to_lock);
+  {
+    lock_guard<mutex> lock(mutex_);
+    lines->insert(lines->end(), others_.begin(), others_.end());
+    others_.clear();
+  }
+  if (store_lock.owns_lock() && !store_->ReadNew(lines))
+    Log("couldn't read history");
+}
+
+bool HistoryWriter::Flush() {
+  unique_lock<mutex> lock(mutex_);
+  uint64_t target = written_count_;
+  if (appended_count_ < target) {
+    flushing_ = true;
+    wake_.notify_one();
+    appended_.wait(lock, [this, target] { return appended_count_ >= target; });
+  }
+  bool ok = !failed_;
+  failed_ = false;
+  return ok;
+}
+
+void HistoryWriter::Run() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+    if (pending_.empty())
+      return;
+    wake_.wait_until(lock, pending_since_ + max_delay_, [this] {
+      return stopping_ || flushing_;
+    });
+    vector<wstring> batch;
+    batch.swap(pending_);
+    flushing_ = false;
+    lock.unlock();
+
+    vector<wstring> others;
+    bool ok;
+    {
+      lock_guard<mutex> store_lock(store_mutex_);
+      ok = store_->Append(batch, &others);
+      lock.lock();
+      // While still holding store_mutex_, so that ReadNew() can't read past
+      // these first.
+      others_.insert(others_.end(), others.begin(), others.end());
+    }
+    if (!ok) {
+      Log("couldn't append to history");
+      failed_ = true;
+    }
+    appended_count_ += batch.size();
+    appended_.notify_all();
+  }
+}
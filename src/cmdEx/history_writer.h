@@ -0,0 +1,94 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_HISTORY_WRITER_H_
+#define CMDEX_HISTORY_WRITER_H_
+
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Where history is saved to. HistoryJournal is the real one.
+class HistoryStoreInterface {
+ public:
+  virtual ~HistoryStoreInterface() {}
+
+  // Appends |lines|, oldest first. Lines other instances have appended since
+  // the last Append() or ReadNew() come before them, and are added to
+  // |others|.
+  virtual bool Append(const vector<wstring>& lines,
+                      vector<wstring>* others) = 0;
+
+  // Adds any lines that other instances have appended to |lines|.
+  virtual bool ReadNew(vector<wstring>* lines) = 0;
+};
+
+// Saves history on a background thread, so that entering a command never
+// waits on the disk, and a crash or a killed console loses at most the last
+// |max_delay_ms| of it.
+//
+// Lines are appended in batches: once one is waiting, the thread gives others
+// up to |max_delay_ms| to arrive and then appends them all together, so that
+// a burst of commands (a paste, say) costs one lock and one write. Anything
+// the store does as part of an append, like compacting itself, also happens
+// on that thread.
+class HistoryWriter {
+ public:
+  HistoryWriter(unique_ptr<HistoryStoreInterface> store, int max_delay_ms);
+  // Flushes.
+  ~HistoryWriter();
+
+  // Queues |line| to be appended.
+  void Write(const wstring& line);
+
+  // Adds lines that other instances have appended to |lines|: those found
+  // while appending, and any more that are there now. Doesn't wait for the
+  // store if it's busy, in which case the rest turn up next time.
+  void ReadNew(vector<wstring>* lines);
+
+  // Blocks until everything passed to Write() so far has been appended,
+  // without waiting out the delay. Returns false if anything couldn't be
+  // since the last Flush().
+  bool Flush();
+
+ private:
+  HistoryWriter(const HistoryWriter&);
+  void operator=(const HistoryWriter&);
+
+  void Run();
+
+  unique_ptr<HistoryStoreInterface> store_;
+  chrono::milliseconds max_delay_;
+  // Held while using store_. Taken before mutex_ when both are needed.
+  mutex store_mutex_;
+
+  // Guards everything below.
+  mutex mutex_;
+  // Signalled when there's something for the thread to do.
+  condition_variable wake_;
+  // Signalled when a batch has been appended.
+  condition_variable appended_;
+  // Started on the first Write(), so that nothing waits on it before then
+  // (e.g. while holding the loader lock in DllMain).
+  thread thread_;
+  vector<wstring> pending_;
+  // When the first of pending_ was written.
+  chrono::steady_clock::time_point pending_since_;
+  // Counts of lines written, and appended (or failed).
+  uint64_t written_count_;
+  uint64_t appended_count_;
+  vector<wstring> others_;
+  bool flushing_;
+  bool stopping_;
+  bool failed_;
+};
+
+#endif  // CMDEX_HISTORY_WRITER_H_
@@ -0,0 +1,207 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/history_writer.h"
+
+#include "cmdEx/history_journal.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// What a FakeStore has been given, which outlives it.
+struct FakeStoreState {
+  FakeStoreState() : fail(false) {}
+
+  vector<vector<wstring>> GetBatches() {
+    lock_guard<mutex> lock(guard);
+    return batches;
+  }
+
+  void AddOther(const wstring& line) {
+    lock_guard<mutex> lock(guard);
+    others.push_back(line);
+  }
+
+  void SetFail(bool value) {
+    lock_guard<mutex> lock(guard);
+    fail = value;
+  }
+
+  mutex guard;
+  vector<vector<wstring>> batches;
+  // Lines as if from other instances, to be returned next.
+  vector<wstring> others;
+  bool fail;
+};
+
+class FakeStore : public HistoryStoreInterface {
+ public:
+  explicit FakeStore(FakeStoreState* state) : state_(state) {}
+
+  virtual bool Append(const vector<wstring>& lines,
+                      vector<wstring>* others) override {
+    lock_guard<mutex> lock(state_->guard);
+    others->insert(others->end(), state_->others.begin(), state_->others.end());
+    state_->others.clear();
+    if (state_->fail)
+      return false;
+    state_->batches.push_back(lines);
+    return true;
+  }
+
+  virtual bool ReadNew(vector<wstring>* lines) override {
+    lock_guard<mutex> lock(state_->guard);
+    lines->insert(lines->end(), state_->others.begin(), state_->others.end());
+    state_->others.clear();
+    return true;
+  }
+
+ private:
+  FakeStoreState* state_;
+};
+
+unique_ptr<HistoryStoreInterface> MakeFakeStore(FakeStoreState* state) {
+  return unique_ptr<HistoryStoreInterface>(new FakeStore(state));
+}
+
+// Long enough that nothing's written because of it during a test.
+const int kLongDelayMs = 60 * 1000;
+
+// Writes |count| lines tagged with |id|.
+void WriteMany(HistoryWriter* writer, int id, int count) {
+  for (int i = 0; i < count; ++i)
+    writer->Write(to_wstring(id) + L":" + to_wstring(i));
+}
+
+// Checks that |lines| has |count| from each of |writers|, each in order.
+void ExpectAllInOrder(const vector<wstring>& lines, int writers, int count) {
+  EXPECT_EQ(static_cast<size_t>(writers * count), lines.size());
+  vector<int> next(writers, 0);
+  for (const auto& line : lines) {
+    size_t colon = line.find(L':');
+    ASSERT_NE(wstring::npos, colon);
+    int id = stoi(line.substr(0, colon));
+    int i = stoi(line.substr(colon + 1));
+    ASSERT_TRUE(id >= 0 && id < writers);
+    EXPECT_EQ(next[id], i);
+    next[id] = i + 1;
+  }
+}
+
+}  // namespace
+
+TEST(HistoryWriterTest, FlushAppendsTogether) {
+  FakeStoreState store;
+  HistoryWriter writer(MakeFakeStore(&store), kLongDelayMs);
+  EXPECT_TRUE(writer.Flush());
+  writer.Write(L"a");
+  writer.Write(L"b");
+  writer.Write(L"c");
+  EXPECT_TRUE(writer.Flush());
+  vector<vector<wstring>> batches = store.GetBatches();
+  ASSERT_EQ(1u, batches.size());
+  vector<wstring> expected;
+  expected.push_back(L"a");
+  expected.push_back(L"b");
+  expected.push_back(L"c");
+  EXPECT_EQ(expected, batches[0]);
+}
+
+TEST(HistoryWriterTest, WritesAfterDelay) {
+  FakeStoreState store;
+  HistoryWriter writer(MakeFakeStore(&store), 10);
+  writer.Write(L"a");
+  for (int i = 0; i < 500 && store.GetBatches().empty(); ++i)
+    this_thread::sleep_for(chrono::milliseconds(10));
+  ASSERT_EQ(1u, store.GetBatches().size());
+}
+
+TEST(HistoryWriterTest, DestructionFlushes) {
+  FakeStoreState store;
+  {
+    HistoryWriter writer(MakeFakeStore(&store), kLongDelayMs);
+    writer.Write(L"a");
+  }
+  EXPECT_EQ(1u, store.GetBatches().size());
+}
+
+TEST(HistoryWriterTest, Others) {
+  FakeStoreState store;
+  HistoryWriter writer(MakeFakeStore(&store), kLongDelayMs);
+  store.AddOther(L"x");
+  writer.Write(L"a");
+  EXPECT_TRUE(writer.Flush());
+  store.AddOther(L"y");
+  vector<wstring> others;
+  writer.ReadNew(&others);
+  vector<wstring> expected;
+  expected.push_back(L"x");
+  expected.push_back(L"y");
+  EXPECT_EQ(expected, others);
+  others.clear();
+  writer.ReadNew(&others);
+  EXPECT_TRUE(others.empty());
+}
+
+TEST(HistoryWriterTest, Failure) {
+  FakeStoreState store;
+  HistoryWriter writer(MakeFakeStore(&store), kLongDelayMs);
+  store.SetFail(true);
+  writer.Write(L"a");
+  EXPECT_FALSE(writer.Flush());
+  store.SetFail(false);
+  writer.Write(L"b");
+  EXPECT_TRUE(writer.Flush());
+}
+
+TEST(HistoryWriterTest, ConcurrentWritesKeepOrder) {
+  const int kThreads = 4;
+  const int kLines = 2000;
+  FakeStoreState store;
+  HistoryWriter writer(MakeFakeStore(&store), 1);
+  vector<thread> threads;
+  for (int i = 0; i < kThreads; ++i)
+    threads.push_back(thread(WriteMany, &writer, i, kLines));
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_TRUE(writer.Flush());
+  vector<wstring> all;
+  for (const auto& batch : store.GetBatches())
+    all.insert(all.end(), batch.begin(), batch.end());
+  ExpectAllInOrder(all, kThreads, kLines);
+}
+
+TEST(HistoryWriterTest, JournalsStress) {
+  ScopedTempPath journal_path("writer_journal");
+  ScopedTempPath history_path("writer_history");
+  const int kWriters = 6;
+  const int kLines = 500;
+  vector<unique_ptr<HistoryWriter>> writers;
+  for (int i = 0; i < kWriters; ++i) {
+    unique_ptr<HistoryJournal> journal(new HistoryJournal);
+    ASSERT_TRUE(journal->Open(journal_path.path(), history_path.path()));
+    // So that the journal's compacted into the snapshot along the way.
+    journal->set_compact_threshold(4096);
+    journal->set_max_snapshot_commands(kWriters * kLines);
+    vector<wstring> lines;
+    ASSERT_TRUE(journal->Load(&lines));
+    writers.push_back(unique_ptr<HistoryWriter>(new HistoryWriter(
+        unique_ptr<HistoryStoreInterface>(move(journal)), 1)));
+  }
+  vector<thread> threads;
+  for (int i = 0; i < kWriters; ++i)
+    threads.push_back(thread(WriteMany, writers[i].get(), i, kLines));
+  for (auto& thread : threads)
+    thread.join();
+  for (auto& writer : writers)
+    EXPECT_TRUE(writer->Flush());
+
+  // Everything's there once flushed, each writer's in order.
+  HistoryJournal fresh;
+  ASSERT_TRUE(fresh.Open(journal_path.path(), history_path.path()));
+  vector<wstring> all;
+  ASSERT_TRUE(fresh.Load(&all));
+  ExpectAllInOrder(all, kWriters, kLines);
+}
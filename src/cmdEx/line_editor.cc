@@ -4,16 +4,70 @@
 
 #include "cmdEx/line_editor.h"
 
+#include <limits.h>
 #include <windows.h>
 
 #include <algorithm>
 
 #include "cmdEx/command_history.h"
+#include "cmdEx/completion_pool.h"
 #include "cmdEx/directory_history.h"
 #include "common/util.h"
 
 #pragma comment(lib, "user32.lib")
 
+namespace {
+
+// How many matches Ctrl-R can cycle through.
+const size_t kMaxSearchResults = 50;
+
+wstring ToWide(const string& str) {
+  if (str.empty())
+    return wstring();
+  int length = MultiByteToWideChar(
+      CP_ACP, 0, str.data(), static_cast<int>(str.size()), NULL, 0);
+  wstring result(length, 0);
+  MultiByteToWideChar(CP_ACP,
+                      0,
+                      str.data(),
+                      static_cast<int>(str.size()),
+                      &result[0],
+                      length);
+  return result;
+}
+
+string ToNarrow(const wstring& str) {
+  if (str.empty())
+    return string();
+  int length = WideCharToMultiByte(CP_ACP,
+                                   0,
+                                   str.data(),
+                                   static_cast<int>(str.size()),
+                                   NULL,
+                                   0,
+                                   NULL,
+                                   NULL);
+  string result(length, 0);
+  WideCharToMultiByte(CP_ACP,
+                      0,
+                      str.data(),
+                      static_cast<int>(str.size()),
+                      &result[0],
+                      length,
+                      NULL,
+                      NULL);
+  return result;
+}
+
+}  // namespace
+
+const int LineEditor::kDefaultCompletionBudgetMs;
+const int LineEditor::kMaxCompletionMenuRows;
+
+LineEditor::~LineEditor() {
+  CancelCompletion();
+}
+
 void LineEditor::Init(ConsoleInterface* console,
                       DirectoryHistory* directory_history,
                       CommandHistory* command_history) {
@@ -23,6 +77,20 @@ void LineEditor::Init(ConsoleInterface* console,
   directory_history_ = directory_history;
   directory_history_->StartingEdit();
   command_history_ = command_history;
+  // Whatever was entered last time has now finished running (or this is the
+  // first prompt, in which case there's nothing to finish).
+  if (command_status_) {
+    int exit_code;
+    if (!command_status_->GetExitCode(&exit_code))
+      exit_code = HistoryRecords::kNoExitCode;
+    command_history_->CommandFinished(command_status_->GetTime(), exit_code);
+  }
+  command_history_->set_directory(
+      ToWide(directory_history_->GetWorkingDirectoryInterface()->Get()));
+  command_history_->StartingEdit();
+  // History has changed, so the last suggestion's position isn't valid.
+  ClearSuggestion();
+  UpdateSuggestion();
   RedrawConsole();
 }
 
@@ -67,16 +135,27 @@ LineEditor::HandleAction LineEditor::HandleKeyEvent(bool pressed,
     // completion which is kind of dumb.
     int previous_completion_begin = completion_word_begin_;
     completion_word_begin_ = -1;
+    // Whatever's still being completed in the background is only wanted if
+    // this is another Tab, and likewise the menu of what it found.
+    if (alt_down || ctrl_down || vk != VK_TAB) {
+      CancelCompletion();
+      completion_menu_.Erase(console_);
+    }
 
     bool second_ctrl_v_was_pending =
         second_ctrl_v_pending_saved_position_ != -1;
     if (second_ctrl_v_was_pending) {
-      line_ = second_ctrl_v_pending_saved_line_;
+      SetLine(second_ctrl_v_pending_saved_line_);
       position_ = second_ctrl_v_pending_saved_position_;
     }
     second_ctrl_v_pending_saved_line_.clear();
     second_ctrl_v_pending_saved_position_ = -1;
 
+    if (searching_ && HandleSearchKey(ctrl_down, alt_down, ascii_char, vk)) {
+      RedrawConsole();
+      return kIncomplete;
+    }
+
     if (alt_down && !ctrl_down && vk == VK_UP) {
       fake_command_ = L"cd..\x0d\x0a";
       return kReturnToCmdThenResume;
@@ -97,16 +176,29 @@ LineEditor::HandleAction LineEditor::HandleKeyEvent(bool pressed,
       return kReturnToCmdThenResume;
     } else if (!alt_down && ctrl_down && vk == 'D') {
       if (line_.empty() && position_ == 0) {
-        line_ = L"exit";
+        SetLine(L"exit");
         RedrawConsole();
         fake_command_ = L"exit\x0d\x0a";
         return kReturnToCmdThenResume;
       }
       return kIncomplete;
     } else if (!alt_down && !ctrl_down && vk == VK_RETURN) {
-      if (!line_.empty())
+      // Don't leave the suggestion on the screen.
+      if (!suggestion_.empty()) {
+        ClearSuggestion();
+        RedrawConsole();
+      }
+      if (!line_.empty()) {
         command_history_->AddCommand(line_);
-      line_ += L"\x0d\x0a";
+        if (command_status_) {
+          command_history_->CommandStarted(line_, command_status_->GetTime());
+          command_status_->ClearExitCode();
+        }
+      }
+      // Having changed directory, cmd only has to show a new prompt.
+      if (JumpToDirectory())
+        SetLine(L"");
+      EditLine(static_cast<int>(line_.size()), 0, L"\x0d\x0a");
       int x, y;
       console_->GetCursorLocation(&x, &y);
       start_y_ += console_->SetCursorLocation(0, y + 1);
@@ -114,17 +206,17 @@ LineEditor::HandleAction LineEditor::HandleKeyEvent(bool pressed,
     } else if (!alt_down && !ctrl_down && vk == VK_ESCAPE) {
       // During prompt, Escape cancels.
       if (!second_ctrl_v_was_pending) {
-        line_ = L"";
+        SetLine(L"");
         position_ = 0;
       }
     } else if (!alt_down && !ctrl_down && vk == VK_BACK) {
       if (position_ == 0 || line_.empty())
         return kIncomplete;
       position_--;
-      line_.erase(position_, 1);
+      EditLine(position_, 1, L"");
     } else if (!alt_down && ctrl_down && vk == 'W') {
       int from = FindBackwards(max(0, position_ - 1), " ");
-      line_.erase(from, position_ - from);
+      EditLine(from, position_ - from, L"");
       position_ = from;
     } else if (!alt_down && !ctrl_down && vk == VK_TAB) {
       // We're continuing completion, keep it on.
@@ -132,21 +224,22 @@ LineEditor::HandleAction LineEditor::HandleKeyEvent(bool pressed,
       TabComplete(!shift_down);
     } else if (!alt_down && ctrl_down && vk == VK_BACK) {
       int from = FindBackwards(max(0, position_ - 1), " /\\");
-      line_.erase(from, position_ - from);
+      EditLine(from, position_ - from, L"");
       position_ = from;
     } else if (!alt_down && !ctrl_down && vk == VK_DELETE) {
       if (position_ == static_cast<int>(line_.size()) || line_.empty())
         return kIncomplete;
-      line_.erase(position_, 1);
+      EditLine(position_, 1, L"");
     } else if (!alt_down && ctrl_down && (vk == VK_END || vk == 'K')) {
-      line_.erase(position_, line_.size() - position_);
+      EditLine(position_, static_cast<int>(line_.size()) - position_, L"");
     } else if (!alt_down && ctrl_down && (vk == VK_HOME || vk == 'U')) {
-      line_.erase(0, position_);
+      EditLine(0, position_, L"");
       position_ = 0;
     } else if (!alt_down && !ctrl_down && vk == VK_LEFT) {
       position_ = max(0, position_ - 1);
     } else if (!alt_down && !ctrl_down && vk == VK_RIGHT) {
-      position_ = min(static_cast<int>(line_.size()), position_ + 1);
+      if (!AcceptSuggestion())
+        position_ = min(static_cast<int>(line_.size()), position_ + 1);
     } else if (!alt_down && ctrl_down && vk == VK_LEFT) {
       position_ = FindBackwards(max(0, position_ - 1), " ");
     } else if (!alt_down && ctrl_down && vk == VK_RIGHT) {
@@ -160,17 +253,35 @@ LineEditor::HandleAction LineEditor::HandleKeyEvent(bool pressed,
       position_ = 0;
     } else if ((!alt_down && !ctrl_down && vk == VK_END) ||
                (!alt_down && ctrl_down && vk == 'E')) {
+      AcceptSuggestion();
       position_ = static_cast<int>(line_.size());
     } else if (!alt_down && !ctrl_down && vk == VK_UP) {
+      // Moving can load more history, which invalidates the suggestion's
+      // position.
+      ClearSuggestion();
       if (command_history_->MoveInHistory(-1, L"", &line_))
         position_ = static_cast<int>(line_.size());
+      tokens_.Reset();
     } else if (!alt_down && !ctrl_down && vk == VK_DOWN) {
+      ClearSuggestion();
       if (command_history_->MoveInHistory(1, L"", &line_))
         position_ = static_cast<int>(line_.size());
+      tokens_.Reset();
     } else if (!alt_down && !ctrl_down && (vk == VK_PRIOR || vk == VK_F8)) {
+      ClearSuggestion();
       command_history_->MoveInHistory(-1, line_.substr(0, position_), &line_);
+      tokens_.Reset();
     } else if (!alt_down && !ctrl_down && vk == VK_NEXT) {
+      ClearSuggestion();
       command_history_->MoveInHistory(1, line_.substr(0, position_), &line_);
+      tokens_.Reset();
+    } else if (!alt_down && ctrl_down && vk == 'R') {
+      searching_ = true;
+      search_query_.clear();
+      search_results_.clear();
+      search_index_ = 0;
+      search_saved_line_ = line_;
+      search_saved_position_ = position_;
     } else if (!alt_down && ctrl_down && vk == 'V') {
       wstring text;
       if (console_->GetClipboardText(&text)) {
@@ -178,18 +289,19 @@ LineEditor::HandleAction LineEditor::HandleKeyEvent(bool pressed,
             !second_ctrl_v_was_pending) {
           second_ctrl_v_pending_saved_line_ = line_;
           second_ctrl_v_pending_saved_position_ = position_;
-          line_ = L"<Clipboard contains newline, Ctrl-V again to confirm>";
+          SetLine(L"<Clipboard contains newline, Ctrl-V again to confirm>");
           position_ = 0;
         } else {
           //vector<wstring> to_paste = StringSplit(text, L'\n');
-          line_.insert(position_, text);
+          EditLine(position_, 0, text);
           position_ += static_cast<int>(text.size());
         }
       }
     } else if (isprint(ascii_char)) {
-      line_.insert(position_, 1, ascii_char);
+      EditLine(position_, 0, wstring(1, ascii_char));
       position_++;
     }
+    UpdateSuggestion();
     RedrawConsole();
   }
   return kIncomplete;
@@ -205,15 +317,11 @@ void LineEditor::ToCmdBuffer(wchar_t* buffer,
   } else {
     wcscpy_s(buffer, buffer_size, line_.c_str());
     *num_chars = static_cast<int>(line_.size());
-    line_.clear();
+    SetLine(L"");
     position_ = 0;
   }
 }
 
-void LineEditor::RegisterCompleter(Completer completer) {
-  completers_.push_back(completer);
-}
-
 bool LineEditor::IsCompleting() const {
   return !completion_output_.results.empty() && completion_word_begin_ != -1;
 }
@@ -271,22 +379,175 @@ void LineEditor::ScrollByOneLine() {
   console_->SetCursorLocation(cursor_x, cursor_y);
 }
 
+void LineEditor::GetDisplayLine(wstring* line,
+                                int* position,
+                                int* dimmed_from) {
+  if (!searching_) {
+    *line = line_;
+    *position = position_;
+    *dimmed_from = static_cast<int>(line_.size());
+    if (!suggestion_.empty() && suggestion_prefix_ == line_ &&
+        position_ == static_cast<int>(line_.size())) {
+      line->append(suggestion_, line_.size(), wstring::npos);
+    }
+    return;
+  }
+  bool failed = !search_query_.empty() && search_results_.empty();
+  *line = wstring(failed ? L"(failed reverse-i-search)`"
+                         : L"(reverse-i-search)`") +
+          search_query_ + L"': ";
+  if (!search_results_.empty())
+    *line += search_results_[search_index_];
+  *position = static_cast<int>(line->size());
+  *dimmed_from = *position;
+}
+
+bool LineEditor::HandleSearchKey(bool ctrl_down,
+                                 bool alt_down,
+                                 unsigned char ascii_char,
+                                 int vk) {
+  if (!alt_down && ctrl_down && vk == 'R') {
+    // Again to go on to the next best match.
+    if (search_index_ + 1 < static_cast<int>(search_results_.size()))
+      ++search_index_;
+  } else if ((!alt_down && !ctrl_down && vk == VK_ESCAPE) ||
+             (!alt_down && ctrl_down && vk == 'G')) {
+    searching_ = false;
+    SetLine(search_saved_line_);
+    position_ = search_saved_position_;
+  } else if (!alt_down && !ctrl_down && vk == VK_BACK) {
+    if (!search_query_.empty()) {
+      search_query_.pop_back();
+      UpdateSearch();
+    }
+  } else if (!alt_down && !ctrl_down && isprint(ascii_char)) {
+    search_query_.push_back(ascii_char);
+    UpdateSearch();
+  } else {
+    // Anything else accepts the current match (so Enter runs it).
+    searching_ = false;
+    if (!search_results_.empty()) {
+      SetLine(search_results_[search_index_]);
+      position_ = static_cast<int>(line_.size());
+    } else {
+      SetLine(search_saved_line_);
+      position_ = search_saved_position_;
+    }
+    return false;
+  }
+  return true;
+}
+
+void LineEditor::UpdateSearch() {
+  command_history_->FuzzySearch(
+      search_query_, kMaxSearchResults, &search_results_);
+  search_index_ = 0;
+  ClearSuggestion();
+}
+
+void LineEditor::UpdateSuggestion() {
+  if (searching_ || line_.empty() ||
+      position_ != static_cast<int>(line_.size())) {
+    ClearSuggestion();
+    return;
+  }
+  if (line_ == suggestion_prefix_)
+    return;
+  int before = INT_MAX;
+  if (!suggestion_prefix_.empty() &&
+      line_.compare(0, suggestion_prefix_.size(), suggestion_prefix_) == 0) {
+    // Typed on from the last one: nothing newer than it can match now.
+    suggestion_prefix_ = line_;
+    if (suggestion_position_ == -1)
+      return;
+    if (suggestion_.size() > line_.size() &&
+        suggestion_.compare(0, line_.size(), line_) == 0) {
+      return;
+    }
+    before = suggestion_position_;
+  }
+  suggestion_prefix_ = line_;
+  suggestion_position_ = command_history_->FindSuggestion(line_, before);
+  if (suggestion_position_ == -1)
+    suggestion_.clear();
+  else
+    suggestion_ = command_history_->GetEntry(suggestion_position_);
+}
+
+bool LineEditor::JumpToDirectory() {
+  if (tokens_.size() < 2 || !(tokens_.deescaped_word(0) == L"z"))
+    return false;
+  vector<string> fragments;
+  for (size_t i = 1; i < tokens_.size(); ++i)
+    fragments.push_back(ToNarrow(tokens_.deescaped_word(i).as_string()));
+  return directory_history_->JumpTo(fragments);
+}
+
+void LineEditor::SetLine(const wstring& line) {
+  line_ = line;
+  tokens_.Reset();
+}
+
+void LineEditor::EditLine(int offset, int removed, const wstring& inserted) {
+  line_.replace(offset, removed, inserted);
+  tokens_.Update(offset, removed, static_cast<int>(inserted.size()));
+}
+
+void LineEditor::ClearSuggestion() {
+  suggestion_prefix_.clear();
+  suggestion_.clear();
+  suggestion_position_ = -1;
+}
+
+bool LineEditor::AcceptSuggestion() {
+  if (suggestion_.empty() || suggestion_prefix_ != line_ ||
+      position_ != static_cast<int>(line_.size())) {
+    return false;
+  }
+  EditLine(static_cast<int>(line_.size()),
+           0,
+           suggestion_.substr(line_.size()));
+  position_ = static_cast<int>(line_.size());
+  return true;
+}
+
 void LineEditor::RedrawConsole() {
   int width = console_->GetWidth();
   int height = console_->GetHeight();
   CHECK(width > 0);
-  bool cursor_past_end = position_ == static_cast<int>(line_.size());
+  wstring line;
+  int position;
+  int dimmed_from;
+  GetDisplayLine(&line, &position, &dimmed_from);
+  bool cursor_past_end = position == static_cast<int>(line.size());
   vector<LineChunk> chunks = BreakIntoLineChunks(
-      line_ + (cursor_past_end ? wstring(L"\x01") : wstring(L"")),
+      line + (cursor_past_end ? wstring(L"\x01") : wstring(L"")),
       start_x_,
       start_y_,
       width);
-  while (chunks[chunks.size() - 1].start_y >= height) {
+  // The menu goes below the line, and the line stays on screen.
+  int menu_rows = 0;
+  if (ShowsCompletionMenu()) {
+    int line_rows = chunks.back().start_y - chunks.front().start_y + 1;
+    int max_menu_rows = min(kMaxCompletionMenuRows, height - line_rows);
+    menu_rows =
+        completion_menu_.Layout(width, max_menu_rows, completion_index_);
+  }
+  while (chunks[chunks.size() - 1].start_y + menu_rows >= height) {
     ScrollByOneLine();
+    completion_menu_.Scrolled(1);
     for (auto& chunk : chunks)
       --chunk.start_y;
     --start_y_;
   }
+  // If the menu's moving (e.g. because the line's grown into where it was),
+  // it's cleared first, rather than leaving the line to draw over some of
+  // it.
+  int menu_top = chunks.back().start_y + 1;
+  if (completion_menu_.IsDrawn() &&
+      (menu_rows == 0 || completion_menu_.drawn_top() != menu_top)) {
+    completion_menu_.Erase(console_);
+  }
   int last_drawn_x = start_x_;
   int last_drawn_y = start_y_;
   int modify_start_y_by = 0;
@@ -295,15 +556,22 @@ void LineEditor::RedrawConsole() {
     size_t to_draw = chunk.contents.size();
     if (i == chunks.size() - 1 && cursor_past_end)
       --to_draw;
-    console_->DrawString(chunk.contents.c_str(), static_cast<int>(to_draw),
+    int plain = max(0, min(static_cast<int>(to_draw),
+                           dimmed_from - chunk.start_offset));
+    console_->DrawString(chunk.contents.c_str(), plain,
                          chunk.start_x, chunk.start_y);
+    if (plain < static_cast<int>(to_draw)) {
+      console_->DrawDimmedString(chunk.contents.c_str() + plain,
+                                 static_cast<int>(to_draw) - plain,
+                                 chunk.start_x + plain, chunk.start_y);
+    }
     last_drawn_x = static_cast<int>(chunk.start_x + to_draw);
     last_drawn_y = chunk.start_y;
-    if (position_ >= chunk.start_offset &&
-        position_ <
+    if (position >= chunk.start_offset &&
+        position <
             chunk.start_offset + static_cast<int>(chunk.contents.size())) {
       modify_start_y_by += console_->SetCursorLocation(
-          chunk.start_x + (position_ - chunk.start_offset),
+          chunk.start_x + (position - chunk.start_offset),
           chunk.start_y + modify_start_y_by);
     }
   }
@@ -317,6 +585,9 @@ void LineEditor::RedrawConsole() {
   }
   largest_y_ =
       chunks.empty() ? start_y_ : chunks.back().start_y + modify_start_y_by;
+  completion_menu_.Scrolled(-modify_start_y_by);
+  if (menu_rows > 0)
+    completion_menu_.Draw(console_, largest_y_ + 1);
 }
 
 int LineEditor::FindBackwards(int start_at, const char* until) {
@@ -342,31 +613,41 @@ int LineEditor::FindForwards(int start_at, const char* until) {
 }
 
 void LineEditor::TabComplete(bool forward_cycle) {
+  if (completion_request_ && completion_output_.results.empty()) {
+    // Nothing's been found yet, so give it a while longer.
+    completion_request_->Wait(completion_budget_ms_);
+    UpdateCompletion();
+    return;
+  }
+
   bool started = false;
   if (!IsCompleting()) {
-    vector<WordData> words;
-    CompletionBreakIntoWords(line_, &words);
     CompleterInput input;
-    input.word_data = words;  // TODO
-    input.word_index = CompletionWordIndex(input.word_data, position_);
+    tokens_.GetWordData(&input.word_data);
+    input.word_index = tokens_.WordIndex(position_);
     input.position_in_word =
         position_ - input.word_data[input.word_index].original_offset;
-    for (vector<Completer>::const_iterator i(completers_.begin());
-        i != completers_.end();
-        ++i) {
+    input.fuzzy = fuzzy_completion_;
+    // We'll be completing from begin_ to position_ subbing in results_.
+    // position_ is updated over time, so old end isn't saved.
+    completion_word_begin_ =
+        input.word_data[input.word_index].original_offset;
+    completion_word_end_ = static_cast<int>(
+        completion_word_begin_ +
+        input.word_data[input.word_index].original_word.size());
+    if (completion_pool_) {
       completion_output_.Reset();
-      if ((*i)(input, &completion_output_)) {
-        // We'll be completing from begin_ to position_ subbing in results_.
-        // position_ is updated over time, so old end isn't saved.
-        started = true;
-        completion_word_begin_ =
-            input.word_data[input.word_index].original_offset;
-        completion_word_end_ = static_cast<int>(
-            completion_word_begin_ +
-            input.word_data[input.word_index].original_word.size());
-        break;
-      }
+      completion_forward_ = forward_cycle;
+      completion_version_ = 0;
+      completion_request_ = completion_pool_->Start(completers_, input);
+      completion_request_->Wait(completion_budget_ms_);
+      UpdateCompletion();
+      return;
     }
+    started = completers_.Complete(input, &completion_output_);
+    if (!started)
+      completion_output_.Reset();
+    completion_menu_.SetItems(&completion_output_.results);
   }
 
   if (!IsCompleting())
@@ -385,17 +666,74 @@ void LineEditor::TabComplete(bool forward_cycle) {
       completion_index_ = 0;
   }
 
-  // Remove the old one (or the stub of one if we just started).
-  line_.erase(completion_word_begin_,
-              completion_word_end_ - completion_word_begin_);
-  position_ = completion_word_begin_;
+  ShowCompletion();
+  RedrawConsole();
+}
+
+void LineEditor::UpdateCompletion() {
+  if (!completion_request_)
+    return;
+  CompleterOutput output;
+  bool finished;
+  if (!completion_request_->GetResults(
+          &completion_version_, &output, &finished)) {
+    return;
+  }
+  if (finished)
+    completion_request_.reset();
+  SetCompletionResults(output);
+  UpdateSuggestion();
+  RedrawConsole();
+}
+
+void LineEditor::SetCompletionResults(const CompleterOutput& output) {
+  if (completion_output_.results.empty()) {
+    completion_output_ = output;
+    completion_menu_.SetItems(&completion_output_.results);
+    if (completion_output_.results.empty())
+      return;
+    completion_index_ =
+        completion_forward_
+            ? 0
+            : static_cast<int>(completion_output_.results.size()) - 1;
+    ShowCompletion();
+    return;
+  }
+  // Leave what's shown, and carry on cycling from wherever it is in the new
+  // results (or the start, if it's not there).
+  wstring shown;
+  if (completion_index_ >= 0 &&
+      completion_index_ < static_cast<int>(completion_output_.results.size()))
+    shown = completion_output_.results[completion_index_];
+  completion_output_ = output;
+  completion_menu_.SetItems(&completion_output_.results);
+  const vector<wstring>& results = completion_output_.results;
+  auto it = find(results.begin(), results.end(), shown);
+  completion_index_ =
+      it == results.end() ? -1 : static_cast<int>(it - results.begin());
+}
 
-  // Insert the new one.
+void LineEditor::ShowCompletion() {
+  // Replace the old one (or the stub of one if we just started) with the new
+  // one.
   wstring quoted = QuoteWord(completion_output_.results[completion_index_]);
   if (completion_output_.trailing_space)
     quoted += L" ";
-  line_.insert(completion_word_begin_, quoted);
+  EditLine(completion_word_begin_,
+           completion_word_end_ - completion_word_begin_,
+           quoted);
   position_ = static_cast<int>(completion_word_begin_ + quoted.size());
   completion_word_end_ = position_;
-  RedrawConsole();
+}
+
+bool LineEditor::ShowsCompletionMenu() const {
+  return completion_menu_enabled_ && !searching_ && IsCompleting() &&
+         completion_output_.results.size() > 1;
+}
+
+void LineEditor::CancelCompletion() {
+  if (completion_request_) {
+    completion_request_->Cancel();
+    completion_request_.reset();
+  }
 }
@@ -5,12 +5,19 @@
 #ifndef CMDEX_LINE_EDITOR_H_
 #define CMDEX_LINE_EDITOR_H_
 
+#include <stdint.h>
+
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "cmdEx/completer_registry.h"
 #include "cmdEx/completion.h"
+#include "cmdEx/completion_menu.h"
 
 class CommandHistory;
+class CompletionPool;
+class CompletionRequest;
 class DirectoryHistory;
 
 class ConsoleInterface {
@@ -20,18 +27,50 @@ class ConsoleInterface {
   virtual int GetHeight() = 0;
   // |str| not null terminated.
   virtual void DrawString(const wchar_t* str, int count, int x, int y) = 0;
+  // As DrawString(), but greyed out, for text that's shown after the line
+  // without being part of it.
+  virtual void DrawDimmedString(const wchar_t* str,
+                                int count,
+                                int x,
+                                int y) = 0;
+  // As DrawString(), but with the colours swapped, for what's selected.
+  virtual void DrawHighlightedString(const wchar_t* str,
+                                     int count,
+                                     int x,
+                                     int y) = 0;
   virtual void FillChar(wchar_t ch, int count, int x, int y) = 0;
   // Return is amount adjust start_y (when console has been scrolled).
   virtual int SetCursorLocation(int x, int y) = 0;
   virtual bool GetClipboardText(wstring* text) = 0;
 };
 
+// How long commands take, and how they exit, for CommandHistory's records.
+class CommandStatusInterface {
+ public:
+  // Milliseconds since the Unix epoch.
+  virtual int64_t GetTime() = 0;
+  // Called as a command is handed to cmd, so that GetExitCode() can tell
+  // whether it ran anything that set one.
+  virtual void ClearExitCode() = 0;
+  // The exit code of the command that just ran, or false if there wasn't one
+  // (e.g. it was a builtin).
+  virtual bool GetExitCode(int* exit_code) = 0;
+};
+
 class LineEditor {
  public:
    LineEditor()
-       : console_(NULL), start_x_(0), start_y_(0), position_(0),
+       : console_(NULL), start_x_(0), start_y_(0), tokens_(&line_),
+         position_(0),
          directory_history_(NULL), command_history_(NULL),
-         completion_index_(-1), second_ctrl_v_pending_saved_position_(-1) {}
+         completion_index_(-1), second_ctrl_v_pending_saved_position_(-1),
+         searching_(false), search_index_(0), search_saved_position_(0),
+         suggestion_position_(-1), command_status_(NULL),
+         completion_pool_(NULL),
+         completion_budget_ms_(kDefaultCompletionBudgetMs),
+         completion_version_(0), completion_forward_(true),
+         fuzzy_completion_(false), completion_menu_enabled_(false) {}
+  ~LineEditor();
 
   // Called initially and on each editing resumption. |directory_history| and
   // |command_history| are not owned.
@@ -58,17 +97,79 @@ class LineEditor {
                    unsigned long buffer_size,
                    unsigned long* num_chars);
 
-  // So tests can inject non-filesystem ones. More specific ones should be
-  // registered first.
-  void RegisterCompleter(Completer completer);
+  // Commands are only timed if this is set. Not owned.
+  void set_command_status(CommandStatusInterface* command_status) {
+    command_status_ = command_status;
+  }
+
+  // What Tab completes with. Registered to here, so that tests can inject
+  // non-filesystem ones.
+  CompleterRegistry* completers() { return &completers_; }
+
+  // If this is set, completers run on |pool| rather than while the key is
+  // handled. Tab then waits up to the budget for them, and if they're not
+  // done, shows what they've found so far (if anything), with the rest
+  // following in UpdateCompletion(). Not owned.
+  void set_completion_pool(CompletionPool* pool) { completion_pool_ = pool; }
+  static const int kDefaultCompletionBudgetMs = 100;
+  void set_completion_budget_ms(int budget_ms) {
+    completion_budget_ms_ = budget_ms;
+  }
+
+  // Whether Tab fuzzy matches (see CompleterInput::fuzzy), cycling through
+  // the results best first.
+  void set_fuzzy_completion(bool fuzzy) { fuzzy_completion_ = fuzzy; }
+
+  // Whether the results being cycled through are also shown below the line
+  // (see CompletionMenu), when there's more than one.
+  static const int kMaxCompletionMenuRows = 10;
+  void set_completion_menu(bool enabled) {
+    completion_menu_enabled_ = enabled;
+  }
+
+  // To be called when the completion pool notifies that there are new
+  // results, on the thread that's handling keys.
+  void UpdateCompletion();
 
   bool IsCompleting() const;
 
  private:
   void RedrawConsole();
+  // What's drawn: line_, or the search prompt during Ctrl-R. Anything from
+  // |dimmed_from| on is the suggestion.
+  void GetDisplayLine(wstring* line, int* position, int* dimmed_from);
+  // Returns false if the key ends the search, and should then be handled as
+  // usual.
+  bool HandleSearchKey(bool ctrl_down,
+                       bool alt_down,
+                       unsigned char ascii_char,
+                       int vk);
+  void UpdateSearch();
+  // Finds the newest command in history that line_ is the start of, to be
+  // suggested after it.
+  void UpdateSuggestion();
+  void ClearSuggestion();
+  // Replaces line_ with the suggestion, if there is one. Returns whether it
+  // did.
+  bool AcceptSuggestion();
+  // If line_ is "z" followed by fragments of a path, changes to the best
+  // match (see DirectoryHistory::JumpTo()). Returns whether it did.
+  bool JumpToDirectory();
+  // Changes to line_ go through these (or are followed by tokens_.Reset()),
+  // to keep tokens_ up to date: either replacing it, or replacing |removed|
+  // characters at |offset| with |inserted|.
+  void SetLine(const wstring& line);
+  void EditLine(int offset, int removed, const wstring& inserted);
   int FindBackwards(int start_at, const char* until);
   int FindForwards(int start_at, const char* until);
   void TabComplete(bool forward_cycle);
+  // Makes results found in the background the ones that are being cycled
+  // through, and shows the first if none has been yet.
+  void SetCompletionResults(const CompleterOutput& output);
+  // Replaces the word being completed with the current result.
+  void ShowCompletion();
+  bool ShowsCompletionMenu() const;
+  void CancelCompletion();
   void ScrollByOneLine();
 
   ConsoleInterface* console_;
@@ -76,12 +177,14 @@ class LineEditor {
   int start_y_;
   int largest_y_;  // The farthest down line wrapping has gotten us.
   wstring line_;
+  // line_ split into words, which is kept up to date as it's edited.
+  LineTokens tokens_;
   int position_;
   wstring fake_command_;
   DirectoryHistory* directory_history_;  // Weak.
   CommandHistory* command_history_;  // Weak.
 
-  vector<Completer> completers_;
+  CompleterRegistry completers_;
 
   int completion_word_begin_;
   int completion_word_end_;
@@ -89,6 +192,36 @@ class LineEditor {
   CompleterOutput completion_output_;
   wstring second_ctrl_v_pending_saved_line_;
   int second_ctrl_v_pending_saved_position_;
+
+  // Ctrl-R search through command history.
+  bool searching_;
+  wstring search_query_;
+  vector<wstring> search_results_;
+  int search_index_;
+  wstring search_saved_line_;
+  int search_saved_position_;
+
+  // What line_ was when suggestion_ was last looked for. As that's typed
+  // on, the next suggestion is either the same one or older, so only the
+  // part of history before suggestion_position_ needs to be searched again.
+  wstring suggestion_prefix_;
+  wstring suggestion_;
+  int suggestion_position_;  // -1 if there's no suggestion.
+
+  CommandStatusInterface* command_status_;  // Weak.
+
+  CompletionPool* completion_pool_;  // Weak.
+  int completion_budget_ms_;
+  // What's still completing in the background, if anything, and the version
+  // of its results that were last picked up.
+  shared_ptr<CompletionRequest> completion_request_;
+  int completion_version_;
+  // Which way the Tab that started it was cycling.
+  bool completion_forward_;
+  bool fuzzy_completion_;
+  bool completion_menu_enabled_;
+  // Shows completion_output_'s results.
+  CompletionMenu completion_menu_;
 };
 
 #endif  // CMDEX_LINE_EDITOR_H_
@@ -6,100 +6,36 @@
 
 #include <windows.h>
 
+#include <atomic>
+
 #include "cmdEx/command_history.h"
+#include "cmdEx/completion_pool.h"
+#include "cmdEx/directory_database.h"
 #include "cmdEx/directory_history.h"
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
 #include "gtest/gtest.h"
 
 namespace {
 
-class MockWorkingDirectory : public WorkingDirectoryInterface {
- public:
-  bool Set(const string& dir) override {
-    dir_ = dir;
-    return true;
-  }
-  string Get() override {
-    return dir_;
-  }
-
- private:
-  string dir_;
-};
-
-class MockConsoleInterface : public ConsoleInterface {
+class FakeCommandStatus : public CommandStatusInterface {
  public:
-  MockConsoleInterface() : width(50), height(10), cursor_x(0), cursor_y(0) {
-    screen_data = new wchar_t[width * height];
-    for (int y = 0; y < height; ++y)
-      for (int x = 0; x < width; ++x)
-        screen_data[y * width + x] = L'!';
-  }
-  ~MockConsoleInterface() {
-    delete[] screen_data;
-  }
-  virtual void GetCursorLocation(int* x, int* y) override {
-    *x = cursor_x;
-    *y = cursor_y;
-  }
-  virtual int GetWidth() override {
-    return width;
-  }
-  virtual int GetHeight() override {
-    return height;
-  }
-  virtual void DrawString(const wchar_t* str, int count, int x, int y)
-      override {
-    ASSERT_GE(x, 0);
-    ASSERT_GE(y, 0);
-    ASSERT_LE(x + count, width);
-    ASSERT_LT(y, height);
-    memcpy(&screen_data[y * width + x], str, count * sizeof(wchar_t));
-  }
-  virtual void FillChar(wchar_t ch, int count, int x, int y) override {
-    ASSERT_GE(x, 0);
-    ASSERT_GE(y, 0);
-    ASSERT_LE(x + count, width);
-    ASSERT_LT(y, height);
-    for (int i = 0; i < count; ++i)
-      screen_data[y * width + x + i] = ch;
-  }
-  virtual int SetCursorLocation(int x, int y) {
-    cursor_x = x;
-    cursor_y = y;
-    while (cursor_y >= height)
-      ScrollByOneLine();
-    return 0;  // TODO(scottmg): Test for this.
-  }
+  FakeCommandStatus() : time(0), exit_code(-1) {}
 
-  void ScrollByOneLine() {
-    ASSERT_GT(cursor_y, 0);
-    for (int y = 1; y < height; ++y) {
-      wchar_t* prev_line = &screen_data[(y - 1) * width];
-      wchar_t* cur_line = &screen_data[y * width];
-      memmove(prev_line, cur_line, width * sizeof(wchar_t));
-    }
-    for (int x = 0; x < width; ++x) {
-      screen_data[(height - 1) * width + x] = L' ';
-    }
-    --cursor_y;
+  int64_t GetTime() override {
+    return time;
   }
-
-  wchar_t GetCharAt(int x, int y) {
-    return screen_data[y * width + x];
+  void ClearExitCode() override {
+    exit_code = -1;
   }
-
-  bool GetClipboardText(wstring* text) {
-    *text = pending_clipboard;
-    pending_clipboard.clear();
-    return true;
+  bool GetExitCode(int* code) override {
+    *code = exit_code;
+    return exit_code != -1;
   }
 
-  int width;
-  int height;
-  int cursor_x;
-  int cursor_y;
-  wchar_t* screen_data;
-  wstring pending_clipboard;
+  int64_t time;
+  // -1 when cleared, for tests' purposes.
+  int exit_code;
 };
 
 class LineEditorTest : public ::testing::Test {
@@ -128,7 +64,7 @@ class LineEditorTest : public ::testing::Test {
   }
 
   MockConsoleInterface console;
-  MockWorkingDirectory wd;
+  FakeWorkingDirectory wd;
   DirectoryHistory dir_history;
   CommandHistory cmd_history;
   LineEditor le;
@@ -581,7 +517,7 @@ bool MockCompleterBasic(const CompleterInput& input, CompleterOutput* output) {
 }
 
 TEST_F(LineEditorTest, TabCompleteBasic) {
-  le.RegisterCompleter(MockCompleterBasic);
+  le.completers()->RegisterFallback(MockCompleterBasic);
   TypeLetters("hi ab");
 
   EXPECT_EQ(LineEditor::kIncomplete,
@@ -640,7 +576,7 @@ TEST_F(LineEditorTest, TabCompleteBasic) {
 }
 
 TEST_F(LineEditorTest, TabCompleteReverseLoop) {
-  le.RegisterCompleter(MockCompleterBasic);
+  le.completers()->RegisterFallback(MockCompleterBasic);
   TypeLetters("hi ab");
 
   // Start backwards.
@@ -701,7 +637,7 @@ TEST_F(LineEditorTest, TabCompleteReverseLoop) {
 }
 
 TEST_F(LineEditorTest, TabCompleteStopsAfterNonTab) {
-  le.RegisterCompleter(MockCompleterBasic);
+  le.completers()->RegisterFallback(MockCompleterBasic);
   TypeLetters("hi ab");
 
   EXPECT_EQ(LineEditor::kIncomplete,
@@ -723,6 +659,66 @@ TEST_F(LineEditorTest, TabCompleteStopsAfterNonTab) {
   EXPECT_FALSE(le.IsCompleting());
 }
 
+TEST_F(LineEditorTest, TabCompleteMenu) {
+  le.set_completion_menu(true);
+  le.completers()->RegisterFallback(MockCompleterBasic);
+  TypeLetters("hi ab");
+
+  // Shown below the line, with the one that's on the line highlighted.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abxxx ", console.GetLine(0, 9));
+  EXPECT_EQ(L"abxxx    abyyyyy  abz!", console.GetLine(1, 22));
+  EXPECT_TRUE(console.IsHighlightedAt(0, 1));
+  EXPECT_FALSE(console.IsHighlightedAt(9, 1));
+  EXPECT_EQ(8, console.cursor_x);
+  EXPECT_EQ(0, console.cursor_y);
+
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abyyyyy ", console.GetLine(0, 11));
+  EXPECT_FALSE(console.IsHighlightedAt(0, 1));
+  EXPECT_TRUE(console.IsHighlightedAt(9, 1));
+
+  // And gone once completing is.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, ' ', 0, VK_SPACE));
+  EXPECT_FALSE(le.IsCompleting());
+  EXPECT_EQ(L"hi abyyyyy  ", console.GetLine(0, 12));
+  EXPECT_EQ(L"                     !", console.GetLine(1, 22));
+}
+
+TEST_F(LineEditorTest, TabCompleteMenuOnLastLine) {
+  le.set_completion_menu(true);
+  le.completers()->RegisterFallback(MockCompleterBasic);
+  for (int i = 0; i < console.height; ++i) {
+    EXPECT_EQ(
+        LineEditor::kReturnToCmd,
+        le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+    ReInit();
+  }
+  TypeLetters("hi ab");
+  EXPECT_EQ(9, console.cursor_y);
+
+  // The console scrolls up to make room for it.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abxxx ", console.GetLine(8, 9));
+  EXPECT_EQ(L"abxxx    abyyyyy  abz ", console.GetLine(9, 22));
+  EXPECT_EQ(8, console.cursor_y);
+
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abyyyyy ", console.GetLine(8, 11));
+  EXPECT_TRUE(console.IsHighlightedAt(9, 9));
+  EXPECT_EQ(8, console.cursor_y);
+
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_ESCAPE, 0,
+                              VK_ESCAPE));
+  EXPECT_EQ(L"                      ", console.GetLine(9, 22));
+}
+
 bool MockCompleterInMiddle(const CompleterInput& input,
                            CompleterOutput* output) {
   EXPECT_EQ(L"hi", input.word_data[0].original_word);
@@ -738,7 +734,7 @@ bool MockCompleterInMiddle(const CompleterInput& input,
 }
 
 TEST_F(LineEditorTest, TabCompleteInMiddle) {
-  le.RegisterCompleter(MockCompleterInMiddle);
+  le.completers()->RegisterFallback(MockCompleterInMiddle);
   TypeLetters("hi ab cdefghi");
 
   // Back to 'b'.
@@ -764,6 +760,160 @@ TEST_F(LineEditorTest, TabCompleteInMiddle) {
   EXPECT_EQ('d', console.GetCharAt(10, 0));
 }
 
+CompletionGate g_completion_gate;
+atomic<bool> g_completion_cancelled;
+
+// Finds one result straight away, and the rest once the gate's open.
+bool MockCompleterSlow(const CompleterInput& input, CompleterOutput* output) {
+  output->results.push_back(L"abxxx");
+  output->trailing_space = false;
+  output->Publish();
+  if (!g_completion_gate.Wait(output)) {
+    g_completion_cancelled = true;
+    return false;
+  }
+  output->results.push_back(L"abyyyyy");
+  return true;
+}
+
+// Finds nothing until the gate's open.
+bool MockCompleterSilent(const CompleterInput& input,
+                         CompleterOutput* output) {
+  if (!g_completion_gate.Wait(output)) {
+    g_completion_cancelled = true;
+    return false;
+  }
+  output->results.push_back(L"abxxx");
+  output->trailing_space = false;
+  return true;
+}
+
+TEST_F(LineEditorTest, TabCompleteInBackground) {
+  CompletionPool pool(1, nullptr);
+  le.set_completion_pool(&pool);
+  le.set_completion_budget_ms(5000);
+  le.completers()->RegisterFallback(MockCompleterBasic);
+  TypeLetters("hi ab");
+
+  // Within the budget, it's as if it weren't in the background.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abxxx ", console.GetLine(0, 9));
+  EXPECT_EQ(8, console.cursor_x);
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abyyyyy ", console.GetLine(0, 11));
+}
+
+bool MockCompleterFuzzy(const CompleterInput& input, CompleterOutput* output) {
+  AddCompletions(PackedCandidates(vector<wstring>{
+                     L"xmxaxkxe", L"cmake", L"tools\\make.py", L"makefile"}),
+                 input.word_data[input.word_index].deescaped_word,
+                 input.fuzzy,
+                 output);
+  return !output->results.empty();
+}
+
+TEST_F(LineEditorTest, TabCompleteFuzzy) {
+  le.completers()->RegisterFallback(MockCompleterFuzzy);
+  TypeLetters("hi mk");
+  // Nothing starts with it.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi mk ", console.GetLine(0, 6));
+
+  // But they contain it, and come best first.
+  le.set_fuzzy_completion(true);
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi makefile ", console.GetLine(0, 12));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi tools\\make.py ", console.GetLine(0, 17));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi cmake         ", console.GetLine(0, 17));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi xmxaxkxe ", console.GetLine(0, 12));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi makefile ", console.GetLine(0, 12));
+}
+
+TEST_F(LineEditorTest, TabCompleteShowsResultsSoFar) {
+  CompletionPool pool(1, nullptr);
+  le.set_completion_pool(&pool);
+  le.set_completion_budget_ms(200);
+  le.completers()->RegisterFallback(MockCompleterSlow);
+  TypeLetters("hi ab");
+
+  g_completion_gate.Close();
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abxxx ", console.GetLine(0, 9));
+  EXPECT_TRUE(le.IsCompleting());
+
+  // The rest is added to what Tab cycles through, without changing the line.
+  g_completion_gate.Open();
+  pool.WaitForIdle();
+  le.UpdateCompletion();
+  EXPECT_EQ(L"hi abxxx ", console.GetLine(0, 9));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abyyyyy ", console.GetLine(0, 11));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi abxxx   ", console.GetLine(0, 11));
+}
+
+TEST_F(LineEditorTest, TabCompleteDoesntBlock) {
+  CompletionPool pool(1, nullptr);
+  le.set_completion_pool(&pool);
+  le.set_completion_budget_ms(10);
+  le.completers()->RegisterFallback(MockCompleterSilent);
+  TypeLetters("hi ab");
+
+  g_completion_gate.Close();
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi ab ", console.GetLine(0, 6));
+  EXPECT_FALSE(le.IsCompleting());
+  // Nothing yet on another Tab either.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  EXPECT_EQ(L"hi ab ", console.GetLine(0, 6));
+
+  // Then it's shown once it's found.
+  g_completion_gate.Open();
+  pool.WaitForIdle();
+  le.UpdateCompletion();
+  EXPECT_EQ(L"hi abxxx ", console.GetLine(0, 9));
+  EXPECT_EQ(8, console.cursor_x);
+  EXPECT_TRUE(le.IsCompleting());
+}
+
+TEST_F(LineEditorTest, TypingCancelsTabComplete) {
+  CompletionPool pool(1, nullptr);
+  le.set_completion_pool(&pool);
+  le.set_completion_budget_ms(10);
+  le.completers()->RegisterFallback(MockCompleterSilent);
+  TypeLetters("hi ab");
+
+  g_completion_gate.Close();
+  g_completion_cancelled = false;
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, VK_TAB, 0, VK_TAB));
+  TypeLetters("c");
+  EXPECT_EQ(L"hi abc ", console.GetLine(0, 7));
+  pool.WaitForIdle();
+  EXPECT_TRUE(g_completion_cancelled);
+  g_completion_gate.Open();
+  le.UpdateCompletion();
+  EXPECT_EQ(L"hi abc ", console.GetLine(0, 7));
+  EXPECT_FALSE(le.IsCompleting());
+}
+
 TEST_F(LineEditorTest, CommandHistoryUpDown) {
   TypeLetters("abc");
   EXPECT_EQ(
@@ -833,6 +983,104 @@ TEST_F(LineEditorTest, CommandHistoryUpDown) {
   EXPECT_EQ('f', console.GetCharAt(2, 3));
 }
 
+TEST_F(LineEditorTest, CommandHistoryPrefersCurrentDirectory) {
+  ReInit();
+  TypeLetters("abc");
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  wd.Set("c:\\other");
+  ReInit();
+  TypeLetters("def");
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  wd.Set("c:\\some\\stuff");
+  ReInit();
+
+  EXPECT_EQ(
+      LineEditor::kIncomplete,
+      le.HandleKeyEvent(true, false, false, false, VK_UP, 0, VK_UP));
+  EXPECT_EQ(L"abc", console.GetLine(console.cursor_y, 3));
+  EXPECT_EQ(
+      LineEditor::kIncomplete,
+      le.HandleKeyEvent(true, false, false, false, VK_UP, 0, VK_UP));
+  EXPECT_EQ(L"def", console.GetLine(console.cursor_y, 3));
+}
+
+TEST_F(LineEditorTest, CommandRecords) {
+  FakeCommandStatus status;
+  le.set_command_status(&status);
+  ReInit();
+  EXPECT_EQ(0u, cmd_history.records()->size());
+
+  status.time = 1000;
+  status.exit_code = 7;
+  TypeLetters("make");
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  EXPECT_EQ(-1, status.exit_code);
+  status.time = 3500;
+  status.exit_code = 2;
+  wd.Set("c:\\other");
+  ReInit();
+  // Nothing was run in between.
+  ReInit();
+
+  TypeLetters("dir");
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  status.time = 3600;
+  ReInit();
+
+  ASSERT_EQ(2u, cmd_history.records()->size());
+  CommandRecord make = cmd_history.records()->Get(0);
+  EXPECT_EQ(L"make", make.command);
+  EXPECT_EQ(L"c:\\some\\stuff", make.directory);
+  EXPECT_EQ(1000, make.start_time);
+  EXPECT_EQ(2500, make.duration_ms);
+  EXPECT_EQ(2, make.exit_code);
+  CommandRecord dir = cmd_history.records()->Get(1);
+  EXPECT_EQ(L"dir", dir.command);
+  EXPECT_EQ(L"c:\\other", dir.directory);
+  EXPECT_EQ(100, dir.duration_ms);
+  EXPECT_EQ(HistoryRecords::kNoExitCode, dir.exit_code);
+}
+
+TEST_F(LineEditorTest, JumpToDirectory) {
+  DirectoryDatabase database;
+  dir_history.set_database(&database);
+  wd.Set("c:\\src\\chrome\\out");
+  ReInit();
+  wd.Set("c:\\src\\cmdEx");
+  ReInit();
+
+  TypeLetters("z chr out");
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  EXPECT_EQ("c:\\src\\chrome\\out", wd.Get());
+  // cmd only has to show a new prompt, but it's in history as typed.
+  wchar_t buf[256];
+  unsigned long num_chars;
+  le.ToCmdBuffer(buf, sizeof(buf) / sizeof(wchar_t), &num_chars);
+  EXPECT_EQ(buf, wstring(L"\x0d\x0a"));
+  le.Init(&console, &dir_history, &cmd_history);
+  wstring previous;
+  EXPECT_TRUE(cmd_history.MoveInHistory(-1, L"", &previous));
+  EXPECT_EQ(L"z chr out", previous);
+
+  // Without a match, it's left to cmd.
+  TypeLetters("z nothing");
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  le.ToCmdBuffer(buf, sizeof(buf) / sizeof(wchar_t), &num_chars);
+  EXPECT_EQ(buf, wstring(L"z nothing\x0d\x0a"));
+}
+
 TEST_F(LineEditorTest, CommandHistoryCompleteUpDown) {
   TypeLetters("abc");
   EXPECT_EQ(
@@ -940,7 +1188,7 @@ TEST_F(LineEditorTest, CommandHistorySaving) {
 
   vector<wstring> saved = cmd_history.GetListForSaving();
 
-  cmd_history = CommandHistory();
+  cmd_history.Clear();
 
   cmd_history.Populate(saved);
 
@@ -972,6 +1220,197 @@ TEST_F(LineEditorTest, CommandHistorySaving) {
   EXPECT_EQ(' ', console.GetCharAt(4, 4));
 }
 
+TEST_F(LineEditorTest, CtrlRSearch) {
+  cmd_history.AddCommand(L"git status");
+  cmd_history.AddCommand(L"ninja -C out");
+  cmd_history.AddCommand(L"git stash");
+  TypeLetters("dir");
+
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'R'));
+  EXPECT_EQ(L"(reverse-i-search)`': ", console.GetLine(0, 22));
+  TypeLetters("gst");
+  EXPECT_EQ(L"(reverse-i-search)`gst': git stash ",
+            console.GetLine(0, 35));
+  EXPECT_EQ(34, console.cursor_x);
+
+  // Again for the next best.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'R'));
+  EXPECT_EQ(L"(reverse-i-search)`gst': git status", console.GetLine(0, 35));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'R'));
+  EXPECT_EQ(L"(reverse-i-search)`gst': git status", console.GetLine(0, 35));
+
+  TypeLetters("x");
+  EXPECT_EQ(L"(failed reverse-i-search)`gstx': ", console.GetLine(0, 33));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_BACK));
+  EXPECT_EQ(L"(reverse-i-search)`gst': git stash ",
+            console.GetLine(0, 35));
+
+  // Enter runs the match.
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  wchar_t buf[256];
+  unsigned long num_chars;
+  le.ToCmdBuffer(buf, sizeof(buf) / sizeof(wchar_t), &num_chars);
+  EXPECT_EQ(L"git stash\x0d\x0a", wstring(buf, num_chars));
+}
+
+TEST_F(LineEditorTest, CtrlRCancel) {
+  cmd_history.AddCommand(L"git status");
+  TypeLetters("dir");
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_LEFT));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'R'));
+  TypeLetters("gs");
+  EXPECT_EQ(L"(reverse-i-search)`gs': git status", console.GetLine(0, 34));
+
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_ESCAPE));
+  EXPECT_EQ(L"dir                               ", console.GetLine(0, 34));
+  EXPECT_EQ(2, console.cursor_x);
+
+  // Ctrl-G cancels too.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'R'));
+  TypeLetters("gs");
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'G'));
+  EXPECT_EQ(L"dir ", console.GetLine(0, 4));
+}
+
+TEST_F(LineEditorTest, CtrlRAcceptAndEdit) {
+  cmd_history.AddCommand(L"git status");
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, true, false, false, 0, 0, 'R'));
+  TypeLetters("stat");
+  // Any other key accepts the match, and then does what it usually would.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_LEFT));
+  EXPECT_EQ(L"git status ", console.GetLine(0, 11));
+  EXPECT_EQ(9, console.cursor_x);
+  TypeLetters("x");
+  EXPECT_EQ(L"git statuxs ", console.GetLine(0, 12));
+}
+
+TEST_F(LineEditorTest, Autosuggest) {
+  cmd_history.AddCommand(L"git status");
+  cmd_history.AddCommand(L"git diff");
+  cmd_history.AddCommand(L"dir");
+  ReInit();
+
+  TypeLetters("git");
+  EXPECT_EQ(L"git diff ", console.GetLine(0, 9));
+  EXPECT_FALSE(console.IsDimmedAt(2, 0));
+  EXPECT_TRUE(console.IsDimmedAt(3, 0));
+  EXPECT_TRUE(console.IsDimmedAt(7, 0));
+  EXPECT_FALSE(console.IsDimmedAt(8, 0));
+  EXPECT_EQ(3, console.cursor_x);
+
+  // Falls back to an older one once the newest doesn't match.
+  TypeLetters(" s");
+  EXPECT_EQ(L"git status ", console.GetLine(0, 11));
+  EXPECT_TRUE(console.IsDimmedAt(5, 0));
+  TypeLetters("x");
+  EXPECT_EQ(L"git sx     ", console.GetLine(0, 11));
+  EXPECT_FALSE(console.IsDimmedAt(6, 0));
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_BACK));
+  EXPECT_EQ(L"git status ", console.GetLine(0, 11));
+
+  // Only shown with the cursor at the end.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_LEFT));
+  EXPECT_EQ(L"git s      ", console.GetLine(0, 11));
+  EXPECT_EQ(4, console.cursor_x);
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_RIGHT));
+  EXPECT_EQ(L"git status ", console.GetLine(0, 11));
+  EXPECT_EQ(5, console.cursor_x);
+
+  // Right at the end accepts it.
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_RIGHT));
+  EXPECT_EQ(L"git status ", console.GetLine(0, 11));
+  EXPECT_FALSE(console.IsDimmedAt(5, 0));
+  EXPECT_EQ(10, console.cursor_x);
+}
+
+TEST_F(LineEditorTest, AutosuggestEndAccepts) {
+  cmd_history.AddCommand(L"ninja -C out");
+  ReInit();
+  TypeLetters("ni");
+  EXPECT_EQ(LineEditor::kIncomplete,
+            le.HandleKeyEvent(true, false, false, false, 0, 0, VK_END));
+  EXPECT_FALSE(console.IsDimmedAt(2, 0));
+  EXPECT_EQ(12, console.cursor_x);
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  wchar_t buf[256];
+  unsigned long num_chars;
+  le.ToCmdBuffer(buf, sizeof(buf) / sizeof(wchar_t), &num_chars);
+  EXPECT_EQ(L"ninja -C out\x0d\x0a", wstring(buf, num_chars));
+}
+
+TEST_F(LineEditorTest, AutosuggestClearedOnEnter) {
+  cmd_history.AddCommand(L"ninja -C out");
+  ReInit();
+  TypeLetters("ni");
+  EXPECT_TRUE(console.IsDimmedAt(2, 0));
+  EXPECT_EQ(
+      LineEditor::kReturnToCmd,
+      le.HandleKeyEvent(true, false, false, false, VK_RETURN, 0, VK_RETURN));
+  EXPECT_EQ(L"ni          ", console.GetLine(0, 12));
+  EXPECT_FALSE(console.IsDimmedAt(2, 0));
+  wchar_t buf[256];
+  unsigned long num_chars;
+  le.ToCmdBuffer(buf, sizeof(buf) / sizeof(wchar_t), &num_chars);
+  EXPECT_EQ(L"ni\x0d\x0a", wstring(buf, num_chars));
+}
+
+TEST_F(LineEditorTest, DISABLED_PerfAutosuggest) {
+  const int kEntries = 500000;
+  vector<wstring> entries;
+  entries.reserve(kEntries);
+  for (int i = 0; i < kEntries; ++i)
+    entries.push_back(L"cd c:\\src\\p" + to_wstring(i * 7919LL % kEntries));
+  cmd_history.Populate(entries);
+  ReInit();
+
+  PerfTimer timer;
+  TypeLetters("c");
+  printf("first keystroke (builds index): %.1fms\n", timer.ElapsedMs());
+
+  // Typing into a prefix that every entry shares, then narrowing it down to
+  // an old one, then backspacing.
+  const char kTyped[] = "d c:\\src\\p1234";
+  double worst = 0;
+  double total = 0;
+  int keys = 0;
+  for (const char* c = kTyped; *c; ++c) {
+    timer.Restart();
+    TypeLetters(string(1, *c).c_str());
+    double ms = timer.ElapsedMs();
+    worst = max(worst, ms);
+    total += ms;
+    ++keys;
+  }
+  for (int i = 0; i < 4; ++i) {
+    timer.Restart();
+    le.HandleKeyEvent(true, false, false, false, 0, 0, VK_BACK);
+    double ms = timer.ElapsedMs();
+    worst = max(worst, ms);
+    total += ms;
+    ++keys;
+  }
+  printf("per keystroke: worst %.3fms, average %.3fms\n", worst, total / keys);
+}
+
 TEST_F(LineEditorTest, MultilineCompleteOnLastLine) {
   // Add the command we're going to complete later.
   TypeLetters("this line has to be 50 characters or longer, which"  // 50
@@ -0,0 +1,322 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/path_index.h"
+
+#include <wctype.h>
+
+#include <algorithm>
+
+#include "cmdEx/completion.h"
+#include "cmdEx/history_file.h"
+#include "cmdEx/string_util.h"
+#include "common/util.h"
+
+namespace {
+
+const uint32_t kMagic = 0x49505843;  // "CXPI".
+const uint32_t kVersion = 1;
+
+bool StartsWithIgnoringCase(const wstring& str, const wstring& prefix) {
+  if (str.size() < prefix.size())
+    return false;
+  for (size_t i = 0; i < prefix.size(); ++i) {
+    if (str[i] != prefix[i] && towlower(str[i]) != towlower(prefix[i]))
+      return false;
+  }
+  return true;
+}
+
+bool EndsWithIgnoringCase(const wstring& str, const wstring& suffix) {
+  if (str.size() < suffix.size())
+    return false;
+  return StartsWithIgnoringCase(str.substr(str.size() - suffix.size()),
+                                suffix);
+}
+
+// Strings are saved as their size, then their UTF-16LE.
+void PutString(const wstring& str, string* out) {
+  Put32(static_cast<uint32_t>(str.size()), out);
+  AppendUtf16Le(str, out);
+}
+
+bool GetString(const char* data, size_t size, size_t* pos, wstring* str) {
+  if (size - *pos < 4)
+    return false;
+  size_t length = Get32(data + *pos);
+  *pos += 4;
+  if (length > (size - *pos) / 2)
+    return false;
+  str->clear();
+  AppendFromUtf16Le(data + *pos, length * 2, str);
+  *pos += length * 2;
+  return true;
+}
+
+}  // namespace
+
+PathIndex::PathIndex() : listed_count_(0) {}
+
+void PathIndex::Build(FileSystemInterface* file_system,
+                      const wstring& path,
+                      const wstring& path_ext,
+                      const PathIndex* previous) {
+  path_ = path;
+  path_ext_ = path_ext;
+  directories_.clear();
+  listed_count_ = 0;
+  vector<wstring> extensions;
+  for (const auto& extension : StringSplit(path_ext, L';')) {
+    if (!extension.empty())
+      extensions.push_back(extension);
+  }
+  // What was found can only be reused if it was looking for the same
+  // extensions.
+  if (previous && previous->path_ext_ != path_ext)
+    previous = NULL;
+
+  for (const auto& dir : StringSplit(path, L';')) {
+    if (dir.empty())
+      continue;
+    Directory directory;
+    directory.path = dir;
+    // Before it's listed, so that anything that changes while it is makes it
+    // out of date.
+    directory.modified = file_system->GetModifiedTime(dir);
+    const Directory* unchanged = NULL;
+    // Including one that's already been listed, for when PATH has it twice.
+    for (const auto& other : directories_) {
+      if (other.path == dir && other.modified == directory.modified)
+        unchanged = &other;
+    }
+    if (!unchanged && previous) {
+      for (const auto& other : previous->directories_) {
+        if (other.path == dir && other.modified == directory.modified)
+          unchanged = &other;
+      }
+    }
+    if (unchanged) {
+      directory.commands = unchanged->commands;
+    } else if (directory.modified != -1) {
+      ++listed_count_;
+      vector<wstring> names;
+      file_system->ListDirectory(dir, &names, NULL);
+      for (const auto& name : names) {
+        for (const auto& extension : extensions) {
+          if (name.size() > extension.size() &&
+              EndsWithIgnoringCase(name, extension)) {
+            directory.commands.push_back(
+                name.substr(0, name.size() - extension.size()));
+            break;
+          }
+        }
+      }
+    }
+    directories_.push_back(move(directory));
+  }
+  Merge();
+}
+
+bool PathIndex::IsCurrent(FileSystemInterface* file_system) const {
+  for (const auto& directory : directories_) {
+    if (file_system->GetModifiedTime(directory.path) != directory.modified)
+      return false;
+  }
+  return true;
+}
+
+void PathIndex::Find(const wstring& prefix, vector<wstring>* results) const {
+  // Everything that starts with |prefix| sorts after it, and before anything
+  // that doesn't that sorts after it.
+  auto it = lower_bound(commands_.begin(),
+                        commands_.end(),
+                        prefix,
+                        [](const wstring& command, const wstring& prefix) {
+                          return CompareIgnoringCase(command, prefix) < 0;
+                        });
+  for (; it != commands_.end() && StartsWithIgnoringCase(*it, prefix); ++it)
+    results->push_back(*it);
+}
+
+bool PathIndex::Load(const string& path) {
+  MappedFile file;
+  PathIndex loaded;
+  bool ok = file.Open(path) && loaded.Parse(file.data(), file.size());
+  PathIndex empty;
+  *this = ok ? move(loaded) : move(empty);
+  return ok;
+}
+
+bool PathIndex::Save(const string& path) const {
+  return WriteFileAtomically(path, Serialize());
+}
+
+void PathIndex::Merge() {
+  // Each directory's sorted, and then they're merged, which keeps the first
+  // directory's where more than one has the same command.
+  vector<vector<wstring>> streams;
+  for (const auto& directory : directories_) {
+    streams.push_back(directory.commands);
+    SortCompletions(&streams.back());
+  }
+  MergeCompletions(&streams, &commands_);
+}
+
+// The file is a header (magic, version), PATH, PATHEXT, the number of
+// directories, and then each directory as its path, modification time, the
+// number of commands in it and the commands, all little-endian.
+bool PathIndex::Parse(const char* data, size_t size) {
+  if (size < 8 || Get32(data) != kMagic || Get32(data + 4) != kVersion)
+    return false;
+  size_t pos = 8;
+  if (!GetString(data, size, &pos, &path_) ||
+      !GetString(data, size, &pos, &path_ext_) || size - pos < 4) {
+    return false;
+  }
+  size_t count = Get32(data + pos);
+  pos += 4;
+  for (size_t i = 0; i < count; ++i) {
+    Directory directory;
+    if (!GetString(data, size, &pos, &directory.path) || size - pos < 12)
+      return false;
+    directory.modified = static_cast<int64_t>(Get64(data + pos));
+    size_t commands = Get32(data + pos + 8);
+    pos += 12;
+    // Each takes at least its size.
+    if (commands > (size - pos) / 4)
+      return false;
+    directory.commands.resize(commands);
+    for (auto& command : directory.commands) {
+      if (!GetString(data, size, &pos, &command))
+        return false;
+    }
+    directories_.push_back(move(directory));
+  }
+  Merge();
+  return true;
+}
+
+string PathIndex::Serialize() const {
+  string contents;
+  Put32(kMagic, &contents);
+  Put32(kVersion, &contents);
+  PutString(path_, &contents);
+  PutString(path_ext_, &contents);
+  Put32(static_cast<uint32_t>(directories_.size()), &contents);
+  for (const auto& directory : directories_) {
+    PutString(directory.path, &contents);
+    Put64(static_cast<uint64_t>(directory.modified), &contents);
+    Put32(static_cast<uint32_t>(directory.commands.size()), &contents);
+    for (const auto& command : directory.commands)
+      PutString(command, &contents);
+  }
+  return contents;
+}
+
+PathIndexer::PathIndexer(FileSystemInterface* file_system,
+                         const string& save_path)
+    : file_system_(file_system),
+      save_path_(save_path),
+      rebuild_pending_(false),
+      save_pending_(false),
+      busy_(false),
+      stopping_(false) {}
+
+PathIndexer::~PathIndexer() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  if (thread_.joinable())
+    thread_.join();
+}
+
+bool PathIndexer::Load() {
+  shared_ptr<PathIndex> loaded(new PathIndex);
+  if (save_path_.empty() || !loaded->Load(save_path_))
+    return false;
+  lock_guard<mutex> lock(mutex_);
+  index_ = loaded;
+  return true;
+}
+
+shared_ptr<const PathIndex> PathIndexer::Get(const wstring& path,
+                                             const wstring& path_ext) {
+  shared_ptr<const PathIndex> index;
+  {
+    lock_guard<mutex> lock(mutex_);
+    index = index_;
+  }
+  if (index && index->path() == path && index->path_ext() == path_ext) {
+    if (!index->IsCurrent(file_system_)) {
+      lock_guard<mutex> lock(mutex_);
+      Schedule(true);
+    }
+    return index;
+  }
+
+  // Nothing to show in the meantime, so it's built now, but it can still
+  // reuse what's unchanged (e.g. when a directory's been added to PATH).
+  shared_ptr<PathIndex> built(new PathIndex);
+  built->Build(file_system_, path, path_ext, index.get());
+  lock_guard<mutex> lock(mutex_);
+  index_ = built;
+  Schedule(false);
+  return built;
+}
+
+void PathIndexer::WaitForIdle() {
+  unique_lock<mutex> lock(mutex_);
+  idle_.wait(lock, [this] {
+    return !rebuild_pending_ && !save_pending_ && !busy_;
+  });
+}
+
+void PathIndexer::Schedule(bool rebuild) {
+  if (rebuild)
+    rebuild_pending_ = true;
+  else if (!save_path_.empty())
+    save_pending_ = true;
+  else
+    return;
+  if (!thread_.joinable())
+    thread_ = thread(&PathIndexer::Run, this);
+  wake_.notify_one();
+}
+
+void PathIndexer::Run() {
+  unique_lock<mutex> lock(mutex_);
+  for (;;) {
+    wake_.wait(lock, [this] {
+      return stopping_ || rebuild_pending_ || save_pending_;
+    });
+    if (stopping_)
+      return;
+    bool rebuild = rebuild_pending_;
+    rebuild_pending_ = false;
+    save_pending_ = false;
+    busy_ = true;
+    shared_ptr<const PathIndex> index = index_;
+    lock.unlock();
+
+    if (rebuild) {
+      shared_ptr<PathIndex> rebuilt(new PathIndex);
+      rebuilt->Build(
+          file_system_, index->path(), index->path_ext(), index.get());
+      lock.lock();
+      // Unless it's been replaced by one for another PATH meanwhile.
+      if (index_ == index)
+        index_ = rebuilt;
+      index = index_;
+      lock.unlock();
+    }
+    if (!save_path_.empty() && !index->Save(save_path_))
+      Log("couldn't save path index");
+
+    lock.lock();
+    busy_ = false;
+    idle_.notify_all();
+  }
+}
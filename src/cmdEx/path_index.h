@@ -0,0 +1,131 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_PATH_INDEX_H_
+#define CMDEX_PATH_INDEX_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/file_system.h"
+
+// The commands in PATH: the files in its directories that have one of
+// PATHEXT's extensions, without the extension, as they're typed. Each
+// directory is listed once, rather than searched once per extension, and
+// the commands are kept sorted ignoring case, without duplicates (the
+// first directory's wins, as it's the one cmd runs), so that finding those
+// that start with a prefix is a binary search.
+//
+// What each directory had in it is kept too, with its modification time,
+// so that building it again after some have changed only lists those.
+class PathIndex {
+ public:
+  PathIndex();
+
+  // Indexes |path| and |path_ext| (the variables' values), reusing what
+  // |previous|, which can be NULL, found in directories that haven't been
+  // modified since.
+  void Build(FileSystemInterface* file_system,
+             const wstring& path,
+             const wstring& path_ext,
+             const PathIndex* previous);
+
+  // What this was built for.
+  const wstring& path() const { return path_; }
+  const wstring& path_ext() const { return path_ext_; }
+  // Whether none of the directories has been modified since this was built.
+  bool IsCurrent(FileSystemInterface* file_system) const;
+
+  // Appends the commands that start with |prefix|, ignoring case, to
+  // |results|, in order.
+  void Find(const wstring& prefix, vector<wstring>* results) const;
+
+  size_t size() const { return commands_.size(); }
+  // The |i|th command in sorted order, e.g. for fuzzy matching.
+  const wstring& command(size_t i) const { return commands_[i]; }
+  // How many directories were listed by the last Build().
+  int listed_count() const { return listed_count_; }
+
+  // Replaces everything with what's in |path|. Returns false if it couldn't
+  // be read, leaving this empty.
+  bool Load(const string& path);
+  bool Save(const string& path) const;
+
+ private:
+  struct Directory {
+    wstring path;
+    int64_t modified;
+    vector<wstring> commands;
+  };
+
+  bool Parse(const char* data, size_t size);
+  string Serialize() const;
+  // Fills commands_ from directories_.
+  void Merge();
+
+  wstring path_;
+  wstring path_ext_;
+  vector<Directory> directories_;
+  vector<wstring> commands_;
+  int listed_count_;
+};
+
+// Keeps a PathIndex for the current PATH and PATHEXT up to date, and saved,
+// so that a new shell starts with one. An index that's only out of date
+// because some of its directories have changed is still used while it's
+// rebuilt on a background thread; otherwise (at first, or after PATH has
+// been changed), one's built as it's asked for. Can be used from more than
+// one thread at once.
+class PathIndexer {
+ public:
+  // Doesn't save if |save_path| is empty.
+  PathIndexer(FileSystemInterface* file_system, const string& save_path);
+  // Waits for a rebuild that's running, if any.
+  ~PathIndexer();
+
+  // Starts with what was saved. Returns false if it couldn't be read.
+  bool Load();
+
+  // The index for |path| and |path_ext|.
+  shared_ptr<const PathIndex> Get(const wstring& path,
+                                  const wstring& path_ext);
+
+  // Blocks until there's no rebuilding or saving to do, for tests.
+  void WaitForIdle();
+
+ private:
+  PathIndexer(const PathIndexer&);
+  void operator=(const PathIndexer&);
+
+  // Has the thread save index_, and rebuild it first if |rebuild|. Needs
+  // mutex_.
+  void Schedule(bool rebuild);
+  void Run();
+
+  FileSystemInterface* file_system_;
+  string save_path_;
+
+  // Guards everything below.
+  mutex mutex_;
+  // Signalled when there's something for the thread to do.
+  condition_variable wake_;
+  // Signalled when it's done it.
+  condition_variable idle_;
+  // Started the first time there's something for it to do.
+  thread thread_;
+  shared_ptr<const PathIndex> index_;
+  bool rebuild_pending_;
+  bool save_pending_;
+  bool busy_;
+  bool stopping_;
+};
+
+#endif  // CMDEX_PATH_INDEX_H_
@@ -0,0 +1,260 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/path_index.h"
+
+#include <algorithm>
+
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/test_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const wchar_t kPathExt[] = L".COM;.EXE;.BAT";
+
+vector<wstring> Find(const PathIndex& index, const wchar_t* prefix) {
+  vector<wstring> results;
+  index.Find(prefix, &results);
+  return results;
+}
+
+vector<wstring> Words(const wchar_t* words) {
+  vector<wstring> result;
+  for (const auto& word : StringSplit(words, L' ')) {
+    if (!word.empty())
+      result.push_back(word);
+  }
+  return result;
+}
+
+void AddFiles(FakeFileSystem* file_system) {
+  file_system->AddFile(L"C:\\bin", L"git.exe");
+  file_system->AddFile(L"C:\\bin", L"gitk.EXE");
+  file_system->AddFile(L"C:\\bin", L"readme.txt");
+  file_system->AddFile(L"C:\\bin", L"Notepad.exe");
+  file_system->AddFile(L"C:\\tools", L"Git.bat");
+  file_system->AddFile(L"C:\\tools", L"cl.exe");
+  file_system->AddFile(L"C:\\tools", L"cmake.com");
+}
+
+TEST(PathIndexTest, Find) {
+  FakeFileSystem file_system;
+  AddFiles(&file_system);
+  PathIndex index;
+  index.Build(
+      &file_system, L"C:\\bin;;C:\\missing;C:\\tools", kPathExt, NULL);
+  EXPECT_EQ(2, index.listed_count());
+  // Sorted ignoring case, without the extensions, and only the first of
+  // those that are the same but for case.
+  EXPECT_EQ(Words(L"cl cmake git gitk Notepad"), Find(index, L""));
+  EXPECT_EQ(Words(L"git gitk"), Find(index, L"GIT"));
+  EXPECT_EQ(Words(L"cl cmake"), Find(index, L"c"));
+  EXPECT_EQ(Words(L"Notepad"), Find(index, L"notepad"));
+  EXPECT_TRUE(Find(index, L"notepad2").empty());
+  EXPECT_TRUE(Find(index, L"readme").empty());
+  EXPECT_TRUE(Find(index, L"z").empty());
+
+  // The first directory's wins.
+  index.Build(&file_system, L"C:\\tools;C:\\bin", kPathExt, NULL);
+  EXPECT_EQ(Words(L"cl cmake Git gitk Notepad"), Find(index, L""));
+}
+
+TEST(PathIndexTest, Rebuild) {
+  FakeFileSystem file_system;
+  AddFiles(&file_system);
+  const wchar_t kPath[] = L"C:\\bin;C:\\tools;C:\\bin";
+  PathIndex index;
+  index.Build(&file_system, kPath, kPathExt, NULL);
+  // Once, even though it's in PATH twice.
+  EXPECT_EQ(2, index.listed_count());
+  EXPECT_TRUE(index.IsCurrent(&file_system));
+
+  file_system.AddFile(L"C:\\tools", L"ninja.exe");
+  EXPECT_FALSE(index.IsCurrent(&file_system));
+  PathIndex rebuilt;
+  rebuilt.Build(&file_system, kPath, kPathExt, &index);
+  EXPECT_EQ(1, rebuilt.listed_count());
+  EXPECT_TRUE(rebuilt.IsCurrent(&file_system));
+  EXPECT_EQ(Words(L"ninja Notepad"), Find(rebuilt, L"n"));
+
+  // Nothing's reused when looking for other extensions.
+  PathIndex other;
+  other.Build(&file_system, kPath, L".TXT", &rebuilt);
+  EXPECT_EQ(2, other.listed_count());
+  EXPECT_EQ(Words(L"readme"), Find(other, L""));
+
+  // Nor is a directory that didn't exist, once it does.
+  file_system.AddFile(L"C:\\new", L"new.exe");
+  other.Build(&file_system, L"C:\\new", kPathExt, &rebuilt);
+  EXPECT_EQ(1, other.listed_count());
+  EXPECT_EQ(Words(L"new"), Find(other, L""));
+}
+
+TEST(PathIndexTest, SaveAndLoad) {
+  ScopedTempPath path("path_index");
+  FakeFileSystem file_system;
+  AddFiles(&file_system);
+  PathIndex index;
+  index.Build(&file_system, L"C:\\bin;C:\\tools", kPathExt, NULL);
+  ASSERT_TRUE(index.Save(path.path()));
+
+  PathIndex loaded;
+  ASSERT_TRUE(loaded.Load(path.path()));
+  EXPECT_EQ(L"C:\\bin;C:\\tools", loaded.path());
+  EXPECT_EQ(kPathExt, loaded.path_ext());
+  EXPECT_EQ(Find(index, L""), Find(loaded, L""));
+  EXPECT_TRUE(loaded.IsCurrent(&file_system));
+  PathIndex rebuilt;
+  rebuilt.Build(&file_system, loaded.path(), kPathExt, &loaded);
+  EXPECT_EQ(0, rebuilt.listed_count());
+
+  FILE* f = fopen(path.path().c_str(), "wb");
+  ASSERT_TRUE(f);
+  fputs("CXPI but not really", f);
+  fclose(f);
+  EXPECT_FALSE(loaded.Load(path.path()));
+  EXPECT_EQ(0u, loaded.size());
+  EXPECT_TRUE(loaded.path().empty());
+}
+
+TEST(PathIndexerTest, RefreshesInBackground) {
+  ScopedTempPath path("path_indexer");
+  FakeFileSystem file_system;
+  AddFiles(&file_system);
+  const wchar_t kPath[] = L"C:\\bin;C:\\tools";
+  {
+    PathIndexer indexer(&file_system, path.path());
+    EXPECT_FALSE(indexer.Load());
+    shared_ptr<const PathIndex> index = indexer.Get(kPath, kPathExt);
+    EXPECT_EQ(5u, index->size());
+    EXPECT_EQ(2, file_system.list_count());
+    EXPECT_EQ(index, indexer.Get(kPath, kPathExt));
+    EXPECT_EQ(2, file_system.list_count());
+
+    // What's there is used until it's been rebuilt.
+    file_system.AddFile(L"C:\\tools", L"ninja.exe");
+    EXPECT_EQ(index, indexer.Get(kPath, kPathExt));
+    indexer.WaitForIdle();
+    EXPECT_EQ(3, file_system.list_count());
+    index = indexer.Get(kPath, kPathExt);
+    EXPECT_EQ(6u, index->size());
+  }
+
+  // A new one starts with what was saved.
+  PathIndexer indexer(&file_system, path.path());
+  EXPECT_TRUE(indexer.Load());
+  EXPECT_EQ(6u, indexer.Get(kPath, kPathExt)->size());
+  EXPECT_EQ(3, file_system.list_count());
+
+  // And only lists a directory that's been added to PATH.
+  file_system.AddFile(L"C:\\new", L"new.exe");
+  shared_ptr<const PathIndex> index =
+      indexer.Get(L"C:\\new;C:\\bin;C:\\tools", kPathExt);
+  EXPECT_EQ(7u, index->size());
+  EXPECT_EQ(4, file_system.list_count());
+  indexer.WaitForIdle();
+}
+
+TEST(PathIndexTest, RealFileSystem) {
+  ScopedTempDirectory dir("path_index_dir");
+  ASSERT_TRUE(MakeDirectory(dir.path()));
+  ASSERT_TRUE(MakeFile(dir.path() + kPathSeparator + "tool.exe"));
+  ASSERT_TRUE(MakeFile(dir.path() + kPathSeparator + "tool.txt"));
+
+  RealFileSystem file_system;
+  vector<wstring> names;
+  vector<bool> is_directory;
+  ASSERT_TRUE(MakeDirectory(dir.path() + kPathSeparator + "sub"));
+  ASSERT_TRUE(
+      file_system.ListDirectory(Widen(dir.path()), &names, &is_directory));
+  ASSERT_EQ(3u, names.size());
+  ASSERT_EQ(3u, is_directory.size());
+  for (size_t i = 0; i < names.size(); ++i)
+    EXPECT_EQ(names[i] == L"sub", is_directory[i]);
+  sort(names.begin(), names.end());
+  EXPECT_EQ(Words(L"sub tool.exe tool.txt"), names);
+  EXPECT_NE(-1, file_system.GetModifiedTime(Widen(dir.path())));
+  EXPECT_FALSE(file_system.ListDirectory(
+      Widen(dir.path() + "_missing"), &names, NULL));
+  EXPECT_EQ(-1, file_system.GetModifiedTime(Widen(dir.path() + "_missing")));
+
+  PathIndex index;
+  index.Build(&file_system, Widen(dir.path()), kPathExt, NULL);
+  EXPECT_EQ(Words(L"tool"), Find(index, L"t"));
+}
+
+TEST(PathIndexTest, DISABLED_PerfPathIndex) {
+  // About what a well-stocked PATH and PATHEXT have.
+  const int kDirectories = 40;
+  const int kFilesPerDirectory = 500;
+  const wchar_t kManyExts[] =
+      L".COM;.EXE;.BAT;.CMD;.VBS;.VBE;.JS;.JSE;.WSF;.WSH;.MSC;.PY";
+  vector<unique_ptr<ScopedTempDirectory>> dirs;
+  wstring path;
+  for (int i = 0; i < kDirectories; ++i) {
+    dirs.push_back(unique_ptr<ScopedTempDirectory>(
+        new ScopedTempDirectory("path_perf_" + to_string(i))));
+    const string& dir = dirs.back()->path();
+    ASSERT_TRUE(MakeDirectory(dir));
+    for (int j = 0; j < kFilesPerDirectory; ++j) {
+      const char* ext = j % 3 == 0 ? ".exe" : j % 3 == 1 ? ".dll" : ".bat";
+      ASSERT_TRUE(MakeFile(dir + kPathSeparator + "tool" + to_string(i) + "_" +
+                           to_string(j) + ext));
+    }
+    path += (i ? L";" : L"") + Widen(dir);
+  }
+
+  RealFileSystem file_system;
+  vector<wstring> exts = StringSplit(kManyExts, L';');
+  PerfTimer timer;
+  // As it was: every directory listed once per extension.
+  size_t found = 0;
+  for (const auto& dir : StringSplit(path, L';')) {
+    for (const auto& ext : exts) {
+      vector<wstring> names;
+      file_system.ListDirectory(dir, &names, NULL);
+      for (const auto& name : names) {
+        if (name.size() > ext.size() &&
+            CompareIgnoringCase(name.substr(name.size() - ext.size()), ext) ==
+                0)
+          ++found;
+      }
+    }
+  }
+  double scan_ms = timer.ElapsedMs();
+
+  timer.Restart();
+  PathIndex index;
+  index.Build(&file_system, path, kManyExts, NULL);
+  double build_ms = timer.ElapsedMs();
+  EXPECT_EQ(found, index.size());
+
+  timer.Restart();
+  bool current = index.IsCurrent(&file_system);
+  double check_ms = timer.ElapsedMs();
+  EXPECT_TRUE(current);
+
+  const int kLookups = 1000;
+  timer.Restart();
+  size_t results = 0;
+  for (int i = 0; i < kLookups; ++i) {
+    vector<wstring> matches;
+    index.Find(L"tool" + to_wstring(i % kDirectories) + L"_1", &matches);
+    results += matches.size();
+  }
+  double find_ms = timer.ElapsedMs();
+  EXPECT_GT(results, 0u);
+
+  printf("%d directories x %d files: scan per extension %.1fms, build "
+         "%.1fms, check %.2fms, find %.1fus\n",
+         kDirectories,
+         kFilesPerDirectory,
+         scan_ms,
+         build_ms,
+         check_ms,
+         find_ms * 1000 / kLookups);
+}
+
+}  // namespace
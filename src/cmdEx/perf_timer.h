@@ -0,0 +1,36 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_PERF_TIMER_H_
+#define CMDEX_PERF_TIMER_H_
+
+#include <chrono>
+
+// Wall clock stopwatch for the DISABLED_Perf* benchmarks in the tests. They
+// don't run by default; use:
+//   out\tests --gtest_also_run_disabled_tests --gtest_filter=*Perf*
+// Budgets that the benchmarks check their timings against only mean anything
+// in an optimized build.
+#if defined(NDEBUG)
+const bool kCheckPerfBudgets = true;
+#else
+const bool kCheckPerfBudgets = false;
+#endif
+
+class PerfTimer {
+ public:
+  PerfTimer() : start_(std::chrono::steady_clock::now()) {}
+
+  void Restart() { start_ = std::chrono::steady_clock::now(); }
+
+  double ElapsedMs() const {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start_).count();
+  }
+
+ private:
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif  // CMDEX_PERF_TIMER_H_
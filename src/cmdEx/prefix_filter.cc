@@ -0,0 +1,201 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/prefix_filter.h"
+
+#include <wchar.h>
+#include <wctype.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define CMDEX_PREFIX_FILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "cmdEx/fuzzy_match.h"
+#include "common/util.h"
+
+namespace {
+
+// How many characters fit in a vector. wchar_t is 16 bits on Windows, and
+// usually 32 elsewhere.
+const size_t kLanes = 16 / sizeof(wchar_t);
+
+bool StartsWith(const wchar_t* candidate,
+                const wstring& prefix,
+                bool ignore_case) {
+  for (size_t i = 0; i < prefix.size(); ++i) {
+    if (candidate[i] != prefix[i] &&
+        (!ignore_case || towlower(candidate[i]) != towlower(prefix[i])))
+      return false;
+  }
+  return true;
+}
+
+#if defined(CMDEX_PREFIX_FILTER_SSE2)
+
+bool IsAscii(const wstring& str) {
+  for (const auto& ch : str) {
+    if (static_cast<uint32_t>(ch) >= 0x80)
+      return false;
+  }
+  return true;
+}
+
+#if WCHAR_MAX <= 0xffff
+__m128i Splat(wchar_t ch) {
+  return _mm_set1_epi16(static_cast<short>(ch));
+}
+__m128i Equal(__m128i a, __m128i b) {
+  return _mm_cmpeq_epi16(a, b);
+}
+__m128i Greater(__m128i a, __m128i b) {
+  return _mm_cmpgt_epi16(a, b);
+}
+#else
+__m128i Splat(wchar_t ch) {
+  return _mm_set1_epi32(static_cast<int>(ch));
+}
+__m128i Equal(__m128i a, __m128i b) {
+  return _mm_cmpeq_epi32(a, b);
+}
+__m128i Greater(__m128i a, __m128i b) {
+  return _mm_cmpgt_epi32(a, b);
+}
+#endif
+
+__m128i Load(const wchar_t* chars) {
+  return _mm_loadu_si128(reinterpret_cast<const __m128i*>(chars));
+}
+
+// Bits of _mm_movemask_epi8() for the first |lanes| characters.
+int LaneMask(size_t lanes) {
+  return (1 << (lanes * sizeof(wchar_t))) - 1;
+}
+
+void FindByPrefixSse2(const PackedCandidates& candidates,
+                      const wstring& prefix,
+                      bool ignore_case,
+                      vector<uint32_t>* matches) {
+  // |prefix| is ASCII if |ignore_case|, so folding it is only lowering A-Z,
+  // and then candidates only need the same done to them.
+  wstring folded(prefix);
+  if (ignore_case) {
+    for (auto& ch : folded) {
+      if (ch >= L'A' && ch <= L'Z')
+        ch = static_cast<wchar_t>(ch - L'A' + L'a');
+    }
+  }
+  const size_t chunks = (prefix.size() + kLanes - 1) / kLanes;
+  folded.resize(chunks * kLanes, L'\0');
+  const int last_mask = LaneMask(prefix.size() - (chunks - 1) * kLanes);
+  const __m128i before_upper = Splat(static_cast<wchar_t>(L'A' - 1));
+  const __m128i after_upper = Splat(static_cast<wchar_t>(L'Z' + 1));
+  const __m128i case_bit = Splat(0x20);
+  const __m128i non_ascii = Splat(static_cast<wchar_t>(~0x7f));
+  const __m128i zero = _mm_setzero_si128();
+
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (candidates.length(i) < prefix.size())
+      continue;
+    const wchar_t* candidate = candidates.data(i);
+    bool match = true;
+    for (size_t chunk = 0; chunk < chunks && match; ++chunk) {
+      const int mask = chunk == chunks - 1 ? last_mask : LaneMask(kLanes);
+      __m128i chars = Load(candidate + chunk * kLanes);
+      if (ignore_case) {
+        __m128i upper = _mm_and_si128(Greater(chars, before_upper),
+                                      Greater(after_upper, chars));
+        chars = _mm_or_si128(chars, _mm_and_si128(upper, case_bit));
+      }
+      __m128i equal = Equal(chars, Load(folded.data() + chunk * kLanes));
+      if ((_mm_movemask_epi8(equal) & mask) == mask)
+        continue;
+      match = false;
+      if (ignore_case) {
+        // Something other than ASCII might still fold to the same.
+        __m128i ascii = Equal(_mm_and_si128(chars, non_ascii), zero);
+        if ((_mm_movemask_epi8(ascii) & mask) != mask)
+          match = StartsWith(candidate, prefix, true);
+        break;
+      }
+    }
+    if (match)
+      matches->push_back(static_cast<uint32_t>(i));
+  }
+}
+
+#endif
+
+}  // namespace
+
+PackedCandidates::PackedCandidates()
+    : chars_(kLanes, L'\0'), folded_(kLanes, '\0'), offsets_(1, 0) {}
+
+PackedCandidates::PackedCandidates(const vector<wstring>& candidates)
+    : offsets_(1, 0) {
+  size_t total = 0;
+  for (const auto& candidate : candidates)
+    total += candidate.size();
+  chars_.reserve(total + kLanes);
+  folded_.reserve(total + kLanes);
+  offsets_.reserve(candidates.size() + 1);
+  signatures_.reserve(candidates.size());
+  chars_.append(kLanes, L'\0');
+  folded_.append(kLanes, '\0');
+  for (const auto& candidate : candidates)
+    Add(candidate);
+}
+
+PackedCandidates::PackedCandidates(const wchar_t* const candidates[],
+                                   size_t count)
+    : chars_(kLanes, L'\0'), folded_(kLanes, '\0'), offsets_(1, 0) {
+  for (size_t i = 0; i < count; ++i)
+    Add(candidates[i], wcslen(candidates[i]));
+}
+
+void PackedCandidates::Add(const wchar_t* candidate, size_t length) {
+  chars_.resize(offsets_.back());
+  chars_.append(candidate, length);
+  CHECK(chars_.size() <= UINT32_MAX);
+  folded_.resize(offsets_.back());
+  for (size_t i = 0; i < length; ++i)
+    folded_.push_back(FoldChar(candidate[i]));
+  offsets_.push_back(static_cast<uint32_t>(chars_.size()));
+  chars_.append(kLanes, L'\0');
+  folded_.append(kLanes, '\0');
+  signatures_.push_back(CharSignature(WStringPiece(candidate, length)));
+}
+
+void FindByPrefix(const PackedCandidates& candidates,
+                  const wstring& prefix,
+                  bool ignore_case,
+                  vector<uint32_t>* matches) {
+  if (prefix.empty()) {
+    for (size_t i = 0; i < candidates.size(); ++i)
+      matches->push_back(static_cast<uint32_t>(i));
+    return;
+  }
+#if defined(CMDEX_PREFIX_FILTER_SSE2)
+  if (!ignore_case || IsAscii(prefix)) {
+    FindByPrefixSse2(candidates, prefix, ignore_case, matches);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < candidates.size(); ++i) {
+    if (candidates.length(i) >= prefix.size() &&
+        StartsWith(candidates.data(i), prefix, ignore_case)) {
+      matches->push_back(static_cast<uint32_t>(i));
+    }
+  }
+}
+
+void FilterCompletions(const PackedCandidates& candidates,
+                       const wstring& prefix,
+                       bool ignore_case,
+                       vector<wstring>* results) {
+  vector<uint32_t> matches;
+  FindByPrefix(candidates, prefix, ignore_case, &matches);
+  for (const auto& i : matches)
+    results->push_back(candidates.Get(i));
+}
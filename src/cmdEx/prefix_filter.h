@@ -0,0 +1,66 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_PREFIX_FILTER_H_
+#define CMDEX_PREFIX_FILTER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+// Completion candidates kept one after the other in one block, rather than
+// each in a string of its own, so that FindByPrefix() can go through them
+// without chasing pointers, and compare several characters at a time.
+//
+// For fuzzy matching, each also has its CharSignature(), so that those
+// lacking some of a query's characters are passed over without being looked
+// at, and a FoldChar() copy, a byte per character, so that the rest can be
+// searched 16 characters at a time, in less memory than the characters take.
+class PackedCandidates {
+ public:
+  PackedCandidates();
+  explicit PackedCandidates(const vector<wstring>& candidates);
+  PackedCandidates(const wchar_t* const candidates[], size_t count);
+
+  void Add(const wchar_t* candidate, size_t length);
+  void Add(const wstring& candidate) {
+    Add(candidate.data(), candidate.size());
+  }
+
+  size_t size() const { return offsets_.size() - 1; }
+  const wchar_t* data(size_t i) const { return chars_.data() + offsets_[i]; }
+  size_t length(size_t i) const { return offsets_[i + 1] - offsets_[i]; }
+  wstring Get(size_t i) const { return wstring(data(i), length(i)); }
+  uint64_t signature(size_t i) const { return signatures_[i]; }
+  const char* folded(size_t i) const { return folded_.data() + offsets_[i]; }
+
+ private:
+  // Followed by enough nuls that a whole vector can be read from anywhere
+  // in the last candidate.
+  wstring chars_;
+  // At the same offsets as chars_.
+  string folded_;
+  vector<uint32_t> offsets_;
+  vector<uint64_t> signatures_;
+};
+
+// Appends the indices of those of |candidates| that start with |prefix| to
+// |matches|, in order. Ignoring case compares as towlower() does, but ASCII
+// is folded and compared with SSE2 where that's available, and only
+// candidates with other characters where they differ are compared one
+// character at a time.
+void FindByPrefix(const PackedCandidates& candidates,
+                  const wstring& prefix,
+                  bool ignore_case,
+                  vector<uint32_t>* matches);
+
+// As FindByPrefix(), but appends the candidates themselves to |results|.
+void FilterCompletions(const PackedCandidates& candidates,
+                       const wstring& prefix,
+                       bool ignore_case,
+                       vector<wstring>* results);
+
+#endif  // CMDEX_PREFIX_FILTER_H_
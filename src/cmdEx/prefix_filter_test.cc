@@ -0,0 +1,202 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/prefix_filter.h"
+
+#include <stdlib.h>
+
+#include "cmdEx/completion.h"
+#include "cmdEx/perf_timer.h"
+#include "cmdEx/string_util.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+vector<wstring> Words(const wchar_t* words) {
+  vector<wstring> result;
+  for (const auto& word : StringSplit(words, L' ')) {
+    if (!word.empty())
+      result.push_back(word);
+  }
+  return result;
+}
+
+vector<wstring> Filter(const PackedCandidates& candidates,
+                       const wchar_t* prefix,
+                       bool ignore_case) {
+  vector<wstring> results;
+  FilterCompletions(candidates, prefix, ignore_case, &results);
+  return results;
+}
+
+TEST(PrefixFilterTest, Pack) {
+  PackedCandidates empty;
+  EXPECT_EQ(0u, empty.size());
+  vector<uint32_t> matches;
+  FindByPrefix(empty, L"", true, &matches);
+  FindByPrefix(empty, L"a", true, &matches);
+  EXPECT_TRUE(matches.empty());
+
+  const wchar_t* kArray[] = {L"status", L"", L"stash"};
+  PackedCandidates packed(kArray, 3);
+  ASSERT_EQ(3u, packed.size());
+  EXPECT_EQ(L"status", packed.Get(0));
+  EXPECT_EQ(0u, packed.length(1));
+  EXPECT_EQ(L"stash", wstring(packed.data(2), packed.length(2)));
+  packed.Add(wstring(L"show"));
+  EXPECT_EQ(L"show", packed.Get(3));
+  EXPECT_EQ(PackedCandidates(Words(L"a bc")).Get(1), L"bc");
+}
+
+TEST(PrefixFilterTest, FindByPrefix) {
+  PackedCandidates candidates(Words(L"Git gitk git g GIT-lfs notepad"));
+  vector<uint32_t> matches(1, 42);
+  FindByPrefix(candidates, L"git", false, &matches);
+  EXPECT_EQ((vector<uint32_t>{42, 1, 2}), matches);
+
+  EXPECT_EQ(Words(L"gitk git"), Filter(candidates, L"git", false));
+  EXPECT_EQ(Words(L"Git gitk git GIT-lfs"), Filter(candidates, L"gIt", true));
+  EXPECT_EQ(Words(L"GIT-lfs"), Filter(candidates, L"git-", true));
+  EXPECT_EQ(Words(L"Git gitk git g GIT-lfs notepad"),
+            Filter(candidates, L"", false));
+  EXPECT_TRUE(Filter(candidates, L"gitk2", true).empty());
+  EXPECT_TRUE(Filter(candidates, L"x", true).empty());
+  // Only letters are folded.
+  EXPECT_TRUE(Filter(candidates, L"GIT_", true).empty());
+  EXPECT_TRUE(Filter(PackedCandidates(Words(L"[x @x")), L"{", true).empty());
+  EXPECT_TRUE(Filter(PackedCandidates(Words(L"[x @x")), L"`", true).empty());
+}
+
+TEST(PrefixFilterTest, LongPrefixes) {
+  // Longer than a vector, or several, and ending at and either side of the
+  // end of one.
+  PackedCandidates candidates(
+      Words(L"out\\Release\\obj\\chrome\\browser\\ui\\views\\frame.obj "
+            L"OUT\\release\\obj\\chrome\\browser\\ui\\views\\tabs.obj "
+            L"out\\Release\\obj\\chrome\\renderer\\render_thread.obj "
+            L"out\\Release\\gen"));
+  EXPECT_EQ(Words(L"out\\Release\\obj\\chrome\\browser\\ui\\views\\frame.obj "
+                  L"OUT\\release\\obj\\chrome\\browser\\ui\\views\\tabs.obj"),
+            Filter(candidates, L"out\\release\\OBJ\\chrome\\browser\\", true));
+  EXPECT_EQ(Words(L"out\\Release\\obj\\chrome\\browser\\ui\\views\\frame.obj"),
+            Filter(candidates, L"out\\Release\\obj\\chrome\\b", false));
+  for (size_t length = 1; length <= 40; ++length) {
+    wstring prefix =
+        wstring(L"out\\Release\\obj\\chrome\\renderer\\render_thread.obj")
+            .substr(0, length);
+    EXPECT_EQ(length <= 12 ? 4u : length <= 23 ? 3u : 1u,
+              Filter(candidates, prefix.c_str(), true).size())
+        << length;
+  }
+}
+
+TEST(PrefixFilterTest, NotAscii) {
+  PackedCandidates candidates(Words(L"r\u00e9sum\u00e9 R\u00c9SUM\u00c9 "
+                                    L"resume r\u00e9sum\u00e9s"));
+  EXPECT_EQ(Words(L"r\u00e9sum\u00e9 r\u00e9sum\u00e9s"),
+            Filter(candidates, L"r\u00e9", false));
+  EXPECT_EQ(Words(L"resume"), Filter(candidates, L"RES", true));
+  EXPECT_EQ(Words(L"R\u00c9SUM\u00c9"),
+            Filter(candidates, L"R\u00c9", false));
+}
+
+TEST(PrefixFilterTest, SameAsOneAtATime) {
+  // Whatever's packed and however it's matched, it's the same as comparing a
+  // character at a time.
+  srand(1234);
+  const wchar_t kChars[] = L"aAbBzZ@[`{_\\.\u00e9\u00c9K\u212a\u4e2d";
+  const size_t kNumChars = sizeof(kChars) / sizeof(kChars[0]) - 1;
+  auto random_string = [&kChars, kNumChars](int max_length) {
+    wstring str;
+    for (int j = rand() % (max_length + 1); j > 0; --j)
+      str.push_back(kChars[rand() % (rand() % 4 == 0 ? kNumChars : 4)]);
+    return str;
+  };
+  vector<wstring> strings;
+  for (int i = 0; i < 2000; ++i)
+    strings.push_back(random_string(20));
+  PackedCandidates candidates(strings);
+  for (int i = 0; i < 500; ++i) {
+    wstring prefix = random_string(i % 2 ? 3 : 18);
+    for (bool ignore_case : {false, true}) {
+      vector<wstring> expected;
+      FilterCompletions(strings, prefix, ignore_case, &expected);
+      vector<wstring> results;
+      FilterCompletions(candidates, prefix, ignore_case, &results);
+      EXPECT_EQ(expected, results) << i;
+    }
+  }
+}
+
+TEST(PrefixFilterTest, DISABLED_PerfPrefixFilter) {
+  // About what a big build has in targets.
+  const int kTargets = 200000;
+  vector<wstring> targets;
+  for (int i = 0; i < kTargets; ++i) {
+    targets.push_back(L"obj/chrome/browser/ui/views/file" + to_wstring(i) +
+                      (i % 2 ? L".obj" : L".o"));
+  }
+  const wchar_t* kPrefixes[] = {
+      L"obj/Chrome/browser/ui/views/file12", L"OBJ/", L"x", L"obj/chrome/b",
+  };
+  const int kRepeats = 20;
+
+  // As it was: a string made for each candidate, case sensitively.
+  PerfTimer timer;
+  size_t substr_found = 0;
+  for (int i = 0; i < kRepeats; ++i) {
+    const wstring prefix = kPrefixes[i % 4];
+    for (const auto& target : targets) {
+      if (target.substr(0, prefix.size()) == prefix)
+        ++substr_found;
+    }
+  }
+  double substr_ms = timer.ElapsedMs() / kRepeats;
+
+  timer.Restart();
+  size_t scalar_found = 0;
+  for (int i = 0; i < kRepeats; ++i) {
+    vector<wstring> results;
+    FilterCompletions(targets, kPrefixes[i % 4], true, &results);
+    scalar_found += results.size();
+  }
+  double scalar_ms = timer.ElapsedMs() / kRepeats;
+
+  timer.Restart();
+  PackedCandidates packed(targets);
+  double pack_ms = timer.ElapsedMs();
+
+  timer.Restart();
+  size_t found = 0;
+  vector<uint32_t> matches;
+  for (int i = 0; i < kRepeats; ++i) {
+    matches.clear();
+    FindByPrefix(packed, kPrefixes[i % 4], true, &matches);
+    found += matches.size();
+  }
+  double kernel_ms = timer.ElapsedMs() / kRepeats;
+  EXPECT_EQ(scalar_found, found);
+  EXPECT_LT(substr_found, found);
+
+  timer.Restart();
+  size_t exact_found = 0;
+  for (int i = 0; i < kRepeats; ++i) {
+    matches.clear();
+    FindByPrefix(packed, kPrefixes[i % 4], false, &matches);
+    exact_found += matches.size();
+  }
+  double exact_ms = timer.ElapsedMs() / kRepeats;
+  EXPECT_EQ(substr_found, exact_found);
+
+  printf("%d candidates: substr %.2fms, towlower %.2fms, pack %.2fms, "
+         "kernel %.2fms (case sensitive %.2fms)\n",
+         kTargets,
+         substr_ms,
+         scalar_ms,
+         pack_ms,
+         kernel_ms,
+         exact_ms);
+}
+
+}  // namespace
@@ -0,0 +1,425 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/prefix_index.h"
+
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "common/util.h"
+
+namespace {
+
+// Entries newer than the last level are scanned directly until there's at
+// least this many of them.
+const int kMinLevelSize = 64;
+
+int PopCount(uint64_t x) {
+#if defined(_MSC_VER)
+  return static_cast<int>(__popcnt64(x));
+#else
+  return __builtin_popcountll(x);
+#endif
+}
+
+bool StartsWith(const WStringPiece& str, const wstring& prefix) {
+  return ComparePrefix(str.data(), str.size(), prefix.data(), prefix.size()) ==
+         0;
+}
+
+// Characters per SortKey(). Each takes 21 bits, enough for any code point.
+const size_t kKeyChars = 3;
+
+// The characters of |command| from |depth|, packed so that keys compare as
+// the characters do. Each is stored plus one, so that 0 is past the end.
+uint64_t SortKey(const WStringPiece& command, size_t depth) {
+  uint64_t key = 0;
+  for (size_t i = depth; i < depth + kKeyChars; ++i) {
+    uint64_t c = i < command.size() ? static_cast<uint64_t>(command[i]) + 1 : 0;
+    key = (key << 21) | (c & 0x1fffff);
+  }
+  return key;
+}
+
+// Sorts positions [begin, end) by command, then position, as PositionLess.
+// Comparing the commands themselves is a cache miss or two for every one of
+// the N log N comparisons, so instead this sorts by a few characters at a
+// time, as integers held alongside the positions, and then sorts each run
+// that ties on the next few ("MSD radix sort"). Commands are only read once
+// for each time they tie, and runs that all share the next few characters,
+// which long common prefixes make likely, aren't sorted at all.
+void SortByCommand(const EntryList& commands,
+                   int begin,
+                   int end,
+                   vector<int>* sorted) {
+  vector<pair<uint64_t, int>> entries;
+  entries.reserve(end - begin);
+  for (int i = begin; i < end; ++i)
+    entries.push_back(make_pair(0, i));
+  // Runs still to sort, and how many characters their commands share. Every
+  // run is in position order to begin with.
+  struct Run {
+    size_t begin;
+    size_t end;
+    size_t depth;
+  };
+  vector<Run> runs;
+  runs.push_back(Run{0, entries.size(), 0});
+  while (!runs.empty()) {
+    Run run = runs.back();
+    runs.pop_back();
+    uint64_t min_key = UINT64_MAX;
+    uint64_t max_key = 0;
+    for (size_t i = run.begin; i < run.end; ++i) {
+      uint64_t key = SortKey(commands[entries[i].second], run.depth);
+      entries[i].first = key;
+      min_key = min(min_key, key);
+      max_key = max(max_key, key);
+    }
+    if (min_key != max_key) {
+      sort(entries.begin() + run.begin, entries.begin() + run.end);
+    } else if ((min_key & 0x1fffff) == 0) {
+      // All the same command.
+      continue;
+    }
+    for (size_t i = run.begin; i < run.end;) {
+      size_t j = i + 1;
+      while (j < run.end && entries[j].first == entries[i].first)
+        ++j;
+      if (j - i > 1 && (entries[i].first & 0x1fffff) != 0)
+        runs.push_back(Run{i, j, run.depth + kKeyChars});
+      i = j;
+    }
+  }
+  sorted->clear();
+  sorted->reserve(entries.size());
+  for (const auto& entry : entries)
+    sorted->push_back(entry.second);
+}
+
+// Orders by command, then position so that a prefix's positions are sorted
+// within its run.
+struct PositionLess {
+  explicit PositionLess(const EntryList& commands) : commands(commands) {}
+  bool operator()(int a, int b) const {
+    int cmp = commands[a].compare(commands[b]);
+    return cmp < 0 || (cmp == 0 && a < b);
+  }
+  const EntryList& commands;
+};
+
+}  // namespace
+
+int ComparePrefix(const wchar_t* str,
+                  size_t str_size,
+                  const wchar_t* prefix,
+                  size_t prefix_size) {
+  size_t common = min(str_size, prefix_size);
+  for (size_t i = 0; i < common; ++i) {
+    if (str[i] != prefix[i])
+      return str[i] < prefix[i] ? -1 : 1;
+  }
+  return str_size < prefix_size ? -1 : 0;
+}
+
+void WaveletMatrix::BitVector::Clear(size_t size) {
+  // One extra word so that Rank1(size) doesn't need a special case.
+  words.assign(size / 64 + 1, 0);
+}
+
+void WaveletMatrix::BitVector::BuildRanks() {
+  ranks.assign(words.size(), 0);
+  int total = 0;
+  for (size_t i = 0; i < words.size(); ++i) {
+    ranks[i] = total;
+    total += PopCount(words[i]);
+  }
+}
+
+int WaveletMatrix::BitVector::Rank1(int pos) const {
+  int word = pos / 64;
+  int bit = pos % 64;
+  uint64_t mask = (1ull << bit) - 1;
+  return ranks[word] + PopCount(words[word] & mask);
+}
+
+WaveletMatrix::WaveletMatrix() {}
+
+void WaveletMatrix::Build(const vector<int>& values) {
+  int max_value = 0;
+  for (const auto& value : values)
+    max_value = max(max_value, value);
+  int num_planes = 1;
+  while ((max_value >> num_planes) != 0)
+    ++num_planes;
+
+  planes_.resize(num_planes);
+  zeros_.resize(num_planes);
+  vector<int> current(values);
+  vector<int> next(values.size());
+  for (int plane = 0; plane < num_planes; ++plane) {
+    int shift = num_planes - 1 - plane;
+    BitVector& bits = planes_[plane];
+    bits.Clear(current.size());
+    int num_zeros = 0;
+    for (size_t i = 0; i < current.size(); ++i) {
+      uint64_t bit = (current[i] >> shift) & 1;
+      bits.words[i / 64] |= bit << (i % 64);
+      num_zeros += static_cast<int>(bit ^ 1);
+    }
+    bits.BuildRanks();
+    zeros_[plane] = num_zeros;
+    // Stable partition, zeros first, for the next plane.
+    int zero_at = 0;
+    int one_at = num_zeros;
+    for (size_t i = 0; i < current.size(); ++i)
+      next[(current[i] >> shift) & 1 ? one_at++ : zero_at++] = current[i];
+    current.swap(next);
+  }
+}
+
+int WaveletMatrix::CountLess(int begin, int end, int upper) const {
+  int num_planes = static_cast<int>(planes_.size());
+  if (upper <= 0)
+    return 0;
+  if ((upper >> num_planes) != 0)
+    return end - begin;
+  int result = 0;
+  for (int plane = 0; plane < num_planes; ++plane) {
+    int shift = num_planes - 1 - plane;
+    int ones_before_begin = planes_[plane].Rank1(begin);
+    int ones_before_end = planes_[plane].Rank1(end);
+    if ((upper >> shift) & 1) {
+      // Everything with a zero here is smaller than |upper|.
+      result += (end - begin) - (ones_before_end - ones_before_begin);
+      begin = zeros_[plane] + ones_before_begin;
+      end = zeros_[plane] + ones_before_end;
+    } else {
+      begin -= ones_before_begin;
+      end -= ones_before_end;
+    }
+  }
+  return result;
+}
+
+int WaveletMatrix::KthSmallest(int begin, int end, int k) const {
+  int num_planes = static_cast<int>(planes_.size());
+  int result = 0;
+  for (int plane = 0; plane < num_planes; ++plane) {
+    int shift = num_planes - 1 - plane;
+    int ones_before_begin = planes_[plane].Rank1(begin);
+    int ones_before_end = planes_[plane].Rank1(end);
+    int zeros_in_range = (end - begin) - (ones_before_end - ones_before_begin);
+    if (k < zeros_in_range) {
+      begin -= ones_before_begin;
+      end -= ones_before_end;
+    } else {
+      k -= zeros_in_range;
+      result |= 1 << shift;
+      begin = zeros_[plane] + ones_before_begin;
+      end = zeros_[plane] + ones_before_end;
+    }
+  }
+  return result;
+}
+
+PrefixIndex::PrefixIndex()
+    : indexed_first_(0), indexed_end_(0), newest_only_(false) {}
+
+void PrefixIndex::Clear() {
+  levels_.clear();
+  indexed_first_ = 0;
+  indexed_end_ = 0;
+}
+
+void PrefixIndex::set_newest_only(bool newest_only) {
+  CHECK(levels_.empty());
+  newest_only_ = newest_only;
+}
+
+void PrefixIndex::Update(const EntryList& commands) {
+  if (levels_.empty())
+    indexed_first_ = indexed_end_ = commands.first();
+  CHECK(commands.first() <= indexed_first_ && commands.end() >= indexed_end_);
+
+  // Older entries aren't scanned, so they're indexed however few there are.
+  if (commands.first() < indexed_first_) {
+    levels_.insert(levels_.begin(), Level());
+    BuildLevel(commands, commands.first(), indexed_first_, &levels_.front());
+    indexed_first_ = commands.first();
+    // Merge towards the newer levels only while they're of a similar size,
+    // so that sizes rise geometrically from the oldest too.
+    while (levels_.size() >= 2) {
+      int older = levels_[0].end - levels_[0].begin;
+      int newer = levels_[1].end - levels_[1].begin;
+      if (newer > 2 * older || older > 2 * newer)
+        break;
+      MergeLevels(commands, 0);
+    }
+  }
+
+  if (commands.end() - indexed_end_ < kMinLevelSize)
+    return;
+  levels_.push_back(Level());
+  BuildLevel(commands, indexed_end_, commands.end(), &levels_.back());
+  indexed_end_ = commands.end();
+
+  // Keep level sizes decreasing geometrically so there's O(log N) of them.
+  while (levels_.size() >= 2) {
+    const Level& older = levels_[levels_.size() - 2];
+    const Level& newer = levels_.back();
+    if (older.end - older.begin > 2 * (newer.end - newer.begin))
+      break;
+    MergeLevels(commands, levels_.size() - 2);
+  }
+}
+
+void PrefixIndex::BuildLevel(const EntryList& commands,
+                             int begin,
+                             int end,
+                             Level* level) const {
+  level->begin = begin;
+  level->end = end;
+  SortByCommand(commands, begin, end, &level->sorted);
+  DropOlderCopies(commands, &level->sorted);
+  BuildPositions(level);
+}
+
+void PrefixIndex::BuildPositions(Level* level) const {
+  vector<int> relative(level->sorted.size());
+  for (size_t i = 0; i < level->sorted.size(); ++i)
+    relative[i] = level->sorted[i] - level->begin;
+  level->positions.Build(relative);
+}
+
+void PrefixIndex::MergeLevels(const EntryList& commands, size_t i) {
+  Level& older = levels_[i];
+  Level& newer = levels_[i + 1];
+  vector<int> merged(older.sorted.size() + newer.sorted.size());
+  merge(older.sorted.begin(),
+        older.sorted.end(),
+        newer.sorted.begin(),
+        newer.sorted.end(),
+        merged.begin(),
+        PositionLess(commands));
+  DropOlderCopies(commands, &merged);
+  older.end = newer.end;
+  older.sorted.swap(merged);
+  BuildPositions(&older);
+  levels_.erase(levels_.begin() + i + 1);
+}
+
+void PrefixIndex::DropOlderCopies(const EntryList& commands,
+                                  vector<int>* sorted) const {
+  if (!newest_only_ || sorted->empty())
+    return;
+  size_t kept = 0;
+  for (size_t i = 0; i + 1 < sorted->size(); ++i) {
+    if (!(commands[(*sorted)[i]] == commands[(*sorted)[i + 1]]))
+      (*sorted)[kept++] = (*sorted)[i];
+  }
+  (*sorted)[kept++] = sorted->back();
+  sorted->resize(kept);
+}
+
+void PrefixIndex::EqualRange(const EntryList& commands,
+                             const Level& level,
+                             const wstring& prefix,
+                             int* first,
+                             int* last) const {
+  int lo = 0;
+  int hi = static_cast<int>(level.sorted.size());
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const WStringPiece& command = commands[level.sorted[mid]];
+    if (ComparePrefix(command.data(),
+                      command.size(),
+                      prefix.data(),
+                      prefix.size()) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *first = lo;
+  hi = static_cast<int>(level.sorted.size());
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const WStringPiece& command = commands[level.sorted[mid]];
+    if (ComparePrefix(command.data(),
+                      command.size(),
+                      prefix.data(),
+                      prefix.size()) <= 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *last = lo;
+}
+
+int PrefixIndex::FindLast(const EntryList& commands,
+                          const wstring& prefix,
+                          int lo,
+                          int hi) const {
+  hi = min(hi, commands.end() - 1);
+  // Without any levels, everything is scanned.
+  int scanned = levels_.empty() ? lo : max(lo, indexed_end_);
+  for (int i = hi; i >= scanned; --i) {
+    if (StartsWith(commands[i], prefix))
+      return i;
+  }
+  for (auto level = levels_.rbegin(); level != levels_.rend(); ++level) {
+    if (level->begin > hi)
+      continue;
+    if (level->end <= lo)
+      break;
+    int first, last;
+    EqualRange(commands, *level, prefix, &first, &last);
+    if (first == last)
+      continue;
+    int upper = min(hi, level->end - 1) - level->begin + 1;
+    int count = level->positions.CountLess(first, last, upper);
+    if (count == 0)
+      continue;
+    int found =
+        level->positions.KthSmallest(first, last, count - 1) + level->begin;
+    // Anything in an older level is even further below |lo|.
+    return found >= lo ? found : -1;
+  }
+  return -1;
+}
+
+int PrefixIndex::FindFirst(const EntryList& commands,
+                           const wstring& prefix,
+                           int lo,
+                           int hi) const {
+  hi = min(hi, commands.end() - 1);
+  lo = max(lo, commands.first());
+  for (const auto& level : levels_) {
+    if (level.end <= lo)
+      continue;
+    if (level.begin > hi)
+      return -1;
+    int first, last;
+    EqualRange(commands, level, prefix, &first, &last);
+    if (first == last)
+      continue;
+    int lower = max(lo, level.begin) - level.begin;
+    int count = level.positions.CountLess(first, last, lower);
+    if (count == last - first)
+      continue;
+    int found = level.positions.KthSmallest(first, last, count) + level.begin;
+    // Anything in a newer level is even further above |hi|.
+    return found <= hi ? found : -1;
+  }
+  for (int i = levels_.empty() ? lo : max(lo, indexed_end_); i <= hi; ++i) {
+    if (StartsWith(commands[i], prefix))
+      return i;
+  }
+  return -1;
+}
@@ -0,0 +1,135 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_PREFIX_INDEX_H_
+#define CMDEX_PREFIX_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/entry_list.h"
+#include "cmdEx/string_util.h"
+
+// A static sequence of non-negative ints, stored one bit-plane at a time so
+// that rank-style questions about any subrange can be answered in
+// O(log max_value) ("wavelet matrix").
+class WaveletMatrix {
+ public:
+  WaveletMatrix();
+
+  void Build(const vector<int>& values);
+
+  // Number of values in positions [begin, end) that are less than |upper|.
+  int CountLess(int begin, int end, int upper) const;
+
+  // The |k|th smallest (0-based) value in positions [begin, end). |k| must be
+  // less than end - begin.
+  int KthSmallest(int begin, int end, int k) const;
+
+ private:
+  struct BitVector {
+    // All zeros, for |size| bits.
+    void Clear(size_t size);
+    // Once |words| is filled in.
+    void BuildRanks();
+    // Number of set bits in [0, pos).
+    int Rank1(int pos) const;
+
+    vector<uint64_t> words;
+    vector<int> ranks;  // Number of set bits before each word.
+  };
+
+  vector<BitVector> planes_;  // Most significant bit first.
+  vector<int> zeros_;         // Number of zero bits in each plane.
+};
+
+// Answers "the closest entry in a range of history positions that starts with
+// a given prefix" for CommandHistory without walking or copying every entry.
+//
+// Entries are indexed in levels covering consecutive position ranges, much
+// like a log-structured merge tree. Each level holds its positions sorted by
+// command text, so the entries that start with a prefix are one contiguous
+// run found by binary search, plus a WaveletMatrix over that order to pick
+// the largest (or smallest) position inside the run that falls in a range.
+// Appending only ever builds a small level for the new entries and merges
+// similarly sized neighbours, so lookups are O(log^2 N) and appends are
+// amortized O(log N). The newest few entries are left unindexed and scanned.
+// Older entries added in front get a level of their own in the same way.
+class PrefixIndex {
+ public:
+  PrefixIndex();
+
+  void Clear();
+
+  // Only indexes the newest copy of each command in each level, so that
+  // however many times a command's repeated, there's only O(log N) copies
+  // of it to skip. For deduplicated history (see CommandHistory), where the
+  // older copies are dead anyway. Has to be set while it's empty.
+  void set_newest_only(bool newest_only);
+
+  // Brings the index up to date with |commands|, which must only have been
+  // added to, at either end, since the last call (or Clear()).
+  void Update(const EntryList& commands);
+
+  // Returns the largest position in [lo, hi] whose entry starts with
+  // |prefix|, or -1 if there isn't one. |commands| must be what was last
+  // passed to Update().
+  int FindLast(const EntryList& commands,
+               const wstring& prefix,
+               int lo,
+               int hi) const;
+
+  // As FindLast(), but the smallest position in [lo, hi].
+  int FindFirst(const EntryList& commands,
+                const wstring& prefix,
+                int lo,
+                int hi) const;
+
+ private:
+  struct Level {
+    int begin;
+    int end;
+    // Positions in [begin, end), ordered by command and then position.
+    vector<int> sorted;
+    // sorted[i] - begin, for range queries by position.
+    WaveletMatrix positions;
+  };
+
+  // Finds the run of |level.sorted| whose entries start with |prefix|.
+  void EqualRange(const EntryList& commands,
+                  const Level& level,
+                  const wstring& prefix,
+                  int* first,
+                  int* last) const;
+  // Fills in |level| for positions [begin, end).
+  void BuildLevel(const EntryList& commands,
+                  int begin,
+                  int end,
+                  Level* level) const;
+  // Builds |level|'s positions from its |sorted|.
+  void BuildPositions(Level* level) const;
+  // Merges levels_[i + 1] into levels_[i].
+  void MergeLevels(const EntryList& commands, size_t i);
+  // Drops all but the last, i.e. newest, of each run of copies of the same
+  // command in |sorted|, if newest_only_.
+  void DropOlderCopies(const EntryList& commands, vector<int>* sorted) const;
+
+  vector<Level> levels_;  // Oldest first.
+  // What levels_ cover, if there are any.
+  int indexed_first_;
+  int indexed_end_;
+  bool newest_only_;
+};
+
+// <0, 0, >0 as |str| truncated to the length of |prefix| sorts before, equal
+// to, or after |prefix|. 0 means |str| starts with |prefix|.
+int ComparePrefix(const wchar_t* str,
+                  size_t str_size,
+                  const wchar_t* prefix,
+                  size_t prefix_size);
+
+#endif  // CMDEX_PREFIX_INDEX_H_
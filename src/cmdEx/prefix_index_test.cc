@@ -0,0 +1,236 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "cmdEx/prefix_index.h"
+
+#include <stdlib.h>
+
+#include <deque>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+int BruteFindLast(const EntryList& commands,
+                  const wstring& prefix,
+                  int lo,
+                  int hi) {
+  for (int i = hi; i >= lo; --i) {
+    if (commands[i].starts_with(prefix))
+      return i;
+  }
+  return -1;
+}
+
+int BruteFindFirst(const EntryList& commands,
+                   const wstring& prefix,
+                   int lo,
+                   int hi) {
+  for (int i = lo; i <= hi; ++i) {
+    if (commands[i].starts_with(prefix))
+      return i;
+  }
+  return -1;
+}
+
+wstring RandomCommand() {
+  // Small alphabet so that there's plenty of shared prefixes.
+  wstring result;
+  int length = rand() % 6;
+  for (int i = 0; i < length; ++i)
+    result.push_back(L"abc"[rand() % 3]);
+  return result;
+}
+
+}  // namespace
+
+TEST(WaveletMatrixTest, CountAndKth) {
+  vector<int> values;
+  values.push_back(5);
+  values.push_back(0);
+  values.push_back(7);
+  values.push_back(3);
+  values.push_back(5);
+  values.push_back(1);
+  WaveletMatrix wm;
+  wm.Build(values);
+  EXPECT_EQ(0, wm.CountLess(0, 6, 0));
+  EXPECT_EQ(1, wm.CountLess(0, 6, 1));
+  EXPECT_EQ(3, wm.CountLess(0, 6, 4));
+  EXPECT_EQ(5, wm.CountLess(0, 6, 6));
+  EXPECT_EQ(6, wm.CountLess(0, 6, 100));
+  EXPECT_EQ(1, wm.CountLess(2, 5, 5));
+  EXPECT_EQ(0, wm.KthSmallest(0, 6, 0));
+  EXPECT_EQ(5, wm.KthSmallest(0, 6, 3));
+  EXPECT_EQ(7, wm.KthSmallest(0, 6, 5));
+  EXPECT_EQ(3, wm.KthSmallest(2, 5, 0));
+  EXPECT_EQ(7, wm.KthSmallest(2, 5, 2));
+}
+
+TEST(PrefixIndexTest, ComparePrefix) {
+  EXPECT_EQ(0, ComparePrefix(L"abc", 3, L"ab", 2));
+  EXPECT_EQ(0, ComparePrefix(L"abc", 3, L"", 0));
+  EXPECT_GT(0, ComparePrefix(L"a", 1, L"ab", 2));
+  EXPECT_GT(0, ComparePrefix(L"aa", 2, L"ab", 2));
+  EXPECT_LT(0, ComparePrefix(L"ac", 2, L"ab", 2));
+}
+
+TEST(PrefixIndexTest, MatchesBruteForceWhileGrowing) {
+  srand(1234);
+  deque<wstring> storage;
+  EntryList commands;
+  PrefixIndex index;
+  for (int round = 0; round < 40; ++round) {
+    // Mix of single appends and big batches, to exercise level merging.
+    int to_add = round % 5 == 0 ? 300 : rand() % 20;
+    for (int i = 0; i < to_add; ++i) {
+      storage.push_back(RandomCommand());
+      commands.push_back(storage.back());
+    }
+    if (commands.empty())
+      continue;
+    index.Update(commands);
+    int size = static_cast<int>(commands.size());
+    for (int query = 0; query < 50; ++query) {
+      wstring prefix = RandomCommand();
+      int lo = rand() % size;
+      int hi = lo + rand() % (size - lo);
+      EXPECT_EQ(BruteFindLast(commands, prefix, lo, hi),
+                index.FindLast(commands, prefix, lo, hi));
+      EXPECT_EQ(BruteFindFirst(commands, prefix, lo, hi),
+                index.FindFirst(commands, prefix, lo, hi));
+    }
+  }
+}
+
+TEST(PrefixIndexTest, MatchesBruteForceGrowingAtBothEnds) {
+  // As history loaded from the archive goes in front of what's there.
+  srand(5678);
+  deque<wstring> storage;
+  EntryList commands(100000);
+  for (int newest_only = 0; newest_only <= 1; ++newest_only) {
+    PrefixIndex index;
+    index.set_newest_only(newest_only != 0);
+    commands.clear();
+    for (int round = 0; round < 40; ++round) {
+      int to_add = round % 7 == 0 ? 500 : rand() % 100;
+      bool older = rand() % 2 == 0;
+      for (int i = 0; i < to_add; ++i) {
+        storage.push_back(RandomCommand());
+        if (older)
+          commands.push_front(storage.back());
+        else
+          commands.push_back(storage.back());
+      }
+      if (commands.empty())
+        continue;
+      index.Update(commands);
+      int size = static_cast<int>(commands.size());
+      for (int query = 0; query < 50; ++query) {
+        wstring prefix = RandomCommand();
+        int lo = commands.first() + rand() % size;
+        int hi = lo + rand() % (commands.end() - lo);
+        // Only the newest copies are sure to be found then.
+        if (newest_only)
+          hi = commands.end() - 1;
+        EXPECT_EQ(BruteFindLast(commands, prefix, lo, hi),
+                  index.FindLast(commands, prefix, lo, hi));
+        if (!newest_only) {
+          EXPECT_EQ(BruteFindFirst(commands, prefix, lo, hi),
+                    index.FindFirst(commands, prefix, lo, hi));
+        }
+      }
+    }
+  }
+}
+
+TEST(PrefixIndexTest, Clear) {
+  wstring xyz(L"xyz");
+  wstring abc(L"abc");
+  EntryList commands;
+  for (int i = 0; i < 100; ++i)
+    commands.push_back(xyz);
+  PrefixIndex index;
+  index.Update(commands);
+  EXPECT_EQ(99, index.FindLast(commands, L"x", 0, 99));
+  index.Clear();
+  commands.clear();
+  for (int i = 0; i < 70; ++i)
+    commands.push_back(abc);
+  index.Update(commands);
+  EXPECT_EQ(-1, index.FindLast(commands, L"x", 0, 69));
+  EXPECT_EQ(0, index.FindFirst(commands, L"ab", 0, 69));
+}
+
+TEST(PrefixIndexTest, LongSharedPrefixes) {
+  // Commands that only differ far in, or not at all, so that they're sorted a
+  // few characters at a time, over and over.
+  srand(4321);
+  deque<wstring> storage;
+  EntryList commands;
+  for (int i = 0; i < 500; ++i) {
+    storage.push_back(L"ninja -C out\\Release " + RandomCommand());
+    commands.push_back(storage.back());
+  }
+  PrefixIndex index;
+  index.Update(commands);
+  const wchar_t* kPrefixes[] = {
+    L"", L"ninja", L"ninja -C out\\Release ", L"ninja -C out\\Release a",
+    L"ninja -C out\\Release abc", L"ninja -C out\\Release bb",
+    L"ninja -C out\\Release cccc", L"ninja -C out\\Debug",
+  };
+  for (const auto& prefix : kPrefixes) {
+    for (int query = 0; query < 50; ++query) {
+      int lo = rand() % 500;
+      int hi = lo + rand() % (500 - lo);
+      EXPECT_EQ(BruteFindLast(commands, prefix, lo, hi),
+                index.FindLast(commands, prefix, lo, hi));
+      EXPECT_EQ(BruteFindFirst(commands, prefix, lo, hi),
+                index.FindFirst(commands, prefix, lo, hi));
+    }
+  }
+}
+
+TEST(PrefixIndexTest, NewestOnly) {
+  // Skipping what isn't the newest copy of its command, as CommandHistory
+  // does when deduplicating, finds the same as a scan of the newest copies.
+  srand(8642);
+  deque<wstring> storage;
+  EntryList commands;
+  PrefixIndex index;
+  index.set_newest_only(true);
+  for (int round = 0; round < 20; ++round) {
+    int to_add = round % 5 == 0 ? 300 : rand() % 100;
+    for (int i = 0; i < to_add; ++i) {
+      storage.push_back(RandomCommand());
+      commands.push_back(storage.back());
+    }
+    index.Update(commands);
+    int size = static_cast<int>(commands.size());
+    vector<bool> newest(size, true);
+    for (int i = 0; i < size; ++i) {
+      for (int j = i + 1; j < size && newest[i]; ++j)
+        newest[i] = !(commands[i] == commands[j]);
+    }
+    for (int query = 0; query < 50; ++query) {
+      wstring prefix = RandomCommand();
+      int lo = rand() % size;
+      int hi = lo + rand() % (size - lo);
+      int expected = -1;
+      for (int i = hi; i >= lo && expected == -1; --i) {
+        if (newest[i] && commands[i].starts_with(prefix))
+          expected = i;
+      }
+      int found = index.FindLast(commands, prefix, lo, hi);
+      // Only a copy in each level.
+      int skipped = 0;
+      while (found != -1 && !newest[found]) {
+        found = index.FindLast(commands, prefix, lo, found - 1);
+        ++skipped;
+      }
+      EXPECT_EQ(expected, found);
+      EXPECT_GT(64, skipped);
+    }
+  }
+}
@@ -4,6 +4,8 @@
 
 #include "cmdEx/string_util.h"
 
+#include <stdint.h>
+
 vector<wstring> StringSplit(const wstring& str, wchar_t break_at) {
   vector<wstring> result;
   wstring current;
@@ -18,3 +20,34 @@ vector<wstring> StringSplit(const wstring& str, wchar_t break_at) {
   result.push_back(current);
   return result;
 }
+
+int WStringPiece::compare(const WStringPiece& other) const {
+  size_t common = size_ < other.size_ ? size_ : other.size_;
+  for (size_t i = 0; i < common; ++i) {
+    if (data_[i] != other.data_[i])
+      return data_[i] < other.data_[i] ? -1 : 1;
+  }
+  if (size_ == other.size_)
+    return 0;
+  return size_ < other.size_ ? -1 : 1;
+}
+
+bool WStringPiece::starts_with(const WStringPiece& prefix) const {
+  if (prefix.size_ > size_)
+    return false;
+  for (size_t i = 0; i < prefix.size_; ++i) {
+    if (data_[i] != prefix.data_[i])
+      return false;
+  }
+  return true;
+}
+
+size_t WStringPieceHash::operator()(const WStringPiece& str) const {
+  // FNV-1a.
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < str.size(); ++i) {
+    hash ^= static_cast<uint64_t>(str[i]);
+    hash *= 1099511628211ull;
+  }
+  return static_cast<size_t>(hash);
+}
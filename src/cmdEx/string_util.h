@@ -5,10 +5,44 @@
 #ifndef CMDEX_STRING_UTIL_H_
 #define CMDEX_STRING_UTIL_H_
 
+#include <wchar.h>
+
 #include <string>
 #include <vector>
 using namespace std;
 
 vector<wstring> StringSplit(const wstring& str, wchar_t break_at);
 
+// A reference to a run of wide characters that it doesn't own, like
+// Chromium's StringPiece16. Whatever it points into has to outlive it.
+class WStringPiece {
+ public:
+  WStringPiece() : data_(NULL), size_(0) {}
+  WStringPiece(const wchar_t* data, size_t size) : data_(data), size_(size) {}
+  WStringPiece(const wchar_t* str) : data_(str), size_(wcslen(str)) {}
+  WStringPiece(const wstring& str) : data_(str.data()), size_(str.size()) {}
+
+  const wchar_t* data() const { return data_; }
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+  wchar_t operator[](size_t i) const { return data_[i]; }
+
+  wstring as_string() const { return wstring(data_, size_); }
+  int compare(const WStringPiece& other) const;
+  bool starts_with(const WStringPiece& prefix) const;
+
+ private:
+  const wchar_t* data_;
+  size_t size_;
+};
+
+inline bool operator==(const WStringPiece& a, const WStringPiece& b) {
+  return a.compare(b) == 0;
+}
+
+// For keying hash containers by WStringPiece.
+struct WStringPieceHash {
+  size_t operator()(const WStringPiece& str) const;
+};
+
 #endif  // CMDEX_STRING_UTIL_H_
@@ -33,3 +33,22 @@ TEST(StringUtil, StringSplitNoSplits) {
   EXPECT_EQ(1u, s.size());
   EXPECT_EQ(L"blorpy", s[0]);
 }
+
+TEST(StringUtil, WStringPieceCompare) {
+  wstring abc(L"abc");
+  EXPECT_EQ(0, WStringPiece(abc).compare(L"abc"));
+  EXPECT_GT(0, WStringPiece(abc).compare(L"abd"));
+  EXPECT_LT(0, WStringPiece(abc).compare(L"ab"));
+  EXPECT_GT(0, WStringPiece(abc.data(), 2).compare(abc));
+  EXPECT_TRUE(WStringPiece(abc.data(), 2) == WStringPiece(L"ab"));
+  EXPECT_EQ(L"bc", WStringPiece(abc.data() + 1, 2).as_string());
+}
+
+TEST(StringUtil, WStringPieceStartsWith) {
+  wstring abc(L"abc");
+  EXPECT_TRUE(WStringPiece(abc).starts_with(L""));
+  EXPECT_TRUE(WStringPiece(abc).starts_with(L"ab"));
+  EXPECT_TRUE(WStringPiece(abc).starts_with(abc));
+  EXPECT_FALSE(WStringPiece(abc).starts_with(L"abcd"));
+  EXPECT_FALSE(WStringPiece(abc).starts_with(L"b"));
+}
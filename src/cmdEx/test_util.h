@@ -0,0 +1,458 @@
+// Copyright 2013 The Chromium Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef CMDEX_TEST_UTIL_H_
+#define CMDEX_TEST_UTIL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "cmdEx/completion.h"
+#include "cmdEx/directory_history.h"
+#include "cmdEx/file_system.h"
+#include "cmdEx/line_editor.h"
+#include "gtest/gtest.h"
+
+// A path in the temp directory for tests that need a real file. |name| is
+// made unique to this process, and the file is removed when this goes out of
+// scope.
+class ScopedTempPath {
+ public:
+  explicit ScopedTempPath(const string& name) {
+#if defined(_WIN32)
+    const char* dir = getenv("TEMP");
+    path_ = string(dir ? dir : ".") + "\\cmdex_test_" + to_string(_getpid());
+#else
+    const char* dir = getenv("TMPDIR");
+    path_ = string(dir ? dir : "/tmp") + "/cmdex_test_" + to_string(getpid());
+#endif
+    path_ += "_" + name;
+    remove(path_.c_str());
+  }
+  ~ScopedTempPath() { remove(path_.c_str()); }
+
+  const string& path() const { return path_; }
+
+ private:
+  string path_;
+};
+
+// As ScopedTempPath, but for a directory, which is removed along with the
+// files and empty directories in it. It's up to the test to create it.
+class ScopedTempDirectory {
+ public:
+  explicit ScopedTempDirectory(const string& name) : path_(name) {
+    RemoveAll();
+  }
+  ~ScopedTempDirectory() { RemoveAll(); }
+
+  const string& path() const { return path_.path(); }
+
+ private:
+  void RemoveAll() {
+    vector<string> files;
+#if defined(_WIN32)
+    WIN32_FIND_DATA data;
+    HANDLE find = FindFirstFile((path() + "\\*").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE) {
+      do {
+        files.push_back(path() + "\\" + data.cFileName);
+      } while (FindNextFile(find, &data));
+      FindClose(find);
+    }
+    for (const auto& file : files) {
+      if (!DeleteFile(file.c_str()))
+        RemoveDirectory(file.c_str());
+    }
+    RemoveDirectory(path().c_str());
+#else
+    if (DIR* dir = opendir(path().c_str())) {
+      while (struct dirent* entry = readdir(dir))
+        files.push_back(path() + "/" + entry->d_name);
+      closedir(dir);
+    }
+    for (const auto& file : files) {
+      if (unlink(file.c_str()) != 0)
+        rmdir(file.c_str());
+    }
+    rmdir(path().c_str());
+#endif
+  }
+
+  ScopedTempPath path_;
+};
+
+#if defined(_WIN32)
+const char kPathSeparator[] = "\\";
+#else
+const char kPathSeparator[] = "/";
+#endif
+
+inline bool MakeDirectory(const string& path) {
+#if defined(_WIN32)
+  return CreateDirectory(path.c_str(), NULL) != 0;
+#else
+  return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
+// Creates an empty file.
+inline bool MakeFile(const string& path) {
+  FILE* f = fopen(path.c_str(), "wb");
+  if (!f)
+    return false;
+  fclose(f);
+  return true;
+}
+
+// For the ASCII paths tests make.
+inline wstring Widen(const string& str) {
+  return wstring(str.begin(), str.end());
+}
+
+// A working directory where any directory exists unless it's been marked
+// missing, and some can be marked as slow to get to (as on a network drive),
+// which is simulated by sleeping.
+class FakeWorkingDirectory : public WorkingDirectoryInterface {
+ public:
+  FakeWorkingDirectory() : set_count_(0), check_count_(0) {}
+
+  bool Set(const string& dir) override {
+    int delay_ms = GetDelayMs(dir);
+    this_thread::sleep_for(chrono::milliseconds(delay_ms));
+    lock_guard<mutex> lock(mutex_);
+    ++set_count_;
+    if (missing_.count(dir))
+      return false;
+    dir_ = dir;
+    return true;
+  }
+  string Get() override {
+    lock_guard<mutex> lock(mutex_);
+    return dir_;
+  }
+  void CheckExist(const vector<string>& dirs, vector<bool>* exists) override {
+    for (const auto& dir : dirs) {
+      int delay_ms = GetDelayMs(dir);
+      this_thread::sleep_for(chrono::milliseconds(delay_ms));
+      lock_guard<mutex> lock(mutex_);
+      ++check_count_;
+      exists->push_back(!missing_.count(dir));
+    }
+  }
+
+  void SetMissing(const string& dir, bool missing) {
+    lock_guard<mutex> lock(mutex_);
+    if (missing)
+      missing_.insert(dir);
+    else
+      missing_.erase(dir);
+  }
+  void SetDelayMs(const string& dir, int delay_ms) {
+    lock_guard<mutex> lock(mutex_);
+    delay_ms_[dir] = delay_ms;
+  }
+
+  // How many times Set() has been called, and how many directories have been
+  // checked.
+  int set_count() {
+    lock_guard<mutex> lock(mutex_);
+    return set_count_;
+  }
+  int check_count() {
+    lock_guard<mutex> lock(mutex_);
+    return check_count_;
+  }
+
+ private:
+  int GetDelayMs(const string& dir) {
+    lock_guard<mutex> lock(mutex_);
+    auto it = delay_ms_.find(dir);
+    return it == delay_ms_.end() ? 0 : it->second;
+  }
+
+  mutex mutex_;
+  string dir_;
+  set<string> missing_;
+  map<string, int> delay_ms_;
+  int set_count_;
+  int check_count_;
+};
+
+// Directories of files in memory. A directory's modification time goes up
+// whenever a file is added to it.
+class FakeFileSystem : public FileSystemInterface {
+ public:
+  FakeFileSystem() : clock_(0), list_count_(0) {}
+
+  bool ListDirectory(const wstring& dir,
+                     vector<wstring>* names,
+                     vector<bool>* is_directory) override {
+    lock_guard<mutex> lock(mutex_);
+    ++list_count_;
+    auto it = dirs_.find(dir);
+    if (it == dirs_.end())
+      return false;
+    names->insert(names->end(), it->second.names.begin(),
+                  it->second.names.end());
+    if (is_directory) {
+      is_directory->insert(is_directory->end(),
+                           it->second.is_directory.begin(),
+                           it->second.is_directory.end());
+    }
+    return true;
+  }
+  int64_t GetModifiedTime(const wstring& path) override {
+    lock_guard<mutex> lock(mutex_);
+    auto it = dirs_.find(path);
+    return it == dirs_.end() ? -1 : it->second.modified;
+  }
+
+  void AddFile(const wstring& dir, const wstring& name) {
+    Add(dir, name, false);
+  }
+  // Adds |name| to |dir| as a directory, which can then have files added to
+  // it as |dir|\|name|.
+  void AddDirectory(const wstring& dir, const wstring& name) {
+    Add(dir, name, true);
+  }
+
+  // How many times ListDirectory() has been called.
+  int list_count() {
+    lock_guard<mutex> lock(mutex_);
+    return list_count_;
+  }
+
+ private:
+  struct Dir {
+    vector<wstring> names;
+    vector<bool> is_directory;
+    int64_t modified;
+  };
+
+  void Add(const wstring& dir, const wstring& name, bool is_directory) {
+    lock_guard<mutex> lock(mutex_);
+    Dir& entry = dirs_[dir];
+    entry.names.push_back(name);
+    entry.is_directory.push_back(is_directory);
+    entry.modified = ++clock_;
+    if (is_directory)
+      dirs_[dir + L"\\" + name].modified = ++clock_;
+  }
+
+  mutex mutex_;
+  map<wstring, Dir> dirs_;
+  int64_t clock_;
+  int list_count_;
+};
+
+// Something for fake completers to wait on, to simulate slow ones. As
+// completers are plain functions, these are generally globals.
+class CompletionGate {
+ public:
+  CompletionGate() : open_(true) {}
+
+  void Close() {
+    lock_guard<mutex> lock(mutex_);
+    open_ = false;
+  }
+  void Open() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      open_ = true;
+    }
+    changed_.notify_all();
+  }
+
+  // Waits until it's open. Returns false if |output| is cancelled first,
+  // unless it's NULL.
+  bool Wait(const CompleterOutput* output) {
+    unique_lock<mutex> lock(mutex_);
+    while (!open_) {
+      if (output && output->IsCancelled())
+        return false;
+      changed_.wait_for(lock, chrono::milliseconds(1));
+    }
+    return true;
+  }
+
+ private:
+  mutex mutex_;
+  condition_variable changed_;
+  bool open_;
+};
+
+// A console that's just a screenful of characters, each remembering how it
+// was last drawn, and which counts how many times each row's been drawn to.
+class MockConsoleInterface : public ConsoleInterface {
+ public:
+  explicit MockConsoleInterface(int screen_width = 50, int screen_height = 10)
+      : width(screen_width),
+        height(screen_height),
+        cursor_x(0),
+        cursor_y(0) {
+    screen_data = new wchar_t[width * height];
+    dimmed = new bool[width * height];
+    highlighted = new bool[width * height];
+    row_draws = new int[height];
+    for (int y = 0; y < height; ++y) {
+      for (int x = 0; x < width; ++x) {
+        screen_data[y * width + x] = L'!';
+        dimmed[y * width + x] = false;
+        highlighted[y * width + x] = false;
+      }
+      row_draws[y] = 0;
+    }
+  }
+  ~MockConsoleInterface() {
+    delete[] screen_data;
+    delete[] dimmed;
+    delete[] highlighted;
+    delete[] row_draws;
+  }
+  virtual void GetCursorLocation(int* x, int* y) override {
+    *x = cursor_x;
+    *y = cursor_y;
+  }
+  virtual int GetWidth() override {
+    return width;
+  }
+  virtual int GetHeight() override {
+    return height;
+  }
+  virtual void DrawString(const wchar_t* str, int count, int x, int y)
+      override {
+    ASSERT_GE(x, 0);
+    ASSERT_GE(y, 0);
+    ASSERT_LE(x + count, width);
+    ASSERT_LT(y, height);
+    memcpy(&screen_data[y * width + x], str, count * sizeof(wchar_t));
+    for (int i = 0; i < count; ++i) {
+      dimmed[y * width + x + i] = false;
+      highlighted[y * width + x + i] = false;
+    }
+    ++row_draws[y];
+  }
+  virtual void DrawDimmedString(const wchar_t* str, int count, int x, int y)
+      override {
+    DrawString(str, count, x, y);
+    for (int i = 0; i < count; ++i)
+      dimmed[y * width + x + i] = true;
+  }
+  virtual void DrawHighlightedString(const wchar_t* str,
+                                     int count,
+                                     int x,
+                                     int y) override {
+    DrawString(str, count, x, y);
+    for (int i = 0; i < count; ++i)
+      highlighted[y * width + x + i] = true;
+  }
+  virtual void FillChar(wchar_t ch, int count, int x, int y) override {
+    ASSERT_GE(x, 0);
+    ASSERT_GE(y, 0);
+    ASSERT_LE(x + count, width);
+    ASSERT_LT(y, height);
+    for (int i = 0; i < count; ++i) {
+      screen_data[y * width + x + i] = ch;
+      dimmed[y * width + x + i] = false;
+      highlighted[y * width + x + i] = false;
+    }
+    ++row_draws[y];
+  }
+  virtual int SetCursorLocation(int x, int y) {
+    cursor_x = x;
+    cursor_y = y;
+    while (cursor_y >= height)
+      ScrollByOneLine();
+    return 0;  // TODO(scottmg): Test for this.
+  }
+
+  void ScrollByOneLine() {
+    ASSERT_GT(cursor_y, 0);
+    for (int y = 1; y < height; ++y) {
+      wchar_t* prev_line = &screen_data[(y - 1) * width];
+      wchar_t* cur_line = &screen_data[y * width];
+      memmove(prev_line, cur_line, width * sizeof(wchar_t));
+      memmove(&dimmed[(y - 1) * width],
+              &dimmed[y * width],
+              width * sizeof(bool));
+      memmove(&highlighted[(y - 1) * width],
+              &highlighted[y * width],
+              width * sizeof(bool));
+    }
+    for (int x = 0; x < width; ++x) {
+      screen_data[(height - 1) * width + x] = L' ';
+      dimmed[(height - 1) * width + x] = false;
+      highlighted[(height - 1) * width + x] = false;
+    }
+    --cursor_y;
+  }
+
+  wchar_t GetCharAt(int x, int y) {
+    return screen_data[y * width + x];
+  }
+
+  wstring GetLine(int y, int count) {
+    return wstring(&screen_data[y * width], count);
+  }
+
+  bool IsDimmedAt(int x, int y) {
+    return dimmed[y * width + x];
+  }
+
+  bool IsHighlightedAt(int x, int y) {
+    return highlighted[y * width + x];
+  }
+
+  // How many rows have been drawn to since the counts were last reset.
+  int CountRowsDrawn() {
+    int count = 0;
+    for (int y = 0; y < height; ++y)
+      count += row_draws[y] > 0 ? 1 : 0;
+    return count;
+  }
+  void ResetRowDraws() {
+    for (int y = 0; y < height; ++y)
+      row_draws[y] = 0;
+  }
+
+  bool GetClipboardText(wstring* text) {
+    *text = pending_clipboard;
+    pending_clipboard.clear();
+    return true;
+  }
+
+  int width;
+  int height;
+  int cursor_x;
+  int cursor_y;
+  wchar_t* screen_data;
+  bool* dimmed;
+  bool* highlighted;
+  // How many times each row's been drawn to.
+  int* row_draws;
+  wstring pending_clipboard;
+};
+
+#endif  // CMDEX_TEST_UTIL_H_
@@ -6,17 +6,32 @@
 #include <DelayImp.h>
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <time.h>
 
 #pragma warning(disable: 4530)
 #include <algorithm>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
 #include "cmdEx/command_history.h"
+#include "cmdEx/completer_registry.h"
+#include "cmdEx/completion_cache.h"
+#include "cmdEx/completion_pool.h"
+#include "cmdEx/directory_database.h"
 #include "cmdEx/directory_history.h"
+#include "cmdEx/directory_listing.h"
+#include "cmdEx/file_system.h"
+#include "cmdEx/history_archive.h"
+#include "cmdEx/history_file.h"
+#include "cmdEx/history_journal.h"
 #include "cmdEx/line_editor.h"
+#include "cmdEx/path_index.h"
+#include "cmdEx/prefix_filter.h"
 #include "cmdEx/string_util.h"
 #include "cmdEx/subprocess.h"
 #include "common/util.h"
@@ -62,6 +77,26 @@ wstring JoinPath(const wstring& a, const wstring& b) {
   return a + L"\\" + b;
 }
 
+// Directories are kept in the ANSI code page, as cmd's working directory is
+// got and set through the A functions.
+string ToNarrow(const wstring& str) {
+  char narrow[_MAX_PATH];
+  if (!WideCharToMultiByte(
+          CP_ACP, 0, str.c_str(), -1, narrow, sizeof(narrow), NULL, NULL)) {
+    return string();
+  }
+  return narrow;
+}
+
+wstring ToWide(const string& str) {
+  wchar_t wide[_MAX_PATH];
+  if (!MultiByteToWideChar(
+          CP_ACP, MB_PRECOMPOSED, str.c_str(), -1, wide, _MAX_PATH)) {
+    return wstring();
+  }
+  return wide;
+}
+
 // Reads |path| into |buffer| which is assumed to be large enough to hold
 // _MAX_PATH. Trailing spaces are trimmed.
 void ReadInto(const string& path, char* buffer) {
@@ -88,42 +123,35 @@ string GetHistoryFilename() {
   return name;
 }
 
-vector<wstring> ReadHistoryFile() {
-  vector<wstring> result;
-  FILE* f = fopen(GetHistoryFilename().c_str(), "rb, ccs=UTF-16LE");
-  if (!f) {
-    Log("couldn't read history file");
-    return vector<wstring>();
-  }
-  for (;;) {
-    wchar_t tmp[4096];
-    if (fgetws(tmp, sizeof(tmp), f) == NULL)
-      break;
-    if (tmp[0] == 0)
-      break;
-    CHECK(tmp[wcslen(tmp) - 1] == L'\n');
-    tmp[wcslen(tmp) - 1] = 0;
-    result.push_back(tmp);
-    tmp[0] = 0;
-    if (feof(f))
-      break;
-  }
-  fclose(f);
-  return result;
+string GetHistoryJournalFilename() {
+  return GetHistoryFilename() + "_journal";
 }
 
-void WriteHistoryFile(const vector<wstring>& history) {
-  FILE* f = fopen(GetHistoryFilename().c_str(), "wb, ccs=UTF-16LE");
-  if (!f) {
-    Log("couldn't write history file");
-    return;
-  }
-  for (size_t i = max(static_cast<int>(history.size()) - 1000, 0);
-       i < history.size();
-       ++i) {
-    fwprintf(f, L"%s\n", history[i].c_str());
+string GetHistoryRecordsFilename() {
+  return GetHistoryFilename() + "_records";
+}
+
+string GetDirectoryDatabaseFilename() {
+  return GetHistoryFilename() + "_directories";
+}
+
+string GetPathIndexFilename() {
+  return GetHistoryFilename() + "_path_index";
+}
+
+string GetHistoryArchiveDirectory() {
+  return GetHistoryFilename() + "_archive";
+}
+
+// NULL if the archive can't be used, in which case history that's dropped
+// from the snapshot is lost, as it was before there was one.
+unique_ptr<HistoryArchive> OpenHistoryArchive() {
+  unique_ptr<HistoryArchive> archive(new HistoryArchive);
+  if (!archive->Open(GetHistoryArchiveDirectory())) {
+    Log("couldn't open history archive");
+    archive.reset();
   }
-  fclose(f);
+  return archive;
 }
 
 HMODULE LoadLibraryInSameLocation(HMODULE self, const char* dll_name) {
@@ -167,11 +195,15 @@ void TrimRefsHead(char* head) {
     memmove(head, &head[length], strlen(&head[length]) + 1);
 }
 
-static bool FindGitRepo(git_buf* git_dir, git_repository** repo) {
+static bool FindGitDir(git_buf* git_dir) {
   char local_path[_MAX_PATH];
   if (GetCurrentDirectory(sizeof(local_path), local_path) == 0)
     return false;
-  if (g_git_repository_discover(git_dir, local_path, 1, "") != 0)
+  return g_git_repository_discover(git_dir, local_path, 1, "") == 0;
+}
+
+static bool FindGitRepo(git_buf* git_dir, git_repository** repo) {
+  if (!FindGitDir(git_dir))
     return false;
   if (g_git_repository_open(repo, git_dir->ptr) != 0)
     return false;
@@ -283,19 +315,13 @@ void* RvaToAddr(void* base, uintptr_t rva) {
 // c:\x
 // c:\y   <--
 //
-// Alt-Left goes 'up' and Alt-Right goes 'down'. If the current directory
-// becomes a directory other than the current item, the item before, or the
-// item after, then everything below the current iterator is dropped, and the
-// new location added (and becomes current). In the history above, Alt-Left
-// goes to c:\x, then Alt-Left again goes to c:\b. Alt-Right or "cd c:\x"
-// would move to c:\x and point the iterator at c:\x. Then, "cd c:\z": because
-// that isn't navigating back or forward, it starts a 'new' forward tree, so
-// c:\y (and all subsequent entries) are dropped, c:\z is added and becomes
-// current.
-//
-// TODO: This doesn't feel quite right. See vim jumplist docs; in particular
-// if revisiting an old location it goes at the end, but is removed from the
-// middle.
+// Alt-Left goes 'up' and Alt-Right goes 'down'. As with vim's jumplist,
+// changing to a directory other than by navigating adds where we were to the
+// end of the list, removing it from wherever it was before, and ends
+// navigation. In the history above, Alt-Left goes to c:\x, then Alt-Left
+// again goes to c:\b. Then, "cd c:\z" makes the list c:\a, c:\x, c:\y,
+// c:\b, and Alt-Left goes back to c:\b. Only the most recent
+// DirectoryHistory::kDefaultCapacity are kept.
 
 class RealWorkingDirectory : public WorkingDirectoryInterface {
  public:
@@ -308,6 +334,41 @@ class RealWorkingDirectory : public WorkingDirectoryInterface {
       return cur_path;
     return "";
   }
+  virtual void CheckExist(const vector<string>& dirs,
+                          vector<bool>* exists) override {
+    for (const auto& dir : dirs) {
+      DWORD attributes = GetFileAttributes(dir.c_str());
+      exists->push_back(attributes != INVALID_FILE_ATTRIBUTES &&
+                        (attributes & FILE_ATTRIBUTE_DIRECTORY));
+    }
+  }
+};
+
+// cmd sets "=ExitCode" (in hex) when a program it ran exits, but leaves it
+// alone for builtins, so it's cleared before each command to tell them apart.
+class RealCommandStatus : public CommandStatusInterface {
+ public:
+  virtual int64_t GetTime() override {
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    ULARGE_INTEGER ticks;
+    ticks.LowPart = now.dwLowDateTime;
+    ticks.HighPart = now.dwHighDateTime;
+    // 100ns ticks since 1601.
+    const uint64_t kUnixEpoch = 116444736000000000ULL;
+    return static_cast<int64_t>((ticks.QuadPart - kUnixEpoch) / 10000);
+  }
+  virtual void ClearExitCode() override {
+    SetEnvironmentVariable("=ExitCode", NULL);
+  }
+  virtual bool GetExitCode(int* exit_code) override {
+    char value[32];
+    DWORD length = GetEnvironmentVariable("=ExitCode", value, sizeof(value));
+    if (length == 0 || length >= sizeof(value))
+      return false;
+    *exit_code = static_cast<int>(strtoul(value, NULL, 16));
+    return true;
+  }
 };
 
 class RealConsole : public ConsoleInterface {
@@ -339,15 +400,42 @@ class RealConsole : public ConsoleInterface {
 
   virtual void DrawString(const wchar_t* str, int count, int x, int y)
       override {
-    COORD coord = { static_cast<SHORT>(x), static_cast<SHORT>(y) };
-    DWORD written;
-    WriteConsoleOutputCharacterW(console_, str, count, coord, &written);
+    DrawStringWithAttributes(str, count, x, y, GetAttributes());
+  }
+
+  virtual void DrawDimmedString(const wchar_t* str, int count, int x, int y)
+      override {
+    // Dark grey, on whatever the background is.
+    DrawStringWithAttributes(
+        str,
+        count,
+        x,
+        y,
+        static_cast<WORD>((GetAttributes() & 0xf0) | FOREGROUND_INTENSITY));
+  }
+
+  virtual void DrawHighlightedString(const wchar_t* str,
+                                     int count,
+                                     int x,
+                                     int y) override {
+    // The foreground and background swapped.
+    WORD attributes = GetAttributes();
+    DrawStringWithAttributes(
+        str,
+        count,
+        x,
+        y,
+        static_cast<WORD>(((attributes & 0x0f) << 4) |
+                          ((attributes & 0xf0) >> 4)));
   }
 
   virtual void FillChar(wchar_t ch, int count, int x, int y) override {
     COORD coord = { static_cast<SHORT>(x), static_cast<SHORT>(y) };
     DWORD written;
     FillConsoleOutputCharacterW(console_, ch, count, coord, &written);
+    // In case it was dimmed.
+    FillConsoleOutputAttribute(console_, GetAttributes(), count, coord,
+                               &written);
   }
 
   virtual int SetCursorLocation(int x, int y) override {
@@ -391,9 +479,73 @@ class RealConsole : public ConsoleInterface {
   }
 
  private:
+  // The attributes that output is normally written with.
+  WORD GetAttributes() {
+    CONSOLE_SCREEN_BUFFER_INFO screen_buffer_info;
+    PCHECK(GetConsoleScreenBufferInfo(console_, &screen_buffer_info));
+    return screen_buffer_info.wAttributes;
+  }
+
+  void DrawStringWithAttributes(const wchar_t* str,
+                                int count,
+                                int x,
+                                int y,
+                                WORD attributes) {
+    COORD coord = { static_cast<SHORT>(x), static_cast<SHORT>(y) };
+    DWORD written;
+    WriteConsoleOutputCharacterW(console_, str, count, coord, &written);
+    FillConsoleOutputAttribute(console_, attributes, count, coord, &written);
+  }
+
   HANDLE console_;
 };
 
+// Completers keep all the candidates they find for a context in here, so
+// that completing another prefix in it is only filtering them again.
+static CompletionCache* g_completion_cache;
+// A few big builds' targets' worth.
+const size_t kMaxCachedCandidates = 500000;
+
+static int64_t ToInt64(const FILETIME& time) {
+  return (static_cast<int64_t>(time.dwHighDateTime) << 32) |
+         time.dwLowDateTime;
+}
+
+// For CompletionCache validators. For a directory, that's when something in
+// it was last added, removed or renamed. -1 if |path| doesn't exist.
+static int64_t GetModifiedTime(const wstring& path) {
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
+    return -1;
+  return ToInt64(data.ftLastWriteTime);
+}
+
+// Adds the modified times of |dir| and all the directories under it.
+static void AddDirectoryTimes(const wstring& dir,
+                              vector<int64_t>* validators) {
+  validators->push_back(GetModifiedTime(dir));
+  WIN32_FIND_DATAW find_data;
+  HANDLE handle = FindFirstFileW(JoinPath(dir, L"*").c_str(), &find_data);
+  if (handle == INVALID_HANDLE_VALUE)
+    return;
+  do {
+    if ((find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) &&
+        find_data.cFileName[0] != L'.')
+      AddDirectoryTimes(JoinPath(dir, find_data.cFileName), validators);
+  } while (FindNextFileW(handle, &find_data));
+  FindClose(handle);
+}
+
+// Absolute, relative to the current directory. Empty if it can't be.
+static wstring GetFullPath(const wstring& path) {
+  wchar_t full[MAX_PATH];
+  DWORD length = GetFullPathNameW(
+      path.empty() ? L"." : path.c_str(), ARRAYSIZE(full), full, NULL);
+  if (length == 0 || length >= ARRAYSIZE(full))
+    return wstring();
+  return full;
+}
+
 // TODO: Search for git-xyz in path too. Should include .sh in addition to
 // PATHEXT
 static const wchar_t* kGitCommandsPorcelain[] = {
@@ -404,48 +556,41 @@ static const wchar_t* kGitCommandsPorcelain[] = {
   L"rm", L"shortlog", L"show", L"stash", L"status", L"submodule", L"tag",
 };
 
+// Completers registered for a command are only called for the words after
+// it, so word_data[0] is that command, and there's at least one more word.
+
 static bool GitCommandNameCompleter(const CompleterInput& input,
                                     CompleterOutput* output) {
-  if (input.word_data.size() > 1 &&
-      input.word_data[0].deescaped_word == L"git") {
-    bool in_word_one = input.word_index == 1;
-    bool no_command = input.word_data.size() == 1;
-    if (no_command || in_word_one) {
-      const wstring prefix =
-          no_command ? L"" : input.word_data[1].deescaped_word;
-      for (size_t i = 0; i < ARRAYSIZE(kGitCommandsPorcelain); ++i) {
-        wstring tmp = kGitCommandsPorcelain[i];
-        if (tmp.substr(0, prefix.size()) == prefix)
-          output->results.push_back(tmp);
-      }
-      return true;
-    }
+  if (input.word_index == 1) {
+    static const PackedCandidates commands(kGitCommandsPorcelain,
+                                           ARRAYSIZE(kGitCommandsPorcelain));
+    AddCompletions(
+        commands, input.word_data[1].deescaped_word, input.fuzzy, output);
+    return true;
   }
   return false;
 }
 
+// Completion replaces the word with the candidate, so what's typed is
+// matched ignoring case, and the candidate's case is what's kept.
 static bool CompletePrefixArray(const CompleterInput& input,
                                 const wstring& prefix,
                                 const wchar_t* candidates[],
                                 size_t candidates_size,
-                                vector<wstring>* results) {
-  for (size_t i = 0; i < candidates_size; ++i) {
-    wstring tmp(candidates[i]);
-    if (tmp.substr(0, prefix.size()) == prefix)
-      results->push_back(tmp);
-  }
-  return !results->empty();
+                                CompleterOutput* output) {
+  AddCompletions(PackedCandidates(candidates, candidates_size),
+                 prefix,
+                 input.fuzzy,
+                 output);
+  return !output->results.empty();
 }
 
 static bool CompletePrefixVector(const CompleterInput& input,
                                  const wstring& prefix,
-                                 const vector<wstring>& candidates,
-                                 vector<wstring>* results) {
-  for (size_t i = 0; i < candidates.size(); ++i) {
-    if (candidates[i].substr(0, prefix.size()) == prefix)
-      results->push_back(candidates[i]);
-  }
-  return !results->empty();
+                                 const PackedCandidates& candidates,
+                                 CompleterOutput* output) {
+  AddCompletions(candidates, prefix, input.fuzzy, output);
+  return !output->results.empty();
 }
 
 // See:
@@ -464,13 +609,36 @@ static int ForeachRefCallback(const char* name, void* payload) {
 
 static bool GitRefsHelper(const CompleterInput& input,
                           const wstring& prefix,
-                          vector<wstring>* results) {
-  CHECK(input.word_data.size() > 2 &&
-        input.word_data[0].deescaped_word == L"git");
+                          CompleterOutput* output) {
+  CHECK(input.word_data.size() > 2);
   git_buf git_dir = GIT_BUF_INIT;
+  if (!FindGitDir(&git_dir)) {
+    g_git_buf_dispose(&git_dir);
+    return false;
+  }
+  wstring git_dir_wide = ToWide(git_dir.ptr);
+  if (!git_dir_wide.empty() && (git_dir_wide.back() == L'/' ||
+                                git_dir_wide.back() == L'\\'))
+    git_dir_wide.pop_back();
+  // Refs are added and removed as files under refs\ (including in
+  // directories of their own, for names with slashes), or in packed-refs,
+  // so that's all that needs checking rather than opening the repo.
+  wstring key = L"git refs\n" + git_dir_wide;
+  vector<int64_t> validators(
+      1, GetModifiedTime(JoinPath(git_dir_wide, L"packed-refs")));
+  AddDirectoryTimes(JoinPath(git_dir_wide, L"refs"), &validators);
+  CompletionCache::Candidates cached =
+      g_completion_cache->Find(key, validators);
+  if (cached) {
+    g_git_buf_dispose(&git_dir);
+    return CompletePrefixVector(input, prefix, *cached, output);
+  }
+
   git_repository* repo;
-  if (!FindGitRepo(&git_dir, &repo))
+  if (g_git_repository_open(&repo, git_dir.ptr) != 0) {
+    g_git_buf_dispose(&git_dir);
     return false;
+  }
   g_git_buf_dispose(&git_dir);
   vector<wstring> candidates;
   bool ok = g_git_reference_foreach_glob(
@@ -480,14 +648,15 @@ static bool GitRefsHelper(const CompleterInput& input,
          g_git_reference_foreach_glob(
              repo, "refs/remotes/*", ForeachRefCallback, &candidates) == 0;
   g_git_repository_free(repo);
-  CompletePrefixVector(input, prefix, candidates, results);
-  return ok && !results->empty();
+  CompletionCache::Candidates packed =
+      ok ? g_completion_cache->Store(key, validators, &candidates)
+         : CompletionCache::Candidates(new PackedCandidates(candidates));
+  return CompletePrefixVector(input, prefix, *packed, output) && ok;
 }
 
 static bool GitCommandArgCompleter(const CompleterInput& input,
                                    CompleterOutput* output) {
-  if (input.word_data.size() > 2 &&
-      input.word_data[0].deescaped_word == L"git") {
+  if (input.word_data.size() > 2) {
     if (input.word_data[1].deescaped_word == L"checkout") {
       const wchar_t* kCheckoutLongArgs[] = {
         L"--quiet", L"--ours", L"--theirs", L"--no-track", L"--merge",
@@ -498,65 +667,88 @@ static bool GitCommandArgCompleter(const CompleterInput& input,
                               input.word_data[2].deescaped_word,
                               kCheckoutLongArgs,
                               ARRAYSIZE(kCheckoutLongArgs),
-                              &output->results)) {
+                              output)) {
         return true;
       }
-      if (GitRefsHelper(
-              input, input.word_data[2].deescaped_word, &output->results))
+      if (GitRefsHelper(input, input.word_data[2].deescaped_word, output))
         return true;
     }
   }
   return false;
 }
 
+// SubprocessSet's completion port is shared by all of them, so only one can
+// be waited on at a time. A cancelled completion can still be running one
+// until it next checks, which is soon.
+static mutex g_subprocess_mutex;
+
 static bool NinjaTargetCompleter(const CompleterInput& input,
                                  CompleterOutput* output) {
-  if (input.word_data.size() > 1 &&
-      input.word_data[0].deescaped_word == L"ninja") {
-    // We do the equivalent of
-    //   ninja -t targets all | awk -F: "{print $1}"
-    // If there's a "-C something", we need to include that in the run of our
-    // ninja subprocess.
-    wstring command = L"ninja";
-    for (size_t i = 1; i < input.word_data.size() - 1; ++i) {
-      if (input.word_data[i].deescaped_word == L"-C") {
-        // If we're in the -C command though, we don't want to complete here at
-        // all, and instead get directory completion.
-        if (input.word_index == static_cast<int>(i) ||
-            input.word_index == static_cast<int>(i + 1)) {
-          return false;
-        }
-        command += L" -C " + input.word_data[i + 1].deescaped_word;
-        break;
+  // We do the equivalent of
+  //   ninja -t targets all | awk -F: "{print $1}"
+  // If there's a "-C something", we need to include that in the run of our
+  // ninja subprocess.
+  wstring command = L"ninja";
+  wstring build_dir;
+  for (size_t i = 1; i < input.word_data.size() - 1; ++i) {
+    if (input.word_data[i].deescaped_word == L"-C") {
+      // If we're in the -C command though, we don't want to complete here at
+      // all, and instead get directory completion.
+      if (input.word_index == static_cast<int>(i) ||
+          input.word_index == static_cast<int>(i + 1)) {
+        return false;
       }
+      build_dir = input.word_data[i + 1].deescaped_word;
+      command += L" -C " + build_dir;
+      break;
     }
-    // Note that this must go after the -C arg if any.
-    command += L" -t targets all";
-
-    SubprocessSet subprocs;
-    Subprocess* subproc = subprocs.Add(command);
-    while (!subproc->Done())
-      subprocs.DoWork();
-
-    if (subproc->Finish() == ExitSuccess) {
-      bool no_command = input.word_data.size() == 1;
-      const wstring prefix =
-          no_command ? L"" : input.word_data[input.word_index].deescaped_word;
-      for (const auto& line : StringSplit(subproc->GetOutput(), L'\n')) {
-        wstring target = StringSplit(line, L':')[0];
-        if (target.substr(0, prefix.size()) == prefix)
-          output->results.push_back(target);
-      }
+  }
+  // Note that this must go after the -C arg if any.
+  command += L" -t targets all";
+
+  // The targets only change when the build is regenerated, which rewrites
+  // build.ninja.
+  const wstring& prefix = input.word_data[input.word_index].deescaped_word;
+  build_dir = GetFullPath(build_dir);
+  wstring key = L"ninja targets\n" + build_dir;
+  vector<int64_t> validators(
+      1, GetModifiedTime(JoinPath(build_dir, L"build.ninja")));
+  if (!build_dir.empty()) {
+    CompletionCache::Candidates cached =
+        g_completion_cache->Find(key, validators);
+    if (cached) {
+      AddCompletions(*cached, prefix, input.fuzzy, output);
       return true;
     }
   }
+
+  lock_guard<mutex> lock(g_subprocess_mutex);
+  SubprocessSet subprocs;
+  Subprocess* subproc = subprocs.Add(command);
+  while (!subproc->Done()) {
+    // Going out of scope kills it.
+    if (output->IsCancelled())
+      return false;
+    subprocs.DoWork();
+  }
+
+  if (subproc->Finish() == ExitSuccess) {
+    vector<wstring> targets;
+    for (const auto& line : StringSplit(subproc->GetOutput(), L'\n'))
+      targets.push_back(StringSplit(line, L':')[0]);
+    CompletionCache::Candidates packed =
+        !build_dir.empty()
+            ? g_completion_cache->Store(key, validators, &targets)
+            : CompletionCache::Candidates(new PackedCandidates(targets));
+    AddCompletions(*packed, prefix, input.fuzzy, output);
+    return true;
+  }
   return false;
 }
 
 static bool EnvironmentVariableCompleter(const CompleterInput& input,
                                          CompleterOutput* output) {
-  if (input.word_data.size() > 1 &&
-      input.word_data[0].deescaped_word == L"set" && input.word_index == 1) {
+  if (input.word_index == 1) {
     const wchar_t* environment_block = ::GetEnvironmentStringsW();
     size_t i;
     for (i = 0; ; ++i)
@@ -564,14 +756,14 @@ static bool EnvironmentVariableCompleter(const CompleterInput& input,
         break;
     wstring full_block(environment_block, i + 1);
     vector<wstring> var_and_settings = StringSplit(full_block, L'\0');
-    const wstring& prefix = input.word_data[1].deescaped_word;
+    PackedCandidates variables;
     for (const auto& var_and_setting : var_and_settings) {
       wstring variable = StringSplit(var_and_setting, L'=')[0];
-      if (variable.empty())
-        continue;
-      if (_wcsnicmp(variable.c_str(), prefix.c_str(), prefix.size()) == 0)
-        output->results.push_back(variable);
+      if (!variable.empty())
+        variables.Add(variable);
     }
+    AddCompletions(
+        variables, input.word_data[1].deescaped_word, input.fuzzy, output);
     output->trailing_space = false;
     ::FreeEnvironmentStringsW(const_cast<wchar_t*>(environment_block));
     return true;
@@ -589,7 +781,13 @@ static const wchar_t* kCmdBuiltins[] = {
   L"title", L"type", L"ver", L"verify", L"vol",
 };
 
+// The commands in PATH, which are kept up to date in the background, and
+// saved so that new shells start with them.
+static RealFileSystem g_real_file_system;
+static PathIndexer* g_path_indexer;
+
 static void SearchPathByPrefix(const wstring& prefix,
+                               bool fuzzy,
                                CompleterOutput* output) {
   const wchar_t* path_var = _wgetenv(L"PATH");
   if (!path_var)
@@ -598,30 +796,21 @@ static void SearchPathByPrefix(const wstring& prefix,
   if (!path_ext_var)
     return;
   CHECK(wcschr(path_var, L'"') == NULL);
-  vector<wstring> paths = StringSplit(path_var, L';');
-  vector<wstring> pathexts = StringSplit(path_ext_var, L';');
-  for (const auto& builtin : kCmdBuiltins) {
-    wstring as_str(builtin);
-    if (as_str.substr(0, prefix.size()) == prefix)
-      output->results.push_back(as_str);  // Don't need quoting here.
-  }
-  for (const auto& path : paths) {
-    for (const auto& pathext : pathexts) {
-      WIN32_FIND_DATAW find_data;
-      HANDLE handle =
-          FindFirstFileW(JoinPath(path, L"*" + pathext).c_str(), &find_data);
-      if (handle != INVALID_HANDLE_VALUE) {
-        do {
-          wstring tmp = find_data.cFileName;
-          if (tmp.substr(0, prefix.size()) == prefix) {
-            // Strip pathext because it's ugly looking.
-            output->results.push_back(
-                tmp.substr(0, tmp.size() - pathext.size()));
-          }
-        } while (FindNextFileW(handle, &find_data));
-        FindClose(handle);
-      }
-    }
+  static const PackedCandidates builtins(kCmdBuiltins,
+                                         ARRAYSIZE(kCmdBuiltins));
+  // Don't need quoting here.
+  AddCompletions(builtins, prefix, fuzzy, output);
+  shared_ptr<const PathIndex> index =
+      g_path_indexer->Get(path_var, path_ext_var);
+  if (fuzzy && !prefix.empty()) {
+    AddFuzzyCompletions(
+        index->size(),
+        [&index](size_t i) { return WStringPiece(index->command(i)); },
+        prefix,
+        wstring(),
+        output);
+  } else {
+    index->Find(prefix, &output->results);
   }
 }
 
@@ -641,7 +830,7 @@ static bool CommandInPathCompleter(const CompleterInput& input,
   if (input.word_data.empty() || in_word_zero) {
     const wstring prefix =
         input.word_data.empty() ? L"" : input.word_data[0].deescaped_word;
-    SearchPathByPrefix(prefix, output);
+    SearchPathByPrefix(prefix, input.fuzzy, output);
     return !output->results.empty();
   }
   return false;
@@ -664,10 +853,43 @@ static wstring NormalizeSlashes(const wstring& path, bool command_is_git) {
   return result;
 }
 
+// How many files FindFiles() finds between publishing what it's found so far.
+const int kFilesPerPublish = 1000;
+
+// Directories FindFiles() has listed, so that completing in one again only
+// has to check that it hasn't changed.
+static DirectoryListingCache* g_directory_listings;
+// Enough for a few of the biggest build output directories.
+const size_t kMaxListedNames = 1000000;
+
+// Adds what |name| completes to in |listing| to |output|, as
+// DirectoryListing::Find() does, or fuzzy matched (see AddCompletions()).
+static void FindInListing(const DirectoryListing& listing,
+                          const wstring& name,
+                          bool dir_only,
+                          bool fuzzy,
+                          const wstring& prepend,
+                          CompleterOutput* output) {
+  if (!fuzzy || name.empty()) {
+    listing.Find(name, dir_only, prepend, &output->results);
+    return;
+  }
+  AddFuzzyCompletions(listing.size(),
+                      [&listing, dir_only](size_t i) {
+                        return dir_only && !listing.IsDirectory(i)
+                                   ? WStringPiece()
+                                   : listing.name(i);
+                      },
+                      name,
+                      prepend,
+                      output);
+}
+
 static void FindFiles(const wstring& prefix,
                       bool dir_only,
                       bool command_is_git,
-                      vector<wstring>* results) {
+                      bool fuzzy,
+                      CompleterOutput* output) {
   wchar_t drive[MAX_PATH];
   wchar_t dir[MAX_PATH];
   wchar_t file[MAX_PATH];
@@ -691,54 +913,165 @@ static void FindFiles(const wstring& prefix,
     prepend += dir;
   prepend = NormalizeSlashes(prepend, command_is_git);
 
+  // The whole directory is listed and cached, and looked up by the name
+  // that's been typed so far, unless that's a wildcard, which only
+  // FindFirstFileW() knows how to match.
+  const wstring name = wstring(file) + ext;
+  const wstring directory =
+      search_prefix.substr(0, search_prefix.size() - name.size());
+  bool use_cache = name.find_first_of(L"*?") == wstring::npos;
+  wstring full_directory;
+  int64_t modified = -1;
+  if (use_cache) {
+    full_directory = GetFullPath(directory);
+    // Before it's listed, so that anything that changes while it is makes it
+    // out of date.
+    modified = GetModifiedTime(full_directory);
+    use_cache = !full_directory.empty() && modified != -1;
+  }
+  if (use_cache) {
+    shared_ptr<const DirectoryListing> cached =
+        g_directory_listings->Find(full_directory, modified);
+    if (cached) {
+      FindInListing(*cached, name, dir_only, fuzzy, prepend, output);
+      return;
+    }
+  }
+
+  // Everything in it, for the listing, but only what matches is shown while
+  // it's still being listed (what it starts with, even when fuzzy matching,
+  // which has to wait for the rest to rank them).
+  vector<wstring> names;
+  vector<bool> is_directory;
+  size_t first = output->results.size();
   WIN32_FIND_DATAW find_data;
-  HANDLE handle = FindFirstFileW((search_prefix + L"*").c_str(), &find_data);
+  wstring pattern = (use_cache ? directory : search_prefix) + L"*";
+  HANDLE handle = FindFirstFileW(pattern.c_str(), &find_data);
   if (handle != INVALID_HANDLE_VALUE) {
+    int found = 0;
     do {
+      if (output->IsCancelled())
+        break;
       // We could keep these but generally they're not too useful.
       if (find_data.cFileName[0] == L'.' &&
           (find_data.cFileName[1] == 0 ||
            (find_data.cFileName[1] == L'.' && find_data.cFileName[2] == 0)))
         continue;
-      if (!dir_only || (dir_only && (find_data.dwFileAttributes &
-                                     FILE_ATTRIBUTE_DIRECTORY))) {
-        results->push_back(prepend + find_data.cFileName);
+      bool is_dir =
+          (find_data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+      if (use_cache) {
+        names.push_back(find_data.cFileName);
+        is_directory.push_back(is_dir);
+        if (_wcsnicmp(find_data.cFileName, name.c_str(), name.size()) != 0)
+          continue;
+      }
+      if (!dir_only || is_dir) {
+        output->results.push_back(prepend + find_data.cFileName);
+        if (++found % kFilesPerPublish == 0)
+          output->Publish();
       }
     } while (FindNextFileW(handle, &find_data));
     FindClose(handle);
   }
+  if (use_cache && !output->IsCancelled()) {
+    shared_ptr<const DirectoryListing> listing(
+        new DirectoryListing(names, is_directory));
+    g_directory_listings->Store(full_directory, modified, listing);
+    // In the listing's order, as they'll be next time.
+    output->results.resize(first);
+    FindInListing(*listing, name, dir_only, fuzzy, prepend, output);
+  }
 }
 
-static bool DirectoryCompleter(const CompleterInput& input,
-                               CompleterOutput* output) {
-  if (input.word_data.size() < 1)
-    return false;
-  const wstring& command = input.word_data[0].deescaped_word;
-  if (command == L"md" || command == L"rd" || command == L"cd" ||
-      command == L"mkdir" || command == L"rmdir" || command == L"chdir") {
-    bool in_word_one = input.word_index == 1;
-    if (input.word_data.size() == 1 || in_word_one) {
-      const wstring prefix =
-          input.word_data.size() == 1 ? L"" : input.word_data[1].deescaped_word;
-      FindFiles(prefix, true, false, &output->results);
-      output->trailing_space = false;
-      return !output->results.empty();
-    }
+static DirectoryDatabase* g_directory_database;
+
+// How many remembered directories are offered after the ones that match
+// what's been typed.
+const size_t kMaxRememberedDirectories = 20;
+
+// For cd, the directories that match are ordered by how often and recently
+// they've been visited, and followed by directories that have been visited
+// before that |prefix| is a fragment of, also by frecency.
+static void RankDirectories(const wstring& prefix, vector<wstring>* results) {
+  if (!g_directory_database)
+    return;
+  int64_t now = time(NULL);
+  char cur_path[_MAX_PATH];
+  string current;
+  if (GetCurrentDirectory(sizeof(cur_path), cur_path))
+    current = cur_path;
+  vector<pair<double, wstring>> scored;
+  for (const auto& result : *results) {
+    string path = ToNarrow(result);
+    if (path.size() < 2 || path[1] != ':')
+      path = JoinPath(current, path);
+    scored.push_back(
+        make_pair(g_directory_database->GetScore(path, now), result));
+  }
+  stable_sort(scored.begin(),
+              scored.end(),
+              [](const pair<double, wstring>& a,
+                 const pair<double, wstring>& b) {
+                return a.first > b.first;
+              });
+  results->clear();
+  for (const auto& result : scored)
+    results->push_back(result.second);
+
+  if (prefix.empty())
+    return;
+  vector<string> remembered;
+  g_directory_database->Find(vector<string>(1, ToNarrow(prefix)),
+                             now,
+                             kMaxRememberedDirectories,
+                             &remembered);
+  for (const auto& dir : remembered) {
+    wstring wide = ToWide(dir);
+    if (find(results->begin(), results->end(), wide) == results->end())
+      results->push_back(wide);
+  }
+}
+
+static bool CompleteDirectories(const CompleterInput& input,
+                                bool ranked,
+                                CompleterOutput* output) {
+  if (input.word_index == 1) {
+    const wstring& prefix = input.word_data[1].deescaped_word;
+    // Before any are published.
+    output->trailing_space = false;
+    FindFiles(prefix, true, false, input.fuzzy, output);
+    // Fuzzy matches are already ranked, by how well they match.
+    if (ranked && output->scores.empty())
+      RankDirectories(prefix, &output->results);
+    return !output->results.empty();
   }
   return false;
 }
 
+static bool DirectoryCompleter(const CompleterInput& input,
+                               CompleterOutput* output) {
+  return CompleteDirectories(input, false, output);
+}
+
+// For changing directory, where ones that have been visited are offered too.
+static bool RankedDirectoryCompleter(const CompleterInput& input,
+                                     CompleterOutput* output) {
+  return CompleteDirectories(input, true, output);
+}
+
 static bool FilenameCompleter(const CompleterInput& input,
                               CompleterOutput* output) {
   const wstring prefix = input.word_data.empty()
                              ? L""
                              : input.word_data[input.word_index].deescaped_word;
+  output->trailing_space = false;
   FindFiles(prefix,
             false,
             input.word_data.size() >= 1 &&
-                input.word_data[0].deescaped_word == L"git",
-            &output->results);
-  output->trailing_space = false;
+                _wcsicmp(input.word_data[0].deescaped_word.c_str(), L"git") ==
+                    0,
+            input.fuzzy,
+            output);
   return !output->results.empty();
 }
 
@@ -747,14 +1080,55 @@ static CommandHistory* g_command_history;
 
 static LineEditor* g_editor;
 static RealConsole g_real_console;
+// Completion runs on g_completion_pool, which signals g_completion_event
+// when there are new results for the editor to pick up. Neither is ever
+// destroyed, so that a slow completer that's been cancelled never has to be
+// waited for. Two threads, so that one of those doesn't hold up the next.
+static CompletionPool* g_completion_pool;
+static HANDLE g_completion_event;
+const int kCompletionThreads = 2;
+static RealCommandStatus g_real_command_status;
 
 static void (*g_original_exit)(int);
 
-// Write command history on shell exit. TODO: This needs to only be when the
-// shell was interactive.
+// How much history is kept when it isn't shared.
+const size_t kMaxSavedCommands = 1000;
+
+// Finish saving command history on shell exit. It's normally saved in the
+// background as it's entered, so that's only waiting for the last few
+// commands, but otherwise it's all written now. How long each command took is
+// only saved here. TODO: This needs to only be when the shell was
+// interactive.
 void ExitReplacement(int exit_code) {
   //printf("ExitReplacement stub, exit_code: %d\n", exit_code);
-  WriteHistoryFile(g_command_history->GetListForSaving());
+  if (g_command_history->is_shared()) {
+    if (!g_command_history->Flush())
+      Log("couldn't save history");
+  } else {
+    vector<wstring> commands =
+        g_command_history->GetListForSaving(kMaxSavedCommands);
+    // History is still backed by the file it was loaded from, mapped, which
+    // has to be let go of before it can be replaced.
+    g_command_history->Clear();
+    if (!WriteHistoryFile(GetHistoryFilename(), commands, kMaxSavedCommands))
+      Log("couldn't write history file");
+  }
+  if (!g_command_history->records()->Save(GetHistoryRecordsFilename(),
+                                          100000)) {
+    Log("couldn't write history records");
+  }
+  if (!g_directory_database->Save(GetDirectoryDatabaseFilename()))
+    Log("couldn't write directory database");
+  if (g_completion_cache) {
+    Log("completion cache: %d hits, %d misses",
+        g_completion_cache->hits(),
+        g_completion_cache->misses());
+  }
+  if (g_directory_listings) {
+    Log("directory listings: %d hits, %d misses",
+        g_directory_listings->hits(),
+        g_directory_listings->misses());
+  }
   g_original_exit(exit_code);
 }
 
@@ -792,16 +1166,44 @@ BOOL WINAPI ReadConsoleReplacement(HANDLE input,
     if (!g_directory_history) {
       RealWorkingDirectory* working_directory = new RealWorkingDirectory;
       g_directory_history = new DirectoryHistory(working_directory);
+      g_directory_history->set_database(g_directory_database);
     }
     if (!g_editor) {
       g_editor = new LineEditor;
-      g_editor->RegisterCompleter(NinjaTargetCompleter);
-      g_editor->RegisterCompleter(GitCommandNameCompleter);
-      g_editor->RegisterCompleter(GitCommandArgCompleter);
-      g_editor->RegisterCompleter(EnvironmentVariableCompleter);
-      g_editor->RegisterCompleter(CommandInPathCompleter);
-      g_editor->RegisterCompleter(DirectoryCompleter);
-      g_editor->RegisterCompleter(FilenameCompleter);
+      g_editor->set_command_status(&g_real_command_status);
+      CompleterRegistry* completers = g_editor->completers();
+      completers->RegisterForCommand(L"ninja", NinjaTargetCompleter);
+      completers->RegisterForCommand(L"git", GitCommandNameCompleter);
+      completers->RegisterForCommand(L"git", GitCommandArgCompleter);
+      completers->RegisterForCommand(L"set", EnvironmentVariableCompleter);
+      const wchar_t* kDirectoryCommands[] = {
+        L"md", L"mkdir", L"rd", L"rmdir",
+      };
+      for (const auto& command : kDirectoryCommands)
+        completers->RegisterForCommand(command, DirectoryCompleter);
+      const wchar_t* kChangeDirectoryCommands[] = {
+        L"cd", L"chdir", L"pushd",
+      };
+      for (const auto& command : kChangeDirectoryCommands)
+        completers->RegisterForCommand(command, RankedDirectoryCompleter);
+      completers->RegisterForWord(0, CommandInPathCompleter);
+      completers->RegisterFallback(FilenameCompleter);
+      // cmd runs either, so offer both.
+      completers->MergeResultsForWord(0);
+      if (!g_completion_pool) {
+        g_completion_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        PCHECK(g_completion_event);
+        g_completion_pool = new CompletionPool(
+            kCompletionThreads, [] { SetEvent(g_completion_event); });
+        g_completion_cache = new CompletionCache(kMaxCachedCandidates);
+        g_directory_listings =
+            new DirectoryListingCache(&g_real_file_system, kMaxListedNames);
+      }
+      g_editor->set_completion_pool(g_completion_pool);
+      if (const char* budget = getenv("CMDEX_COMPLETIONBUDGET"))
+        g_editor->set_completion_budget_ms(atoi(budget));
+      g_editor->set_fuzzy_completion(getenv("CMDEX_FUZZYCOMPLETION") != NULL);
+      g_editor->set_completion_menu(getenv("CMDEX_NOCOMPLETIONMENU") == NULL);
     }
     g_real_console.SetConsole(conout);
     g_editor->Init(&g_real_console, g_directory_history, g_command_history);
@@ -813,6 +1215,14 @@ BOOL WINAPI ReadConsoleReplacement(HANDLE input,
         g_editor = NULL;
         goto done;
       }
+      // Results from the completion pool are picked up between keys.
+      HANDLE handles[] = {input, g_completion_event};
+      DWORD signalled = WaitForMultipleObjects(
+          ARRAYSIZE(handles), handles, FALSE, INFINITE);
+      if (signalled == WAIT_OBJECT_0 + 1) {
+        g_editor->UpdateCompletion();
+        continue;
+      }
       BOOL ret = ReadConsoleInput(input, &input_record, 1, &num_read);
       if (!ret) {
         delete g_editor;
@@ -1195,7 +1605,29 @@ void OnAttach(HMODULE self) {
 
   CHECK(!g_command_history);
   g_command_history = new CommandHistory;
-  g_command_history->Populate(ReadHistoryFile());
+  g_command_history->set_deduplicate(getenv("CMDEX_DEDUPHISTORY") != NULL);
+  unique_ptr<HistoryJournal> journal(new HistoryJournal);
+  // Each has its own, as the journal's is used on HistoryWriter's thread.
+  journal->set_archive(OpenHistoryArchive());
+  g_command_history->set_archive(OpenHistoryArchive());
+  if (!journal->Open(GetHistoryJournalFilename(), GetHistoryFilename()) ||
+      !g_command_history->Populate(move(journal))) {
+    Log("couldn't open history journal, history won't be shared");
+    unique_ptr<HistoryFile> history_file(new HistoryFile);
+    if (history_file->Open(GetHistoryFilename()))
+      g_command_history->Populate(move(history_file));
+    else
+      Log("couldn't read history file");
+  }
+  if (!g_command_history->records()->Load(GetHistoryRecordsFilename()))
+    Log("couldn't read history records");
+  g_directory_database = new DirectoryDatabase;
+  if (!g_directory_database->Load(GetDirectoryDatabaseFilename()))
+    Log("couldn't read directory database");
+  g_path_indexer =
+      new PathIndexer(&g_real_file_system, GetPathIndexFilename());
+  if (!g_path_indexer->Load())
+    Log("couldn't read path index");
 
   // Trap in GetDriveTypeW (this guards the call to WNetGetConnectionW we want
   // to override). When it's next called and it matches the callsite we want,